@@ -10,6 +10,17 @@
 #include "freertos/FreeRTOS.h"
 #include "freertos/semphr.h"
 
+/*
+ * Text and images do not change once they are added, they are drawn together
+ * with the background into a static layer that is only redrawn when the render
+ * list, the background or the font changes. Scrolling text and animations are
+ * drawn over it every frame, before that only their areas are restored from the
+ * static layer. Text or an image that overlaps a scrolling text or animation
+ * earlier in the list is drawn every frame as well, to keep it on top.
+ *
+ * When nothing is animated nothing is drawn at all, so the display driver sees
+ * an unchanged buffer. While the compositor is enabled it owns the buffer.
+ */
 
 #define C_SM 0xFFFFFFFF
 
@@ -31,6 +42,12 @@ Color *buffer;
 renderTask_t *head = NULL;
 SemaphoreHandle_t node_lock = NULL;
 
+static Color *target;              // Buffer that is drawn to, the display buffer or the static layer
+static Color *layer = NULL;        // Background and static nodes
+static Color *composited = NULL;   // Display buffer that holds a copy of the static layer
+static volatile uint32_t changes = 1; // Counts changes to the render list, background and font
+static uint32_t layer_changes = 0; // Value of changes when the static layer was drawn
+
 #define N_FONTS 2
 int font_index = 0;
 void (*font_render_char[])(uint8_t charId, Color color, int *x, int y, int endX, int *skip) = {&renderChar_7x5, &renderChar_6x3};
@@ -82,6 +99,7 @@ void compositor_clear() {
       node = next;
     }
     head = NULL;
+    changes++;
     xSemaphoreGive(node_lock);
   }
 }
@@ -91,9 +109,12 @@ void compositor_clear() {
 */
 void compositor_setBackground(Color color) {
         background = color;
+        changes++;
 }
 
 void addTask(renderTask_t *node) {
+        node->dynamic = false;
+        xSemaphoreTake(node_lock, portMAX_DELAY);
         if(head == NULL) {
                 head = node;
         } else {
@@ -101,6 +122,8 @@ void addTask(renderTask_t *node) {
                 while(pos->next != NULL) pos = pos->next;
                 pos->next = node;
         }
+        changes++;
+        xSemaphoreGive(node_lock);
 }
 
 void compositor_addText(char *text, Color color, int x, int y) {
@@ -129,6 +152,7 @@ void compositor_addScrollText(char *text, Color color, int x, int y, int sizeX)
 	strcpy(text_store, text);
 	scrollText_t *scroll = (scrollText_t *) malloc(sizeof(scrollText_t));
 	scroll->text = text_store;
+	scroll->length = strlen(text_store);
 	scroll->speed = 1;
 	scroll->skip = -10;
 	scroll->firstshow = true;
@@ -187,12 +211,13 @@ void compositor_addAnimation(uint8_t *image, int x, int y, int width, int length
 }
 
 void compositor_setPixel(int x, int y, Color color) {
-	if (!buffer) return;
-	Color *target = &buffer[y*CONFIG_HUB75_WIDTH+x];
-        double alpha = color.RGB[0]/255;
-	target->RGB[1] = (uint8_t)(alpha*color.RGB[1] + (1-alpha)*target->RGB[1]);
-	target->RGB[2] = (uint8_t)(alpha*color.RGB[2] + (1-alpha)*target->RGB[2]);
-	target->RGB[3] = (uint8_t)(alpha*color.RGB[3] + (1-alpha)*target->RGB[3]);
+	if (!target || x < 0 || x >= CONFIG_HUB75_WIDTH || y < 0 || y >= CONFIG_HUB75_HEIGHT) return;
+	//Only opaque pixels are drawn, the alpha channel does not blend
+	if (color.RGB[0] != 255) return;
+	Color *pixel = &target[y*CONFIG_HUB75_WIDTH+x];
+	pixel->RGB[1] = color.RGB[1];
+	pixel->RGB[2] = color.RGB[2];
+	pixel->RGB[3] = color.RGB[3];
 }
 
 void renderImage(uint8_t *image, int x, int y, int sizeX, int sizeY) {
@@ -228,7 +253,7 @@ void renderText(char *text, Color color, int x, int y, int sizeX, int skip, bool
 	// - 0xc2 0xa0-0xbf (first latin block without control chars)
 	// - 0xc3 0x80-0xbf (second latin block)
 	// See: https://en.wikipedia.org/wiki/UTF-8
-	for(int i = 0; i<strlen(text); i++) {
+	for(int i = 0; text[i]; i++) {
 		uint8_t c = (uint8_t)text[i];
 		uint8_t charId = 0; // default to space
 		if (c & 0x80) {
@@ -255,25 +280,29 @@ void renderText(char *text, Color color, int x, int y, int sizeX, int skip, bool
 
 unsigned int compositor_getTextWidth(char *text) {
 	int width = 0;
+	int length = strlen(text);
 
-	for(int i = 0; i<strlen(text); i++) {
+	for(int i = 0; i<length; i++) {
 		uint8_t charId = (uint8_t)text[i] - 32;
 		width += (*font_char_width[font_index])(charId);
 	}
-	if (strlen(text) > 1)
-		width += strlen(text);
+	if (length > 1)
+		width += length;
 	return width;
 }
 
 void compositor_setFont(int index) {
 	if(index < 0 || index >= N_FONTS) return;
 	font_index = index;
+	changes++;
 }
 
 
 void display_crash() {
 	enabled = false;
 	if (!buffer) return;
+	target = buffer;
+	composited = NULL;
 	Color blue;
 	blue.value = 0x1070AA00;
 	Color white;
@@ -287,41 +316,115 @@ void display_crash() {
 	renderText("FML", white, 0, 0, -1, 0, false);     
 }
 
+/*
+* Returns the area a node can draw to, clipped to the display. Returns false if it is not visible
+*/
+static bool getBounds(renderTask_t *node, int *x0, int *y0, int *x1, int *y1) {
+	*x0 = node->x;
+	*y0 = node->y;
+	if(node->id == 0 || node->id == 2) {
+		//Text can continue up to the edge of the display, each character is 8 pixels high
+		*x1 = CONFIG_HUB75_WIDTH;
+		*y1 = node->y + 8;
+	} else {
+		*x1 = node->x + node->sizeX;
+		*y1 = node->y + node->sizeY;
+	}
+	if(*x0 < 0) *x0 = 0;
+	if(*y0 < 0) *y0 = 0;
+	if(*x1 > CONFIG_HUB75_WIDTH) *x1 = CONFIG_HUB75_WIDTH;
+	if(*y1 > CONFIG_HUB75_HEIGHT) *y1 = CONFIG_HUB75_HEIGHT;
+	return *x0 < *x1 && *y0 < *y1;
+}
+
+static bool overlaps(renderTask_t *a, renderTask_t *b) {
+	int ax0, ay0, ax1, ay1, bx0, by0, bx1, by1;
+	if(!getBounds(a, &ax0, &ay0, &ax1, &ay1) || !getBounds(b, &bx0, &by0, &bx1, &by1)) return false;
+	return ax0 < bx1 && bx0 < ax1 && ay0 < by1 && by0 < ay1;
+}
+
+static void renderNode(renderTask_t *node) {
+	if(node->id == 0) { //Render text
+		renderText((char *)node->payload, node->color, node->x, node->y, -1, 0, false);
+	} else if(node->id == 1) {  //Render image
+		renderImage((uint8_t *)node->payload, node->x, node->y, node->sizeX, node->sizeY);
+	} else if(node->id == 2) {  //Render scrolling text
+		scrollText_t *scroll = (scrollText_t *) node->payload;
+		renderText(scroll->text, node->color, node->x, node->y, node->sizeX, scroll->skip, scroll->firstshow);
+		scroll->skip++;
+		if(scroll->skip == scroll->length*6+6)
+		{
+			scroll->skip = -node->sizeX;
+			scroll->firstshow = false;
+		}
+	} else if(node->id == 3) {//Render animation
+		animation_t *gif = (animation_t *) node->payload;
+		int index = node->sizeX*node->sizeY*4*gif->showFrame;
+		renderImage(&(gif->gif[index]), node->x, node->y, node->sizeX, node->sizeY);
+		gif->showFrame++;
+		if(gif->showFrame == gif->numberFrames) gif->showFrame = 0;
+	}
+}
+
+/*
+* Draws the background and the static nodes into the static layer. Returns false if there is no memory for it
+*/
+static bool renderLayer() {
+	if(!layer) layer = malloc(CONFIG_HUB75_WIDTH*CONFIG_HUB75_HEIGHT*sizeof(Color));
+	if(!layer) return false;
+	layer_changes = changes;
+	for(int i=0; i<CONFIG_HUB75_WIDTH*CONFIG_HUB75_HEIGHT; i++) layer[i] = background;
+	target = layer;
+	for(renderTask_t *node = head; node != NULL; node = node->next) {
+		node->dynamic = node->id == 2 || node->id == 3;
+		for(renderTask_t *below = head; below != node && !node->dynamic; below = below->next) {
+			if(below->dynamic && overlaps(below, node)) node->dynamic = true;
+		}
+		if(!node->dynamic) renderNode(node);
+	}
+	return true;
+}
+
+/*
+* Copies the area of a node from the static layer to the display buffer
+*/
+static void restoreNode(renderTask_t *node, Color *display) {
+	int x0, y0, x1, y1;
+	if(!getBounds(node, &x0, &y0, &x1, &y1)) return;
+	for(int y=y0; y<y1; y++) {
+		memcpy(&display[y*CONFIG_HUB75_WIDTH+x0], &layer[y*CONFIG_HUB75_WIDTH+x0], (x1-x0)*sizeof(Color));
+	}
+}
+
 void composite() {
-	if (!buffer) return;
+	Color *display = buffer;
+	if (!display) return;
 
         if(xSemaphoreTake(node_lock, ( TickType_t ) 10 / portTICK_PERIOD_MS) != pdTRUE) {
           return;
         }
-	//Setting the background color
-	for(int x=0; x<CONFIG_HUB75_WIDTH; x++) {
-			for(int y=0; y<CONFIG_HUB75_HEIGHT; y++) {
-					buffer[y*CONFIG_HUB75_WIDTH+x] = background;
-			}
+	if(!layer || layer_changes != changes) {
+		if(!renderLayer()) {
+			//Without memory for the static layer everything is drawn every frame
+			for(int i=0; i<CONFIG_HUB75_WIDTH*CONFIG_HUB75_HEIGHT; i++) display[i] = background;
+			target = display;
+			for(renderTask_t *node = head; node != NULL; node = node->next) renderNode(node);
+			xSemaphoreGive(node_lock);
+			return;
+		}
+		composited = NULL;
 	}
-	renderTask_t *node = head;
-	while(node != NULL) {
-		if(node->id == 0) { //Render text
-			renderText((char *)node->payload, node->color, node->x, node->y, -1, 0, false);
-		} else if(node->id == 1) {  //Render image
-			renderImage((uint8_t *)node->payload, node->x, node->y, node->sizeX, node->sizeY);
-		} else if(node->id == 2) {  //Render scrolling text
-			scrollText_t *scroll = (scrollText_t *) node->payload;
-			renderText(scroll->text, node->color, node->x, node->y, node->sizeX, scroll->skip, scroll->firstshow);
-			scroll->skip++;
-			if(scroll->skip == strlen(scroll->text)*6+6) 
-			{
-				scroll->skip = -node->sizeX;
-				scroll->firstshow = false;
-			}
-		} else if(node->id == 3) {//Render animation
-			animation_t *gif = (animation_t *) node->payload;
-			int index = node->sizeX*node->sizeY*4*gif->showFrame;
-			renderImage(&(gif->gif[index]), node->x, node->y, node->sizeX, node->sizeY);
-			gif->showFrame++;
-			if(gif->showFrame == gif->numberFrames) gif->showFrame = 0;
+	if(composited != display) {
+		memcpy(display, layer, CONFIG_HUB75_WIDTH*CONFIG_HUB75_HEIGHT*sizeof(Color));
+		composited = display;
+	} else {
+		for(renderTask_t *node = head; node != NULL; node = node->next) {
+			if(node->dynamic) restoreNode(node, display);
 		}
-		node = node->next;
+	}
+	target = display;
+	for(renderTask_t *node = head; node != NULL; node = node->next) {
+		if(node->dynamic) renderNode(node);
 	}
         xSemaphoreGive(node_lock);
 }
@@ -331,6 +434,7 @@ void compositor_setBuffer(Color* framebuffer) {
 }
 
 void compositor_enable() {
+	composited = NULL; //The buffer may have been drawn to while the compositor was disabled
 	enabled = true;
 }
 
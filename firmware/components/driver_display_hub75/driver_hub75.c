@@ -27,6 +27,11 @@
 
 int brightness=CONFIG_HUB75_DEFAULT_BRIGHTNESS;
 int framerate=20;
+#ifdef CONFIG_HUB75_DITHER_BRIGHTNESS
+int dither_brightness=CONFIG_HUB75_DITHER_BRIGHTNESS;
+#else
+int dither_brightness=-1;
+#endif
 Color *hub75_framebuffer = NULL;
 
 bool driver_hub75_active; // Stops all compositing + DMA buffer updating
@@ -44,7 +49,7 @@ void displayTask(void *pvParameter)
 
 	while(driver_hub75_active) {
             if(compositor_status()) composite();
-            uint32_t total_intensity = driver_hub75_render(brightness, hub75_framebuffer);
+            uint32_t total_intensity = driver_hub75_render(brightness, brightness <= dither_brightness, hub75_framebuffer);
             vTaskDelayUntil( &xLastWakeTime, 1.0 / framerate * 1000 / portTICK_PERIOD_MS );
 	}
 	vTaskDelete( NULL );
@@ -67,7 +72,8 @@ esp_err_t driver_hub75_init(void)
 	hub75_framebuffer = calloc(HUB75_BUFFER_SIZE, sizeof(uint8_t));
 	#endif
 
-	driver_hub75_init_bits();
+	esp_err_t res = driver_hub75_init_bits();
+	if (res != ESP_OK) return res;
 
 	compositor_init();
 	#ifndef CONFIG_DRIVER_FRAMEBUFFER_ENABLE
@@ -101,6 +107,11 @@ void driver_hub75_set_framerate(int framerate_val)
 	framerate = min(max(1, framerate_val), 30);
 }
 
+void driver_hub75_set_dither(int brightness_val)
+{
+	dither_brightness = min(brightness_val, 65535);
+}
+
 void driver_hub75_switch_buffer(uint8_t* buffer)
 {
 	hub75_framebuffer = (Color*) buffer;
@@ -1,12 +1,42 @@
 /* TEST:
  * gcc -o driver_hub75_bits driver_hub75_bits.c val2pwm.c -Wall -DDRIVER_HUB75_DMA_DATA_TEST -g
  *
+ * Other geometries are tested by defining them, for example four chained 64x32 1/16 scan panels at 8 bits:
+ * gcc -o driver_hub75_bits driver_hub75_bits.c val2pwm.c -Wall -DDRIVER_HUB75_DMA_DATA_TEST -g \
+ *     -DCONFIG_HUB75_WIDTH=256 -DCONFIG_HUB75_HEIGHT=32 -DCONFIG_HUB75_SCAN=16 -DCONFIG_HUB75_BIT_DEPTH=8
+ *
+ * The test dithers with 2 bits and prints the intensity error it leaves, -DCONFIG_HUB75_DITHER_BITS=0 turns it off.
  */
 
+#ifdef DRIVER_HUB75_DMA_DATA_TEST
+#define CONFIG_DRIVER_HUB75_ENABLE
+#ifndef CONFIG_HUB75_WIDTH
+#define CONFIG_HUB75_WIDTH 32
+#endif
+#ifndef CONFIG_HUB75_HEIGHT
+#define CONFIG_HUB75_HEIGHT 8
+#endif
+#ifndef CONFIG_HUB75_SCAN
+#define CONFIG_HUB75_SCAN 8
+#endif
+#ifndef CONFIG_HUB75_BIT_DEPTH
+#define CONFIG_HUB75_BIT_DEPTH 12
+#endif
+#ifndef CONFIG_HUB75_CLOCK_SPEED
+#define CONFIG_HUB75_CLOCK_SPEED 2000000
+#endif
+#ifndef CONFIG_HUB75_DITHER_BITS
+#define CONFIG_HUB75_DITHER_BITS 2
+#endif
+#else
+#include <sdkconfig.h>
+#endif
+
 #include <assert.h>
 #include <unistd.h>
 #include <stdint.h>
 #include <stddef.h>
+#include <stdbool.h>
 #include <string.h>
 
 #include "include/val2pwm.h"
@@ -15,152 +45,219 @@
 
 
 #ifdef DRIVER_HUB75_DMA_DATA_TEST
-#define CONFIG_DRIVER_HUB75_ENABLE
-#define CONFIG_HUB75_WIDTH 32
 #define MALLOC_CAP_DMA (-1)
 #include <stdlib.h>
 #include <stdio.h>
-void *heap_caps_calloc(size_t nmemb, size_t size, int cap) { return calloc(nmemb, size); }
-void i2sparallel_init(i2s_parallel_buffer_desc_t *bufa, i2s_parallel_buffer_desc_t *bufb) { }
-void i2sparallel_flipBuffer(int bufid) { }
+#include <time.h>
+#define ESP_LOGI(tag, format, ...) printf(format "\n", ##__VA_ARGS__)
+#define ESP_LOGW ESP_LOGI
+#define ESP_LOGE ESP_LOGI
+void *heap_caps_calloc(size_t nmemb, size_t size, int cap) { (void) cap; return calloc(nmemb, size); }
+void i2sparallel_init(i2s_parallel_buffer_desc_t *bufa, i2s_parallel_buffer_desc_t *bufb) { (void) bufa; (void) bufb; }
+void i2sparallel_flipBuffer(int bufid) { (void) bufid; }
+void i2sparallel_alternateBuffers(void) { }
 #else
 #include "esp_heap_caps.h"
+#include "esp_log.h"
 #endif
 
 #ifdef CONFIG_DRIVER_HUB75_ENABLE
 
+#define TAG "hub75-bits"
+
+#define N_ROWS CONFIG_HUB75_SCAN         /* row addresses, each shows HUB75_HALVES rows */
+#define N_COLUMNS CONFIG_HUB75_WIDTH     /* of all chained panels together */
+#define BIT_DEPTH CONFIG_HUB75_BIT_DEPTH
+#define DITHER_BITS CONFIG_HUB75_DITHER_BITS
+
+#if HUB75_SAMPLE_BITS == 8
+
+typedef uint8_t sample_t;
+
 #define BIT_RED   (1<<0)   //connected to GPIO2 here
 #define BIT_GREEN (1<<1)   //connected to GPIO15 here
 #define BIT_BLUE  (1<<2)   //connected to GPIO4 here
-#define MASK_RGB (BIT_RED|BIT_GREEN|BIT_BLUE)
-
-#define BIT_A (1<<3)    //connected to GPIO5 here
-#define BIT_B (1<<4)    //connected to GPIO18 here
-#define BIT_C (1<<5)   //connected to GPIO19 here
-
+#define SHIFT_ADDR (3)     //A, B and C, connected to GPIO5, GPIO18 and GPIO19 here
 #define BIT_LATCH (1<<6) //connected to GPIO26 here
 #define BIT_NOT_OUTPUT_ENABLE (1<<7)  //connected to GPIO25 here
 
-#define N_ROWS (8)
-#define N_COLUMNS (32)
-
-#define BIT_DEPTH (12)
-
 // data is written out as upside-down middle-endian
 #define DMA_ORDER(x) ((x)^2)
 
-/* BCM* modulation */
-
-/*
-	bits15_to_12, bit11, bit4_1x1, * for each row *
-	bits15_to_12, bit10, bit6_1x4, * ...          *
-	bits15_to_12, bit11, on_1x32   *              *
-	bits15_to_12, bit9_1x32, bit7_1x8,
-
-	bits15_to_12, bit11, on_1x32, 
-	bits15_to_12, bit10, bit5_1x2,
-	bits15_to_12, bit11, on_1x32,
-	bits15_to_12, bit8_1x16, 
-*/
-
-/* BCM dithering data pointed to by DMS descriptors
- * bitXX[W] fields contain screen data so they need to be unique
- * try to pack them such that we don't need many dma descriptors
- * off_prev_row[W] contains address line data for the previously displayed row
- * in order to prevent ghosting.
- * off_prev_row & bit15 have not output enable
+#else
+
+typedef uint16_t sample_t;
+
+#define BIT_RED   (1<<0)
+#define BIT_GREEN (1<<1)
+#define BIT_BLUE  (1<<2)
+#define SHIFT_LOWER_HALF (3) //R2, G2 and B2 for the rows below N_ROWS
+#define SHIFT_ADDR (6)       //A to E
+#define BIT_LATCH (1<<11)
+#define BIT_NOT_OUTPUT_ENABLE (1<<12)
+
+// halfwords are written out swapped
+#define DMA_ORDER(x) ((x)^1)
+
+#endif
+
+#if HUB75_HALVES == 2
+#define MASK_RGB ((BIT_RED|BIT_GREEN|BIT_BLUE) * (1 + (1<<SHIFT_LOWER_HALF)))
+#elif HUB75_HALVES == 1
+#define MASK_RGB (BIT_RED|BIT_GREEN|BIT_BLUE)
+#else
+#error "the panel height has to be once or twice the number of row addresses"
+#endif
+
+#if N_ROWS > 32 || (HUB75_SAMPLE_BITS == 8 && N_ROWS > 8)
+#error "not enough address lines for this number of rows"
+#endif
+#if N_COLUMNS % 4 || N_COLUMNS < 8
+#error "the number of columns has to be a multiple of 4"
+#endif
+#if BIT_DEPTH < 1 || BIT_DEPTH > 12
+#error "the bit depth has to be between 1 and 12"
+#endif
+#if DITHER_BITS < 0 || DITHER_BITS > 3
+#error "dithering adds 0 to 3 bits"
+#endif
+
+/* BCM* modulation
+ *
+ * Bitplane j of a row is shown for lsb_time * 2^j clocks per frame. The frame
+ * shows every row subframes times, the bitplanes that are long enough ("split"
+ * planes) are shown in every subframe for a share of their time, the short ones
+ * are shown in one subframe each. A subframe of a row looks like this:
+ *
+ *	off_prev_row, off_cur_row,
+ *	bitplane (msb), on time, bitplane (msb-1), on time, ... bitplane (last split),
+ *	    on time, [extension | bitplane (short), on time, ...]
+ *
+ * While a bitplane is shifted in, the one latched before it stays on for up to
+ * N_COLUMNS-4 clocks, so long bitplanes hide the time it takes to shift. The
+ * first bitplane of a row is shifted in with the output off, off_prev_row keeps
+ * the address of the row before to prevent ghosting.
+ *
+ * All of this lives in the data of a row, only on times that are longer than
+ * ON_BLOCK repeat a block that is shared by both frames instead of taking up
+ * memory in the frame. The time of the least significant bit and the number of
+ * subframes follow from the geometry: the most significant bitplane has to be
+ * long enough to hide shifting in a row four times over in every subframe.
  */
 
-#define ON_TIME_SLOT (N_COLUMNS)         /* must be multiple of 4 */
-#define OFF_PREV_TIME_SLOT (1*N_COLUMNS)        /* must be multiple of 4 */
-#define OFF_CUR_TIME_SLOT (1*N_COLUMNS)        /* must be multiple of 4 */
-#define BITBANG_SLOT (N_COLUMNS)         /* must be multiple of 4 */
-#define BITBANG_ON_TIME (BITBANG_SLOT-4)
-#define PADD4(x) ( (x+3) & ~3 )
-
-#define ON_TIME_BIT15  (8*ON_TIME_SLOT-BITBANG_ON_TIME)
-#define ON_TIME_BIT14  (4*ON_TIME_SLOT-BITBANG_ON_TIME)
-#define ON_TIME_BIT13  (2*ON_TIME_SLOT-BITBANG_ON_TIME)
-#define ON_TIME_BIT12  (1*ON_TIME_SLOT-BITBANG_ON_TIME)
-#define ON_TIME_BIT11  (1*ON_TIME_SLOT)
-#define ON_TIME_BIT11B (1*ON_TIME_SLOT-BITBANG_ON_TIME)
-#define ON_TIME_BIT10  (1*ON_TIME_SLOT-BITBANG_ON_TIME)
-#define ON_TIME_BIT9   (1*ON_TIME_SLOT-BITBANG_ON_TIME)
-#define ON_TIME_BIT8   (ON_TIME_SLOT/2)
-#define ON_TIME_BIT7   (ON_TIME_SLOT/4)
-#define ON_TIME_BIT6   (ON_TIME_SLOT/8)
-#define ON_TIME_BIT5   (ON_TIME_SLOT/16)
-#define ON_TIME_BIT4   (ON_TIME_SLOT/32)
-
-typedef struct __attribute__((packed))
-{
-	/* common part: */
-	uint8_t off_prev_row[PADD4(OFF_PREV_TIME_SLOT)];
-	uint8_t off_cur_row[PADD4(OFF_CUR_TIME_SLOT)];
-	uint8_t bit15[BITBANG_SLOT];
-	uint8_t on_time_bit15[PADD4(ON_TIME_BIT15)];
-	uint8_t bit14[BITBANG_SLOT];
-	uint8_t on_time_bit14[PADD4(ON_TIME_BIT14)];
-	uint8_t bit13[BITBANG_SLOT];
-	uint8_t on_time_bit13[PADD4(ON_TIME_BIT13)];
-	uint8_t bit12[BITBANG_SLOT];
-	uint8_t on_time_bit12[PADD4(ON_TIME_BIT12)];
-	/* line 0 & 2 & 4 & 6 */
-	uint8_t bit11[BITBANG_SLOT];
-	/* line 2 & 4 & 6 */
-	uint8_t on_time_bit11[PADD4(ON_TIME_BIT11)];
-	/* line 0 */
-	uint8_t on_time_bit11b[PADD4(ON_TIME_BIT11B)];
-	uint8_t bit4[BITBANG_SLOT];
-	uint8_t on_time_bit4[PADD4(ON_TIME_BIT4)];
-	/* line 1 & 5 */
-	uint8_t bit10[BITBANG_SLOT];
-	uint8_t on_time_bit10[PADD4(ON_TIME_BIT10)];
-	/* line 1 */
-	uint8_t bit6[BITBANG_SLOT];
-	uint8_t on_time_bit6[PADD4(ON_TIME_BIT6)];
-	/* line 3 */
-	uint8_t bit9[BITBANG_SLOT];
-	uint8_t on_time_bit9[PADD4(ON_TIME_BIT9)];
-	uint8_t bit7[BITBANG_SLOT];
-	uint8_t on_time_bit7[PADD4(ON_TIME_BIT7)];
-	/* line 5 */
-	uint8_t bit5[BITBANG_SLOT];
-	uint8_t on_time_bit5[PADD4(ON_TIME_BIT5)];
-	/* line 7 */
-	uint8_t bit8[BITBANG_SLOT];
-	uint8_t on_time_bit8[PADD4(ON_TIME_BIT8)];
-
-} row_data_t;
+#define OFF_PREV_TIME_SLOT (32)        /* must be multiple of 4 */
+#define OFF_CUR_TIME_SLOT (32)         /* must be multiple of 4 */
+#define BITBANG_ON_TIME (N_COLUMNS-4)
+#define ON_BLOCK (128)                 /* must be multiple of 4 */
+#define MAX_SUBFRAMES (8)
+#define PADD4(x) ( ((x)+3) & ~3 )
 
 typedef struct
 {
-	row_data_t rows[N_ROWS];
-	uint8_t *bits[N_ROWS][BIT_DEPTH];
+	int lsb_time;                  /* clocks bitplane 0 is shown per frame */
+	int subframes;                 /* times every row is shown per frame */
+	int n_split;                   /* bitplanes from the top that are shown in every subframe */
+	int time[BIT_DEPTH];           /* clocks a bitplane is shown in every subframe it is in */
+	int subframe[BIT_DEPTH];       /* subframe the bitplanes below the split ones are shown in */
+	int shifting_on[BIT_DEPTH];    /* clocks the split bitplane before stays on while shifting in a split bitplane */
+	int on_time[BIT_DEPTH];        /* clocks a bitplane is on after it was latched, ... */
+	int on_blocks[BIT_DEPTH];      /* ... in ON_BLOCKs ... */
+	int on_inline[BIT_DEPTH];      /* ... and in the data of the row, padded to a multiple of 4 */
+	int off_bits[BIT_DEPTH];       /* offsets in samples in the data of a row */
+	int off_on[BIT_DEPTH];
+	int off_extension;             /* on time of the last split bitplane when there is no short one after it */
+	int extension;
+	int row_size;                  /* samples of data per row */
+} layout_t;
 
+typedef struct
+{
+	sample_t *data;
+	sample_t *bits[N_ROWS][BIT_DEPTH];
 } frame_t;
 
-
+static layout_t layout;
+static int n_frames;
 static int cur_frame = 0;
 static frame_t *frames[2];
+static sample_t *on_blocks;    /* ON_BLOCK samples with the output on, for every row */
 
 static int row_bits(int row)
 {
-#if N_ROWS == 8
+	return row << SHIFT_ADDR;
+}
 
-	int addr = 0;
-	if (row&1) addr |= BIT_A;
-	if (row&2) addr |= BIT_B;
-	if (row&4) addr |= BIT_C;
-	return addr;
+static void init_layout(layout_t *l)
+{
+	int j, s;
+	memset(l, 0, sizeof(layout_t));
+
+	l->lsb_time = 1;
+	while ((l->lsb_time << (BIT_DEPTH-1)) < 4*N_COLUMNS)
+		l->lsb_time *= 2;
+	l->subframes = 1;
+	while (l->subframes < MAX_SUBFRAMES && (l->lsb_time << (BIT_DEPTH-1)) >= 8*N_COLUMNS*l->subframes)
+		l->subframes *= 2;
+
+	/* shares of split bitplanes are a multiple of 4 clocks, so they need no padding */
+	int load[MAX_SUBFRAMES] = { 0 };
+	for (j=BIT_DEPTH-1; j>=0; j--)
+	{
+		int time = l->lsb_time << j;
+		if (time >= 4*l->subframes && l->n_split == BIT_DEPTH-1-j)
+		{
+			l->n_split++;
+			l->time[j] = time / l->subframes;
+			continue;
+		}
+		int least = 0;
+		for (s=1; s<l->subframes; s++)
+			if (load[s] < load[least])
+				least = s;
+		load[least] += time;
+		l->time[j] = time;
+		l->subframe[j] = least;
+	}
 
-#else
-#error "row bits needs to be updated to accomodate a different number of rows"
-#endif
+	int row_size = OFF_PREV_TIME_SLOT + OFF_CUR_TIME_SLOT;
+	for (j=BIT_DEPTH-1; j>=0; j--)
+	{
+		/* split bitplanes stay on while the next one is shifted in, the last one
+		 * while the first short one of the subframe is, or in the extension */
+		int on = l->time[j];
+		if (j >= BIT_DEPTH-l->n_split)
+			on = (on > BITBANG_ON_TIME) ? PADD4(on - BITBANG_ON_TIME) : 0;
+		l->on_time[j] = on;
+		if (j > BIT_DEPTH-l->n_split)
+			l->shifting_on[j-1] = l->time[j] - on;
+
+		l->off_bits[j] = row_size;
+		row_size += N_COLUMNS;
+		l->on_blocks[j] = on / ON_BLOCK;
+		l->on_inline[j] = PADD4(on % ON_BLOCK);
+		l->off_on[j] = row_size;
+		row_size += l->on_inline[j];
+
+		if (j == BIT_DEPTH-l->n_split)
+		{
+			l->extension = l->time[j] - on;
+			l->off_extension = row_size;
+			row_size += PADD4(l->extension);
+		}
+	}
+	l->row_size = row_size;
 }
 
+static int first_short(const layout_t *l, int subframe)
+{
+	int j;
+	for (j=BIT_DEPTH-l->n_split-1; j>=0; j--)
+		if (l->subframe[j] == subframe)
+			return j;
+	return -1;
+}
 
-static void init_on_time(uint8_t buf[], int size, int on_time, int bits)
+static void init_on_time(sample_t buf[], int size, int on_time, int bits)
 {
 	int i;
 	assert(on_time <= size);
@@ -172,233 +269,487 @@ static void init_on_time(uint8_t buf[], int size, int on_time, int bits)
 		buf[DMA_ORDER(i)] = bits | BIT_NOT_OUTPUT_ENABLE;
 }
 
-static void init_bits(uint8_t *buf, size_t size, int old_bits, int new_bits)
+static void init_bits(sample_t *buf, int on_time, int bits)
 {
-	assert(size == N_COLUMNS);
-	int i;
+	init_on_time(buf, N_COLUMNS, on_time, bits);
+	buf[DMA_ORDER(N_COLUMNS-1)] |= BIT_LATCH;
+}
 
-	for (i=0; i<BITBANG_ON_TIME; i++)
-		buf[DMA_ORDER(i)] = old_bits;
+static void init_row_data(const layout_t *l, sample_t *data, int addr)
+{
+	int addr_bits = row_bits(addr), prev_addr_bits = row_bits( (addr+N_ROWS-1) % N_ROWS );
+	int j, last_split = BIT_DEPTH-l->n_split;
 
-	for (i=BITBANG_ON_TIME; i<size; i++)
-		buf[DMA_ORDER(i)] = new_bits | BIT_NOT_OUTPUT_ENABLE;
+	init_on_time(data, OFF_PREV_TIME_SLOT, 0, prev_addr_bits);
+	init_on_time(&data[OFF_PREV_TIME_SLOT], OFF_CUR_TIME_SLOT, 0, addr_bits);
+
+	for (j=0; j<BIT_DEPTH; j++)
+	{
+		int shifting_on = l->shifting_on[j];
+		/* the first short bitplane of a subframe is shifted in while the last split one is on */
+		if (j < last_split)
+			shifting_on = (first_short(l, l->subframe[j]) == j) ? l->extension : 0;
 
-	buf[DMA_ORDER(size-1)] |= BIT_LATCH;
+		init_bits(&data[l->off_bits[j]], shifting_on, addr_bits);
+		init_on_time(&data[l->off_on[j]], l->on_inline[j], l->on_time[j] % ON_BLOCK, addr_bits);
+	}
+	init_on_time(&data[l->off_extension], PADD4(l->extension), l->extension, addr_bits);
 }
 
-static void init_row_data(row_data_t *data, int addr)
+/* Frame encoding
+ *
+ * Every sample of a bitplane holds the red, green and blue bits of one column,
+ * so one 32-bit DMA word holds SAMPLES_PER_WORD columns. The PWM value of every
+ * channel value comes from a table that is only rebuilt when the brightness
+ * changes, a second table spreads it over words with one bitplane per sample.
+ * A transpose of the samples turns the words of the pixels in one DMA word into
+ * words of bitplanes.
+ *
+ * Both frames remember the pixels they were encoded from, so only rows that
+ * changed since then are encoded again, and the frames are not flipped at all
+ * while the framebuffer does not change.
+ *
+ * With dithering, the PWM value is computed with DITHER_BITS more bits and the
+ * fraction below the LSB decides if a pixel shows one LSB more. The threshold
+ * it is compared to follows an ordered pattern over 2x2 pixels and both frames,
+ * which the DMA then shows in turn instead of one of them, so the average over
+ * the pattern is exact. Both frames are encoded, and a row that changes shows
+ * the old and the new pixels in turn for one refresh.
+ */
+
+#define SAMPLES_PER_WORD ((int) (4/sizeof(sample_t)))
+#define N_PLANE_GROUPS ((BIT_DEPTH+SAMPLES_PER_WORD-1)/SAMPLES_PER_WORD)
+#define WORD_MASK_RGB (MASK_RGB * (sizeof(sample_t)==1 ? 0x01010101u : 0x00010001u))
+
+typedef struct
 {
-	int addr_bits = row_bits(addr), prev_addr_bits = row_bits( (addr+7) & 7 );
+	int brightness;                     /* brightness the frame was encoded at, -1 when not encoded yet */
+	int phase;                          /* half of the dither pattern the frame was encoded with, -1 for none */
+	Color *source;                      /* pixels the frame was encoded from */
+	uint32_t intensity[N_ROWS];
+} frame_source_t;
 
-	memset(data, 0xff, sizeof(row_data_t));
-	memset(data->off_prev_row, prev_addr_bits | BIT_NOT_OUTPUT_ENABLE, sizeof(data->off_prev_row));
-	memset(data->off_cur_row, addr_bits | BIT_NOT_OUTPUT_ENABLE, sizeof(data->off_cur_row));
+static frame_source_t sources[2];
+static const Color black_row[N_COLUMNS];
 
-	init_on_time(data->on_time_bit15,  sizeof(data->on_time_bit15),  ON_TIME_BIT15,  addr_bits);
-	init_on_time(data->on_time_bit14,  sizeof(data->on_time_bit14),  ON_TIME_BIT14,  addr_bits);
-	init_on_time(data->on_time_bit13,  sizeof(data->on_time_bit13),  ON_TIME_BIT13,  addr_bits);
-	init_on_time(data->on_time_bit12,  sizeof(data->on_time_bit12),  ON_TIME_BIT12,  addr_bits);
-	init_on_time(data->on_time_bit11,  sizeof(data->on_time_bit11),  ON_TIME_BIT11,  addr_bits);
-	init_on_time(data->on_time_bit11b, sizeof(data->on_time_bit11b), ON_TIME_BIT11B, addr_bits);
-	init_on_time(data->on_time_bit10,  sizeof(data->on_time_bit10),  ON_TIME_BIT10,  addr_bits);
-	init_on_time(data->on_time_bit9,   sizeof(data->on_time_bit9),   ON_TIME_BIT9,   addr_bits);
-	init_on_time(data->on_time_bit8,   sizeof(data->on_time_bit8),   ON_TIME_BIT8,   addr_bits);
-	init_on_time(data->on_time_bit7,   sizeof(data->on_time_bit7),   ON_TIME_BIT7,   addr_bits);
-	init_on_time(data->on_time_bit6,   sizeof(data->on_time_bit6),   ON_TIME_BIT6,   addr_bits);
-	init_on_time(data->on_time_bit5,   sizeof(data->on_time_bit5),   ON_TIME_BIT5,   addr_bits);
-	init_on_time(data->on_time_bit4,   sizeof(data->on_time_bit4),   ON_TIME_BIT4,   addr_bits);
+#define NO_DITHER ((1<<DITHER_BITS)-1)   /* threshold no fraction is above */
+#define PWM_LEVELS (DITHER_BITS ? 2 : 1)
 
-	init_bits(data->bit15, sizeof(data->bit15), addr_bits|BIT_NOT_OUTPUT_ENABLE, addr_bits);
-	init_bits(data->bit14, sizeof(data->bit14), addr_bits, addr_bits);
-	init_bits(data->bit13, sizeof(data->bit13), addr_bits, addr_bits);
-	init_bits(data->bit12, sizeof(data->bit12), addr_bits, addr_bits);
-	init_bits(data->bit11, sizeof(data->bit11), addr_bits, addr_bits);
-	init_bits(data->bit10, sizeof(data->bit10), addr_bits, addr_bits);
-	init_bits(data->bit9,  sizeof(data->bit9),  addr_bits, addr_bits);
-	init_bits(data->bit8,  sizeof(data->bit8),  addr_bits, addr_bits);
-	init_bits(data->bit7,  sizeof(data->bit7),  addr_bits, addr_bits);
-	init_bits(data->bit6,  sizeof(data->bit6),  addr_bits, addr_bits);
-	init_bits(data->bit5,  sizeof(data->bit5),  addr_bits, addr_bits);
-	init_bits(data->bit4,  sizeof(data->bit4),  addr_bits, addr_bits);
-}
+static int lut_brightness = -1;
+static uint16_t lut_pwm[256];                    /* PWM value of a channel value at lut_brightness */
+static uint8_t lut_fraction[256];                /* DITHER_BITS below the PWM value */
+static uint32_t lut_planes[PWM_LEVELS][256][N_PLANE_GROUPS]; /* bit SAMPLES_PER_WORD*g+n of the PWM value (plus one LSB) in bit 0 of sample n of word g */
 
-static void clear_frame(frame_t *frame)
+static void update_lut(int brightness)
 {
-	int i,j,k;
-	for (i=0; i<N_ROWS; i++)
-		for (j=0; j<BIT_DEPTH; j++)
-			for (k=0; k<N_COLUMNS; k++)
+	int v, g, n, up;
+	for (v=0; v<256; v++)
+	{
+		uint16_t fine = valToPwm(v, brightness, BIT_DEPTH+DITHER_BITS);
+		lut_pwm[v] = fine >> DITHER_BITS;
+		lut_fraction[v] = fine & NO_DITHER;
+		for (up=0; up<PWM_LEVELS; up++)
+		{
+			uint16_t pwm = lut_pwm[v] + up;
+			if (pwm >= 1<<BIT_DEPTH)
+				pwm = (1<<BIT_DEPTH)-1;
+			for (g=0; g<N_PLANE_GROUPS; g++)
 			{
-				frame->bits[i][j][k] &=~ MASK_RGB;
-//				frame->bits[i][j][DMA_ORDER(k)] &=~ MASK_RGB; // DMA_ORDER doesn't matter here
+				uint32_t word = 0;
+				for (n=0; n<SAMPLES_PER_WORD; n++)
+					if (pwm & (1<<(SAMPLES_PER_WORD*g+n)))
+						word |= 1<<(8*sizeof(sample_t)*n);
+				lut_planes[up][v][g] = word;
 			}
+		}
+	}
+	lut_brightness = brightness;
 }
 
-/* returns total intensity */
-uint32_t driver_hub75_render(int brightness, Color* fb)
+#if DITHER_BITS
+#define CHANNEL_PLANES(v, g, t) lut_planes[lut_fraction[v] > (t)][v][g]
+#else
+#define CHANNEL_PLANES(v, g, t) ((void) (t), lut_planes[0][v][g])
+#endif
+
+/* t is the dither threshold of the pixel, NO_DITHER to round down */
+static inline uint32_t pixel_planes(const Color *c, int g, int t)
 {
-	uint32_t total_intensity = 0;
-	if (brightness < 0)
-		brightness = 0;
-	else if (brightness > 65535)
-		brightness = 65535;
+	return CHANNEL_PLANES(c->RGB[3], g, t) | CHANNEL_PLANES(c->RGB[2], g, t)<<1 | CHANNEL_PLANES(c->RGB[1], g, t)<<2;
+}
 
- 	cur_frame ^= 1;
-	frame_t *f = frames[cur_frame];
-	clear_frame(f);
+/* words start at an even column, so the threshold of column k of a word is threshold[half][k & 1] */
+#if HUB75_HALVES == 2
+/* the upper and lower half of a panel share their samples */
+#define COLUMN_PLANES(p, k, g) (pixel_planes(&(p)[k], g, threshold[0][(k)&1]) | \
+	pixel_planes(&(p)[(k)+N_COLUMNS*N_ROWS], g, threshold[1][(k)&1])<<SHIFT_LOWER_HALF)
+#else
+#define COLUMN_PLANES(p, k, g) pixel_planes(&(p)[k], g, threshold[0][(k)&1])
+#endif
 
-	int i,j,k;
-	if (fb != NULL)
-	for (i=0; i<N_ROWS; i++)
-	{
-		for (k=0; k<N_COLUMNS; k++)
-		{
-			/* use DMA_ORDER(k) for our reads instead of writes because it is symmetric
-			 * and this is faster */
-			Color *c = &fb[i*CONFIG_HUB75_WIDTH+31-DMA_ORDER(k)];
+/* ordered pattern over 2x2 pixels and both frames: every pixel flips between the
+ * upper and lower half of the thresholds, like a checkerboard, and each DITHER_BITS
+ * prefix of the pattern index is evenly spread */
+static int dither_threshold(int phase, int x, int y)
+{
+	int index = ((x^y^phase)&1)<<2 | (y&1)<<1 | (phase&1);
+	return index >> (3-DITHER_BITS);
+}
 
-			uint32_t r = valToPwm12(c->RGB[3], brightness),
-			         g = valToPwm12(c->RGB[2], brightness),
-			         b = valToPwm12(c->RGB[1], brightness);
+static inline void store_plane(frame_t *f, int row, int plane, int word, uint32_t rgb)
+{
+	/* bitplanes are word aligned: the frame is, and everything in a row is a multiple of 4 samples */
+	if (plane >= BIT_DEPTH)
+		return;
+	uint32_t *w = (uint32_t *)f->bits[row][plane] + word;
+	*w = (*w & ~WORD_MASK_RGB) | rgb;
+}
 
-			total_intensity += r+b+g;
+/* returns the intensity of the row, src is the first of the rows that share the row address,
+ * phase is the half of the dither pattern to use, -1 for none */
+static uint32_t encode_row(frame_t *f, int row, const Color *src, int phase)
+{
+	uint32_t intensity = 0;
+	int h, k, g;
+	int threshold[HUB75_HALVES][2];
 
-			for (j=0; j<BIT_DEPTH; j++)
-			{
-				uint32_t bit = 1<<j, val = 0;
-				if (r & bit)
-					val |= BIT_RED;
-				if (g & bit)
-					val |= BIT_GREEN;
-				if (b & bit)
-					val |= BIT_BLUE;
+	for (h=0; h<HUB75_HALVES; h++)
+		for (k=0; k<2; k++)
+			threshold[h][k] = (phase < 0) ? NO_DITHER : dither_threshold(phase, k, h*N_ROWS+row);
 
-				f->bits[i][j][k] |= val;
-			}
+	for (h=0; h<HUB75_HALVES; h++)
+		for (k=0; k<N_COLUMNS; k++)
+		{
+			const Color *c = &src[h*N_COLUMNS*N_ROWS+k];
+			intensity += lut_pwm[c->RGB[3]] + lut_pwm[c->RGB[2]] + lut_pwm[c->RGB[1]];
 		}
-	}
 
-	i2sparallel_flipBuffer(cur_frame);
-	return total_intensity;
+	for (k=0; k<N_COLUMNS; k+=SAMPLES_PER_WORD)
+	{
+#if HUB75_SAMPLE_BITS == 8
+		/* the DMA word at sample k shows columns N_COLUMNS-1-DMA_ORDER(k..k+3),
+		 * which are p[1], p[0], p[3] and p[2] */
+		const Color *p = &src[N_COLUMNS-4-k];
+		for (g=0; g<N_PLANE_GROUPS; g++)
+		{
+			uint32_t a = COLUMN_PLANES(p, 1, g), b = COLUMN_PLANES(p, 0, g),
+			         c = COLUMN_PLANES(p, 3, g), d = COLUMN_PLANES(p, 2, g);
+
+			/* byte n of a..d is bitplane 4*g+n, swap bytes and then halfwords */
+			uint32_t ab_even = (a & 0x00ff00ff) | (b & 0x00ff00ff)<<8,
+			         ab_odd  = (a>>8 & 0x00ff00ff) | (b & 0xff00ff00),
+			         cd_even = (c & 0x00ff00ff) | (d & 0x00ff00ff)<<8,
+			         cd_odd  = (c>>8 & 0x00ff00ff) | (d & 0xff00ff00);
+
+			store_plane(f, row, 4*g+0, k/4, (ab_even & 0xffff) | cd_even<<16);
+			store_plane(f, row, 4*g+1, k/4, (ab_odd & 0xffff) | cd_odd<<16);
+			store_plane(f, row, 4*g+2, k/4, ab_even>>16 | (cd_even & 0xffff0000));
+			store_plane(f, row, 4*g+3, k/4, ab_odd>>16 | (cd_odd & 0xffff0000));
+		}
+#else
+		/* the DMA word at sample k shows columns N_COLUMNS-1-DMA_ORDER(k..k+1),
+		 * which are p[0] and p[1] */
+		const Color *p = &src[N_COLUMNS-2-k];
+		for (g=0; g<N_PLANE_GROUPS; g++)
+		{
+			uint32_t a = COLUMN_PLANES(p, 0, g), b = COLUMN_PLANES(p, 1, g);
+
+			/* halfword n of a and b is bitplane 2*g+n */
+			store_plane(f, row, 2*g+0, k/2, (a & 0xffff) | b<<16);
+			store_plane(f, row, 2*g+1, k/2, a>>16 | (b & 0xffff0000));
+		}
+#endif
+	}
+	return intensity;
 }
 
-static frame_t *create_frame_data(void)
+static bool row_changed(const frame_source_t *s, Color *fb, int row)
 {
-	frame_t *frame = heap_caps_calloc(sizeof(frame_t), 1, MALLOC_CAP_DMA);
-	int i;
-	for(i=0; i<N_ROWS; i++)
+	int h;
+	for (h=0; h<HUB75_HALVES; h++)
 	{
-		init_row_data(&frame->rows[i], i);
-#if BIT_DEPTH != 12
-#error "code expects BIT_DEPTH == 12"
-#endif
-		frame->bits[i][11] = frame->rows[i].bit15;
-		frame->bits[i][10] = frame->rows[i].bit14;
-		frame->bits[i][ 9] = frame->rows[i].bit13;
-		frame->bits[i][ 8] = frame->rows[i].bit12;
-		frame->bits[i][ 7] = frame->rows[i].bit11;
-		frame->bits[i][ 6] = frame->rows[i].bit10;
-		frame->bits[i][ 5] = frame->rows[i].bit9;
-		frame->bits[i][ 4] = frame->rows[i].bit8;
-		frame->bits[i][ 3] = frame->rows[i].bit7;
-		frame->bits[i][ 2] = frame->rows[i].bit6;
-		frame->bits[i][ 1] = frame->rows[i].bit5;
-		frame->bits[i][ 0] = frame->rows[i].bit4;
+		int offset = (h*N_ROWS+row)*N_COLUMNS;
+		if (memcmp(&s->source[offset], fb ? &fb[offset] : black_row, N_COLUMNS*sizeof(Color)) != 0)
+			return true;
 	}
-	return frame;
+	return false;
 }
 
-#define RANGE_SIZE(s, from, to) ( (intptr_t)s.to + sizeof(s.to) - (intptr_t)s.from )
-#define BUFFER_RANGE(s, from, to) ( (i2s_parallel_buffer_desc_t) { .memory = s.from, .size = RANGE_SIZE(s, from, to) } )
-#define END_BUFFER ( (i2s_parallel_buffer_desc_t) { .memory = NULL, .size = 0 } )
-
-#define N_DMA_DESCRIPTORS ( N_ROWS * 14 + 1 )
+static uint32_t frame_intensity(int n)
+{
+	uint32_t total_intensity = 0;
+	int i;
+	for (i=0; i<N_ROWS; i++)
+		total_intensity += sources[n].intensity[i];
+	return total_intensity;
+}
 
-i2s_parallel_buffer_desc_t *create_dma_descriptors(frame_t *frame)
+static bool frame_changed(int n, int brightness, int phase, Color *fb)
 {
-	i2s_parallel_buffer_desc_t *desc = malloc( sizeof(i2s_parallel_buffer_desc_t) * N_DMA_DESCRIPTORS );
+	const frame_source_t *s = &sources[n];
+	int i;
+	if (s->brightness != brightness || s->phase != phase)
+		return true;
+	for (i=0; i<N_ROWS; i++)
+		if (row_changed(s, fb, i))
+			return true;
+	return false;
+}
 
-	int i, cur = 0;
+/* returns total intensity */
+static uint32_t encode_frame(int n, int brightness, int phase, Color *fb)
+{
+	uint32_t total_intensity = 0;
+	frame_source_t *s = &sources[n];
+	bool all_rows = (s->brightness != brightness || s->phase != phase);
+	int i, h;
+	s->brightness = brightness;
+	s->phase = phase;
 
 	for (i=0; i<N_ROWS; i++)
 	{
-		desc[ cur++ ] = BUFFER_RANGE(frame->rows[i], off_prev_row, bit11);
-		desc[ cur++ ] = BUFFER_RANGE(frame->rows[i], on_time_bit11b, on_time_bit4);
+		if (all_rows || row_changed(s, fb, i))
+		{
+			/* encode the copy, the framebuffer may be drawn to while we are at it */
+			for (h=0; h<HUB75_HALVES; h++)
+			{
+				int offset = (h*N_ROWS+i)*N_COLUMNS;
+				memcpy(&s->source[offset], fb ? &fb[offset] : black_row, N_COLUMNS*sizeof(Color));
+			}
+			s->intensity[i] = encode_row(frames[n], i, &s->source[i*N_COLUMNS], phase);
+		}
+		total_intensity += s->intensity[i];
 	}
+	return total_intensity;
+}
 
-	for (i=0; i<N_ROWS; i++)
-	{
-		desc[ cur++ ] = BUFFER_RANGE(frame->rows[i], off_prev_row, on_time_bit12);
-		desc[ cur++ ] = BUFFER_RANGE(frame->rows[i], bit10, on_time_bit6);
-	}
+static bool alternating = false;   /* the DMA shows both frames in turn */
 
-	for (i=0; i<N_ROWS; i++)
+/* returns total intensity */
+uint32_t driver_hub75_render(int brightness, bool dither, Color* fb)
+{
+	uint32_t total_intensity = 0;
+	if (brightness < 0)
+		brightness = 0;
+	else if (brightness > 65535)
+		brightness = 65535;
+
+	if (n_frames == 0)
+		return 0;
+
+	if (brightness != lut_brightness)
+		update_lut(brightness);
+
+	if (DITHER_BITS && dither && n_frames == 2)
 	{
-		desc[ cur++ ] = BUFFER_RANGE(frame->rows[i], off_prev_row, on_time_bit11);
+		int n;
+		for (n=0; n<2; n++)
+			total_intensity = frame_changed(n, brightness, n, fb) ? encode_frame(n, brightness, n, fb) : frame_intensity(n);
+		if (!alternating)
+			i2sparallel_alternateBuffers();
+		alternating = true;
+		return total_intensity;
 	}
 
-	for (i=0; i<N_ROWS; i++)
+	if (!alternating && !frame_changed(cur_frame, brightness, -1, fb))
+		return frame_intensity(cur_frame);
+
+	/* with a single frame, the rows that are being encoded show garbage for a moment */
+	cur_frame = (cur_frame + 1) % n_frames;
+	total_intensity = encode_frame(cur_frame, brightness, -1, fb);
+
+	i2sparallel_flipBuffer(cur_frame);
+	alternating = false;
+	return total_intensity;
+}
+
+static frame_t *create_frame_data(void)
+{
+	frame_t *frame = calloc(1, sizeof(frame_t));
+	if (frame == NULL)
+		return NULL;
+	frame->data = heap_caps_calloc(N_ROWS * layout.row_size, sizeof(sample_t), MALLOC_CAP_DMA);
+	if (frame->data == NULL)
 	{
-		desc[ cur++ ] = BUFFER_RANGE(frame->rows[i], off_prev_row, on_time_bit12);
-		desc[ cur++ ] = BUFFER_RANGE(frame->rows[i], bit9, on_time_bit7);
+		free(frame);
+		return NULL;
 	}
 
-	for (i=0; i<N_ROWS; i++)
+	int i, j;
+	for(i=0; i<N_ROWS; i++)
 	{
-		desc[ cur++ ] = BUFFER_RANGE(frame->rows[i], off_prev_row, on_time_bit11);
+		sample_t *row = &frame->data[i * layout.row_size];
+		init_row_data(&layout, row, i);
+		for (j=0; j<BIT_DEPTH; j++)
+			frame->bits[i][j] = &row[layout.off_bits[j]];
 	}
+	return frame;
+}
+
+static void destroy_frame_data(frame_t *frame)
+{
+	if (frame == NULL)
+		return;
+	free(frame->data);
+	free(frame);
+}
 
+static bool create_on_blocks(void)
+{
+	int i, j, needed = 0;
+	for (j=0; j<BIT_DEPTH; j++)
+		needed |= layout.on_blocks[j];
+	if (!needed)
+		return true;
+
+	on_blocks = heap_caps_calloc(N_ROWS * ON_BLOCK, sizeof(sample_t), MALLOC_CAP_DMA);
+	if (on_blocks == NULL)
+		return false;
 	for (i=0; i<N_ROWS; i++)
+		init_on_time(&on_blocks[i * ON_BLOCK], ON_BLOCK, ON_BLOCK, row_bits(i));
+	return true;
+}
+
+/* Descriptors are merged when their memory follows each other */
+typedef struct
+{
+	i2s_parallel_buffer_desc_t *desc;  /* NULL to only count */
+	int count;
+	sample_t *end;
+} desc_list_t;
+
+static void add_range(desc_list_t *list, sample_t *from, int samples)
+{
+	if (samples == 0)
+		return;
+	if (list->count > 0 && from == list->end)
 	{
-		desc[ cur++ ] = BUFFER_RANGE(frame->rows[i], off_prev_row, on_time_bit12);
-		desc[ cur++ ] = BUFFER_RANGE(frame->rows[i], bit10, on_time_bit10);
-		desc[ cur++ ] = BUFFER_RANGE(frame->rows[i], bit5, on_time_bit5);
+		if (list->desc)
+			list->desc[list->count-1].size += samples * sizeof(sample_t);
 	}
-
-	for (i=0; i<N_ROWS; i++)
+	else
 	{
-		desc[ cur++ ] = BUFFER_RANGE(frame->rows[i], off_prev_row, on_time_bit11);
+		if (list->desc)
+			list->desc[list->count] = (i2s_parallel_buffer_desc_t) { .memory = from, .size = samples * sizeof(sample_t) };
+		list->count++;
 	}
+	list->end = from + samples;
+}
 
-	for (i=0; i<N_ROWS; i++)
+static void add_on_blocks(desc_list_t *list, int row, int n)
+{
+	int i;
+	for (i=0; i<n; i++)
 	{
-		desc[ cur++ ] = BUFFER_RANGE(frame->rows[i], off_prev_row, on_time_bit12);
-		desc[ cur++ ] = BUFFER_RANGE(frame->rows[i], bit8, on_time_bit8);
+		list->end = NULL; /* the block is repeated, not continued */
+		add_range(list, &on_blocks[row * ON_BLOCK], ON_BLOCK);
 	}
+}
+
+static void add_bitplane(desc_list_t *list, frame_t *frame, int row, int j)
+{
+	sample_t *data = &frame->data[row * layout.row_size];
+	add_range(list, &data[layout.off_bits[j]], N_COLUMNS);
+	add_range(list, &data[layout.off_on[j]], layout.on_inline[j]);
+	add_on_blocks(list, row, layout.on_blocks[j]);
+}
+
+static void add_frame(desc_list_t *list, frame_t *frame)
+{
+	int s, i, j;
+	for (s=0; s<layout.subframes; s++)
+		for (i=0; i<N_ROWS; i++)
+		{
+			sample_t *data = &frame->data[i * layout.row_size];
+			add_range(list, data, OFF_PREV_TIME_SLOT + OFF_CUR_TIME_SLOT);
+			for (j=BIT_DEPTH-1; j>=BIT_DEPTH-layout.n_split; j--)
+				add_bitplane(list, frame, i, j);
+			if (first_short(&layout, s) < 0)
+				add_range(list, &data[layout.off_extension], PADD4(layout.extension));
+			for (; j>=0; j--)
+				if (layout.subframe[j] == s)
+					add_bitplane(list, frame, i, j);
+		}
+}
 
-	desc[ cur++ ] = END_BUFFER;
-	assert(cur == N_DMA_DESCRIPTORS);
+i2s_parallel_buffer_desc_t *create_dma_descriptors(frame_t *frame)
+{
+	desc_list_t list = { .desc = NULL };
+	add_frame(&list, frame);
+
+	list.desc = malloc( sizeof(i2s_parallel_buffer_desc_t) * (list.count + 1) );
+	if (list.desc == NULL)
+		return NULL;
+	list.count = 0;
+	list.end = NULL;
+	add_frame(&list, frame);
+	list.desc[list.count] = (i2s_parallel_buffer_desc_t) { .memory = NULL, .size = 0 };
+
+	return list.desc;
+}
 
-	return desc;
+static int count_dma_descriptors(i2s_parallel_buffer_desc_t desc[])
+{
+	int i, n = 0;
+	for (i=0; desc[i].memory; i++)
+		n += (desc[i].size + I2S_PARALLEL_DMA_MAX - 1) / I2S_PARALLEL_DMA_MAX;
+	return n;
+}
+
+static uint32_t frame_clocks(i2s_parallel_buffer_desc_t desc[])
+{
+	uint32_t i, clocks = 0;
+	for (i=0; desc[i].memory; i++)
+		clocks += desc[i].size / sizeof(sample_t);
+	return clocks;
 }
 
 #ifdef DRIVER_HUB75_DMA_DATA_TEST
 
+static void clear_frame(frame_t *frame)
+{
+	int i,j,k;
+	for (i=0; i<N_ROWS; i++)
+		for (j=0; j<BIT_DEPTH; j++)
+			for (k=0; k<N_COLUMNS; k++)
+			{
+				frame->bits[i][j][k] &=~ MASK_RGB;
+//				frame->bits[i][j][DMA_ORDER(k)] &=~ MASK_RGB; // DMA_ORDER doesn't matter here
+			}
+}
+
+#define HEIGHT (N_ROWS*HUB75_HALVES)
+
 #define PLOT_WIDTH (128)
 static void print_dma_output(i2s_parallel_buffer_desc_t desc[])
 {
-	size_t len=0;
+	int len=0;
 	int bit,i,j,cur,chunk;
 	for(i=0; desc[i].memory; i++)
-		len += desc[i].size;
+		len += desc[i].size / sizeof(sample_t);
 
+#if HUB75_SAMPLE_BITS == 8
 	char repr[]="RGBabcLE";
+#else
+	char repr[]="RGBrgbabcdeLE";
+#endif
 
 	for(chunk=0; chunk<len; chunk+=PLOT_WIDTH)
 	{
-		for(bit=0; bit<8; bit++)
+		for(bit=0; bit<(int) sizeof(repr)-1; bit++)
 		{
 			cur = 0;
 			for(i=0; desc[i].memory; i++)
 			{
-				if (cur+desc[i].size > chunk)
+				int size = desc[i].size / sizeof(sample_t);
+				if (cur+size > chunk)
 				{
-					uint8_t *buf = (uint8_t *)desc[i].memory;
-					for (j=0; j<desc[i].size; j++)
+					sample_t *buf = (sample_t *)desc[i].memory;
+					for (j=0; j<size; j++)
 						if (cur+j >= chunk && cur+j < chunk+PLOT_WIDTH)
 							printf("%c", ((buf[DMA_ORDER(j)]>>bit)&1)?repr[bit]:' ');
 				}
-				cur += desc[i].size;
+				cur += size;
 				if (cur > chunk+PLOT_WIDTH)
 					break;
 			}
@@ -410,7 +761,7 @@ static void print_dma_output(i2s_parallel_buffer_desc_t desc[])
 	}
 }
 
-static void shift(uint8_t reg[N_COLUMNS], int v)
+static void shift(sample_t reg[N_COLUMNS], int v)
 {
 	int i;
 	for(i=0; i<N_COLUMNS-1; i++)
@@ -418,66 +769,59 @@ static void shift(uint8_t reg[N_COLUMNS], int v)
 	reg[N_COLUMNS-1] = v;
 }
 
-static void update_row(uint32_t accum[N_COLUMNS][3], uint8_t reg[N_COLUMNS])
+static void update_row(uint32_t accum[N_COLUMNS][3], sample_t reg[N_COLUMNS], int rgb_shift)
 {
 	int x;
 	for (x=0; x<N_COLUMNS; x++)
 	{
-		if (reg[x]&BIT_RED)
+		if ((reg[x]>>rgb_shift)&BIT_RED)
 			accum[x][0]++;
-		if (reg[x]&BIT_GREEN)
+		if ((reg[x]>>rgb_shift)&BIT_GREEN)
 			accum[x][1]++;
-		if (reg[x]&BIT_BLUE)
+		if ((reg[x]>>rgb_shift)&BIT_BLUE)
 			accum[x][2]++;
 	}
 }
 
-static int get_row(uint8_t v)
+static int get_row(sample_t v)
 {
-#if N_ROWS == 8
-
-	int row = 0;
-	if (v&BIT_A)
-		row |= 1;
-	if (v&BIT_B)
-		row |= 2;
-	if (v&BIT_C)
-		row |= 4;
-	return row;
-
-#else
-#error "row bits needs to be updated to accomodate a different number of rows"
-#endif
+	return (v >> SHIFT_ADDR) & 31;
 }
 
 #define minsizeof(a, b) ( sizeof(a)<sizeof(b)?sizeof(a):sizeof(b) )
-static void sym_dma(i2s_parallel_buffer_desc_t desc[], uint32_t accum[N_ROWS][N_COLUMNS][3])
+static void sym_dma(i2s_parallel_buffer_desc_t desc[], uint32_t accum[HEIGHT][N_COLUMNS][3])
 {
-	uint8_t reg[N_COLUMNS];
-	uint8_t latch[N_COLUMNS];
-	uint8_t out[N_COLUMNS];
+	sample_t reg[N_COLUMNS];
+	sample_t latch[N_COLUMNS];
+	sample_t out[N_COLUMNS];
 	memset(reg, 0, sizeof(reg));
 
 	int i,j;
 	for(i=0; desc[i].memory; i++)
-		for(j=0; j<desc[i].size; j++)
+		for(j=0; j<(int) (desc[i].size/sizeof(sample_t)); j++)
 		{
-			int v = ((uint8_t *)desc[i].memory)[DMA_ORDER(j)];
+			int v = ((sample_t *)desc[i].memory)[DMA_ORDER(j)];
 			shift(reg, (v & MASK_RGB));
 			if (v & BIT_LATCH)
 				memcpy(latch, reg, minsizeof(latch, reg));
 			if (v & BIT_NOT_OUTPUT_ENABLE)
 				memcpy(out, latch, minsizeof(out, latch));
 			if ( !(v & BIT_NOT_OUTPUT_ENABLE) )
-				update_row(accum[get_row(v)], out);
+			{
+				assert(get_row(v) < N_ROWS);
+				update_row(accum[get_row(v)], out, 0);
+#if HUB75_HALVES == 2
+				update_row(accum[get_row(v)+N_ROWS], out, SHIFT_LOWER_HALF);
+#endif
+			}
 		}
 }
 
-static void print_accum(uint32_t accum[N_ROWS][N_COLUMNS][3])
+static void print_accum(uint32_t accum[HEIGHT][N_COLUMNS][3])
 {
 	int i,j,k;
 	printf("-------------\n");
-	for(i=0; i<N_ROWS; i++)
+	for(i=0; i<HEIGHT; i++)
 	{
 		for(j=0; j<3; j++)
 		{
@@ -492,37 +836,28 @@ static void print_accum(uint32_t accum[N_ROWS][N_COLUMNS][3])
 	}
 }
 
-void fill_semirand(uint32_t randbits[N_ROWS][N_COLUMNS][3], frame_t *frame)
+void fill_semirand(uint32_t randbits[HEIGHT][N_COLUMNS][3], frame_t *frame)
 {
-	int i,j,k;
-	for (i=0; i<N_ROWS; i++)
+	int i,j,k,c;
+	for (i=0; i<HEIGHT; i++)
 		for (k=0; k<N_COLUMNS; k++)
-		{
-			int r = rand()&((1<<BIT_DEPTH)-1);
-			int g = rand()&((1<<BIT_DEPTH)-1);
-			int b = rand()&((1<<BIT_DEPTH)-1);
-			randbits[i][k][0]=r;
-			randbits[i][k][1]=g;
-			randbits[i][k][2]=b;
-			for (j=0; j<BIT_DEPTH; j++)
+			for (c=0; c<3; c++)
 			{
-				if ( (1<<j) & r )
-					frame->bits[i][j][DMA_ORDER(k)] |= BIT_RED;
-				if ( (1<<j) & g )
-					frame->bits[i][j][DMA_ORDER(k)] |= BIT_GREEN;
-				if ( (1<<j) & b )
-					frame->bits[i][j][DMA_ORDER(k)] |= BIT_BLUE;
+				int v = rand()&((1<<BIT_DEPTH)-1);
+				randbits[i][k][c] = v * layout.lsb_time;
+				for (j=0; j<BIT_DEPTH; j++)
+					if ( (1<<j) & v )
+						frame->bits[i%N_ROWS][j][DMA_ORDER(k)] |= (BIT_RED<<c) << (i/N_ROWS*3);
 			}
-		}
 }
 
 
-#define N_RAND_TESTS 100
+#define N_RAND_TESTS 20
 void do_test(i2s_parallel_buffer_desc_t desc[], frame_t *frame)
 {
 	srand(42);
-	uint32_t randbits[N_ROWS][N_COLUMNS][3];
-	uint32_t accum[N_ROWS][N_COLUMNS][3];
+	static uint32_t randbits[HEIGHT][N_COLUMNS][3];
+	static uint32_t accum[HEIGHT][N_COLUMNS][3];
 
 	int i;
 	for (i=0; i<N_RAND_TESTS; i++)
@@ -533,6 +868,7 @@ void do_test(i2s_parallel_buffer_desc_t desc[], frame_t *frame)
 		sym_dma(desc, accum);
 		assert(memcmp(randbits, accum, minsizeof(randbits, accum))==0);
 	}
+	clear_frame(frame);
 }
 
 
@@ -540,7 +876,7 @@ void do_test_old(i2s_parallel_buffer_desc_t desc[], frame_t *frame)
 {
 	print_dma_output(desc);
 
-	uint32_t accum[N_ROWS][N_COLUMNS][3];
+	static uint32_t accum[HEIGHT][N_COLUMNS][3];
 
 	int i,j,k;
 	for (i=0; i<N_ROWS; i++)
@@ -555,43 +891,309 @@ void do_test_old(i2s_parallel_buffer_desc_t desc[], frame_t *frame)
 		}
 }
 
-void do_test_count(i2s_parallel_buffer_desc_t desc[])
+/* a plain encoder to check the bit-sliced one against, phase is the half of the dither pattern or -1 */
+static uint32_t render_reference(frame_t *f, int brightness, Color* fb, int phase)
+{
+	uint32_t total_intensity = 0;
+	clear_frame(f);
+
+	int i,j,k;
+	if (fb != NULL)
+	for (i=0; i<HEIGHT; i++)
+	{
+		for (k=0; k<N_COLUMNS; k++)
+		{
+			int x = N_COLUMNS-1-DMA_ORDER(k);
+			Color *c = &fb[i*N_COLUMNS+x];
+
+			uint32_t r = valToPwm12(c->RGB[3], brightness) >> (12-BIT_DEPTH),
+			         g = valToPwm12(c->RGB[2], brightness) >> (12-BIT_DEPTH),
+			         b = valToPwm12(c->RGB[1], brightness) >> (12-BIT_DEPTH);
+
+			total_intensity += r+b+g;
+
+			if (phase >= 0)
+			{
+				uint32_t t = dither_threshold(phase, x, i), max = (1<<BIT_DEPTH)-1;
+				if ((valToPwm(c->RGB[3], brightness, BIT_DEPTH+DITHER_BITS) & NO_DITHER) > t && r < max)
+					r++;
+				if ((valToPwm(c->RGB[2], brightness, BIT_DEPTH+DITHER_BITS) & NO_DITHER) > t && g < max)
+					g++;
+				if ((valToPwm(c->RGB[1], brightness, BIT_DEPTH+DITHER_BITS) & NO_DITHER) > t && b < max)
+					b++;
+			}
+
+			for (j=0; j<BIT_DEPTH; j++)
+			{
+				uint32_t bit = 1<<j, val = 0;
+				if (r & bit)
+					val |= BIT_RED;
+				if (g & bit)
+					val |= BIT_GREEN;
+				if (b & bit)
+					val |= BIT_BLUE;
+
+				f->bits[i%N_ROWS][j][k] |= val << (i/N_ROWS*3);
+			}
+		}
+	}
+	return total_intensity;
+}
+
+static void fill_fb(Color *fb, int rows)
 {
 	int i;
+	for (i=0; i<rows*N_COLUMNS; i++)
+		fb[i].value = rand() ^ ((uint32_t)rand()<<16);
+}
 
-	unsigned int sum = 0;
-	for(i=0; desc[i].memory; i++)
-		sum += desc[i].size;
+static void check_render(int brightness, Color *fb, frame_t *expected)
+{
+	uint32_t total = driver_hub75_render(brightness, false, fb);
+	uint32_t total_expected = render_reference(expected, brightness, fb, -1);
+	assert(total == total_expected);
+	assert(memcmp(frames[cur_frame]->data, expected->data, N_ROWS * layout.row_size * sizeof(sample_t))==0);
+}
 
-	printf("net. duty cycle: %u/%u = %lf\n", 4095*8, sum, (double)(4095*8)/(double)sum);
+#if DITHER_BITS
+static void check_render_dither(int brightness, Color *fb, frame_t *expected)
+{
+	uint32_t total = driver_hub75_render(brightness, true, fb);
+	int n;
+	for (n=0; n<2; n++)
+	{
+		uint32_t total_expected = render_reference(expected, brightness, fb, n);
+		assert(total == total_expected);
+		assert(memcmp(frames[n]->data, expected->data, N_ROWS * layout.row_size * sizeof(sample_t))==0);
+	}
+}
+#endif
+
+#define N_RENDER_TESTS 200
+void do_test_render(void)
+{
+	srand(43);
+	frame_t *expected = create_frame_data();
+	static Color fb[HEIGHT*N_COLUMNS];
+	int brightness[] = { 0, 255, 4000, 31337, 65535 };
+	int i, b;
+
+	for (b=0; b<(int) (sizeof(brightness)/sizeof(brightness[0])); b++)
+		for (i=0; i<N_RENDER_TESTS; i++)
+		{
+			int shown = cur_frame;
+			switch (i%4)
+			{
+				case 0: /* new frame */
+					fill_fb(fb, HEIGHT);
+					break;
+				case 1: /* one row changed */
+					fill_fb(&fb[(rand()%HEIGHT)*N_COLUMNS], 1);
+					break;
+				case 2: /* one pixel changed */
+					fb[rand()%(HEIGHT*N_COLUMNS)].RGB[1+rand()%3] ^= 1<<(rand()%8);
+					break;
+				case 3: /* nothing changed, must not flip */
+					check_render(brightness[b], fb, expected);
+					assert(cur_frame == shown);
+					continue;
+			}
+			check_render(brightness[b], fb, expected);
+			assert(cur_frame != shown);
+		}
+
+	check_render(4000, NULL, expected);
+
+#if DITHER_BITS
+	/* both frames are encoded with their half of the pattern, until dithering is turned off again */
+	for (b=0; b<(int) (sizeof(brightness)/sizeof(brightness[0])); b++)
+		for (i=0; i<N_RENDER_TESTS; i++)
+		{
+			switch (i%4)
+			{
+				case 0:
+					fill_fb(fb, HEIGHT);
+					break;
+				case 1:
+					fill_fb(&fb[(rand()%HEIGHT)*N_COLUMNS], 1);
+					break;
+				case 2:
+					fb[rand()%(HEIGHT*N_COLUMNS)].RGB[1+rand()%3] ^= 1<<(rand()%8);
+					break;
+			}
+			check_render_dither(brightness[b], fb, expected);
+			if (i%16 == 15)
+				check_render(brightness[b], fb, expected);
+		}
+	check_render(4000, fb, expected);
+	int shown = cur_frame;
+	check_render(4000, fb, expected);
+	assert(cur_frame == shown);
+#endif
+	destroy_frame_data(expected);
+}
+
+#if DITHER_BITS
+/* shows dim colors in blocks of 2x2 pixels, the size of the pattern, and compares
+ * what the DMA shows of them over both frames with the exact intensity */
+void do_test_dither(i2s_parallel_buffer_desc_t *desc[2])
+{
+	static Color fb[HEIGHT*N_COLUMNS];
+	static uint32_t accum[HEIGHT][N_COLUMNS][3];
+	int brightness[] = { 256, 1024, 4000 };
+	int b, dither, x, y, c, n;
+
+	for (y=0; y<HEIGHT; y++)
+		for (x=0; x<N_COLUMNS; x++)
+		{
+			int block = (y/2)*(N_COLUMNS/2) + x/2;
+			fb[y*N_COLUMNS+x] = (Color) { .RGB = { 255, block*37, block*11, block*3 } };
+		}
+
+	for (b=0; b<(int) (sizeof(brightness)/sizeof(brightness[0])); b++)
+	{
+		double error[2] = { 0, 0 };
+		int blocks = 0;
+		for (dither=0; dither<2; dither++)
+		{
+			driver_hub75_render(brightness[b], dither, fb);
+			memset(accum, 0, sizeof(accum));
+			for (n=0; n<2; n++)
+				sym_dma(desc[dither ? n : cur_frame], accum);
+
+			for (y=0; y+1<HEIGHT; y+=2)
+				for (x=0; x<N_COLUMNS; x+=2)
+					for (c=0; c<3; c++)
+					{
+						/* the shift registers hold the columns from right to left */
+						int k = N_COLUMNS-2-x;
+						uint32_t sum = accum[y][k][c] + accum[y][k+1][c] + accum[y+1][k][c] + accum[y+1][k+1][c];
+						uint8_t v = fb[y*N_COLUMNS+x].RGB[3-c];
+						uint32_t fine = valToPwm(v, brightness[b], BIT_DEPTH+DITHER_BITS);
+						double exact = (double)valToPwm(v, brightness[b], 16) / (1<<(16-BIT_DEPTH));
+						double shown = (double)sum / (8 * layout.lsb_time);
+						if (dither && (fine >> DITHER_BITS) < (1<<BIT_DEPTH)-1)
+							assert(sum * (1<<DITHER_BITS) == 8 * layout.lsb_time * fine);
+						error[dither] += (shown > exact) ? shown - exact : exact - shown;
+						blocks += !dither;
+					}
+		}
+		printf("brightness %d: average intensity error %.3lf LSB, %.3lf LSB with %d bits of dithering\n",
+			brightness[b], error[0] / blocks, error[1] / blocks, DITHER_BITS);
+	}
+}
+#endif
+
+#define N_BENCH_FRAMES 2000
+void do_bench_render(void)
+{
+	frame_t *reference = create_frame_data();
+	static Color fbs[2][HEIGHT*N_COLUMNS];
+	clock_t start;
+	int i;
+
+	srand(44);
+	fill_fb(fbs[0], HEIGHT);
+	fill_fb(fbs[1], HEIGHT);
+
+	start = clock();
+	for (i=0; i<N_BENCH_FRAMES; i++)
+		render_reference(reference, 20000, fbs[i&1], -1);
+	double t_ref = (double)(clock()-start)/CLOCKS_PER_SEC/N_BENCH_FRAMES;
+
+	start = clock();
+	for (i=0; i<N_BENCH_FRAMES; i++)
+	{
+		int row;
+		for (row=0; row<HEIGHT; row++) /* every row changes */
+			fbs[i&1][row*N_COLUMNS].RGB[3]++;
+		driver_hub75_render(20000, false, fbs[i&1]);
+	}
+	double t_new = (double)(clock()-start)/CLOCKS_PER_SEC/N_BENCH_FRAMES;
+
+	start = clock();
+	for (i=0; i<N_BENCH_FRAMES; i++)
+		driver_hub75_render(20000, false, fbs[0]);
+	double t_same = (double)(clock()-start)/CLOCKS_PER_SEC/N_BENCH_FRAMES;
+
+	printf("render: reference %.2lf us, all rows changed %.2lf us, unchanged %.2lf us\n", t_ref*1e6, t_new*1e6, t_same*1e6);
+	destroy_frame_data(reference);
+}
+
+void do_test_count(i2s_parallel_buffer_desc_t desc[])
+{
+	unsigned int on = ((1<<BIT_DEPTH)-1) * layout.lsb_time * N_ROWS;
+	unsigned int sum = frame_clocks(desc);
+
+	printf("net. duty cycle: %u/%u = %lf\n", on, sum, (double)on/(double)sum);
 }
 
 #endif // DRIVER_HUB75_DMA_DATA_TEST
 
-void driver_hub75_init_bits(void)
+esp_err_t driver_hub75_init_bits(void)
 {
+	init_layout(&layout);
+
+	int i;
+	for (i=0; i<2; i++)
+	{
+		sources[i].brightness = -1;
+		sources[i].phase = -1;
+		sources[i].source = calloc(N_ROWS * HUB75_HALVES * N_COLUMNS, sizeof(Color));
+	}
 	frames[0] = create_frame_data();
-	frames[1] = create_frame_data();
+	if (!sources[0].source || !sources[1].source || !frames[0] || !create_on_blocks())
+	{
+		ESP_LOGE(TAG, "not enough memory for %u bytes of frame data", (unsigned int)(N_ROWS * layout.row_size * sizeof(sample_t)));
+		return ESP_ERR_NO_MEM;
+	}
 
 	i2s_parallel_buffer_desc_t *dma_desc_0 = create_dma_descriptors(frames[0]);
-	i2s_parallel_buffer_desc_t *dma_desc_1 = create_dma_descriptors(frames[1]);
+	if (dma_desc_0 == NULL)
+		return ESP_ERR_NO_MEM;
+
+	/* without memory for a second frame, render encodes into the frame that is shown */
+	int descriptors = count_dma_descriptors(dma_desc_0);
+	size_t frame_memory = N_ROWS * layout.row_size * sizeof(sample_t) + descriptors * I2S_PARALLEL_DMA_DESC_SIZE;
+	frames[1] = create_frame_data();
+	i2s_parallel_buffer_desc_t *dma_desc_1 = frames[1] ? create_dma_descriptors(frames[1]) : NULL;
+	n_frames = dma_desc_1 ? 2 : 1;
+	if (n_frames == 1)
+	{
+		ESP_LOGW(TAG, "not enough memory for a second frame, frames will tear");
+		destroy_frame_data(frames[1]);
+		frames[1] = NULL;
+	}
 
-	i2sparallel_init(dma_desc_0, dma_desc_1);
+	uint32_t clocks = frame_clocks(dma_desc_0);
+	ESP_LOGI(TAG, "%dx%d 1/%d scan, %d bits: %u clocks per frame, %u Hz, %u subframes, duty cycle %u%%",
+		N_COLUMNS, N_ROWS * HUB75_HALVES, N_ROWS, BIT_DEPTH, clocks, CONFIG_HUB75_CLOCK_SPEED / clocks, layout.subframes,
+		(unsigned int)(100ULL * ((1<<BIT_DEPTH)-1) * layout.lsb_time * N_ROWS / clocks));
+	ESP_LOGI(TAG, "%d x %u bytes of DMA memory per frame, %u bytes shared",
+		n_frames, (unsigned int)frame_memory, on_blocks ? (unsigned int)(N_ROWS * ON_BLOCK * sizeof(sample_t)) : 0);
+
+	i2sparallel_init(dma_desc_0, n_frames == 2 ? dma_desc_1 : dma_desc_0);
 
 #ifdef DRIVER_HUB75_DMA_DATA_TEST
 	do_test(dma_desc_0, frames[0]);
 	do_test_count(dma_desc_0);
+	do_test_render();
+#if DITHER_BITS
+	do_test_dither((i2s_parallel_buffer_desc_t *[2]) { dma_desc_0, dma_desc_1 });
+#endif
+	do_bench_render();
 #endif // DRIVER_HUB75_DMA_DATA_TEST
 
 	free(dma_desc_0);
 	free(dma_desc_1);
+	return ESP_OK;
 }
 
 #ifdef DRIVER_HUB75_DMA_DATA_TEST
 
-int main(int argc, char *argv[])
+int main(void)
 {
-	driver_hub75_init_bits();
+	return driver_hub75_init_bits();
 }
 
 #endif // DRIVER_HUB75_DMA_DATA_TEST
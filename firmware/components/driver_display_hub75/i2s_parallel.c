@@ -32,6 +32,7 @@
 #include "esp_heap_caps.h"
 #include "include/val2pwm.h"
 #include "include/i2s_parallel.h"
+#include "include/driver_hub75_bits.h"
 
 #define hw I2S1
 
@@ -41,6 +42,8 @@ typedef struct {
 } i2s_parallel_state_t;
 
 static i2s_parallel_state_t *i2s_state[2]={NULL, NULL};
+//Has to match the samples of driver_hub75_bits.c
+#if HUB75_SAMPLE_BITS == 8
 int gpio_bus[32] = {CONFIG_PIN_NUM_HUB75_R0,
                     CONFIG_PIN_NUM_HUB75_G0,
                     CONFIG_PIN_NUM_HUB75_B0,
@@ -49,11 +52,27 @@ int gpio_bus[32] = {CONFIG_PIN_NUM_HUB75_R0,
                     CONFIG_PIN_NUM_HUB75_C,
                     CONFIG_PIN_NUM_HUB75_LAT,
                     CONFIG_PIN_NUM_HUB75_OE, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1};
+i2s_parallel_cfg_bits_t bits = I2S_PARALLEL_BITS_8;
+#else
+int gpio_bus[32] = {CONFIG_PIN_NUM_HUB75_R0,
+                    CONFIG_PIN_NUM_HUB75_G0,
+                    CONFIG_PIN_NUM_HUB75_B0,
+                    CONFIG_PIN_NUM_HUB75_R1,
+                    CONFIG_PIN_NUM_HUB75_G1,
+                    CONFIG_PIN_NUM_HUB75_B1,
+                    CONFIG_PIN_NUM_HUB75_A,
+                    CONFIG_PIN_NUM_HUB75_B,
+                    CONFIG_PIN_NUM_HUB75_C,
+                    CONFIG_PIN_NUM_HUB75_D,
+                    CONFIG_PIN_NUM_HUB75_E,
+                    CONFIG_PIN_NUM_HUB75_LAT,
+                    CONFIG_PIN_NUM_HUB75_OE, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1};
+i2s_parallel_cfg_bits_t bits = I2S_PARALLEL_BITS_16;
+#endif
 int gpio_clk = CONFIG_PIN_NUM_HUB75_CLK;
 int clkspeed_hz = CONFIG_HUB75_CLOCK_SPEED;
-i2s_parallel_cfg_bits_t bits = I2S_PARALLEL_BITS_8;
 
-#define DMA_MAX (4096-4)
+#define DMA_MAX I2S_PARALLEL_DMA_MAX
 
 //Calculate the amount of dma descs needed for a buffer desc
 static int calc_needed_dma_descs_for(i2s_parallel_buffer_desc_t *desc) {
@@ -142,6 +161,11 @@ void i2sparallel_init(i2s_parallel_buffer_desc_t *bufa, i2s_parallel_buffer_desc
     gpio_set_drive_capability(CONFIG_PIN_NUM_HUB75_R0, GPIO_DRIVE_CAP_3);
     gpio_set_drive_capability(CONFIG_PIN_NUM_HUB75_G0, GPIO_DRIVE_CAP_3);
     gpio_set_drive_capability(CONFIG_PIN_NUM_HUB75_B0, GPIO_DRIVE_CAP_3);
+#if HUB75_HALVES == 2
+    gpio_set_drive_capability(CONFIG_PIN_NUM_HUB75_R1, GPIO_DRIVE_CAP_3);
+    gpio_set_drive_capability(CONFIG_PIN_NUM_HUB75_G1, GPIO_DRIVE_CAP_3);
+    gpio_set_drive_capability(CONFIG_PIN_NUM_HUB75_B1, GPIO_DRIVE_CAP_3);
+#endif
     gpio_set_drive_capability(CONFIG_PIN_NUM_HUB75_OE, GPIO_DRIVE_CAP_3);
     gpio_set_drive_capability(CONFIG_PIN_NUM_HUB75_LAT, GPIO_DRIVE_CAP_3);
 
@@ -239,4 +263,12 @@ void i2sparallel_flipBuffer(int bufid) {
     i2s_state[no]->dmadesc_b[i2s_state[no]->desccount_b-1].qe.stqe_next=active_dma_chain;
 }
 
+//Show both buffers in turn, until the next flip
+void i2sparallel_alternateBuffers(void) {
+    int no=i2snum();
+    if (i2s_state[no]==NULL) return;
+    i2s_state[no]->dmadesc_a[i2s_state[no]->desccount_a-1].qe.stqe_next=(lldesc_t*)&i2s_state[no]->dmadesc_b[0];
+    i2s_state[no]->dmadesc_b[i2s_state[no]->desccount_b-1].qe.stqe_next=(lldesc_t*)&i2s_state[no]->dmadesc_a[0];
+}
+
 #endif
@@ -17,6 +17,7 @@ typedef struct renderTask {
     int sizeX;
     int sizeY;
     Color color;
+    bool dynamic; // Drawn every frame instead of into the static layer
 } renderTask_t;
 
 typedef struct animation {
@@ -27,6 +28,7 @@ typedef struct animation {
 
 typedef struct scrollText {
     char *text;
+    int length; // Length of text in bytes
     int skip;
     int speed;
     bool firstshow;
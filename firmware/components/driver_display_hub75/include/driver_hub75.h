@@ -16,6 +16,7 @@ extern "C" {
 esp_err_t driver_hub75_init(void);
 void driver_hub75_set_brightness(int brightness_val);
 void driver_hub75_set_framerate(int framerate_val);
+void driver_hub75_set_dither(int brightness_val); // Dithers up to this brightness, -1 turns it off
 void driver_hub75_switch_buffer(uint8_t* buffer);
 
 Color* getFrameBuffer();
@@ -1,15 +1,35 @@
 #ifndef DRIVER_HUB75_BITS_H
 #define DRIVER_HUB75_BITS_H
 
+#include <stdbool.h>
 #include "color.h"
 
+#ifndef DRIVER_HUB75_DMA_DATA_TEST
+#include <esp_err.h>
+#else
+typedef int esp_err_t;
+#define ESP_OK 0
+#define ESP_ERR_NO_MEM 0x101
+#endif
+
+/* CONFIG_HUB75_WIDTH columns, of all chained panels together, are shifted out for every one of the
+ * CONFIG_HUB75_SCAN row addresses. Panels that are twice as high show two rows at every address,
+ * they need the second set of RGB pins and 16-bit DMA samples */
+#define HUB75_HALVES (CONFIG_HUB75_HEIGHT / CONFIG_HUB75_SCAN)
+#if HUB75_HALVES == 1 && CONFIG_HUB75_SCAN <= 8
+#define HUB75_SAMPLE_BITS 8
+#else
+#define HUB75_SAMPLE_BITS 16
+#endif
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-/* returns total intensity */
-uint32_t driver_hub75_render(int brightness, Color* fb);
-void driver_hub75_init_bits(void);
+/* returns total intensity, the frames are not flipped when nothing changed since the last render.
+ * With dither (and CONFIG_HUB75_DITHER_BITS) both frames are shown in turn */
+uint32_t driver_hub75_render(int brightness, bool dither, Color* fb);
+esp_err_t driver_hub75_init_bits(void);
 
 #ifdef __cplusplus
 }
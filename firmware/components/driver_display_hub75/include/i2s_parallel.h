@@ -10,6 +10,9 @@ typedef enum {
     I2S_PARALLEL_BITS_32=32,
 } i2s_parallel_cfg_bits_t;
 
+#define I2S_PARALLEL_DMA_MAX (4096-4)     // Buffers are split into DMA descriptors of at most this many bytes
+#define I2S_PARALLEL_DMA_DESC_SIZE 12     // sizeof(lldesc_t)
+
 typedef struct i2s_parallel_buffer_desc {
     void *memory;
     size_t size;
@@ -17,5 +20,6 @@ typedef struct i2s_parallel_buffer_desc {
 
 void i2sparallel_init(i2s_parallel_buffer_desc_t *bufa, i2s_parallel_buffer_desc_t *bufb);
 void i2sparallel_flipBuffer(int bufid);
+void i2sparallel_alternateBuffers(void);
 
 #endif
@@ -1,3 +1,5 @@
 
 //Converts an 0-255 intensity value to an equivalent  0-4095 LED PWM value
 uint16_t valToPwm12(int val, int brightness);
+//Same, to a PWM value of 1 to 16 bits
+uint16_t valToPwm(int val, int brightness, int bits);
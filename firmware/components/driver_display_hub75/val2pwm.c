@@ -103,9 +103,13 @@ const uint32_t lumConvTab[]={
 
 
 uint16_t valToPwm12(int val, int brightness) {
+    return valToPwm(val, brightness, 12);
+}
+
+uint16_t valToPwm(int val, int brightness, int bits) {
     if (val<0) val=0;
     if (val>255) val=255;
-    return ((uint32_t)brightness*lumConvTab[val])>>20;
+    return ((uint32_t)brightness*lumConvTab[val])>>(32-bits);
 }
 
 #endif
@@ -25,8 +25,14 @@
 #ifdef CONFIG_DRIVER_ILI9341_ENABLE
 
 #define ILI9341_MAX_LINES 8
+#define ILI9341_QUEUE_SIZE 2 //Amount of transfer buffers that can be queued for DMA at the same time
 
-uint8_t *internalBuffer = NULL; //Internal transfer buffer for doing partial updates
+static uint8_t *internalBuffer[ILI9341_QUEUE_SIZE] = {NULL}; //Internal transfer buffers for doing partial updates
+static spi_transaction_t transactions[ILI9341_QUEUE_SIZE];
+static uint8_t transactionIndex = 0;   //Transfer buffer to fill next, buffers are used round-robin
+static uint8_t transactionsPending = 0; //Transactions queued but not yet finished
+
+static const uint8_t dc_level_data = true;
 
 static spi_device_handle_t spi_device = NULL;
 
@@ -71,6 +77,42 @@ esp_err_t driver_ili9341_send(const uint8_t *data, int len, const uint8_t dc_lev
 	return spi_device_transmit(spi_device, &t);
 }
 
+static esp_err_t driver_ili9341_wait_queue(void)
+{ //Wait until all queued transactions are finished
+	esp_err_t res = ESP_OK;
+	spi_transaction_t *result;
+	while (transactionsPending > 0) {
+		esp_err_t err = spi_device_get_trans_result(spi_device, &result, portMAX_DELAY);
+		if (err != ESP_OK) res = err;
+		transactionsPending--;
+	}
+	return res;
+}
+
+static uint8_t* driver_ili9341_get_transfer_buffer(void)
+{ //Get the next transfer buffer, waiting for the oldest transaction if all buffers are in use
+	if (transactionsPending >= ILI9341_QUEUE_SIZE) {
+		spi_transaction_t *result;
+		spi_device_get_trans_result(spi_device, &result, portMAX_DELAY);
+		transactionsPending--;
+	}
+	return internalBuffer[transactionIndex];
+}
+
+static esp_err_t driver_ili9341_queue_data(int len)
+{ //Queue the transfer buffer returned by driver_ili9341_get_transfer_buffer
+	spi_transaction_t *t = &transactions[transactionIndex];
+	memset(t, 0, sizeof(spi_transaction_t));
+	t->length    = len * 8; // transaction length is in bits
+	t->tx_buffer = internalBuffer[transactionIndex];
+	t->user      = (void *) &dc_level_data;
+	esp_err_t res = spi_device_queue_trans(spi_device, t, portMAX_DELAY);
+	if (res != ESP_OK) return res;
+	transactionsPending++;
+	transactionIndex = (transactionIndex + 1) % ILI9341_QUEUE_SIZE;
+	return ESP_OK;
+}
+
 esp_err_t driver_ili9341_receive(uint8_t *data, int len, const uint8_t dc_level)
 {
 	if (len == 0) return ESP_OK;
@@ -261,10 +303,12 @@ esp_err_t driver_ili9341_init(void)
 	res = driver_ili9341_set_backlight(0);
 	if (res != ESP_OK) return res;
 
-	//Allocate partial update buffer
-	if (internalBuffer == NULL) {
-		internalBuffer = heap_caps_malloc(CONFIG_BUS_VSPI_MAX_TRANSFERSIZE, MALLOC_CAP_8BIT);
-		if (!internalBuffer) return ESP_FAIL;
+	//Allocate partial update buffers
+	for (uint8_t i = 0; i < ILI9341_QUEUE_SIZE; i++) {
+		if (internalBuffer[i] == NULL) {
+			internalBuffer[i] = heap_caps_malloc(CONFIG_BUS_VSPI_MAX_TRANSFERSIZE, MALLOC_CAP_DMA | MALLOC_CAP_8BIT);
+			if (!internalBuffer[i]) return ESP_FAIL;
+		}
 	}
 	
 	//Initialize reset GPIO pin
@@ -287,7 +331,7 @@ esp_err_t driver_ili9341_init(void)
 			.clock_speed_hz = CONFIG_DRIVER_ILI9341_SPI_SPEED,
 			.mode           = 0,  // SPI mode 0
 			.spics_io_num   = CONFIG_PIN_NUM_ILI9341_CS,
-			.queue_size     = 1,
+			.queue_size     = ILI9341_QUEUE_SIZE,
 			.flags          = (SPI_DEVICE_HALFDUPLEX | SPI_DEVICE_3WIRE),//SPI_DEVICE_HALFDUPLEX,
 			.pre_cb         = driver_ili9341_spi_pre_transfer_callback, // Specify pre-transfer callback to handle D/C line
 		};
@@ -362,7 +406,7 @@ esp_err_t driver_ili9341_write(const uint8_t *buffer)
 
 esp_err_t driver_ili9341_write_partial_direct(const uint8_t *buffer, uint16_t x0, uint16_t y0, uint16_t x1, uint16_t y1)
 { //Without conversion
-	if (spi_device == NULL || internalBuffer == NULL) return ESP_FAIL;
+	if (spi_device == NULL || internalBuffer[0] == NULL) return ESP_FAIL;
 	if (x0 > x1) return ESP_FAIL;
 	if (y0 > y1) return ESP_FAIL;
 	uint16_t w = x1-x0;
@@ -375,7 +419,7 @@ esp_err_t driver_ili9341_write_partial_direct(const uint8_t *buffer, uint16_t x0
 
 esp_err_t driver_ili9341_write_partial(const uint8_t *frameBuffer, uint16_t x0, uint16_t y0, uint16_t x1, uint16_t y1)
 { //With conversion from framebuffer
-	if (spi_device == NULL || internalBuffer == NULL) return ESP_FAIL;
+	if (spi_device == NULL || internalBuffer[0] == NULL) return ESP_FAIL;
 	esp_err_t res = ESP_OK;
 	if (x0 > x1) {
 		printf("X0 %u > X1 %u\n", x0, x1);
@@ -391,49 +435,44 @@ esp_err_t driver_ili9341_write_partial(const uint8_t *frameBuffer, uint16_t x0,
 	uint16_t w = x1-x0+1;
 	uint16_t h = y1-y0+1;
 
-#if CONFIG_DRIVER_ILI9341_8C
 	while (w > 0) {
 		uint16_t transactionWidth = w;
 		if (transactionWidth*2 > CONFIG_BUS_VSPI_MAX_TRANSFERSIZE) {
 			transactionWidth = CONFIG_BUS_VSPI_MAX_TRANSFERSIZE/2;
 		}
+		uint16_t transactionLines = CONFIG_BUS_VSPI_MAX_TRANSFERSIZE/(transactionWidth*2);
 		res = driver_ili9341_set_addr_window(x0, y0, transactionWidth, h);
 		if (res != ESP_OK) return res;
-		for (uint16_t currentLine = 0; currentLine < h; currentLine++) {
-			for (uint16_t i = 0; i<transactionWidth; i++) {
-				uint8_t color8 = frameBuffer[x0+i+(y0+currentLine)*ILI9341_WIDTH];
-				uint8_t r = color8 & 0x07;
-				uint8_t g = (color8>>3) & 0x07;
-				uint8_t b = color8 >> 6;
-				internalBuffer[i*2+0] = g | (r << 5);
-				internalBuffer[i*2+1] = (b << 3);
-			}
-			res = driver_ili9341_send(internalBuffer, transactionWidth*2, true);
-			if (res != ESP_OK) return res;
-		}
-		w -= transactionWidth;
-		x0 += transactionWidth;
-	}
+		//Fill the next transfer buffer while the previous one is sent using DMA
+		for (uint16_t currentLine = 0; currentLine < h; currentLine += transactionLines) {
+			uint16_t lines = transactionLines;
+			if (currentLine + lines > h) lines = h - currentLine;
+			uint8_t *target = driver_ili9341_get_transfer_buffer();
+			for (uint16_t line = currentLine; line < currentLine + lines; line++) {
+#if CONFIG_DRIVER_ILI9341_8C
+				for (uint16_t i = 0; i<transactionWidth; i++) {
+					uint8_t color8 = frameBuffer[x0+i+(y0+line)*ILI9341_WIDTH];
+					uint8_t r = color8 & 0x07;
+					uint8_t g = (color8>>3) & 0x07;
+					uint8_t b = color8 >> 6;
+					*target++ = g | (r << 5);
+					*target++ = (b << 3);
+				}
 #else
-	while (w > 0) {
-		uint16_t transactionWidth = w;
-		if (transactionWidth*2 > CONFIG_BUS_VSPI_MAX_TRANSFERSIZE) {
-			transactionWidth = CONFIG_BUS_VSPI_MAX_TRANSFERSIZE/2;
-		}
-		res = driver_ili9341_set_addr_window(x0, y0, transactionWidth, h);
-		if (res != ESP_OK) return res;
-		for (uint16_t currentLine = 0; currentLine < h; currentLine++) {
-			for (uint16_t i = 0; i<transactionWidth; i++) {
-				internalBuffer[i*2+0] = frameBuffer[((x0+i)+(y0+currentLine)*ILI9341_WIDTH)*2+0];
-				internalBuffer[i*2+1] = frameBuffer[((x0+i)+(y0+currentLine)*ILI9341_WIDTH)*2+1];
+				memcpy(target, &frameBuffer[(x0+(y0+line)*ILI9341_WIDTH)*2], transactionWidth*2);
+				target += transactionWidth*2;
+#endif
 			}
-			res = driver_ili9341_send(internalBuffer, transactionWidth*2, true);
-			if (res != ESP_OK) return res;
+			res = driver_ili9341_queue_data(lines*transactionWidth*2);
+			if (res != ESP_OK) break;
 		}
+		//The address window for the next column can only be set once the queue is empty
+		esp_err_t waitRes = driver_ili9341_wait_queue();
+		if (res == ESP_OK) res = waitRes;
+		if (res != ESP_OK) return res;
 		w -= transactionWidth;
 		x0 += transactionWidth;
 	}
-#endif
 	return res;
 }
 
@@ -17,6 +17,28 @@
 
 static const char *TAG = "ssd1306";
 
+/*
+ * The buffer is stored column by column, every byte holds 8 rows (a page)
+ * of a column. The display is in vertical addressing mode, which takes the
+ * bytes in the same order for any window of columns and pages, so partial
+ * updates only send the pages of the rows that changed.
+ *
+ * With CONFIG_DRIVER_SSD1306_DIFF a shadow of the display memory is kept
+ * and only the columns with bytes that differ from it are sent. Pixel data
+ * goes out in transactions of CONFIG_DRIVER_SSD1306_I2C_CHUNK bytes, so
+ * other devices on the bus get a turn in between.
+ */
+
+#define SSD1306_PAGES (SSD1306_HEIGHT / 8)
+#define SSD1306_WINDOW_COST 12 // Bytes on the bus to start sending to another window
+
+static uint8_t transfer[CONFIG_DRIVER_SSD1306_I2C_CHUNK];
+
+#ifdef CONFIG_DRIVER_SSD1306_DIFF
+static uint8_t shadow[SSD1306_BUFFER_SIZE]; // Contents of the display memory
+static bool shadow_valid = false;           // False until the whole display was written
+#endif
+
 static inline esp_err_t i2c_command(uint8_t value)
 {
 	esp_err_t res = driver_i2c_write_reg(CONFIG_DRIVER_SSD1306_I2C_BUS, CONFIG_I2C_ADDR_SSD1306, 0x00, value);
@@ -27,9 +49,19 @@ static inline esp_err_t i2c_command(uint8_t value)
 	return res;
 }
 
+static inline esp_err_t i2c_commands(uint8_t* commands, size_t len)
+{
+	esp_err_t res = driver_i2c_write_reg_n(CONFIG_DRIVER_SSD1306_I2C_BUS, CONFIG_I2C_ADDR_SSD1306, 0x00, commands, len);
+	if (res != ESP_OK) {
+		ESP_LOGE(TAG, "i2c write commands(0x%02x): error %d", commands[0], res);
+		return res;
+	}
+	return res;
+}
+
 static inline esp_err_t i2c_data(const uint8_t* buffer, uint16_t len)
 {
-	esp_err_t res = driver_i2c_write_buffer_reg(CONFIG_DRIVER_SSD1306_I2C_BUS, , CONFIG_I2C_ADDR_SSD1306, 0x40, buffer, len);
+	esp_err_t res = driver_i2c_write_buffer_reg(CONFIG_DRIVER_SSD1306_I2C_BUS, CONFIG_I2C_ADDR_SSD1306, 0x40, buffer, len);
 	if (res != ESP_OK) {
 		ESP_LOGE(TAG, "i2c write data: error %d", res);
 		return res;
@@ -37,8 +69,73 @@ static inline esp_err_t i2c_data(const uint8_t* buffer, uint16_t len)
 	return res;
 }
 
+static esp_err_t write_window(const uint8_t *buffer, uint8_t x0, uint8_t x1, uint8_t page0, uint8_t page1)
+{
+	uint8_t window[] = {
+		0x21, x0, x1,      //Column address, start and end
+		0x22, page0, page1 //Page address, start and end
+	};
+	esp_err_t res = i2c_commands(window, sizeof(window));
+	if (res != ESP_OK) return res;
+
+	uint16_t length = 0;
+	for (uint16_t x = x0; x <= x1; x++) {
+		for (uint8_t page = page0; page <= page1; page++) {
+			uint16_t position = x * SSD1306_PAGES + page;
+			transfer[length++] = buffer[position];
+			#ifdef CONFIG_DRIVER_SSD1306_DIFF
+			shadow[position] = buffer[position];
+			#endif
+			if (length == sizeof(transfer)) {
+				res = i2c_data(transfer, length);
+				if (res != ESP_OK) return res;
+				length = 0;
+			}
+		}
+	}
+	if (length > 0) res = i2c_data(transfer, length);
+	return res;
+}
+
+#ifdef CONFIG_DRIVER_SSD1306_DIFF
+static esp_err_t write_changes(const uint8_t *buffer, uint8_t x0, uint8_t x1, uint8_t page0, uint8_t page1)
+{ //Send the columns that changed, runs of unchanged columns that cost less than a new window are sent along
+	int16_t start = -1, end = -1;
+	uint8_t first = 0, last = 0;
+	for (uint16_t x = x0; x <= x1; x++) {
+		int16_t changedFirst = -1, changedLast = -1;
+		for (uint8_t page = page0; page <= page1; page++) {
+			uint16_t position = x * SSD1306_PAGES + page;
+			if (buffer[position] == shadow[position]) continue;
+			if (changedFirst < 0) changedFirst = page;
+			changedLast = page;
+		}
+		if (changedFirst < 0) continue;
+		if ((start >= 0) && ((x - end - 1) * (last - first + 1) > SSD1306_WINDOW_COST)) {
+			esp_err_t res = write_window(buffer, start, end, first, last);
+			if (res != ESP_OK) return res;
+			start = -1;
+		}
+		if (start < 0) {
+			start = x;
+			first = changedFirst;
+			last  = changedLast;
+		} else {
+			if (changedFirst < first) first = changedFirst;
+			if (changedLast > last) last = changedLast;
+		}
+		end = x;
+	}
+	if (start < 0) return ESP_OK;
+	return write_window(buffer, start, end, first, last);
+}
+#endif
+
 esp_err_t driver_ssd1306_reset(void)
 {
+#ifdef CONFIG_DRIVER_SSD1306_DIFF
+	shadow_valid = false;
+#endif
 #if CONFIG_PIN_NUM_SSD1306_RESET >= 0
 	gpio_set_level(CONFIG_PIN_NUM_SSD1306_RESET, false);
 	vTaskDelay(10 / portTICK_PERIOD_MS);
@@ -54,114 +151,115 @@ esp_err_t driver_ssd1306_init(void)
 	gpio_set_direction(CONFIG_PIN_NUM_SSD1306_RESET, GPIO_MODE_OUTPUT);
 	driver_ssd1306_reset();
 #endif
+	esp_err_t res;
 	
 #ifdef CONFIG_SSD1306_12832
-	res=i2c_command(0xae); // SSD1306_DISPLAYOFF
+	res = i2c_command(0xae); // SSD1306_DISPLAYOFF
 	if (res != ESP_OK) return res;
-	res=i2c_command(0xd5); // SSD1306_SETDISPLAYCLOCKDIV
+	res = i2c_command(0xd5); // SSD1306_SETDISPLAYCLOCKDIV
 	if (res != ESP_OK) return res;
-	i2c_command(0xf0); // Sets frequency to highest value and divider to 1 for less flicker
+	res = i2c_command(0xf0); // Sets frequency to highest value and divider to 1 for less flicker
 	if (res != ESP_OK) return res;
-	i2c_command(0xa8); // SSD1306_SETMULTIPLEX
+	res = i2c_command(0xa8); // SSD1306_SETMULTIPLEX
 	if (res != ESP_OK) return res;
-	i2c_command(0x1f); // 1/32
+	res = i2c_command(0x1f); // 1/32
 	if (res != ESP_OK) return res;
-	i2c_command(0xd3); // SSD1306_SETDISPLAYOFFSET
+	res = i2c_command(0xd3); // SSD1306_SETDISPLAYOFFSET
 	if (res != ESP_OK) return res;
-	i2c_command(0x00); // 0 no offset
+	res = i2c_command(0x00); // 0 no offset
 	if (res != ESP_OK) return res;
-	i2c_command(0x40); // SSD1306_SETSTARTLINE line #0
+	res = i2c_command(0x40); // SSD1306_SETSTARTLINE line #0
 	if (res != ESP_OK) return res;
-	i2c_command(0x8d); // SSD1306_CHARGEPUMP
+	res = i2c_command(0x8d); // SSD1306_CHARGEPUMP
 	if (res != ESP_OK) return res;
-	i2c_command(0x14); // Charge pump on
+	res = i2c_command(0x14); // Charge pump on
 	if (res != ESP_OK) return res;
-	i2c_command(0x20); // SSD1306_MEMORYMODE
+	res = i2c_command(0x20); // SSD1306_MEMORYMODE
 	if (res != ESP_OK) return res;
-	i2c_command(0x00); // 0x0 act like ks0108
+	res = i2c_command(0x01); // 0x01 vertical addressing mode, the order of the buffer
 	if (res != ESP_OK) return res;
-	i2c_command(0xa1); // SSD1306_SEGREMAP | 1
+	res = i2c_command(0xa1); // SSD1306_SEGREMAP | 1
 	if (res != ESP_OK) return res;
-	i2c_command(0xc8); // SSD1306_COMSCANDEC
+	res = i2c_command(0xc8); // SSD1306_COMSCANDEC
 	if (res != ESP_OK) return res;
-	i2c_command(0xda); // SSD1306_SETCOMPINS
+	res = i2c_command(0xda); // SSD1306_SETCOMPINS
 	if (res != ESP_OK) return res;
-	i2c_command(0x02);
+	res = i2c_command(0x02);
 	if (res != ESP_OK) return res;
-	i2c_command(0x81); // SSD1306_SETCONTRAST
+	res = i2c_command(0x81); // SSD1306_SETCONTRAST
 	if (res != ESP_OK) return res;
-	i2c_command(0x2f);
+	res = i2c_command(0x2f);
 	if (res != ESP_OK) return res;
-	i2c_command(0xd9); // SSD1306_SETPRECHARGE
+	res = i2c_command(0xd9); // SSD1306_SETPRECHARGE
 	if (res != ESP_OK) return res;
-	i2c_command(0xf1);
+	res = i2c_command(0xf1);
 	if (res != ESP_OK) return res;
-	i2c_command(0xdb); // SSD1306_SETVCOMDETECT
+	res = i2c_command(0xdb); // SSD1306_SETVCOMDETECT
 	if (res != ESP_OK) return res;
-	i2c_command(0x40);
+	res = i2c_command(0x40);
 	if (res != ESP_OK) return res;
-	i2c_command(0x2e); // SSD1306_DEACTIVATE_SCROLL
+	res = i2c_command(0x2e); // SSD1306_DEACTIVATE_SCROLL
 	if (res != ESP_OK) return res;
-	i2c_command(0xa4); // SSD1306_DISPLAYALLON_RESUME
+	res = i2c_command(0xa4); // SSD1306_DISPLAYALLON_RESUME
 	if (res != ESP_OK) return res;
-	i2c_command(0xa6); // SSD1306_NORMALDISPLAY
+	res = i2c_command(0xa6); // SSD1306_NORMALDISPLAY
 	if (res != ESP_OK) return res;
 #else
-	i2c_command(0xae); // SSD1306_DISPLAYOFF
+	res = i2c_command(0xae); // SSD1306_DISPLAYOFF
 	if (res != ESP_OK) return res;
-	i2c_command(0xd5); // SSD1306_SETDISPLAYCLOCKDIV
+	res = i2c_command(0xd5); // SSD1306_SETDISPLAYCLOCKDIV
 	if (res != ESP_OK) return res;
-	i2c_command(0x80); // Suggested value 0x80
+	res = i2c_command(0x80); // Suggested value 0x80
 	if (res != ESP_OK) return res;
-	i2c_command(0xa8); // SSD1306_SETMULTIPLEX
+	res = i2c_command(0xa8); // SSD1306_SETMULTIPLEX
 	if (res != ESP_OK) return res;
-	i2c_command(0x3f); // 1/64
+	res = i2c_command(0x3f); // 1/64
 	if (res != ESP_OK) return res;
-	i2c_command(0xd3); // SSD1306_SETDISPLAYOFFSET
+	res = i2c_command(0xd3); // SSD1306_SETDISPLAYOFFSET
 	if (res != ESP_OK) return res;
-	i2c_command(0x00); // 0 no offset
+	res = i2c_command(0x00); // 0 no offset
 	if (res != ESP_OK) return res;
-	i2c_command(0x40); // SSD1306_SETSTARTLINE line #0
+	res = i2c_command(0x40); // SSD1306_SETSTARTLINE line #0
 	if (res != ESP_OK) return res;
-	i2c_command(0x20); // SSD1306_MEMORYMODE
+	res = i2c_command(0x20); // SSD1306_MEMORYMODE
 	if (res != ESP_OK) return res;
-	i2c_command(0x01); // 0x0 act like ks0108 / 0x01 vertical addressing mode
+	res = i2c_command(0x01); // 0x0 act like ks0108 / 0x01 vertical addressing mode
 	if (res != ESP_OK) return res;
-	i2c_command(0xa1); // SSD1306_SEGREMAP | 1
+	res = i2c_command(0xa1); // SSD1306_SEGREMAP | 1
 	if (res != ESP_OK) return res;
-	i2c_command(0xc8); // SSD1306_COMSCANDEC
+	res = i2c_command(0xc8); // SSD1306_COMSCANDEC
 	if (res != ESP_OK) return res;
-	i2c_command(0xda); // SSD1306_SETCOMPINS
+	res = i2c_command(0xda); // SSD1306_SETCOMPINS
 	if (res != ESP_OK) return res;
-	i2c_command(0x12);
+	res = i2c_command(0x12);
 	if (res != ESP_OK) return res;
-	i2c_command(0x81); // SSD1306_SETCONTRAST
+	res = i2c_command(0x81); // SSD1306_SETCONTRAST
 	if (res != ESP_OK) return res;
-	i2c_command(0xcf);
+	res = i2c_command(0xcf);
 	if (res != ESP_OK) return res;
-	i2c_command(0xd9); // SSD1306_SETPRECHARGE
+	res = i2c_command(0xd9); // SSD1306_SETPRECHARGE
 	if (res != ESP_OK) return res;
-	i2c_command(0xf1);
+	res = i2c_command(0xf1);
 	if (res != ESP_OK) return res;
-	i2c_command(0xdb); // SSD1306_SETVCOMDETECT
+	res = i2c_command(0xdb); // SSD1306_SETVCOMDETECT
 	if (res != ESP_OK) return res;
-	i2c_command(0x30);
+	res = i2c_command(0x30);
 	if (res != ESP_OK) return res;
-	i2c_command(0x8d); // SSD1306_CHARGEPUMP
+	res = i2c_command(0x8d); // SSD1306_CHARGEPUMP
 	if (res != ESP_OK) return res;
-	i2c_command(0x14); // Charge pump on
+	res = i2c_command(0x14); // Charge pump on
 	if (res != ESP_OK) return res;
-	i2c_command(0x2e); // SSD1306_DEACTIVATE_SCROLL
+	res = i2c_command(0x2e); // SSD1306_DEACTIVATE_SCROLL
 	if (res != ESP_OK) return res;
-	i2c_command(0xa4); // SSD1306_DISPLAYALLON_RESUME
+	res = i2c_command(0xa4); // SSD1306_DISPLAYALLON_RESUME
 	if (res != ESP_OK) return res;
-	i2c_command(0xa6); // SSD1306_NORMALDISPLAY
+	res = i2c_command(0xa6); // SSD1306_NORMALDISPLAY
 	if (res != ESP_OK) return res;
 #endif
-	i2c_command(0xaf); // SSD1306_DISPLAYON
+	res = i2c_command(0xaf); // SSD1306_DISPLAYON
 	if (res != ESP_OK) return res;
 	
-	uint8_t buffer[1024] = {0};
+	uint8_t buffer[SSD1306_BUFFER_SIZE] = {0};
 	res = driver_ssd1306_write(buffer); //Clear screen
 	if (res != ESP_OK) return res;
 	return ESP_OK;
@@ -169,47 +267,31 @@ esp_err_t driver_ssd1306_init(void)
 
 esp_err_t driver_ssd1306_write_part(const uint8_t *buffer, int16_t x0, int16_t y0, int16_t x1, int16_t y1)
 {
-	uint16_t addr0 = x0*(SSD1306_HEIGHT/8);
-	uint16_t addr1 = x1*(SSD1306_HEIGHT/8) + (SSD1306_HEIGHT/8);
-	uint16_t length = addr1-addr0;
-	
+	if (x0 < 0) x0 = 0;
+	if (y0 < 0) y0 = 0;
+	if (x1 > SSD1306_WIDTH-1) x1 = SSD1306_WIDTH-1;
+	if (y1 > SSD1306_HEIGHT-1) y1 = SSD1306_HEIGHT-1;
+	if ((x0 > x1) || (y0 > y1)) return ESP_OK;
+
 	esp_err_t res;
-	res = i2c_command(0x21); //Column address
-	if (res != ESP_OK) return res;
-	res = i2c_command(x0); //Column start
-	if (res != ESP_OK) return res;
-	res = i2c_command(x1);//SSD1306_WIDTH-1); //Column end
-	if (res != ESP_OK) return res;
-	res = i2c_command(0x22); //Page address
-	if (res != ESP_OK) return res;
-	res = i2c_command(0); //Page start
-	if (res != ESP_OK) return res;
-	res = i2c_command(7);   //Page end
-	if (res != ESP_OK) return res;
-	res = i2c_data(buffer+addr0, length);
-	if ( res != ESP_OK) return res;
+	#ifdef CONFIG_DRIVER_SSD1306_DIFF
+	if (shadow_valid) {
+		res = write_changes(buffer, x0, x1, y0/8, y1/8);
+		if (res != ESP_OK) shadow_valid = false; //Unknown what the display got
+		return res;
+	}
+	#endif
+	res = write_window(buffer, x0, x1, y0/8, y1/8);
 	return res;
 }
 
 esp_err_t driver_ssd1306_write(const uint8_t *buffer)
 {
-	esp_err_t res;
-	res = i2c_command(0x21); //Column address
-	if (res != ESP_OK) return res;
-	res = i2c_command(   0); //Column start
-	if (res != ESP_OK) return res;
-	res = i2c_command( SSD1306_WIDTH-1); //Column end
+	esp_err_t res = write_window(buffer, 0, SSD1306_WIDTH-1, 0, SSD1306_PAGES-1);
+	#ifdef CONFIG_DRIVER_SSD1306_DIFF
+	shadow_valid = (res == ESP_OK);
+	#endif
 	if (res != ESP_OK) return res;
-	
-	res = i2c_command(0x22); //Page address
-	if (res != ESP_OK) return res;
-	res = i2c_command(0); //Page start
-	if (res != ESP_OK) return res;
-	res = i2c_command(7);   //Page end
-	if (res != ESP_OK) return res;
-	
-	res = i2c_data(buffer, SSD1306_BUFFER_SIZE);
-	if ( res != ESP_OK) return res;
 
 	ESP_LOGD(TAG, "i2c write data ok");
 	return res;
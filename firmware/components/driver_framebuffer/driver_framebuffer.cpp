@@ -4,6 +4,14 @@
  * Renze Nicolai 2019
  */
 
+/* TEST (from this directory, host/ stands in for ESP-IDF):
+ * gcc -o fb_span_test -DDRIVER_FRAMEBUFFER_SPAN_TEST -Wall -g -I host -I png \
+ *     $(find ../driver_display_* ../driver_io_disobey_samd -maxdepth 1 -name include -printf '-I %p ') \
+ *     $(find . host png fonts -maxdepth 1 -name '*.c*') -lstdc++ -lm
+ *
+ * Add -DCONFIG_DRIVER_FRAMEBUFFER_DITHER to compare the dithered spans as well
+ */
+
 #include "sdkconfig.h"
 #include "esp_heap_caps.h"
 #include "esp_log.h"
@@ -14,6 +22,11 @@
 #include "include/driver_framebuffer_internal.h"
 #define TAG "fb"
 
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+
 
 #ifdef CONFIG_DRIVER_FRAMEBUFFER_DOUBLE_BUFFERED
 uint8_t* framebuffer1;
@@ -22,6 +35,9 @@ uint8_t* framebuffer2;
 
 uint8_t* framebuffer;
 
+// Pixel operations for the format of the display.
+const pixel_ops_t* framebuffer_ops;
+
 // Matrix stack for 2D; describes the current transformation and the stack of other transformations.
 matrix_stack_2d stack_2d_global;
 // Matrix stack for 3D.
@@ -33,64 +49,86 @@ depth_buffer_3d depth_buffer_global;
 // Nonzero if the global context is in 3D.
 bool is_3d_global;
 
-/* Color space conversions */
+typedef struct flush_job_t {
+	uint8_t* buffer;       // Buffer to send to the display
+	uint32_t eink_flags;   // Display specific flags
+	bool     greyscale;    // Use the greyscale flush function of the display
+	uint8_t  regions;      // Amount of dirty regions
+	int16_t  area[CONFIG_DRIVER_FRAMEBUFFER_DIRTY_REGIONS][4]; // Dirty regions (x0, y0, x1, y1)
+} flush_job_t;
+
+// Serializes drawing and flushing between tasks, taken recursively by the public functions.
+SemaphoreHandle_t framebuffer_lock = NULL;
+
+#ifdef CONFIG_DRIVER_FRAMEBUFFER_ASYNC_FLUSH
+// The core MicroPython does not run on, core 0 on single core boards.
+#define FLUSH_CORE (portNUM_PROCESSORS - 1)
+// Flush jobs waiting for the flush task.
+QueueHandle_t flush_queue = NULL;
+// Taken while the flush task is sending a buffer to the display.
+SemaphoreHandle_t flush_idle = NULL;
+#endif
 
-inline uint16_t convert24to16(uint32_t in) //RGB24 to 565
+void _flush_job(flush_job_t* job)
 {
-#ifdef CONFIG_DRIVER_FRAMEBUFFER_SWAP_R_AND_B
-	uint8_t b = (in>>16)&0xFF;
-	uint8_t r = in&0xFF;
-#else
-	uint8_t r = (in>>16)&0xFF;
-	uint8_t b = in&0xFF;
-#endif
-	uint8_t g = (in>>8)&0xFF;
-	return ((b & 0b11111000) << 8) | ((g & 0b11111100) << 3) | (r >> 3);
+	#ifdef FB_FLUSH_GS
+	if (job->greyscale) {
+		FB_FLUSH_GS(job->buffer, job->eink_flags);
+		return;
+	}
+	#endif
+	for (uint8_t i = 0; i < job->regions; i++) {
+		FB_FLUSH(job->buffer, job->eink_flags, job->area[i][0], job->area[i][1], job->area[i][2], job->area[i][3]);
+	}
 }
 
-inline uint8_t convert24to8C(uint32_t in) //RGB24 to 256-color
+#ifdef CONFIG_DRIVER_FRAMEBUFFER_ASYNC_FLUSH
+void _flush_task(void* arg)
 {
-#ifdef CONFIG_DRIVER_FRAMEBUFFER_SWAP_R_AND_B
-	uint8_t r = ((in>>16)&0xFF) >> 5;
-	uint8_t b = ( in     &0xFF) >> 6;
-#else
-	uint8_t b = ((in>>16)&0xFF) >> 5;
-	uint8_t r = ( in     &0xFF) >> 6;
-#endif
-	uint8_t g = ((in>> 8)&0xFF) >> 5;
-	return r | (g<<3) | (b<<6);
+	flush_job_t job;
+	while (true) {
+		if (xQueueReceive(flush_queue, &job, portMAX_DELAY) != pdTRUE) continue;
+		_flush_job(&job);
+		xSemaphoreGive(flush_idle);
+	}
 }
+#endif
 
-inline uint32_t convert8Cto24(uint8_t in) //256-color to RGB24
+void driver_framebuffer_lock()
 {
-#ifdef CONFIG_DRIVER_FRAMEBUFFER_SWAP_R_AND_B
-	uint8_t b = in & 0x07;
-	uint8_t r = in >> 6;
-#else
-	uint8_t r = in & 0x07;
-	uint8_t b = in >> 6;
-#endif
-	uint8_t g = (in>>3) & 0x07;
-	return b | (g << 8) | (r << 16);
+	#ifdef CONFIG_LIB3D_ENABLE
+	//Triangles queued by this task are drawn before anything else, the rasterizer takes the lock for them
+	driver_framebuffer_tri3d_wait();
+	#endif
+	if (framebuffer_lock) xSemaphoreTakeRecursive(framebuffer_lock, portMAX_DELAY);
 }
 
-inline uint8_t convert24to8(uint32_t in) //RGB24 to 8-bit greyscale
+void driver_framebuffer_unlock()
 {
-#ifdef CONFIG_DRIVER_FRAMEBUFFER_SWAP_R_AND_B
-	uint8_t b = (in>>16)&0xFF;
-	uint8_t r = in&0xFF;
-#else
-	uint8_t r = (in>>16)&0xFF;
-	uint8_t b = in&0xFF;
-#endif
-	uint8_t g = (in>>8)&0xFF;
-	return ( r + g + b + 1 ) / 3;
+	if (framebuffer_lock) xSemaphoreGiveRecursive(framebuffer_lock);
 }
 
-inline bool convert8to1(uint8_t in) //8-bit greyscale to black&white
+bool driver_framebuffer_lock_held()
 {
-	return in >= 128;
+	return framebuffer_lock && (xSemaphoreGetMutexHolder(framebuffer_lock) == xTaskGetCurrentTaskHandle());
+}
+
+#ifdef CONFIG_DRIVER_FRAMEBUFFER_DOUBLE_BUFFERED
+void _copy_rows(uint8_t* target, const uint8_t* source, int16_t y0, int16_t y1)
+{ //Copy the rows y0 to y1 (inclusive) from one framebuffer to the other
+	#if defined(FB_TYPE_12BPP) || defined(FB_1BPP_VERT2) || defined(FB_1BPP_OHS)
+		memcpy(target, source, FB_SIZE); //Not stored row by row
+	#else
+		#if defined(FB_1BPP_VERT)
+			y0 &= ~7; //Rows are stored in pages of 8
+		#endif
+		uint32_t start = driver_framebuffer_format_size(FB_FORMAT_NATIVE, FB_WIDTH, y0);
+		uint32_t end   = driver_framebuffer_format_size(FB_FORMAT_NATIVE, FB_WIDTH, y1 + 1);
+		if (end > FB_SIZE) end = FB_SIZE;
+		if (end > start) memcpy(target + start, source + start, end - start);
+	#endif
 }
+#endif
 
 esp_err_t driver_framebuffer_init()
 {
@@ -98,6 +136,14 @@ esp_err_t driver_framebuffer_init()
 	if (driver_framebuffer_init_done) return ESP_OK;
 	ESP_LOGD(TAG, "init called");
 
+	framebuffer_lock = xSemaphoreCreateRecursiveMutex();
+	if (!framebuffer_lock) {
+		ESP_LOGE(TAG, "Unable to allocate the framebuffer lock.");
+		return ESP_FAIL;
+	}
+
+	framebuffer_ops = driver_framebuffer_format_ops(FB_FORMAT_NATIVE);
+
 	#ifdef CONFIG_DRIVER_FRAMEBUFFER_DOUBLE_BUFFERED
 		ESP_LOGI(TAG, "Allocating %u bytes for framebuffer 1", FB_SIZE);
 		#ifdef CONFIG_DRIVER_FRAMEBUFFER_SPIRAM
@@ -140,6 +186,16 @@ esp_err_t driver_framebuffer_init()
 	matrix_stack_2d_init(&stack_2d_global);
 	#endif
 
+	#ifdef CONFIG_DRIVER_FRAMEBUFFER_ASYNC_FLUSH
+		flush_queue = xQueueCreate(1, sizeof(flush_job_t));
+		flush_idle  = xSemaphoreCreateBinary();
+		if ((!flush_queue) || (!flush_idle)) return ESP_FAIL;
+		xSemaphoreGive(flush_idle);
+		//MicroPython runs on core 0, the flush task runs next to it on core 1 (or shares core 0 on single core boards). It mostly
+		//waits for DMA transfers, above the priority of MicroPython and the 3D rasterizer it starts the next transfer as soon as one is done
+		if (xTaskCreatePinnedToCore(&_flush_task, "fb_flush", 4096, NULL, 10, NULL, FLUSH_CORE) != pdPASS) return ESP_FAIL;
+	#endif
+
 	//driver_framebuffer_flush(FB_FLAG_FORCE | FB_FLAG_FULL);
 	//driver_framebuffer_fill(NULL, COLOR_FILL_DEFAULT); //2nd framebuffer
 	driver_framebuffer_set_orientation_angle(NULL, 0); //Apply global orientation (needed for flip)
@@ -148,13 +204,14 @@ esp_err_t driver_framebuffer_init()
 	return ESP_OK;
 }
 
-bool _getFrameContext(Window* window, uint8_t** buffer, int16_t* width, int16_t* height)
+bool _getFrameContext(Window* window, uint8_t** buffer, int16_t* width, int16_t* height, const pixel_ops_t** ops)
 {
 	if (window == NULL) {
 		//No window provided, use global context
 		*width = FB_WIDTH;
 		*height = FB_HEIGHT;
 		*buffer = framebuffer;
+		*ops = framebuffer_ops;
 		if (!framebuffer) {
 			ESP_LOGE(TAG, "Framebuffer not allocated!");
 			return false;
@@ -163,304 +220,449 @@ bool _getFrameContext(Window* window, uint8_t** buffer, int16_t* width, int16_t*
 		*width  = window->width;
 		*height = window->height;
 		*buffer = window->buffer;
+		*ops = window->pixelOps;
 	}
 	return true;
 }
 
+bool _buffer_rect(Window* window, int16_t x, int16_t y, int16_t w, int16_t h, int16_t* area)
+{ //Store the buffer area covered by a rectangle, returns false if none of it is visible
+	//Clip against the user-facing (oriented) size
+	orientation_map_t map;
+	driver_framebuffer_orientation_map(window, &map);
+	int32_t x0 = x, y0 = y, x1 = (int32_t) x + w - 1, y1 = (int32_t) y + h - 1;
+	if (x0 < 0) x0 = 0;
+	if (y0 < 0) y0 = 0;
+	if (x1 >= map.width)  x1 = map.width  - 1;
+	if (y1 >= map.height) y1 = map.height - 1;
+	if ((x0 > x1) || (y0 > y1)) return false;
+
+	//Rotating an axis-aligned rectangle gives an axis-aligned rectangle, so mapping two corners is enough
+	int16_t bx0 = map.x + map.pixelX * x0 + map.rowX * y0, by0 = map.y + map.pixelY * x0 + map.rowY * y0;
+	int16_t bx1 = map.x + map.pixelX * x1 + map.rowX * y1, by1 = map.y + map.pixelY * x1 + map.rowY * y1;
+	if (bx0 > bx1) { int16_t t = bx0; bx0 = bx1; bx1 = t; }
+	if (by0 > by1) { int16_t t = by0; by0 = by1; by1 = t; }
+
+	area[0] = bx0;
+	area[1] = by0;
+	area[2] = bx1;
+	area[3] = by1;
+	return true;
+}
+
+bool _blend_rect(Window* window, int16_t x, int16_t y, int16_t w, int16_t h, uint32_t value, uint8_t alpha, int16_t* area)
+{ //Draw a rectangle and store the buffer area it covers, the caller marks that area as changed
+	if (alpha == 0) return false;
+	uint8_t* buffer; int16_t width, height; const pixel_ops_t* ops;
+	if (!_getFrameContext(window, &buffer, &width, &height, &ops)) return false;
+	if (!_buffer_rect(window, x, y, w, h, area)) return false;
+	int16_t bx0 = area[0], by0 = area[1], bx1 = area[2], by1 = area[3];
+
+	uint32_t pattern[16];
+	if ((alpha == 255) && driver_framebuffer_dither_pattern(ops, value, pattern)) {
+		//A color the format can not show is stored a pixel at a time, following the ordered pattern
+		for (int16_t row = by0; row <= by1; row++) {
+			for (int16_t column = bx0; column <= bx1; column++) ops->store(buffer, width, height, column, row, pattern[((row & 3) << 2) | (column & 3)]);
+		}
+		return true;
+	}
+	value = ops->encode(value);
+	if (alpha < 255) {
+		for (int16_t row = by0; row <= by1; row++) ops->hblend(buffer, width, height, bx0, bx1, row, value, alpha);
+	} else if (ops->packedVertically) {
+		for (int16_t column = bx0; column <= bx1; column++) ops->vspan(buffer, width, height, column, by0, by1, value);
+	} else {
+		for (int16_t row = by0; row <= by1; row++) ops->hspan(buffer, width, height, bx0, bx1, row, value);
+	}
+	return true;
+}
+
+void driver_framebuffer_fill_rect(Window* window, int16_t x, int16_t y, int16_t w, int16_t h, uint32_t value)
+{
+	driver_framebuffer_blend_rect(window, x, y, w, h, value, 255);
+}
+
+void driver_framebuffer_blend_rect(Window* window, int16_t x, int16_t y, int16_t w, int16_t h, uint32_t value, uint8_t alpha)
+{
+	framebuffer_lock_t lock;
+	int16_t area[4];
+	if (!_blend_rect(window, x, y, w, h, value, alpha, area)) return;
+	if (!window) {
+		driver_framebuffer_set_dirty_area(area[0], area[1], area[2], area[3], false);
+	} else {
+		window->changed = true;
+	}
+}
+
+void driver_framebuffer_mark_rect(Window* window, int16_t x, int16_t y, int16_t w, int16_t h)
+{
+	framebuffer_lock_t lock;
+	int16_t area[4];
+	if (!_buffer_rect(window, x, y, w, h, area)) return;
+	if (!window) {
+		driver_framebuffer_set_dirty_area(area[0], area[1], area[2], area[3], false);
+	} else {
+		window->changed = true;
+	}
+}
+
+void driver_framebuffer_fill_rect_unmarked(Window* window, int16_t x, int16_t y, int16_t w, int16_t h, uint32_t value)
+{
+	framebuffer_lock_t lock;
+	int16_t area[4];
+	_blend_rect(window, x, y, w, h, value, 255, area);
+}
+
+void driver_framebuffer_hline(Window* window, int16_t x, int16_t y, int16_t length, uint32_t value)
+{
+	driver_framebuffer_fill_rect(window, x, y, length, 1, value);
+}
+
+void driver_framebuffer_vline(Window* window, int16_t x, int16_t y, int16_t length, uint32_t value)
+{
+	driver_framebuffer_fill_rect(window, x, y, 1, length, value);
+}
+
 void driver_framebuffer_fill(Window* window, uint32_t value)
 {
-	uint8_t* buffer;
-	int16_t width, height;
-	if (!_getFrameContext(window, &buffer, &width, &height)) return;
-	if (!window) driver_framebuffer_set_dirty_area(0,0,width-1,height-1, true);
-
-	#if   defined(FB_TYPE_1BPP)
-		memset(buffer, convert8to1(convert24to8(value)) ? 0xFF : 0x00, (width*height)/8);
-	#elif defined(FB_TYPE_8BPP)
-		memset(buffer, convert24to8(value), width*height);
-	#elif defined(FB_TYPE_12BPP)
-		#ifdef CONFIG_DRIVER_FRAMEBUFFER_SWAP_R_AND_B
-			uint8_t r = (value >> 20) &0x0F;
-			uint8_t b = (value >> 04) &0x0F;
-		#else
-			uint8_t b = (value >> 20) &0x0F;
-			uint8_t r = (value >> 04) &0x0F;
-		#endif
-		uint8_t g = (value >> 12) &0x0F;
-		for (uint32_t position = 0; position < width*height; position++) {
-			#elif defined(FB_TYPE_12BPP)
-			uint32_t positionBits = (x+(y*width))*12;
-			uint32_t positionByte = positionBits/8;
-			uint8_t positionBit = positionBits % 8;
-			switch(positionBit) {
-				case 0:
-					buffer[positionByte+0] = (r<<4) | g;
-					buffer[positionByte+1] = (b<<4) | (buffer[positionByte+1]&0x0F);
-					break;
-				case 4:
-					buffer[positionByte+0] = (buffer[positionByte+0]&0xF0) | r;
-					buffer[positionByte+1] = (g<<4) | b;
-					break;
-				default:
-					printf("??? %u, %u: %u = %u(%u)\n", x,y,positionBits, positionByte, positionBit);
-			}
-		}
-	#elif defined(FB_TYPE_16BPP)
-		value = convert24to16(value);
-		uint8_t c0 = (value>>8)&0xFF;
-		uint8_t c1 = value&0xFF;
-		for (uint32_t i = 0; i < width*height*2; i+=2) {
-			buffer[i + 0] = c0;
-			buffer[i + 1] = c1;
-		}
-	#elif defined(FB_TYPE_8CBPP)
-		value = convert24to8C(value);
-		for (uint32_t i = 0; i < width*height; i++) {
-			buffer[i] = value;
-		}
-	#elif defined(FB_TYPE_24BPP)
-		#ifdef CONFIG_DRIVER_FRAMEBUFFER_SWAP_R_AND_B
-			uint8_t b = (value>>16)&0xFF;
-			uint8_t r = value&0xFF;
-		#else
-			uint8_t r = (value>>16)&0xFF;
-			uint8_t b = value&0xFF;
-		#endif
-		uint8_t g = (value>>8)&0xFF;
-		for (uint32_t i = 0; i < width*height*3; i+=3) {
-			buffer[i + 0] = r;
-			buffer[i + 1] = g;
-			buffer[i + 2] = b;
-		}
-	#elif defined(FB_TYPE_32BPP)
-		#ifdef CONFIG_DRIVER_FRAMEBUFFER_SWAP_R_AND_B
-			uint8_t b = (value>>16)&0xFF;
-			uint8_t r = value&0xFF;
-		#else
-			uint8_t r = (value>>16)&0xFF;
-			uint8_t b = value&0xFF;
-		#endif
-		uint8_t g = (value>>8)&0xFF;
-		uint8_t a = (value>>24)&0xFF;
-		for (uint32_t i = 0; i < width*height*4; i+=4) {
-			buffer[i + 0] = a;
-			buffer[i + 1] = b;
-			buffer[i + 2] = g;
-			buffer[i + 3] = r;
+	framebuffer_lock_t lock;
+	uint8_t* buffer; int16_t width, height; const pixel_ops_t* ops;
+	if (!_getFrameContext(window, &buffer, &width, &height, &ops)) return;
+	if (!window) {
+		driver_framebuffer_set_dirty_area(0,0,width-1,height-1, true);
+	} else {
+		window->changed = true;
+	}
+	uint32_t pattern[16];
+	if (driver_framebuffer_dither_pattern(ops, value, pattern)) {
+		for (int16_t row = 0; row < height; row++) {
+			for (int16_t column = 0; column < width; column++) ops->store(buffer, width, height, column, row, pattern[((row & 3) << 2) | (column & 3)]);
 		}
-	#else
-		#error "No framebuffer type configured."
-	#endif
+		return;
+	}
+	ops->fill(buffer, width, height, ops->encode(value));
 }
 
 void driver_framebuffer_setPixel(Window* window, int16_t x, int16_t y, uint32_t value)
 {
-	uint8_t* buffer; int16_t width, height;
-	if (!_getFrameContext(window, &buffer, &width, &height)) return;
+	framebuffer_lock_t lock;
+	uint8_t* buffer; int16_t width, height; const pixel_ops_t* ops;
+	if (!_getFrameContext(window, &buffer, &width, &height, &ops)) return;
 	if (!driver_framebuffer_orientation_apply(window, &x, &y)) return;
-	bool changed = false;
-	#if defined(FB_TYPE_1BPP)
-		value = convert8to1(convert24to8(value));
-		#if defined(FB_1BPP_VERT)
-			// A byte consists of 8 vertical pixels,
-			// each byte is placed next to each other horizontally
-			uint32_t position = ( (y / 8) * width) + x;
-			uint8_t  bit      = y % 8;
-		#elif defined(FB_1BPP_VERT2)
-			// TODO: description
-			uint32_t position = (y/8) + (x*height/8);
-			uint8_t  bit      = y % 8;
-		#elif defined(FB_1BPP_OHS)
-			// TODO: description
-			uint32_t position = ((width-x-1) + y * width) / 8;
-			uint8_t  bit      = x % 8;
-		#else
-			// TODO: description
-			uint32_t position = (y * (width/8)) + (x / 8);
-			uint8_t  bit      = x % 8;
-		#endif
-
-		uint8_t oldVal = buffer[position];
-		if (value) {
-			buffer[position] |= 1UL << bit;
-		} else {
-			buffer[position] &= ~(1UL << bit);
-		}
-		if (oldVal != buffer[position]) changed = true;
-	#elif defined(FB_TYPE_8BPP)
-		value = convert24to8(value);
-		uint32_t position = (y * width) + x;
-		if (buffer[position] != value) changed = true;
-		buffer[position] = value;
-	#elif defined(FB_TYPE_12BPP)
-		//12-bit (RRRRGGGGBBBB)
-		uint32_t positionBits = (x+(y*width))*12;
-		uint32_t positionByte = positionBits/8;
-		uint8_t positionBit = positionBits % 8;
-
-		uint8_t r = (value >> 20) &0x0F;
-		uint8_t g = (value >> 12) &0x0F;
-		uint8_t b = (value >> 04) &0x0F;
-
-		switch(positionBit) {
-			case 0:
-				buffer[positionByte+0] = (r<<4) | g;
-				buffer[positionByte+1] = (b<<4) | (buffer[positionByte+1]&0x0F);
-				break;
-			case 4:
-				buffer[positionByte+0] = (buffer[positionByte+0]&0xF0) | r;
-				buffer[positionByte+1] = (g<<4) | b;
-				break;
-			default:
-				printf("??? %u, %u: %u = %u(%u)\n", x,y,positionBits, positionByte, positionBit);
-		}
-	#elif defined(FB_TYPE_16BPP)
-		value = convert24to16(value);
-		uint8_t c0 = (value>>8)&0xFF;
-		uint8_t c1 = value&0xFF;
-		uint32_t position = (y * width * 2) + (x * 2);
-		if (buffer[position + 0] != c0 || buffer[position + 1] != c1) changed = true;
-		buffer[position + 0] = c0;
-		buffer[position + 1] = c1;
-	#elif defined(FB_TYPE_8CBPP)
-		uint32_t position = (y * width) + x;
-		value = convert24to8C(value);
-		if (value != buffer[position]) changed = true;
-		buffer[position] = value;
-	#elif defined(FB_TYPE_24BPP)
-		uint8_t r = (value>>16)&0xFF;
-		uint8_t g = (value>>8)&0xFF;
-		uint8_t b = value&0xFF;
-		uint32_t position = (y * width * 3) + (x * 3);
-		if (buffer[position + 0] != r || buffer[position + 1] != g || buffer[position + 2] != b) changed = true;
-		buffer[position + 0] = r;
-		buffer[position + 1] = g;
-		buffer[position + 2] = b;
-	#elif defined(FB_TYPE_32BPP)
-		uint8_t a = (value>>24)&0xFF;
-		uint8_t r = (value>>16)&0xFF;
-		uint8_t g = (value>>8)&0xFF;
-		uint8_t b = value&0xFF;
-		uint32_t position = (y * width * 4) + (x * 4);
-		if (buffer[position + 0] != a || buffer[position + 1] != b || buffer[position + 2] != g || buffer[position + 3] != r) changed = true;
-		buffer[position + 0] = a;
-		buffer[position + 1] = b;
-		buffer[position + 2] = g;
-		buffer[position + 3] = r;
-	#else
-		#error "No framebuffer type configured."
-	#endif
+	bool changed = ops->store(buffer, width, height, x, y, driver_framebuffer_dither_value(ops, value, x, y));
+	if (!changed) return;
+	if (!window) {
+		driver_framebuffer_set_dirty_area(x,y,x,y,false);
+	} else {
+		window->changed = true;
+	}
+}
 
-	if ((!window) && changed) driver_framebuffer_set_dirty_area(x,y,x,y,false);
+void driver_framebuffer_blendPixel(Window* window, int16_t x, int16_t y, uint32_t value, uint8_t alpha)
+{
+	framebuffer_lock_t lock;
+	if (alpha == 0) return;
+	uint8_t* buffer; int16_t width, height; const pixel_ops_t* ops;
+	if (!_getFrameContext(window, &buffer, &width, &height, &ops)) return;
+	if (!driver_framebuffer_orientation_apply(window, &x, &y)) return;
+	bool changed = ops->blend(buffer, width, height, x, y, ops->encode(value), alpha);
+	if (!changed) return;
+	if (!window) {
+		driver_framebuffer_set_dirty_area(x,y,x,y,false);
+	} else {
+		window->changed = true;
+	}
 }
 
 uint32_t driver_framebuffer_getPixel(Window* window, int16_t x, int16_t y)
 {
-	uint8_t* buffer; int16_t width, height;
-	if (!_getFrameContext(window, &buffer, &width, &height)) return 0;
+	framebuffer_lock_t lock;
+	uint8_t* buffer; int16_t width, height; const pixel_ops_t* ops;
+	if (!_getFrameContext(window, &buffer, &width, &height, &ops)) return 0;
 	if (!driver_framebuffer_orientation_apply(window, &x, &y)) return 0;
+	return ops->load(buffer, width, height, x, y);
+}
 
-	#if defined(FB_TYPE_1BPP)
-		#ifndef FB_1BPP_VERT
-			#if defined(FB_1BPP_OHS)
-			#warning "USING OHS!!"
-				uint32_t position = ((width-x-1) + y * width) / 8;
-				uint8_t  bit      = x % 8;
-			#elif defined(FB_1BPP_VERT2)
-				#warning "USING VERT2!"
-				uint32_t position = (y/8) + (x*height/8);
-				uint8_t  bit      = y % 8;
-			#else
-			#warning "USING HORI!"
-				uint32_t position = (y * (width/8)) + (x / 8);
-				uint8_t  bit      = x % 8;
-			#endif
-		#else
-			#warning "USING VERT!"
-			uint32_t position = ( (y / 8) * width) + x;
-			uint8_t  bit      = y % 8;
-		#endif
-		if ((buffer[position] >> bit) & 0x01) {
-			return 0xFFFFFF;
+const pixel_ops_t* driver_framebuffer_get_ops(Window* window)
+{
+	uint8_t* buffer; int16_t width, height; const pixel_ops_t* ops;
+	if (!_getFrameContext(window, &buffer, &width, &height, &ops)) return NULL;
+	return ops;
+}
+
+bool _blit_clip(Window* source, Window* target, int16_t* x0, int16_t* y0, int16_t* x1, int16_t* y1)
+{
+	//Clip the drawing area of the window against the window itself and against the target, in window coordinates
+	int16_t sourceWidth, sourceHeight, targetWidth, targetHeight;
+	driver_framebuffer_get_orientation_size(source, &sourceWidth, &sourceHeight);
+	driver_framebuffer_get_orientation_size(target, &targetWidth, &targetHeight);
+	if (source->width  < sourceWidth)  sourceWidth  = source->width;
+	if (source->height < sourceHeight) sourceHeight = source->height;
+	int32_t cx0 = source->hOffset, cy0 = source->vOffset;
+	int32_t cx1 = (int32_t) source->drawWidth - 1, cy1 = (int32_t) source->drawHeight - 1;
+	if (cx0 < 0) cx0 = 0;
+	if (cy0 < 0) cy0 = 0;
+	if (cx0 < -source->x) cx0 = -source->x;
+	if (cy0 < -source->y) cy0 = -source->y;
+	if (cx1 >= sourceWidth)  cx1 = sourceWidth  - 1;
+	if (cy1 >= sourceHeight) cy1 = sourceHeight - 1;
+	if (cx1 >= targetWidth  - source->x) cx1 = targetWidth  - source->x - 1;
+	if (cy1 >= targetHeight - source->y) cy1 = targetHeight - source->y - 1;
+	if ((cx0 > cx1) || (cy0 > cy1)) return false;
+	*x0 = cx0; *y0 = cy0; *x1 = cx1; *y1 = cy1;
+	return true;
+}
+
+void _blit_walk(Window* window, int16_t x, int16_t y, orientation_map_t* walk)
+{
+	//Orientation maps a row of the window onto a row or a column of the buffer, which only needs to be worked out once,
+	//the walk starts at the buffer position of (x, y) and keeps the steps of the orientation
+	driver_framebuffer_orientation_map(window, walk);
+	walk->x += walk->pixelX * x + walk->rowX * y;
+	walk->y += walk->pixelY * x + walk->rowY * y;
+}
+
+void driver_framebuffer_blit_key(Window* source, Window* target, const uint8_t* key)
+{
+	framebuffer_lock_t lock;
+	uint8_t* sourceBuffer; int16_t sourceWidth, sourceHeight; const pixel_ops_t* sourceOps;
+	uint8_t* targetBuffer; int16_t targetWidth, targetHeight; const pixel_ops_t* targetOps;
+	if (!_getFrameContext(source, &sourceBuffer, &sourceWidth, &sourceHeight, &sourceOps)) return;
+	if (!_getFrameContext(target, &targetBuffer, &targetWidth, &targetHeight, &targetOps)) return;
+
+	int16_t x0, y0, x1, y1;
+	if (!_blit_clip(source, target, &x0, &y0, &x1, &y1)) return;
+	int16_t count = x1 - x0 + 1;
+
+	orientation_map_t from, to;
+	_blit_walk(source, x0, y0, &from);
+	_blit_walk(target, source->x + x0, source->y + y0, &to);
+
+	//Rows can be copied as they are when both buffers store them the same way, stored pixels can be copied when only the orientation differs
+	uint8_t pixelBytes = sourceOps->bitsPerPixel / 8;
+	bool bytes = (sourceOps == targetOps) && ((sourceOps->bitsPerPixel % 8) == 0);
+	bool raw = bytes && (from.pixelX == 1) && (from.pixelY == 0) && (to.pixelX == 1) && (to.pixelY == 0);
+
+	//Stored pixels are walked with constant steps through memory, whatever the orientation of either buffer
+	const uint8_t* inRow = bytes ? &sourceBuffer[((int32_t) from.y * sourceWidth + from.x) * pixelBytes] : NULL;
+	uint8_t* outRow = bytes ? &targetBuffer[((int32_t) to.y * targetWidth + to.x) * pixelBytes] : NULL;
+	int32_t inPixel  = ((int32_t) from.pixelY * sourceWidth + from.pixelX) * pixelBytes;
+	int32_t inNext   = ((int32_t) from.rowY   * sourceWidth + from.rowX)   * pixelBytes;
+	int32_t outPixel = ((int32_t) to.pixelY   * targetWidth + to.pixelX)   * pixelBytes;
+	int32_t outNext  = ((int32_t) to.rowY     * targetWidth + to.rowX)     * pixelBytes;
+
+	bool keyed = (key != NULL);
+	uint32_t keyColor = keyed ? sourceOps->load(key, 1, 1, 0, 0) : 0;
+
+	int16_t dirtyX0 = INT16_MAX, dirtyY0 = INT16_MAX, dirtyX1 = INT16_MIN, dirtyY1 = INT16_MIN;
+	for (int16_t row = y0; row <= y1; row++) {
+		bool changed = false;
+		if (raw) {
+			const uint8_t* in = inRow;
+			uint8_t* out = outRow;
+			if (!keyed) {
+				if (memcmp(out, in, count * pixelBytes) != 0) {
+					memcpy(out, in, count * pixelBytes);
+					changed = true;
+				}
+			} else {
+				for (int16_t i = 0; i < count; i++, in += pixelBytes, out += pixelBytes) {
+					if (memcmp(in, key, pixelBytes) == 0) continue; //Transparent
+					if (memcmp(out, in, pixelBytes) == 0) continue; //Unchanged
+					memcpy(out, in, pixelBytes);
+					changed = true;
+				}
+			}
+		} else if (bytes) {
+			const uint8_t* in = inRow;
+			uint8_t* out = outRow;
+			for (int16_t i = 0; i < count; i++, in += inPixel, out += outPixel) {
+				if (!(keyed && (memcmp(in, key, pixelBytes) == 0)) && (memcmp(out, in, pixelBytes) != 0)) {
+					memcpy(out, in, pixelBytes);
+					changed = true;
+				}
+			}
 		} else {
-			return 0x000000;
+			int16_t sx = from.x, sy = from.y, tx = to.x, ty = to.y;
+			for (int16_t i = 0; i < count; i++) {
+				uint32_t color = sourceOps->load(sourceBuffer, sourceWidth, sourceHeight, sx, sy);
+				if (!(keyed && (color == keyColor))) {
+					changed |= targetOps->store(targetBuffer, targetWidth, targetHeight, tx, ty, driver_framebuffer_dither_value(targetOps, color, tx, ty));
+				}
+				sx += from.pixelX; sy += from.pixelY;
+				tx += to.pixelX;   ty += to.pixelY;
+			}
 		}
-	#elif defined(FB_TYPE_8BPP)
-		uint32_t position = (y * width) + x;
-		return (buffer[position] << 16) + (buffer[position]<<8) + buffer[position];
-	#elif defined(FB_TYPE_12BPP)
-		//12-bit (RRRRGGGGBBBB)
-		uint32_t positionBits = (x+(y*width))*12;
-		uint32_t positionByte = positionBits/8;
-		uint8_t positionBit = positionBits % 8;
-
-		uint8_t r = 0;
-		uint8_t g = 0;
-		uint8_t b = 0;
-
-		switch(positionBit) {
-			case 0:
-				r = (buffer[positionByte+0] & 0xF0);
-				g = (buffer[positionByte+0] << 4);
-				b = (buffer[positionByte+1] & 0xF0);
-				break;
-			case 4:
-				r = (buffer[positionByte+0] << 4);
-				g = (buffer[positionByte+1] & 0xF0);
-				b = (buffer[positionByte+1] << 4);
-				break;
-			default:
-				printf("??? %u, %u: %u = %u(%u)\n", x,y,positionBits, positionByte, positionBit);
+		if (changed) {
+			int16_t endX = to.x + to.pixelX * (count - 1), endY = to.y + to.pixelY * (count - 1);
+			if (to.x   < dirtyX0) dirtyX0 = to.x;
+			if (endX   < dirtyX0) dirtyX0 = endX;
+			if (to.y   < dirtyY0) dirtyY0 = to.y;
+			if (endY   < dirtyY0) dirtyY0 = endY;
+			if (to.x   > dirtyX1) dirtyX1 = to.x;
+			if (endX   > dirtyX1) dirtyX1 = endX;
+			if (to.y   > dirtyY1) dirtyY1 = to.y;
+			if (endY   > dirtyY1) dirtyY1 = endY;
 		}
-	#elif defined(FB_TYPE_16BPP)
-		uint32_t position = (y * width * 2) + (x * 2);
-		uint32_t color = (buffer[position] << 8) + (buffer[position + 1]);
-		uint8_t r = ((((color >> 11) & 0x1F) * 527) + 23) >> 6;
-		uint8_t g = ((((color >> 5 ) & 0x3F) * 259) + 33) >> 6;
-		uint8_t b = ((((color      ) & 0x1F) * 527) + 23) >> 6;
-		return r << 16 | g << 8 | b;
-	#elif defined(FB_TYPE_8CBPP)
-		return convert8Cto24(buffer[(y * width) + x]);
-	#elif defined(FB_TYPE_24BPP)
-		uint32_t position = (y * width * 3) + (x * 3);
-		return (buffer[position+2] << 16) + (buffer[position+1] << 8) + (buffer[position + 0]);
-	#elif defined(FB_TYPE_32BPP)
-		uint32_t position = (y * width * 4) + (x * 4);
-		return (buffer[position] << 24) + (buffer[position+3] << 16) + (buffer[position+2] << 8) + (buffer[position+1]);
-	#else
-		#error "No framebuffer type configured."
-	#endif
+		from.x += from.rowX; from.y += from.rowY;
+		to.x   += to.rowX;   to.y   += to.rowY;
+		if (bytes) {
+			inRow  += inNext;
+			outRow += outNext;
+		}
+	}
+
+	if (dirtyX0 > dirtyX1) return; //Nothing changed
+	if (!target) {
+		driver_framebuffer_set_dirty_area(dirtyX0, dirtyY0, dirtyX1, dirtyY1, false);
+	} else {
+		target->changed = true;
+	}
 }
 
 void driver_framebuffer_blit(Window* source, Window* target)
 {
-	if (source->vOffset >= source->height) return; //The vertical offset is larger than the height of the window
-	if (source->hOffset >= source->width)  return; //The horizontal offset is larger than the width of the window
-	for (uint16_t wy = source->vOffset; wy < source->drawHeight; wy++) {
-		for (uint16_t wx = source->hOffset; wx < source->drawWidth; wx++) {
-			if (wy >= source->height) continue; //Out-of-bounds
-			if (wx >= source->width) continue;  //Out-of-bounds
-			uint32_t color = driver_framebuffer_getPixel(source, wx, wy); //Read the pixel from the window framebuffer
-			if (source->enableTransparentColor && source->transparentColor == color) continue; //Transparent
-			driver_framebuffer_setPixel(target, source->x + wx, source->y + wy, color); //Write the pixel to the global framebuffer
+	if (!source->enableTransparentColor) {
+		driver_framebuffer_blit_key(source, target, NULL);
+		return;
+	}
+	//Compare stored values instead of colors, a transparent color that does not survive conversion never matches
+	uint8_t key[4] = {0};
+	const pixel_ops_t* ops = driver_framebuffer_get_ops(source);
+	if (!ops) return;
+	ops->store(key, 1, 1, 0, 0, ops->encode(source->transparentColor));
+	bool keyed = (ops->load(key, 1, 1, 0, 0) == source->transparentColor);
+	driver_framebuffer_blit_key(source, target, keyed ? key : NULL);
+}
+
+void driver_framebuffer_draw_row(Window* window, int16_t x, int16_t y, const uint32_t* values, const uint8_t* alpha, int16_t count)
+{
+	framebuffer_lock_t lock;
+	uint8_t* buffer; int16_t width, height; const pixel_ops_t* ops;
+	if (!_getFrameContext(window, &buffer, &width, &height, &ops)) return;
+
+	orientation_map_t walk;
+	driver_framebuffer_orientation_map(window, &walk);
+	if ((y < 0) || (y >= walk.height)) return;
+	if (x < 0) {
+		values -= x;
+		if (alpha) alpha -= x;
+		count += x;
+		x = 0;
+	}
+	if (count > walk.width - x) count = walk.width - x;
+	if (count <= 0) return;
+	int16_t bx = walk.x + walk.pixelX * x + walk.rowX * y;
+	int16_t by = walk.y + walk.pixelY * x + walk.rowY * y;
+
+	for (int16_t i = 0; i < count;) {
+		if (alpha && (alpha[i] < 255)) {
+			if (alpha[i] > 0) ops->blend(buffer, width, height, bx + walk.pixelX * i, by + walk.pixelY * i, values[i], alpha[i]);
+			i++;
+			continue;
 		}
+		//Opaque values are stored a run at a time, along a row or a column of the buffer
+		int16_t run = 1;
+		while ((i + run < count) && (!alpha || (alpha[i + run] == 255))) run++;
+		ops->row(buffer, width, height, bx + walk.pixelX * i, by + walk.pixelY * i, walk.pixelX, walk.pixelY, &values[i], run);
+		i += run;
+	}
+}
+
+void _window_area(Window* window, int16_t* area)
+{
+	int16_t x0, y0, x1, y1;
+	if (!_blit_clip(window, NULL, &x0, &y0, &x1, &y1)) {
+		area[0] = 0; area[1] = 0; area[2] = -1; area[3] = -1;
+		return;
+	}
+	x0 += window->x; x1 += window->x;
+	y0 += window->y; y1 += window->y;
+	driver_framebuffer_orientation_apply(NULL, &x0, &y0);
+	driver_framebuffer_orientation_apply(NULL, &x1, &y1);
+	area[0] = (x0 < x1) ? x0 : x1; area[2] = (x0 < x1) ? x1 : x0;
+	area[1] = (y0 < y1) ? y0 : y1; area[3] = (y0 < y1) ? y1 : y0;
+}
+
+void _window_render_state(Window* window, window_render_state_t* state)
+{
+	memset(state, 0, sizeof(window_render_state_t)); //Compared using memcmp, padding included
+	state->valid                  = true;
+	state->below                  = window->_prevWindow;
+	state->x                      = window->x;
+	state->y                      = window->y;
+	state->hOffset                = window->hOffset;
+	state->vOffset                = window->vOffset;
+	state->drawWidth              = window->drawWidth;
+	state->drawHeight             = window->drawHeight;
+	state->orientation            = window->orientation;
+	state->target                 = driver_framebuffer_get_orientation(NULL);
+	state->enableTransparentColor = window->enableTransparentColor;
+	state->transparentColor       = window->transparentColor;
+	_window_area(window, state->area);
+}
+
+void _area_add(int16_t* area, const int16_t* other)
+{
+	if (other[0] > other[2]) return; //Empty
+	if (area[0] > area[2]) {
+		memcpy(area, other, 4 * sizeof(int16_t));
+		return;
 	}
+	if (other[0] < area[0]) area[0] = other[0];
+	if (other[1] < area[1]) area[1] = other[1];
+	if (other[2] > area[2]) area[2] = other[2];
+	if (other[3] > area[3]) area[3] = other[3];
+}
+
+bool _area_overlaps(const int16_t* area, int16_t x0, int16_t y0, int16_t x1, int16_t y1)
+{
+	return (area[0] <= area[2]) && (area[0] <= x1) && (x0 <= area[2]) && (area[1] <= y1) && (y0 <= area[3]);
 }
 
 void _render_windows()
 {
-	//Step through the linked list of windows and blit each of the visible windows to the main framebuffer
-	Window* currentWindow = driver_framebuffer_window_first();
-	while (currentWindow != NULL) {
-		if (currentWindow->visible) {
-			driver_framebuffer_blit(currentWindow, NULL);
+	//Windows are only blitted to the main framebuffer when that changes the result, which is when the window itself
+	//changed, when something it overlaps changed or when a window below it has to be drawn again
+	Window* currentWindow;
+	window_render_state_t state;
+
+	//Collect the area of the framebuffer in which windows have to be composed again
+	int16_t damage[4] = {0, 0, -1, -1};
+	for (currentWindow = driver_framebuffer_window_first(); currentWindow != NULL; currentWindow = currentWindow->_nextWindow) {
+		if (!currentWindow->visible) {
+			if (currentWindow->rendered.valid) _area_add(damage, currentWindow->rendered.area); //Hidden, uncover the windows below
+			currentWindow->rendered.valid = false;
+			continue;
+		}
+		_window_render_state(currentWindow, &state);
+		if (currentWindow->changed || (memcmp(&state, &currentWindow->rendered, sizeof(window_render_state_t)) != 0)) {
+			if (currentWindow->rendered.valid) _area_add(damage, currentWindow->rendered.area);
+			_area_add(damage, state.area);
 		}
-		currentWindow = currentWindow->_nextWindow;
+	}
+
+	//Step through the linked list of windows and blit the windows that are affected to the main framebuffer
+	for (currentWindow = driver_framebuffer_window_first(); currentWindow != NULL; currentWindow = currentWindow->_nextWindow) {
+		if (!currentWindow->visible) continue;
+		_window_render_state(currentWindow, &state);
+		bool render = currentWindow->changed || (memcmp(&state, &currentWindow->rendered, sizeof(window_render_state_t)) != 0);
+		if (!render) render = _area_overlaps(damage, state.area[0], state.area[1], state.area[2], state.area[3]);
+		int16_t x0, y0, x1, y1;
+		for (uint8_t i = 0; (!render) && driver_framebuffer_get_dirty_region(i, &x0, &y0, &x1, &y1); i++) {
+			render = _area_overlaps(state.area, x0, y0, x1, y1); //Drawn over by the framebuffer or by a window below
+		}
+		if (!render) continue;
+		driver_framebuffer_blit(currentWindow, NULL);
+		currentWindow->changed = false;
+		memcpy(&currentWindow->rendered, &state, sizeof(window_render_state_t));
 	}
 }
 
 bool driver_framebuffer_flush(uint32_t flags)
 {
+	framebuffer_lock_t lock; //Also waits for the triangles this task queued, they belong to this frame
+
 	if (!framebuffer) {
 		ESP_LOGE(TAG, "flush without alloc!");
 		return false;
@@ -501,54 +703,116 @@ bool driver_framebuffer_flush(uint32_t flags)
 #error "NO LUT BIT"
 	#endif
 
-	#ifdef FB_FLUSH_GS
-	if (flags & FB_FLAG_LUT_GREYSCALE) {
-		FB_FLUSH_GS(framebuffer, eink_flags);
-	} else {
+	flush_job_t job;
+	job.buffer     = framebuffer;
+	job.eink_flags = eink_flags;
+	job.greyscale  = (flags & FB_FLAG_LUT_GREYSCALE);
+	#ifdef FB_FLUSH_REGIONS
+		//Send every dirty region separately instead of their bounding box
+		job.regions = 0;
+		while (driver_framebuffer_get_dirty_region(job.regions, &job.area[job.regions][0], &job.area[job.regions][1], &job.area[job.regions][2], &job.area[job.regions][3])) job.regions++;
+	#else
+		driver_framebuffer_get_dirty_area(&job.area[0][0], &job.area[0][1], &job.area[0][2], &job.area[0][3]);
+		job.regions = 1;
 	#endif
-		int16_t dirty_x0, dirty_y0, dirty_x1, dirty_y1;
-		driver_framebuffer_get_dirty_area(&dirty_x0, &dirty_y0, &dirty_x1, &dirty_y1);
-		FB_FLUSH(framebuffer,eink_flags,dirty_x0,dirty_y0,dirty_x1,dirty_y1);
-	#ifdef FB_FLUSH_GS
-	}
+
+	#ifdef CONFIG_DRIVER_FRAMEBUFFER_ASYNC_FLUSH
+		xSemaphoreTake(flush_idle, portMAX_DELAY); //The other buffer is still being sent
+		xQueueSend(flush_queue, &job, portMAX_DELAY);
+	#else
+		_flush_job(&job);
 	#endif
 
 	#ifdef CONFIG_DRIVER_FRAMEBUFFER_DOUBLE_BUFFERED
-	if (framebuffer==framebuffer1) {
-		framebuffer = framebuffer2;
-		memcpy(framebuffer, framebuffer1, FB_SIZE);
-	} else {
-		framebuffer = framebuffer1;
-		memcpy(framebuffer, framebuffer2, FB_SIZE);
-	}
+		//Continue in the other buffer, which only lacks the rows that changed since the previous flush
+		framebuffer = (job.buffer == framebuffer1) ? framebuffer2 : framebuffer1;
+		for (uint8_t i = 0; i < job.regions; i++) {
+			_copy_rows(framebuffer, job.buffer, job.area[i][1], job.area[i][3]);
+		}
 	#endif
 
 	driver_framebuffer_set_dirty_area(FB_WIDTH-1, FB_HEIGHT-1, 0, 0, true); //Not dirty.
 	return true;
 }
 
-esp_err_t driver_framebuffer_png(Window* window, int16_t x, int16_t y, lib_reader_read_t reader, void* reader_p)
+void driver_framebuffer_flush_wait()
 {
+	#ifdef CONFIG_DRIVER_FRAMEBUFFER_ASYNC_FLUSH
+		if (!flush_idle) return;
+		xSemaphoreTake(flush_idle, portMAX_DELAY);
+		xSemaphoreGive(flush_idle);
+	#endif
+}
+
+typedef struct image_decoder_t {
+	const char* name;
+	void* (*create)(lib_reader_read_t reader, void* reader_p);
+	/* Start decoding, returns NULL when out of memory */
+	int   (*read_header)(void* decoder, int* width, int* height);
+	/* Read the size of the image, returns a negative value on errors */
+	int   (*load_image)(Window* window, void* decoder, int16_t x, int16_t y, uint32_t dst_min_x, uint32_t dst_min_y, uint32_t dst_width, uint32_t dst_height, uint32_t dst_linelen);
+	/* Draw the part of the image from (dst_min_x, dst_min_y) up to (dst_width, dst_height) at (x, y), returns a negative value on errors */
+	void  (*destroy)(void* decoder);
+} image_decoder_t;
+
+void* _png_create(lib_reader_read_t reader, void* reader_p) { return lib_png_new(reader, reader_p); }
+void  _png_destroy(void* decoder) { lib_png_destroy((struct lib_png_reader*) decoder); }
+
+int _png_read_header(void* decoder, int* width, int* height)
+{
+	struct lib_png_reader* pr = (struct lib_png_reader*) decoder;
+	int res = lib_png_read_header(pr);
+	*width  = pr->ihdr.width;
+	*height = pr->ihdr.height;
+	return res;
+}
+
+int _png_load_image(Window* window, void* decoder, int16_t x, int16_t y, uint32_t dst_min_x, uint32_t dst_min_y, uint32_t dst_width, uint32_t dst_height, uint32_t dst_linelen)
+{
+	return lib_png_load_image(window, (struct lib_png_reader*) decoder, x, y, dst_min_x, dst_min_y, dst_width, dst_height, dst_linelen);
+}
+
+void* _qoi_create(lib_reader_read_t reader, void* reader_p) { return lib_qoi_new(reader, reader_p); }
+void  _qoi_destroy(void* decoder) { lib_qoi_destroy((struct lib_qoi_reader*) decoder); }
+
+int _qoi_read_header(void* decoder, int* width, int* height)
+{
+	struct lib_qoi_reader* qr = (struct lib_qoi_reader*) decoder;
+	int res = lib_qoi_read_header(qr);
+	*width  = qr->header.width;
+	*height = qr->header.height;
+	return res;
+}
+
+int _qoi_load_image(Window* window, void* decoder, int16_t x, int16_t y, uint32_t dst_min_x, uint32_t dst_min_y, uint32_t dst_width, uint32_t dst_height, uint32_t dst_linelen)
+{
+	return lib_qoi_load_image(window, (struct lib_qoi_reader*) decoder, x, y, dst_min_x, dst_min_y, dst_width, dst_height);
+}
+
+const image_decoder_t pngDecoder = {"png", &_png_create, &_png_read_header, &_png_load_image, &_png_destroy};
+const image_decoder_t qoiDecoder = {"qoi", &_qoi_create, &_qoi_read_header, &_qoi_load_image, &_qoi_destroy};
+
+esp_err_t _image_load(const image_decoder_t* decoder, Window* window, int16_t x, int16_t y, lib_reader_read_t reader, void* reader_p)
+{
+	framebuffer_lock_t lock;
 	if (!framebuffer) {
-		ESP_LOGE(TAG, "png without alloc!");
+		ESP_LOGE(TAG, "%s without alloc!", decoder->name);
 		return ESP_FAIL;
 	}
-	struct lib_png_reader *pr = lib_png_new(reader, reader_p);
-	if (pr == NULL) {
-		printf("Out of memory.\n");
+	void* image = decoder->create(reader, reader_p);
+	if (image == NULL) {
+		ESP_LOGE(TAG, "%s: out of memory", decoder->name);
 		return ESP_FAIL;
 	}
 
-	int res = lib_png_read_header(pr);
+	int width, height;
+	int res = decoder->read_header(image, &width, &height);
 	if (res < 0) {
-		lib_png_destroy(pr);
-		printf("Can not read header.\n");
+		decoder->destroy(image);
+		ESP_LOGE(TAG, "%s: can not read header (%d)", decoder->name, -res);
 		return ESP_FAIL;
 	}
 
-	int width = pr->ihdr.width;
-	int height = pr->ihdr.height;
-
 	uint32_t dst_min_x = x < 0 ? -x : 0;
 	uint32_t dst_min_y = y < 0 ? -y : 0;
 
@@ -557,18 +821,29 @@ esp_err_t driver_framebuffer_png(Window* window, int16_t x, int16_t y, lib_reade
 
 	driver_framebuffer_get_orientation_size(window, &screenWidth, &screenHeight);
 
-	res = lib_png_load_image(window, pr, x, y, dst_min_x, dst_min_y, screenWidth - x, screenHeight - y, screenWidth);
+	res = decoder->load_image(window, image, x, y, dst_min_x, dst_min_y, screenWidth - x, screenHeight - y, screenWidth);
 
-	lib_png_destroy(pr);
+	decoder->destroy(image);
 
+	//Rows drawn before a decoding error are in the buffer as well
+	driver_framebuffer_mark_rect(window, x, y, width, height);
 	if (res < 0) {
-		printf("Failed to load image: %d.\n", -res);
+		ESP_LOGE(TAG, "%s: failed to load image (%d)", decoder->name, -res);
 		return ESP_FAIL;
 	}
-	driver_framebuffer_set_dirty_area(x, y, x + width - 1, y + height - 1, false);
 	return ESP_OK;
 }
 
+esp_err_t driver_framebuffer_png(Window* window, int16_t x, int16_t y, lib_reader_read_t reader, void* reader_p)
+{
+	return _image_load(&pngDecoder, window, x, y, reader, reader_p);
+}
+
+esp_err_t driver_framebuffer_qoi(Window* window, int16_t x, int16_t y, lib_reader_read_t reader, void* reader_p)
+{
+	return _image_load(&qoiDecoder, window, x, y, reader, reader_p);
+}
+
 uint16_t driver_framebuffer_getWidth(Window* window)
 {
 	int16_t width, height;
@@ -604,3 +879,84 @@ uint8_t driver_framebuffer_getBacklight()
 #include "include/driver_framebuffer_disabled.h"
 esp_err_t driver_framebuffer_init() { return ESP_OK; }
 #endif
+
+#ifdef DRIVER_FRAMEBUFFER_SPAN_TEST
+#include <assert.h>
+
+#define N_RAND_TESTS 200
+
+static const char* formatNames[FB_FORMAT_COUNT] = {"NATIVE", "1BPP", "1BPP_VERT", "1BPP_VERT2", "1BPP_OHS", "8BPP", "8CBPP", "12BPP", "16BPP", "24BPP", "32BPP"};
+
+static uint32_t randomColor()
+{
+	switch (rand() % 4) {
+		case 0:  return 0x000000;
+		case 1:  return 0xFFFFFF;
+		default: return (((uint32_t) rand() << 8) ^ rand()) & 0xFFFFFF;
+	}
+}
+
+/* every span drawn in one window is drawn a pixel at a time in the other, after which all pixels of both buffers have to be equal
+   (fills also set the unused bits at the end of packed rows, so the bytes are not compared) */
+static bool equalPixels(Window* a, Window* b)
+{
+	for (int16_t y = 0; y < a->height; y++) {
+		for (int16_t x = 0; x < a->width; x++) {
+			if (a->pixelOps->load(a->buffer, a->width, a->height, x, y) != b->pixelOps->load(b->buffer, b->width, b->height, x, y)) return false;
+		}
+	}
+	return true;
+}
+
+static void do_test_spans(pixel_format_t format, uint16_t width, uint16_t height, uint16_t angle)
+{
+	Window* spans  = driver_framebuffer_window_create_format("spans",  width, height, format);
+	Window* pixels = driver_framebuffer_window_create_format("pixels", width, height, format);
+	assert(spans && pixels);
+	driver_framebuffer_set_orientation_angle(spans,  angle);
+	driver_framebuffer_set_orientation_angle(pixels, angle);
+	uint32_t size = driver_framebuffer_format_size(format, width, height);
+	memset(spans->buffer,  0, size);
+	memset(pixels->buffer, 0, size);
+	int16_t userWidth, userHeight;
+	driver_framebuffer_get_orientation_size(spans, &userWidth, &userHeight);
+
+	for (int i = 0; i < N_RAND_TESTS; i++) {
+		uint32_t color = randomColor();
+		//Rects partly or completely outside of the window are clipped
+		int16_t x = rand() % (userWidth + 8) - 4, y = rand() % (userHeight + 8) - 4;
+		int16_t w = rand() % (userWidth + 4), h = rand() % (userHeight + 4);
+		switch (i % 8) {
+			case 0:  driver_framebuffer_hline(spans, x, y, w, color); h = 1; break;
+			case 1:  driver_framebuffer_vline(spans, x, y, h, color); w = 1; break;
+			case 2:  driver_framebuffer_fill(spans, color); x = 0; y = 0; w = userWidth; h = userHeight; break;
+			default: driver_framebuffer_fill_rect(spans, x, y, w, h, color); break;
+		}
+		for (int16_t py = y; py < y + h; py++) {
+			for (int16_t px = x; px < x + w; px++) driver_framebuffer_setPixel(pixels, px, py, color);
+		}
+		if (!equalPixels(spans, pixels)) {
+			fprintf(stderr, "%s at %u degrees: %d, %d, %d x %d in %06x differs\n", formatNames[format], angle, x, y, w, h, color);
+			assert(false);
+		}
+	}
+
+	driver_framebuffer_window_remove(spans);
+	driver_framebuffer_window_remove(pixels);
+}
+
+int main(void)
+{
+	srand(42);
+	assert(driver_framebuffer_init() == ESP_OK);
+	for (int f = FB_FORMAT_NATIVE + 1; f < FB_FORMAT_COUNT; f++) {
+		for (uint16_t angle = 0; angle < 360; angle += 90) {
+			do_test_spans((pixel_format_t) f, 24, 13, angle);
+			if (f != FB_FORMAT_1BPP_OHS) do_test_spans((pixel_format_t) f, 21, 10, angle); //OHS needs whole bytes per row
+		}
+		printf("%s OK\n", formatNames[f]);
+	}
+	return 0;
+}
+
+#endif // DRIVER_FRAMEBUFFER_SPAN_TEST
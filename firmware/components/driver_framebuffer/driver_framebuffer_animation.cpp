@@ -0,0 +1,266 @@
+/*
+ * The functions in this file play animations from a background task
+ *
+ * Frames are read from the file while playing and only the area that
+ * changed is decoded, so the framebuffer (or window) is the only copy
+ * of the animation in memory. The changed areas go through the dirty
+ * area tracking, displays that support partial updates only receive
+ * the pixels that changed
+ */
+
+#include "include/driver_framebuffer_internal.h"
+
+#ifdef CONFIG_DRIVER_FRAMEBUFFER_ENABLE
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_timer.h"
+
+#define TAG "fb-animation"
+
+// The core MicroPython does not run on, core 0 on single core boards.
+#define ANIMATION_CORE (portNUM_PROCESSORS - 1)
+
+typedef struct animation_player_t {
+	TaskHandle_t task;             // Player task, NULL when no animation was started
+	SemaphoreHandle_t stop;        // Given to stop the player early
+	SemaphoreHandle_t done;        // Given by the player when it is finished
+	Window* window;                // Target of the animation
+	int16_t x, y;                  // Position of the animation
+	const uint8_t* data;           // Animation in memory, or NULL when playing a file
+	uint32_t size;                 // Size of the animation in memory
+	char* filename;                // Animation file, or NULL when playing from memory
+	uint32_t period;               // Time between frames in microseconds, 0 uses the timing of the file
+	uint8_t flags;                 // ANIMATION_FLAG_*
+	int64_t due;                   // Time the next frame should be shown
+	bool skipped;                  // The last frame was not sent to the display
+	animation_status_t status;
+} animation_player_t;
+
+typedef struct animation_reader_t {
+	lib_reader_read_t read;
+	void* read_p;
+	uint32_t left;                 // Bytes left in the image data of the frame
+} animation_reader_t;
+
+animation_player_t animation_player;
+
+/* Private functions */
+
+inline uint16_t _animation_u16(const uint8_t* data)
+{
+	return data[0] | (data[1] << 8);
+}
+
+inline uint32_t _animation_u32(const uint8_t* data)
+{
+	return data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t) data[3] << 24);
+}
+
+ssize_t _animation_read(animation_reader_t* reader, uint8_t* buf, size_t buf_len)
+{ //Read the image data of one frame, the decoder stops reading rows that are not visible
+	if (buf_len > reader->left) buf_len = reader->left;
+	if (buf_len == 0) return 0;
+	ssize_t res = reader->read(reader->read_p, buf, buf_len);
+	if (res > 0) reader->left -= res;
+	return res;
+}
+
+bool _animation_present(animation_player_t* player, uint32_t period)
+{ //Show a frame once it is due, returns false when the player was stopped
+	int64_t now = esp_timer_get_time();
+	bool late = now > player->due + period; //The next frame is due already
+	player->due += period;
+	if (late && !player->skipped) {
+		//Skip sending this frame, its changed area is sent together with the next frame
+		player->skipped = true;
+		framebuffer_lock_t lock; //The status is read under the lock
+		player->status.dropped++;
+		return xSemaphoreTake(player->stop, 0) != pdTRUE;
+	}
+	player->skipped = false;
+	if (late) {
+		player->due = now; //Slower than the frame rate, continue from here instead of catching up
+	} else if (now < player->due - period) {
+		if (xSemaphoreTake(player->stop, pdMS_TO_TICKS((player->due - period - now) / 1000)) == pdTRUE) return false;
+	}
+	{
+		framebuffer_lock_t lock;
+		if (player->flags & ANIMATION_FLAG_FLUSH) driver_framebuffer_flush(0);
+		player->status.shown++;
+	}
+	return xSemaphoreTake(player->stop, 0) != pdTRUE;
+}
+
+esp_err_t _animation_run(animation_player_t* player, bool* stopped)
+{ //Play the animation once
+	lib_reader_read_t read;
+	void* read_p;
+	if (player->data) {
+		read   = (lib_reader_read_t) &lib_mem_read;
+		read_p = lib_mem_new(player->data, player->size);
+	} else {
+		read   = (lib_reader_read_t) &lib_file_read;
+		read_p = lib_file_new(player->filename, 1024);
+	}
+	if (!read_p) return player->data ? ESP_ERR_NO_MEM : ESP_ERR_NOT_FOUND;
+
+	animation_info_t info;
+	esp_err_t res = driver_framebuffer_animation_info(read, read_p, &info);
+	for (uint16_t frame = 0; (frame < info.frames) && (res == ESP_OK); frame++) {
+		uint8_t header[ANIMATION_FRAME_HEADER_SIZE];
+		if (read(read_p, header, sizeof(header)) != sizeof(header)) {
+			res = ESP_ERR_INVALID_SIZE;
+			break;
+		}
+		int16_t frameX = _animation_u16(&header[0]);
+		int16_t frameY = _animation_u16(&header[2]);
+		uint32_t delay = _animation_u16(&header[4]);
+		animation_reader_t reader = {read, read_p, _animation_u32(&header[8])};
+		if (reader.left > 0) {
+			res = driver_framebuffer_qoi(player->window, player->x + frameX, player->y + frameY, (lib_reader_read_t) &_animation_read, &reader);
+			//Skip what the decoder did not read
+			uint8_t skip[64];
+			while ((res == ESP_OK) && (reader.left > 0)) {
+				if (_animation_read(&reader, skip, sizeof(skip)) <= 0) res = ESP_ERR_INVALID_SIZE;
+			}
+			if (res != ESP_OK) break;
+		}
+		{
+			framebuffer_lock_t lock;
+			player->status.frame = frame;
+		}
+		if (!_animation_present(player, player->period ? player->period : delay * 1000)) {
+			*stopped = true;
+			break;
+		}
+	}
+
+	if (player->data) {
+		lib_mem_destroy((struct lib_mem_reader*) read_p);
+	} else {
+		lib_file_destroy((struct lib_file_reader*) read_p);
+	}
+	return res;
+}
+
+void _animation_task(void* arg)
+{
+	animation_player_t* player = (animation_player_t*) arg;
+	player->due = esp_timer_get_time();
+	bool stopped = false;
+	esp_err_t res;
+	do {
+		res = _animation_run(player, &stopped);
+	} while ((res == ESP_OK) && (player->flags & ANIMATION_FLAG_LOOP) && !stopped);
+	if (res != ESP_OK) ESP_LOGE(TAG, "animation stopped at frame %u (%d)", player->status.frame, res);
+	//The last frame has to be shown, even when the player was late for it
+	{
+		framebuffer_lock_t lock;
+		if (player->skipped && (player->flags & ANIMATION_FLAG_FLUSH)) driver_framebuffer_flush(0);
+		player->status.playing = false;
+	}
+	xSemaphoreGive(player->done);
+	vTaskDelete(NULL);
+}
+
+esp_err_t _animation_start(Window* window, int16_t x, int16_t y, uint16_t fps, uint8_t flags)
+{
+	animation_player_t* player = &animation_player;
+	if (!player->stop) player->stop = xSemaphoreCreateBinary();
+	if (!player->done) player->done = xSemaphoreCreateBinary();
+	if (!player->stop || !player->done) {
+		ESP_LOGE(TAG, "Unable to allocate the animation player.");
+		return ESP_ERR_NO_MEM;
+	}
+	player->window  = window;
+	player->x       = x;
+	player->y       = y;
+	player->period  = fps ? 1000000 / fps : 0;
+	player->flags   = flags;
+	player->skipped = false;
+	memset(&player->status, 0, sizeof(animation_status_t));
+	player->status.playing = true;
+	//MicroPython runs on core 0, on dual core boards the player runs on core 1 so it keeps the frame rate while the application
+	//is busy. It sleeps between frames, above the 3D rasterizer and below the flush task. On single core boards it shares core 0
+	//with MicroPython and plays while the application waits
+	if (xTaskCreatePinnedToCore(&_animation_task, "fb_animation", 4096, player, tskIDLE_PRIORITY + 2, &player->task, ANIMATION_CORE) != pdPASS) {
+		ESP_LOGE(TAG, "Unable to start the animation player.");
+		player->task = NULL;
+		player->status.playing = false;
+		return ESP_FAIL;
+	}
+	return ESP_OK;
+}
+
+/* Public functions */
+
+esp_err_t driver_framebuffer_animation_info(lib_reader_read_t reader, void* reader_p, animation_info_t* info)
+{
+	memset(info, 0, sizeof(animation_info_t));
+	uint8_t header[ANIMATION_HEADER_SIZE];
+	if (reader(reader_p, header, sizeof(header)) != sizeof(header)) return ESP_ERR_INVALID_SIZE;
+	if ((memcmp(header, "FBAN", 4) != 0) || (header[4] != ANIMATION_VERSION)) return ESP_ERR_INVALID_ARG;
+	info->frames = _animation_u16(&header[6]);
+	info->width  = _animation_u16(&header[8]);
+	info->height = _animation_u16(&header[10]);
+	if (!info->frames || !info->width || !info->height) return ESP_ERR_INVALID_ARG;
+	return ESP_OK;
+}
+
+esp_err_t driver_framebuffer_animation_play(Window* window, int16_t x, int16_t y, const uint8_t* data, uint32_t size, uint16_t fps, uint8_t flags)
+{
+	driver_framebuffer_animation_stop();
+	struct lib_mem_reader* mr = lib_mem_new(data, size);
+	if (!mr) return ESP_ERR_NO_MEM;
+	animation_info_t info;
+	esp_err_t res = driver_framebuffer_animation_info((lib_reader_read_t) &lib_mem_read, mr, &info);
+	lib_mem_destroy(mr);
+	if (res != ESP_OK) return res;
+	animation_player.data = data;
+	animation_player.size = size;
+	return _animation_start(window, x, y, fps, flags);
+}
+
+esp_err_t driver_framebuffer_animation_play_file(Window* window, int16_t x, int16_t y, const char* filename, uint16_t fps, uint8_t flags)
+{
+	driver_framebuffer_animation_stop();
+	struct lib_file_reader* fr = lib_file_new(filename, 16);
+	if (!fr) return ESP_ERR_NOT_FOUND;
+	animation_info_t info;
+	esp_err_t res = driver_framebuffer_animation_info((lib_reader_read_t) &lib_file_read, fr, &info);
+	lib_file_destroy(fr);
+	if (res != ESP_OK) return res;
+	animation_player.data     = NULL;
+	animation_player.filename = strdup(filename); //The name of the caller may not outlive the animation
+	if (!animation_player.filename) return ESP_ERR_NO_MEM;
+	return _animation_start(window, x, y, fps, flags);
+}
+
+void driver_framebuffer_animation_stop()
+{
+	animation_player_t* player = &animation_player;
+	if (player->task) {
+		xSemaphoreGive(player->stop);
+		xSemaphoreTake(player->done, portMAX_DELAY);
+		xSemaphoreTake(player->stop, 0); //The player may have finished before it saw the signal
+		player->task = NULL;
+	}
+	free(player->filename);
+	player->filename = NULL;
+	player->data     = NULL;
+}
+
+void driver_framebuffer_animation_stop_window(Window* window)
+{
+	if (animation_player.task && (animation_player.window == window)) driver_framebuffer_animation_stop();
+}
+
+void driver_framebuffer_animation_status(animation_status_t* status)
+{
+	framebuffer_lock_t lock; //The player updates the status under the lock
+	*status = animation_player.status;
+}
+
+#endif /* CONFIG_DRIVER_FRAMEBUFFER_ENABLE */
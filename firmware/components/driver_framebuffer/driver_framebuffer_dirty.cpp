@@ -1,52 +1,268 @@
 /*
  * The functions in this file serve as a simple way of
- * storing which area of the framebuffer needs to be
+ * storing which areas of the framebuffer need to be
  * sent to the display during the next flush
+ *
+ * Up to CONFIG_DRIVER_FRAMEBUFFER_DIRTY_REGIONS separate rectangles
+ * are kept, so that displays which support partial updates only
+ * receive the pixels that actually changed instead of their bounding box
  * 
  * (This only applies to the main framebuffer and not to the compositor frames!)
  */
 
+/* TEST (from this directory, host/ stands in for ESP-IDF):
+ * gcc -o fb_dirty_test -DDRIVER_FRAMEBUFFER_DIRTY_TEST -Wall -g -I host -I png \
+ *     $(find ../driver_display_* ../driver_io_disobey_samd -maxdepth 1 -name include -printf '-I %p ') \
+ *     $(find . host png fonts -maxdepth 1 -name '*.c*') -lstdc++ -lm
+ *
+ * Other amounts of regions are tested by defining them, for example -DCONFIG_DRIVER_FRAMEBUFFER_DIRTY_REGIONS=1
+ */
+
 #include "include/driver_framebuffer_internal.h"
 
 #ifdef CONFIG_DRIVER_FRAMEBUFFER_ENABLE
 
+#define DIRTY_MAX_REGIONS CONFIG_DRIVER_FRAMEBUFFER_DIRTY_REGIONS
+#define DIRTY_MERGE_COST  64 //Amount of clean pixels worth sending to save a separate transfer
+
+typedef struct dirty_region_t {
+	int16_t x0, y0, x1, y1;
+} dirty_region_t;
+
 /* Variables */
-int16_t dirty_x0 = 0,          dirty_y0 = 0;           // Top-left corner of the "dirty" area
-int16_t dirty_x1 = FB_WIDTH-1, dirty_y1 = FB_HEIGHT-1; // Bottom-right corner of the "dirty" area
+dirty_region_t dirty_regions[DIRTY_MAX_REGIONS] = {{0, 0, FB_WIDTH-1, FB_HEIGHT-1}}; // Dirty areas, initially the whole framebuffer
+uint8_t        dirty_count = 1;                                                      // Amount of dirty areas in use
+
+/* Private functions */
+inline int32_t _area(const dirty_region_t* r)
+{
+	return (int32_t) (r->x1 - r->x0 + 1) * (r->y1 - r->y0 + 1);
+}
+
+inline dirty_region_t _union(const dirty_region_t* a, const dirty_region_t* b)
+{
+	dirty_region_t result = *a;
+	if (b->x0 < result.x0) result.x0 = b->x0;
+	if (b->y0 < result.y0) result.y0 = b->y0;
+	if (b->x1 > result.x1) result.x1 = b->x1;
+	if (b->y1 > result.y1) result.y1 = b->y1;
+	return result;
+}
+
+inline int32_t _merge_cost(const dirty_region_t* a, const dirty_region_t* b)
+{ //Amount of clean pixels that would be sent when the two regions are merged
+	dirty_region_t merged = _union(a, b);
+	return _area(&merged) - _area(a) - _area(b);
+}
+
+inline bool _contains(const dirty_region_t* a, const dirty_region_t* b)
+{
+	return (b->x0 >= a->x0) && (b->x1 <= a->x1) && (b->y0 >= a->y0) && (b->y1 <= a->y1);
+}
+
+inline bool _touches(const dirty_region_t* a, const dirty_region_t* b)
+{ //Overlapping or directly adjacent (including diagonally)
+	return (a->x0 <= b->x1 + 1) && (b->x0 <= a->x1 + 1) && (a->y0 <= b->y1 + 1) && (b->y0 <= a->y1 + 1);
+}
+
+void _add_region(dirty_region_t region)
+{
+	for (uint8_t i = 0; i < dirty_count; i++) {
+		if (_contains(&dirty_regions[i], &region)) return; //Already dirty
+	}
+
+	//Absorb every region that touches the new region or that is cheap to merge with it
+	bool merged;
+	do {
+		merged = false;
+		for (uint8_t i = 0; i < dirty_count; i++) {
+			if (_touches(&dirty_regions[i], &region) || (_merge_cost(&dirty_regions[i], &region) <= DIRTY_MERGE_COST)) {
+				region = _union(&dirty_regions[i], &region);
+				dirty_regions[i] = dirty_regions[--dirty_count];
+				merged = true;
+				break;
+			}
+		}
+	} while (merged);
+
+	if (dirty_count < DIRTY_MAX_REGIONS) {
+		dirty_regions[dirty_count++] = region;
+		return;
+	}
+
+	//Out of regions: merge whichever pair (including the new region) wastes the least pixels
+	uint8_t bestA = 0, bestB = DIRTY_MAX_REGIONS; //bestB == DIRTY_MAX_REGIONS refers to the new region
+	int32_t bestCost = INT32_MAX;
+	for (uint8_t a = 0; a < dirty_count; a++) {
+		int32_t cost = _merge_cost(&dirty_regions[a], &region);
+		if (cost < bestCost) { bestCost = cost; bestA = a; bestB = DIRTY_MAX_REGIONS; }
+		for (uint8_t b = a + 1; b < dirty_count; b++) {
+			cost = _merge_cost(&dirty_regions[a], &dirty_regions[b]);
+			if (cost < bestCost) { bestCost = cost; bestA = a; bestB = b; }
+		}
+	}
+
+	if (bestB == DIRTY_MAX_REGIONS) {
+		dirty_regions[bestA] = _union(&dirty_regions[bestA], &region);
+	} else {
+		dirty_regions[bestA] = _union(&dirty_regions[bestA], &dirty_regions[bestB]);
+		dirty_regions[bestB] = region;
+	}
+}
 
 /* Public functions */
 bool driver_framebuffer_is_dirty()
 {
-	return (dirty_x1 >= dirty_x0) || (dirty_y1 >= dirty_y0);
+	return dirty_count > 0;
 }
 
 void driver_framebuffer_set_dirty_area(int16_t x0, int16_t y0, int16_t x1, int16_t y1, bool force)
 {
-	if (force) {
-		//Just set the dirty area
-		dirty_x0 = x0;
-		dirty_y0 = y0;
-		dirty_x1 = x1;
-		dirty_y1 = y1;
-	} else {
-		//Only increase the dirty area
-		if (x0 < dirty_x0) dirty_x0 = x0;
-		if (y0 < dirty_y0) dirty_y0 = y0;
-		if (x1 > dirty_x1) dirty_x1 = x1;
-		if (y1 > dirty_y1) dirty_y1 = y1;
-	}
-	if (dirty_x0 > FB_WIDTH-1)  dirty_x0 = FB_WIDTH  - 1;
-	if (dirty_y0 > FB_HEIGHT-1) dirty_y0 = FB_HEIGHT - 1;
-	if (dirty_x1 > FB_WIDTH-1)  dirty_x1 = FB_WIDTH  - 1;
-	if (dirty_y1 > FB_HEIGHT-1) dirty_y1 = FB_HEIGHT - 1;
+	if (x0 > FB_WIDTH-1)  x0 = FB_WIDTH  - 1;
+	if (y0 > FB_HEIGHT-1) y0 = FB_HEIGHT - 1;
+	if (x1 > FB_WIDTH-1)  x1 = FB_WIDTH  - 1;
+	if (y1 > FB_HEIGHT-1) y1 = FB_HEIGHT - 1;
+
+	//Forcing replaces the dirty areas, an empty area (x1 < x0 or y1 < y0) marks the framebuffer as clean
+	if (force) dirty_count = 0;
+	if ((x1 < x0) || (y1 < y0)) return;
+
+	dirty_region_t region = {x0, y0, x1, y1};
+	_add_region(region);
 }
 
 void driver_framebuffer_get_dirty_area(int16_t* x0, int16_t* y0, int16_t* x1, int16_t* y1)
 {
-	*x0 = dirty_x0;
-	*y0 = dirty_y0;
-	*x1 = dirty_x1;
-	*y1 = dirty_y1;
+	if (!dirty_count) {
+		*x0 = FB_WIDTH-1;
+		*y0 = FB_HEIGHT-1;
+		*x1 = 0;
+		*y1 = 0;
+		return;
+	}
+	dirty_region_t bounds = dirty_regions[0];
+	for (uint8_t i = 1; i < dirty_count; i++) bounds = _union(&bounds, &dirty_regions[i]);
+	*x0 = bounds.x0;
+	*y0 = bounds.y0;
+	*x1 = bounds.x1;
+	*y1 = bounds.y1;
+}
+
+uint8_t driver_framebuffer_get_dirty_region_count()
+{
+	return dirty_count;
+}
+
+bool driver_framebuffer_get_dirty_region(uint8_t index, int16_t* x0, int16_t* y0, int16_t* x1, int16_t* y1)
+{
+	if (index >= dirty_count) return false;
+	*x0 = dirty_regions[index].x0;
+	*y0 = dirty_regions[index].y0;
+	*x1 = dirty_regions[index].x1;
+	*y1 = dirty_regions[index].y1;
+	return true;
 }
 
 #endif /* CONFIG_DRIVER_FRAMEBUFFER_ENABLE */
+
+#ifdef DRIVER_FRAMEBUFFER_DIRTY_TEST
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define N_RAND_TESTS 2000
+
+static bool marked[FB_HEIGHT][FB_WIDTH];
+
+/* every pixel that was marked since the last forced area has to be in one of the regions */
+static void check_regions(void)
+{
+	assert(dirty_count <= DIRTY_MAX_REGIONS);
+	assert(driver_framebuffer_get_dirty_region_count() == dirty_count);
+	for (int y = 0; y < FB_HEIGHT; y++) {
+		for (int x = 0; x < FB_WIDTH; x++) {
+			if (!marked[y][x]) continue;
+			bool covered = false;
+			for (uint8_t i = 0; i < dirty_count; i++) {
+				const dirty_region_t* r = &dirty_regions[i];
+				assert((r->x0 >= 0) && (r->y0 >= 0) && (r->x1 < FB_WIDTH) && (r->y1 < FB_HEIGHT));
+				if ((x >= r->x0) && (x <= r->x1) && (y >= r->y0) && (y <= r->y1)) covered = true;
+			}
+			assert(covered);
+		}
+	}
+}
+
+static void mark(int16_t x0, int16_t y0, int16_t x1, int16_t y1, bool force)
+{
+	if (force) memset(marked, 0, sizeof(marked));
+	for (int y = y0; y <= y1; y++) {
+		for (int x = x0; x <= x1; x++) marked[y][x] = true;
+	}
+	driver_framebuffer_set_dirty_area(x0, y0, x1, y1, force);
+	check_regions();
+}
+
+static void do_test_rand(void)
+{
+	srand(42);
+	mark(0, 0, -1, -1, true);
+	assert(!driver_framebuffer_is_dirty());
+
+	uint32_t sent = 0, sentBox = 0, dirty = 0;
+	for (int i = 0; i < N_RAND_TESTS; i++) {
+		//Mostly small rects, like text and sprites, sometimes a large one
+		int16_t w = (rand() % 8) ? 1 + rand() % 24 : 1 + rand() % FB_WIDTH;
+		int16_t h = (rand() % 8) ? 1 + rand() % 24 : 1 + rand() % FB_HEIGHT;
+		int16_t x = rand() % (FB_WIDTH - w + 1);
+		int16_t y = rand() % (FB_HEIGHT - h + 1);
+		mark(x, y, x + w - 1, y + h - 1, false);
+
+		if ((i % 16) == 15) { //A flush
+			int16_t bx0, by0, bx1, by1;
+			driver_framebuffer_get_dirty_area(&bx0, &by0, &bx1, &by1);
+			sentBox += (bx1 - bx0 + 1) * (by1 - by0 + 1);
+			for (uint8_t r = 0; r < dirty_count; r++) sent += _area(&dirty_regions[r]);
+			for (int py = 0; py < FB_HEIGHT; py++) {
+				for (int px = 0; px < FB_WIDTH; px++) dirty += marked[py][px];
+			}
+			mark(0, 0, -1, -1, true);
+			assert(!driver_framebuffer_is_dirty());
+		}
+	}
+	printf("dirty pixels %u, sent with regions %u, sent with bounding box %u\n", dirty, sent, sentBox);
+}
+
+static void do_test_edges(void)
+{
+	//Rects that touch, contain each other and lie in the corners
+	mark(0, 0, 0, 0, true);
+	mark(FB_WIDTH-1, FB_HEIGHT-1, FB_WIDTH-1, FB_HEIGHT-1, false);
+	mark(FB_WIDTH-1, 0, FB_WIDTH-1, 0, false);
+	mark(0, FB_HEIGHT-1, 0, FB_HEIGHT-1, false);
+	mark(1, 0, 10, 0, false);
+	mark(2, 0, 5, 0, false);
+	mark(100, 100, 120, 120, false);
+	mark(121, 121, 130, 130, false);
+	mark(0, 0, FB_WIDTH-1, FB_HEIGHT-1, false);
+	assert(dirty_count == 1);
+
+	//Coordinates beyond the framebuffer are clamped
+	mark(FB_WIDTH-4, FB_HEIGHT-4, FB_WIDTH-1, FB_HEIGHT-1, true);
+	driver_framebuffer_set_dirty_area(FB_WIDTH-4, FB_HEIGHT-4, FB_WIDTH+10, FB_HEIGHT+10, false);
+	check_regions();
+	assert(dirty_count == 1);
+	assert((dirty_regions[0].x1 == FB_WIDTH-1) && (dirty_regions[0].y1 == FB_HEIGHT-1));
+}
+
+int main(void)
+{
+	assert((dirty_count == 1) && (_area(&dirty_regions[0]) == FB_WIDTH * FB_HEIGHT)); //Initially everything
+	do_test_edges();
+	do_test_rand();
+	printf("OK\n");
+	return 0;
+}
+
+#endif // DRIVER_FRAMEBUFFER_DIRTY_TEST
@@ -0,0 +1,350 @@
+/*
+ * The functions in this file dither the colors that black and
+ * white and 8-bit color buffers can not show
+ *
+ * Pixels and shapes follow an ordered pattern that only depends
+ * on the position in the buffer, decoded images carry the error
+ * of every pixel over to the pixels to the right and below it
+ */
+
+/* TEST (from this directory, host/ stands in for ESP-IDF):
+ * gcc -o fb_dither_test -DDRIVER_FRAMEBUFFER_DITHER_TEST -DCONFIG_DRIVER_FRAMEBUFFER_DITHER -Wall -g -O2 -I host -I png \
+ *     $(find ../driver_display_* ../driver_io_disobey_samd -maxdepth 1 -name include -printf '-I %p ') \
+ *     $(find . host png fonts -maxdepth 1 -name '*.c*') -lstdc++ -lm
+ *
+ * The test prints how far the average of the dithered pixels is from the drawn colors and how long dithering takes per pixel
+ */
+
+#include "include/driver_framebuffer_internal.h"
+
+#ifdef CONFIG_DRIVER_FRAMEBUFFER_ENABLE
+
+#define TAG "fb-dither"
+
+typedef struct dither_format_t {
+	uint8_t channels; // 1 for greyscale formats, 3 for color formats
+	uint8_t levels[3]; // Highest level stored per channel, starting at the most significant byte of a color
+} dither_format_t;
+
+struct dither_row_t {
+	const pixel_ops_t* ops;
+	uint8_t channels;
+	uint16_t width;
+	bool reverse; // The next row is walked from right to left
+	uint8_t nearest[3][256]; // Closest value that can be stored, per channel
+	int16_t* error; // Error carried over to the next row in 1/16 steps, per channel of every pixel
+};
+
+static const dither_format_t ditherGrey = {1, {1, 0, 0}};
+#ifdef CONFIG_DRIVER_FRAMEBUFFER_SWAP_R_AND_B
+static const dither_format_t ditherColor = {3, {3, 7, 7}}; // 3-3-2, red is stored in the 2 bits of blue
+#else
+static const dither_format_t ditherColor = {3, {7, 7, 3}}; // 3-3-2, blue keeps 2 bits
+#endif
+
+//4x4 Bayer matrix, the threshold of buffer position (x, y) is at index (y & 3) * 4 + (x & 3)
+static const uint8_t ditherBayer[16] = {
+	 0,  8,  2, 10,
+	12,  4, 14,  6,
+	 3, 11,  1,  9,
+	15,  7, 13,  5
+};
+
+/* Private functions */
+
+inline const dither_format_t* _dither_format(const pixel_ops_t* ops)
+{
+#ifdef CONFIG_DRIVER_FRAMEBUFFER_DITHER
+	switch (ops->format) {
+		case FB_FORMAT_1BPP:
+		case FB_FORMAT_1BPP_VERT:
+		case FB_FORMAT_1BPP_VERT2:
+		case FB_FORMAT_1BPP_OHS:
+			return &ditherGrey;
+		case FB_FORMAT_8CBPP:
+			return &ditherColor;
+		default:
+			return NULL;
+	}
+#else
+	return NULL;
+#endif
+}
+
+inline void _dither_split(uint8_t channels, uint32_t color, uint8_t* value)
+{
+	uint8_t r = (color >> 16) & 0xFF, g = (color >> 8) & 0xFF, b = color & 0xFF;
+	if (channels == 1) {
+		value[0] = (r + g + b + 1) / 3; //Same as convert24to8
+	} else {
+		value[0] = r;
+		value[1] = g;
+		value[2] = b;
+	}
+}
+
+inline uint32_t _dither_join(uint8_t channels, const uint8_t* value)
+{
+	if (channels == 1) return value[0] * 0x010101;
+	return (value[0] << 16) | (value[1] << 8) | value[2];
+}
+
+inline bool _dither_exact(const dither_format_t* format, uint32_t color)
+{ //True if every channel of the color is at one of the levels of the format
+	uint8_t value[3];
+	_dither_split(format->channels, color, value);
+	for (uint8_t c = 0; c < format->channels; c++) {
+		if ((value[c] * format->levels[c]) % 255 != 0) return false;
+	}
+	return true;
+}
+
+uint32_t _dither_ordered(const dither_format_t* format, uint32_t color, uint8_t threshold)
+{ //Round every channel up when its distance to the level below is above the threshold (0 to 15)
+	uint8_t value[3];
+	_dither_split(format->channels, color, value);
+	uint16_t offset = threshold * 16 + 8;
+	for (uint8_t c = 0; c < format->channels; c++) {
+		uint8_t levels = format->levels[c];
+		value[c] = (((value[c] * levels + offset) / 255) * 255) / levels;
+	}
+	return _dither_join(format->channels, value);
+}
+
+/* Public functions */
+
+bool driver_framebuffer_dither_active(const pixel_ops_t* ops)
+{
+	return _dither_format(ops) != NULL;
+}
+
+uint32_t driver_framebuffer_dither_value(const pixel_ops_t* ops, uint32_t color, int16_t x, int16_t y)
+{
+	const dither_format_t* format = _dither_format(ops);
+	if (!format) return ops->encode(color);
+	return ops->encode(_dither_ordered(format, color, ditherBayer[((y & 3) << 2) | (x & 3)]));
+}
+
+bool driver_framebuffer_dither_pattern(const pixel_ops_t* ops, uint32_t color, uint32_t* pattern)
+{
+	const dither_format_t* format = _dither_format(ops);
+	if (!format || _dither_exact(format, color)) return false;
+	for (uint8_t i = 0; i < 16; i++) pattern[i] = ops->encode(_dither_ordered(format, color, ditherBayer[i]));
+	return true;
+}
+
+dither_row_t* driver_framebuffer_dither_new(const pixel_ops_t* ops, uint16_t width)
+{
+	const dither_format_t* format = _dither_format(ops);
+	if (!format) return NULL;
+	uint32_t errorSize = (uint32_t) width * format->channels * sizeof(int16_t);
+	dither_row_t* dither = (dither_row_t*) malloc(sizeof(dither_row_t) + errorSize);
+	if (!dither) {
+		ESP_LOGE(TAG, "dither out of memory");
+		return NULL;
+	}
+	dither->ops      = ops;
+	dither->channels = format->channels;
+	dither->width    = width;
+	dither->reverse  = false;
+	dither->error    = (int16_t*) &dither[1];
+	memset(dither->error, 0, errorSize);
+	for (uint8_t c = 0; c < format->channels; c++) {
+		uint8_t levels = format->levels[c];
+		for (uint16_t i = 0; i < 256; i++) dither->nearest[c][i] = (((i * levels + 127) / 255) * 255) / levels;
+	}
+	return dither;
+}
+
+void driver_framebuffer_dither_row(dither_row_t* dither, uint32_t* values, const uint8_t* alpha, uint16_t count)
+{
+	//Floyd-Steinberg: 7/16 of the error goes to the next pixel, 3/16, 5/16 and 1/16 to the pixels behind, below and ahead of it in the next row.
+	//The next row only needs the slots of pixels that were passed already, so one row of error is enough
+	uint8_t channels = dither->channels;
+	if (count > dither->width) count = dither->width;
+	int16_t step = dither->reverse ? -1 : 1;
+	int16_t i = dither->reverse ? count - 1 : 0;
+	int16_t* error = dither->error;
+	int32_t previous = 0; //Slot of the pixel before
+	int16_t carry[3] = {0, 0, 0}, below[3] = {0, 0, 0}, last[3] = {0, 0, 0};
+	for (uint16_t n = 0; n < count; n++, i += step) {
+		bool skip = alpha && (alpha[i] == 0); //Transparent pixels pass no error on
+		int32_t slot = (int32_t) i * channels;
+		uint8_t value[3];
+		_dither_split(channels, values[i], value);
+		for (uint8_t c = 0; c < channels; c++) {
+			int16_t e = 0;
+			if (!skip) {
+				int32_t wanted = ((value[c] << 4) + error[slot + c] + carry[c] + 8) >> 4;
+				if (wanted < 0)   wanted = 0;
+				if (wanted > 255) wanted = 255;
+				value[c] = dither->nearest[c][wanted];
+				e = wanted - value[c];
+			}
+			carry[c] = 7 * e;
+			if (n > 0) error[previous + c] = below[c] + 3 * e;
+			below[c] = last[c] + 5 * e;
+			last[c]  = e;
+		}
+		values[i] = skip ? 0 : dither->ops->encode(_dither_join(channels, value));
+		previous = slot;
+	}
+	if (count > 0) {
+		for (uint8_t c = 0; c < channels; c++) error[previous + c] = below[c];
+	}
+	dither->reverse = !dither->reverse;
+}
+
+void driver_framebuffer_dither_destroy(dither_row_t* dither)
+{
+	free(dither);
+}
+
+#endif /* CONFIG_DRIVER_FRAMEBUFFER_ENABLE */
+
+#ifdef DRIVER_FRAMEBUFFER_DITHER_TEST
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "esp_timer.h"
+
+#define N_RAND_COLORS 1000
+#define TEST_SIZE     64
+#define TIME_PIXELS   1000000
+
+/* the largest difference between the average of the stored colors and a channel of the drawn color,
+   the ordered pattern has 16 thresholds, diffusion loses some of the error at the edges */
+static float maxError(const dither_format_t* format, uint8_t channel, float fraction)
+{
+	return (255.0f / format->levels[channel]) * fraction + 1.5f;
+}
+
+static void split(const dither_format_t* format, uint32_t color, float* value)
+{
+	uint8_t v[3];
+	_dither_split(format->channels, color, v);
+	for (uint8_t c = 0; c < format->channels; c++) value[c] = v[c];
+}
+
+static void do_test_ordered(const pixel_ops_t* ops)
+{
+	const dither_format_t* format = _dither_format(ops);
+	uint8_t buffer[4];
+	float worst = 0;
+	for (int i = 0; i < N_RAND_COLORS; i++) {
+		uint32_t color = (((uint32_t) rand() << 8) ^ rand()) & 0xFFFFFF;
+		uint32_t pattern[16];
+		if (!driver_framebuffer_dither_pattern(ops, color, pattern)) {
+			assert(_dither_exact(format, color));
+			continue;
+		}
+		float wanted[3], sum[3] = {0, 0, 0};
+		split(format, color, wanted);
+		for (int16_t p = 0; p < 16; p++) {
+			assert(pattern[p] == driver_framebuffer_dither_value(ops, color, p & 3, p >> 2));
+			ops->store(buffer, 1, 1, 0, 0, pattern[p]);
+			float loaded[3];
+			split(format, ops->load(buffer, 1, 1, 0, 0), loaded);
+			for (uint8_t c = 0; c < format->channels; c++) sum[c] += loaded[c];
+		}
+		for (uint8_t c = 0; c < format->channels; c++) {
+			float error = fabsf(sum[c] / 16 - wanted[c]);
+			if (error > worst) worst = error;
+			assert(error <= maxError(format, c, 1.0f / 16));
+		}
+	}
+
+	//Colors the format shows exactly are stored as they are
+	uint32_t exact = (format->channels == 1) ? 0xFFFFFF : 0xFF00FF;
+	uint32_t pattern[16];
+	assert(!driver_framebuffer_dither_pattern(ops, exact, pattern));
+	assert(driver_framebuffer_dither_value(ops, exact, 1, 2) == ops->encode(exact));
+	printf("ordered:   largest error of the average %.2f\n", worst);
+}
+
+static void do_test_diffusion(const pixel_ops_t* ops)
+{
+	const dither_format_t* format = _dither_format(ops);
+	uint32_t values[TEST_SIZE];
+	uint8_t alpha[TEST_SIZE];
+	uint8_t buffer[4];
+	float worst = 0;
+
+	for (int i = 0; i < N_RAND_COLORS / 10; i++) {
+		uint32_t color = (((uint32_t) rand() << 8) ^ rand()) & 0xFFFFFF;
+		float wanted[3], sum[3] = {0, 0, 0};
+		split(format, color, wanted);
+		dither_row_t* dither = driver_framebuffer_dither_new(ops, TEST_SIZE);
+		assert(dither);
+		for (int row = 0; row < TEST_SIZE; row++) {
+			for (int x = 0; x < TEST_SIZE; x++) values[x] = color;
+			driver_framebuffer_dither_row(dither, values, NULL, TEST_SIZE);
+			for (int x = 0; x < TEST_SIZE; x++) {
+				ops->store(buffer, 1, 1, 0, 0, values[x]);
+				float loaded[3];
+				split(format, ops->load(buffer, 1, 1, 0, 0), loaded);
+				for (uint8_t c = 0; c < format->channels; c++) sum[c] += loaded[c];
+			}
+		}
+		driver_framebuffer_dither_destroy(dither);
+		for (uint8_t c = 0; c < format->channels; c++) {
+			float error = fabsf(sum[c] / (TEST_SIZE * TEST_SIZE) - wanted[c]);
+			if (error > worst) worst = error;
+			assert(error <= maxError(format, c, 1.0f / 32));
+		}
+	}
+
+	//Transparent pixels are skipped and pass no error on
+	dither_row_t* dither = driver_framebuffer_dither_new(ops, TEST_SIZE);
+	for (int x = 0; x < TEST_SIZE; x++) {
+		values[x] = 0x808080;
+		alpha[x] = (x & 1) ? 255 : 0;
+	}
+	driver_framebuffer_dither_row(dither, values, alpha, TEST_SIZE);
+	for (int x = 0; x < TEST_SIZE; x += 2) assert(values[x] == 0);
+	driver_framebuffer_dither_destroy(dither);
+	printf("diffusion: largest error of the average %.2f\n", worst);
+}
+
+static void do_test_time(const pixel_ops_t* ops)
+{
+	static uint32_t values[TEST_SIZE];
+	volatile uint32_t sink = 0;
+	int64_t start = esp_timer_get_time();
+	for (int i = 0; i < TIME_PIXELS; i++) sink += driver_framebuffer_dither_value(ops, (uint32_t) i * 0x010203, i, i >> 6);
+	int64_t ordered = esp_timer_get_time() - start;
+
+	dither_row_t* dither = driver_framebuffer_dither_new(ops, TEST_SIZE);
+	start = esp_timer_get_time();
+	for (int i = 0; i < TIME_PIXELS / TEST_SIZE; i++) {
+		for (int x = 0; x < TEST_SIZE; x++) values[x] = (uint32_t) (i + x) * 0x010203;
+		driver_framebuffer_dither_row(dither, values, NULL, TEST_SIZE);
+	}
+	int64_t diffusion = esp_timer_get_time() - start;
+	driver_framebuffer_dither_destroy(dither);
+	printf("time per pixel: ordered %.1f ns, diffusion %.1f ns\n", ordered * 1000.0 / TIME_PIXELS, diffusion * 1000.0 / TIME_PIXELS);
+}
+
+int main(void)
+{
+	srand(42);
+	static const pixel_format_t formats[] = {FB_FORMAT_1BPP, FB_FORMAT_8CBPP};
+	for (uint8_t i = 0; i < sizeof(formats) / sizeof(formats[0]); i++) {
+		const pixel_ops_t* ops = driver_framebuffer_format_ops(formats[i]);
+		if (!driver_framebuffer_dither_active(ops)) {
+			printf("dithering is off, build with -DCONFIG_DRIVER_FRAMEBUFFER_DITHER\n");
+			return 1;
+		}
+		printf("%s\n", (formats[i] == FB_FORMAT_1BPP) ? "1BPP" : "8CBPP");
+		do_test_ordered(ops);
+		do_test_diffusion(ops);
+		do_test_time(ops);
+	}
+	assert(!driver_framebuffer_dither_active(driver_framebuffer_format_ops(FB_FORMAT_16BPP)));
+	assert(!driver_framebuffer_dither_new(driver_framebuffer_format_ops(FB_FORMAT_16BPP), TEST_SIZE));
+	printf("OK\n");
+	return 0;
+}
+
+#endif // DRIVER_FRAMEBUFFER_DITHER_TEST
@@ -3,6 +3,14 @@
  * Uses parts of the Adafruit GFX Arduino libray
  */
 
+/* TEST (from this directory, host/ stands in for ESP-IDF):
+ * gcc -o fb_drawing_test -DDRIVER_FRAMEBUFFER_DRAWING_TEST -Wall -g -O2 -I host -I png \
+ *     $(find ../driver_display_* ../driver_io_disobey_samd -maxdepth 1 -name include -printf '-I %p ') \
+ *     $(find . host png fonts -maxdepth 1 -name '*.c*') -lstdc++ -lm
+ *
+ * The test prints the throughput of the blend kernels and of the anti-aliased shapes
+ */
+
 /*
 This is the core graphics library for all our displays, providing a common
 set of graphics primitives (points, lines, circles, etc.).  It needs to be
@@ -48,6 +56,19 @@ POSSIBILITY OF SUCH DAMAGE.
 
 void driver_framebuffer_line(Window* window, int16_t x0, int16_t y0, int16_t x1, int16_t y1, uint32_t color)
 {
+	framebuffer_lock_t lock;
+	if (y0 == y1) {
+		if (x0 > x1) _swap_int16_t(x0, x1);
+		driver_framebuffer_hline(window, x0, y0, x1 - x0 + 1, color);
+		return;
+	}
+
+	if (x0 == x1) {
+		if (y0 > y1) _swap_int16_t(y0, y1);
+		driver_framebuffer_vline(window, x0, y0, y1 - y0 + 1, color);
+		return;
+	}
+
 	int16_t steep = abs(y1 - y0) > abs(x1 - x0);
 	if (steep) {
 		_swap_int16_t(x0, y0);
@@ -72,13 +93,18 @@ void driver_framebuffer_line(Window* window, int16_t x0, int16_t y0, int16_t x1,
 		ystep = -1;
 	}
 
+	//Emit every run of pixels sharing the same minor coordinate as a single span
+	int16_t runStart = x0;
 	for (/*empty*/; x0<=x1; x0++) {
-		if (steep) {
-			driver_framebuffer_setPixel(window, y0, x0, color);
-		} else {
-			driver_framebuffer_setPixel(window, x0, y0, color);
-		}
 		err -= dy;
+		if ((err < 0) || (x0 == x1)) {
+			if (steep) {
+				driver_framebuffer_vline(window, y0, runStart, x0 - runStart + 1, color);
+			} else {
+				driver_framebuffer_hline(window, runStart, y0, x0 - runStart + 1, color);
+			}
+			runStart = x0 + 1;
+		}
 		if (err < 0) {
 			y0 += ystep;
 			err += dx;
@@ -88,10 +114,9 @@ void driver_framebuffer_line(Window* window, int16_t x0, int16_t y0, int16_t x1,
 
 void driver_framebuffer_rect(Window* window, int16_t x, int16_t y, uint16_t w, uint16_t h, bool fill, uint32_t color)
 {
+	framebuffer_lock_t lock;
 	if (fill) {
-		for (int16_t i=x; i<x+w; i++) {
-			driver_framebuffer_line(window, i, y, i, y+h-1, color);
-		}
+		driver_framebuffer_fill_rect(window, x, y, w, h, color);
 	} else {
 		driver_framebuffer_line(window, x,    y,     x+w-1, y,     color);
 		driver_framebuffer_line(window, x,    y+h-1, x+w-1, y+h-1, color);
@@ -100,28 +125,519 @@ void driver_framebuffer_rect(Window* window, int16_t x, int16_t y, uint16_t w, u
 	}
 }
 
-void driver_framebuffer_circle(Window* window, int16_t x0, int16_t y0, uint16_t r, uint16_t startAngle, uint16_t endAngle, bool fill, uint32_t color)
+#define ARC_OUTSIDE  0
+#define ARC_PARTIAL  1
+#define ARC_INSIDE   2
+#define ARC_ONE      16384 //Directions are stored with 14 fractional bits
+
+typedef struct circle_arc_t {
+	bool full;              // The arc is a whole circle, nothing has to be tested
+	bool wide;              // The arc covers half of the circle or more, the union of two half-planes instead of their intersection
+	int32_t sx, sy;         // Direction of the start of the arc
+	int32_t ex, ey;         // Direction of the end of the arc
+	uint8_t octants[8];     // ARC_OUTSIDE, ARC_PARTIAL or ARC_INSIDE for every 45 degrees, starting at the right going clockwise
+} circle_arc_t;
+
+inline int32_t _floor_div(int32_t a, int32_t b)
+{
+	int32_t q = a / b;
+	if ((a % b != 0) && ((a < 0) != (b < 0))) q--;
+	return q;
+}
+
+void _arc_init(circle_arc_t* arc, float start, float span)
+{ //Angles are in radians, 0 points to the right and angles increase clockwise on the screen (y points down)
+	arc->full = span >= 2 * M_PI;
+	if (arc->full) return;
+	start = fmodf(start, 2 * M_PI);
+	if (start < 0) start += 2 * M_PI;
+	arc->wide = span >= M_PI;
+	arc->sx = lroundf(cosf(start) * ARC_ONE);
+	arc->sy = lroundf(sinf(start) * ARC_ONE);
+	arc->ex = lroundf(cosf(start + span) * ARC_ONE);
+	arc->ey = lroundf(sinf(start + span) * ARC_ONE);
+	for (int i = 0; i < 8; i++) {
+		float octant = i * M_PI / 4;
+		float toOctant = fmodf(octant - start + 2 * M_PI, 2 * M_PI); //From the start of the arc to the start of the octant
+		float toStart  = fmodf(start - octant + 2 * M_PI, 2 * M_PI); //From the start of the octant to the start of the arc
+		if (toOctant + M_PI / 4 <= span) {
+			arc->octants[i] = ARC_INSIDE;
+		} else if ((toOctant >= span) && (toStart >= M_PI / 4)) {
+			arc->octants[i] = ARC_OUTSIDE;
+		} else {
+			arc->octants[i] = ARC_PARTIAL;
+		}
+	}
+}
+
+inline bool _arc_contains(const circle_arc_t* arc, int32_t dx, int32_t dy)
+{ //The start of the arc is included, the end is not
+	bool afterStart = arc->sx * dy - arc->sy * dx >= 0;
+	bool beforeEnd  = arc->ex * dy - arc->ey * dx < 0;
+	return arc->wide ? (afterStart || beforeEnd) : (afterStart && beforeEnd);
+}
+
+void _arc_half_plane(int32_t vx, int32_t vy, int32_t dy, bool before, int32_t* lo, int32_t* hi)
+{ //Columns of row dy on the clockwise side of direction v (or the other side when before is set)
+	int32_t c = vx * dy;
+	*lo = INT16_MIN;
+	*hi = INT16_MAX;
+	if (vy == 0) {
+		if (before ? (c >= 0) : (c < 0)) *hi = *lo - 1; //Empty
+	} else if (vy > 0) {
+		if (before) *lo = _floor_div(c, vy) + 1; else *hi = _floor_div(c, vy);
+	} else {
+		int32_t q = -_floor_div(-c, vy); //Rounded up
+		if (before) *hi = q - 1; else *lo = q;
+	}
+}
+
+void _arc_span(Window* window, const circle_arc_t* arc, int16_t x0, int16_t y, int32_t dy, int32_t extent, uint32_t color)
+{ //Draw the part of the row from -extent to extent (relative to x0) that lies inside the arc
+	if (arc->full) {
+		driver_framebuffer_hline(window, x0 - extent, y, 2 * extent + 1, color);
+		return;
+	}
+	int32_t aLo, aHi, bLo, bHi;
+	_arc_half_plane(arc->sx, arc->sy, dy, false, &aLo, &aHi);
+	_arc_half_plane(arc->ex, arc->ey, dy, true,  &bLo, &bHi);
+	if (!arc->wide) {
+		int32_t lo = -extent, hi = extent;
+		if (aLo > lo) lo = aLo;
+		if (bLo > lo) lo = bLo;
+		if (aHi < hi) hi = aHi;
+		if (bHi < hi) hi = bHi;
+		if (lo <= hi) driver_framebuffer_hline(window, x0 + lo, y, hi - lo + 1, color);
+	} else {
+		//Two half-infinite ranges, drawn as one span when they touch
+		if (aLo > bLo) {
+			int32_t t;
+			t = aLo; aLo = bLo; bLo = t;
+			t = aHi; aHi = bHi; bHi = t;
+		}
+		if ((aLo <= aHi) && (bLo <= bHi) && (bLo <= aHi + 1)) {
+			if (bHi > aHi) aHi = bHi;
+			bHi = bLo - 1;
+		}
+		if (aLo < -extent) aLo = -extent;
+		if (aHi >  extent) aHi =  extent;
+		if (bLo < -extent) bLo = -extent;
+		if (bHi >  extent) bHi =  extent;
+		if (aLo <= aHi) driver_framebuffer_hline(window, x0 + aLo, y, aHi - aLo + 1, color);
+		if (bLo <= bHi) driver_framebuffer_hline(window, x0 + bLo, y, bHi - bLo + 1, color);
+	}
+}
+
+void _arc_row(Window* window, const circle_arc_t* arc, int16_t x0, int16_t y0, int32_t dy, int32_t extent, uint32_t color)
+{ //Fill rows dy and -dy of a circle or an ellipse
+	_arc_span(window, arc, x0, y0 + dy, dy, extent, color);
+	if (dy != 0) _arc_span(window, arc, x0, y0 - dy, -dy, extent, color);
+}
+
+void _arc_plot(Window* window, const circle_arc_t* arc, int octant, int16_t x0, int16_t y0, int32_t dx, int32_t dy, uint32_t color)
 {
-	bool havePrevPixel = 0;
-	int prevX = 0;
-	int prevY = 0;
+	if (!arc->full) {
+		if (arc->octants[octant] == ARC_OUTSIDE) return;
+		if ((arc->octants[octant] == ARC_PARTIAL) && !_arc_contains(arc, dx, dy)) return;
+	}
+	driver_framebuffer_setPixel(window, x0 + dx, y0 + dy, color);
+}
+
+void driver_framebuffer_arc(Window* window, int16_t x0, int16_t y0, uint16_t r, float startAngle, float endAngle, bool fill, uint32_t color)
+{
+	framebuffer_lock_t lock;
 	if (startAngle >= endAngle) return;
-	for (int f=(fill ? 0 : r); f <= r; f++) {
-		havePrevPixel = false;
-		for (int i=startAngle; i<endAngle; i++) {
-			float radians = i * M_PI / 180;
-			int px = x0 + f * cos(radians);
-			int py = y0 + f * sin(radians);
-			if (havePrevPixel && ((prevX != px) || (prevY != py))) {
-				driver_framebuffer_line(window, prevX, prevY, px, py, color);
+	circle_arc_t arc;
+	_arc_init(&arc, startAngle, endAngle - startAngle);
+
+	//Midpoint circle: (x, y) walks the 45 degrees below the right-hand side, the other octants are mirrored
+	int32_t x = r, y = 0, decision = 1 - r;
+	while (y <= x) {
+		if (fill) {
+			//Every row gets one span: rows y while walking, rows x when x is about to change
+			_arc_row(window, &arc, x0, y0, y, x, color);
+		} else {
+			_arc_plot(window, &arc, 0, x0, y0,  x,  y, color);
+			_arc_plot(window, &arc, 1, x0, y0,  y,  x, color);
+			_arc_plot(window, &arc, 2, x0, y0, -y,  x, color);
+			_arc_plot(window, &arc, 3, x0, y0, -x,  y, color);
+			_arc_plot(window, &arc, 4, x0, y0, -x, -y, color);
+			_arc_plot(window, &arc, 5, x0, y0, -y, -x, color);
+			_arc_plot(window, &arc, 6, x0, y0,  y, -x, color);
+			_arc_plot(window, &arc, 7, x0, y0,  x, -y, color);
+		}
+		y++;
+		if (decision <= 0) {
+			decision += 2 * y + 1;
+		} else {
+			if (fill && (x > y - 1)) _arc_row(window, &arc, x0, y0, x, y - 1, color);
+			x--;
+			decision += 2 * (y - x) + 1;
+		}
+	}
+	if (fill && !arc.full) driver_framebuffer_setPixel(window, x0, y0, color); //The center is on both edges of a pie
+}
+
+void driver_framebuffer_circle(Window* window, int16_t x0, int16_t y0, uint16_t r, uint16_t startAngle, uint16_t endAngle, bool fill, uint32_t color)
+{
+	framebuffer_lock_t lock;
+	driver_framebuffer_arc(window, x0, y0, r, startAngle * M_PI / 180, endAngle * M_PI / 180, fill, color);
+}
+
+void driver_framebuffer_ellipse(Window* window, int16_t x0, int16_t y0, uint16_t rx, uint16_t ry, bool fill, uint32_t color)
+{
+	framebuffer_lock_t lock;
+	//Midpoint ellipse in two regions, above and below the point where the slope of the edge is 1. The decision
+	//variables are scaled by 4 to stay integer. Points arrive from the top down, a row is done when y changes
+	if (ry == 0) {
+		driver_framebuffer_hline(window, x0 - rx, y0, 2 * rx + 1, color);
+		return;
+	}
+	circle_arc_t arc;
+	arc.full = true;
+	int64_t rx2 = (int64_t) rx * rx, ry2 = (int64_t) ry * ry;
+	int32_t x = 0, y = ry;
+	int32_t rowY = ry, rowX = 0;
+	int64_t px = 0, py = 2 * rx2 * y;
+	int64_t decision = 4 * ry2 - 4 * rx2 * ry + rx2;
+	bool region1 = true;
+	while (y >= 0) {
+		if (fill) {
+			if (y != rowY) _arc_row(window, &arc, x0, y0, rowY, rowX, color);
+			rowY = y;
+			rowX = x;
+		} else {
+			driver_framebuffer_setPixel(window, x0 + x, y0 + y, color);
+			if (x != 0) driver_framebuffer_setPixel(window, x0 - x, y0 + y, color);
+			if (y != 0) {
+				driver_framebuffer_setPixel(window, x0 + x, y0 - y, color);
+				if (x != 0) driver_framebuffer_setPixel(window, x0 - x, y0 - y, color);
+			}
+		}
+		if (region1 && (px >= py)) {
+			region1 = false;
+			decision = ry2 * (2 * x + 1) * (2 * x + 1) + 4 * rx2 * (int64_t) (y - 1) * (y - 1) - 4 * rx2 * ry2;
+		}
+		if (region1) {
+			x++;
+			px += 2 * ry2;
+			if (decision < 0) {
+				decision += 4 * (ry2 + px);
 			} else {
-				driver_framebuffer_setPixel(window, px, py, color);
+				y--;
+				py -= 2 * rx2;
+				decision += 4 * (ry2 + px - py);
 			}
-			prevX = px;
-			prevY = py;
-			havePrevPixel = true;
+		} else {
+			y--;
+			py -= 2 * rx2;
+			if (decision > 0) {
+				decision += 4 * (rx2 - py);
+			} else {
+				x++;
+				px += 2 * ry2;
+				decision += 4 * (rx2 - py + px);
+			}
+		}
+	}
+	if (fill) _arc_row(window, &arc, x0, y0, rowY, rowX, color);
+}
+
+uint32_t _isqrt(uint64_t value)
+{ //Integer square root, rounded down
+	uint64_t result = 0;
+	uint64_t bit = (uint64_t) 1 << 62;
+	while (bit > value) bit >>= 2;
+	while (bit) {
+		if (value >= result + bit) {
+			value -= result + bit;
+			result = (result >> 1) + bit;
+		} else {
+			result >>= 1;
+		}
+		bit >>= 2;
+	}
+	return result;
+}
+
+void _plot_aa(Window* window, bool steep, int32_t x, int32_t y, uint32_t color, int32_t coverage)
+{
+	if (coverage <= 0) return;
+	if (coverage > 255) coverage = 255;
+	if (steep) {
+		driver_framebuffer_blendPixel(window, y, x, color, coverage);
+	} else {
+		driver_framebuffer_blendPixel(window, x, y, color, coverage);
+	}
+}
+
+void driver_framebuffer_line_aa(Window* window, float x0, float y0, float x1, float y1, uint32_t color)
+{
+	framebuffer_lock_t lock;
+	//Xiaolin Wu's algorithm with coordinates in 24.8 and the gradient in 16.16 fixed point,
+	//every step shares its coverage between the two pixels closest to the line
+	int32_t fx0 = lroundf(x0 * 256), fy0 = lroundf(y0 * 256);
+	int32_t fx1 = lroundf(x1 * 256), fy1 = lroundf(y1 * 256);
+	bool steep = abs(fy1 - fy0) > abs(fx1 - fx0);
+	if (steep) {
+		int32_t t;
+		t = fx0; fx0 = fy0; fy0 = t;
+		t = fx1; fx1 = fy1; fy1 = t;
+	}
+	if (fx0 > fx1) {
+		int32_t t;
+		t = fx0; fx0 = fx1; fx1 = t;
+		t = fy0; fy0 = fy1; fy1 = t;
+	}
+	int32_t dx = fx1 - fx0, dy = fy1 - fy0;
+	int32_t gradient = (dx == 0) ? (1 << 16) : (int32_t) (((int64_t) dy << 16) / dx);
+
+	//First end point
+	int32_t xStart = (fx0 + 128) >> 8;
+	int32_t yEnd   = fy0 + (int32_t) (((int64_t) gradient * ((xStart << 8) - fx0)) >> 16);
+	int32_t xGap   = 256 - ((fx0 + 128) & 0xFF);
+	_plot_aa(window, steep, xStart, yEnd >> 8,       color, ((255 - (yEnd & 0xFF)) * xGap) >> 8);
+	_plot_aa(window, steep, xStart, (yEnd >> 8) + 1, color, ((yEnd & 0xFF) * xGap) >> 8);
+	int32_t intery = (yEnd << 8) + gradient;
+
+	//Second end point
+	int32_t xStop = (fx1 + 128) >> 8;
+	yEnd = fy1 + (int32_t) (((int64_t) gradient * ((xStop << 8) - fx1)) >> 16);
+	xGap = (fx1 + 128) & 0xFF;
+	_plot_aa(window, steep, xStop, yEnd >> 8,       color, ((255 - (yEnd & 0xFF)) * xGap) >> 8);
+	_plot_aa(window, steep, xStop, (yEnd >> 8) + 1, color, ((yEnd & 0xFF) * xGap) >> 8);
+
+	for (int32_t x = xStart + 1; x < xStop; x++) {
+		int32_t fraction = (intery >> 8) & 0xFF;
+		_plot_aa(window, steep, x, intery >> 16,       color, 255 - fraction);
+		_plot_aa(window, steep, x, (intery >> 16) + 1, color, fraction);
+		intery += gradient;
+	}
+}
+
+void driver_framebuffer_circle_aa(Window* window, int16_t x0, int16_t y0, uint16_t r, bool fill, uint32_t color)
+{
+	framebuffer_lock_t lock;
+	//Coverage follows from the distance between the center of a pixel and the circle, which
+	//is only worked out for pixels near the edge, the inside of a filled circle is drawn as spans
+	int64_t outer = (int64_t) (r + 1) * (r + 1);
+	for (int32_t dy = -r; dy <= r; dy++) {
+		int64_t dy2 = (int64_t) dy * dy;
+		int32_t xEdge = _isqrt(outer - dy2); //Pixels further away are not covered
+		int32_t xInside = -1; //Pixels closer by are either covered completely (fill) or not at all (outline)
+		if (fill) {
+			int64_t inside = (int64_t) r * r - r - dy2; //Distance at most r - 0.5
+			if (inside >= 0) xInside = _isqrt(inside);
+			if (xInside >= 0) driver_framebuffer_hline(window, x0 - xInside, y0 + dy, 2 * xInside + 1, color);
+		} else if (r > 0) {
+			int64_t inside = (int64_t) (r - 1) * (r - 1) - dy2; //Distance at most r - 1
+			if (inside >= 0) xInside = _isqrt(inside);
+		}
+		for (int32_t dx = xInside + 1; dx <= xEdge; dx++) {
+			int32_t distance = _isqrt(((uint64_t) dx * dx + dy2) << 16); //8 fractional bits
+			int32_t coverage = fill ? ((r << 8) + 128 - distance) : (256 - abs(distance - (r << 8)));
+			if (coverage <= 0) continue;
+			if (coverage > 255) coverage = 255;
+			driver_framebuffer_blendPixel(window, x0 + dx, y0 + dy, color, coverage);
+			if (dx != 0) driver_framebuffer_blendPixel(window, x0 - dx, y0 + dy, color, coverage);
 		}
 	}
 }
 
 #endif
+
+#ifdef DRIVER_FRAMEBUFFER_DRAWING_TEST
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "esp_timer.h"
+
+#define N_RAND_BLENDS 100000
+#define TEST_SIZE     101
+#define ROW_SIZE      320
+
+static const char* formatNames[FB_FORMAT_COUNT] = {"NATIVE", "1BPP", "1BPP_VERT", "1BPP_VERT2", "1BPP_OHS", "8BPP", "8CBPP", "12BPP", "16BPP", "24BPP", "32BPP"};
+
+static float channelStep(pixel_format_t format)
+{ //Distance between the levels of the coarsest channel
+	switch (format) {
+		case FB_FORMAT_8CBPP: return 85;
+		case FB_FORMAT_12BPP: return 17;
+		case FB_FORMAT_16BPP: return 255.0f / 31;
+		default:              return 1;
+	}
+}
+
+static float blendAlpha(pixel_format_t format, uint8_t alpha)
+{ //The kernels blend with fixed point alpha, 16-bit color blends two pixels in a 32-bit word and has 5 bits left for it
+	if (format == FB_FORMAT_16BPP) return ((alpha + 4) >> 3) / 32.0f;
+	return (alpha + (alpha >> 7)) / 256.0f;
+}
+
+static uint32_t stored(const pixel_ops_t* ops, uint32_t color)
+{ //The color as the format keeps it
+	uint8_t buffer[4] = {0};
+	ops->store(buffer, 1, 1, 0, 0, ops->encode(color));
+	return ops->load(buffer, 1, 1, 0, 0);
+}
+
+/* blending one pixel follows source-over within the precision of the format and of its alpha, a row blends like its pixels */
+static void do_test_blend(const pixel_ops_t* ops)
+{
+	uint8_t pixel[4];
+	static uint8_t row[ROW_SIZE * 4], rowPixels[ROW_SIZE * 4];
+	float worst = 0, limit = channelStep(ops->format) + 1;
+	for (int i = 0; i < N_RAND_BLENDS; i++) {
+		uint32_t target = (((uint32_t) rand() << 8) ^ rand()) & 0xFFFFFF, source = (((uint32_t) rand() << 8) ^ rand()) & 0xFFFFFF;
+		if (ops->format == FB_FORMAT_8BPP) { target = (target & 0xFF) * 0x010101; source = (source & 0xFF) * 0x010101; }
+		uint8_t alpha = (i < 256) ? i : rand();
+		ops->store(pixel, 1, 1, 0, 0, ops->encode(target));
+		bool changed = ops->blend(pixel, 1, 1, 0, 0, ops->encode(source), alpha);
+		uint32_t result = ops->load(pixel, 1, 1, 0, 0);
+		uint32_t t = stored(ops, target), s = stored(ops, source);
+		float a = blendAlpha(ops->format, alpha);
+		if (alpha == 0)   assert(!changed && (result == t));
+		if (alpha == 255) assert(result == s);
+		for (uint8_t shift = 0; shift < 24; shift += 8) {
+			float expected = ((s >> shift) & 0xFF) * a + ((t >> shift) & 0xFF) * (1 - a);
+			float error = fabsf(((result >> shift) & 0xFF) - expected);
+			if (error > worst) worst = error;
+			if (error > limit) {
+				fprintf(stderr, "%s: %06x over %06x at %u gives %06x\n", formatNames[ops->format], source, target, alpha, result);
+				assert(false);
+			}
+		}
+	}
+
+	//The row kernels give the same result as blending every pixel
+	for (int i = 0; i < 100; i++) {
+		for (int16_t x = 0; x < ROW_SIZE; x++) ops->store(row, ROW_SIZE, 1, x, 0, ops->encode((((uint32_t) rand() << 8) ^ rand()) & 0xFFFFFF));
+		memcpy(rowPixels, row, sizeof(row));
+		uint32_t value = ops->encode((((uint32_t) rand() << 8) ^ rand()) & 0xFFFFFF);
+		uint8_t alpha = rand();
+		int16_t x0 = rand() % ROW_SIZE, x1 = x0 + rand() % (ROW_SIZE - x0);
+		ops->hblend(row, ROW_SIZE, 1, x0, x1, 0, value, alpha);
+		for (int16_t x = x0; x <= x1; x++) ops->blend(rowPixels, ROW_SIZE, 1, x, 0, value, alpha);
+		assert(memcmp(row, rowPixels, driver_framebuffer_format_size(ops->format, ROW_SIZE, 1)) == 0);
+	}
+
+	//Throughput of the row kernel against blending every pixel in floating point
+	int64_t start = esp_timer_get_time();
+	for (int i = 0; i < 1000; i++) ops->hblend(row, ROW_SIZE, 1, 0, ROW_SIZE - 1, 0, ops->encode(i * 0x010101), i);
+	int64_t kernel = esp_timer_get_time() - start;
+	start = esp_timer_get_time();
+	for (int i = 0; i < 1000; i++) {
+		float a = (i & 0xFF) / 255.0f;
+		uint32_t source = (uint32_t) i * 0x010101;
+		for (int16_t x = 0; x < ROW_SIZE; x++) {
+			uint32_t target = ops->load(row, ROW_SIZE, 1, x, 0), result = 0;
+			for (uint8_t shift = 0; shift < 24; shift += 8) {
+				result |= (uint32_t) lroundf(((source >> shift) & 0xFF) * a + ((target >> shift) & 0xFF) * (1 - a)) << shift;
+			}
+			ops->store(row, ROW_SIZE, 1, x, 0, ops->encode(result));
+		}
+	}
+	int64_t reference = esp_timer_get_time() - start;
+	printf("%-6s blend: largest error %.2f, row kernel %.1f Mpixel/s, float per pixel %.1f Mpixel/s\n", formatNames[ops->format], worst,
+		ROW_SIZE * 1000.0 / kernel, ROW_SIZE * 1000.0 / reference);
+}
+
+static float coverage(Window* window, int16_t x, int16_t y)
+{
+	return window->buffer[y * window->width + x] / 255.0f;
+}
+
+static float distanceToSegment(float px, float py, float x0, float y0, float x1, float y1)
+{
+	float dx = x1 - x0, dy = y1 - y0;
+	float t = ((px - x0) * dx + (py - y0) * dy) / (dx * dx + dy * dy);
+	if (t < 0) t = 0;
+	if (t > 1) t = 1;
+	return hypotf(px - (x0 + t * dx), py - (y0 + t * dy));
+}
+
+/* an anti-aliased line covers about one pixel per step along its longest axis, and only pixels next to it */
+static void do_test_line_aa(Window* window)
+{
+	uint32_t size = TEST_SIZE * TEST_SIZE;
+	for (int i = 0; i < 1000; i++) {
+		float x0 = 5 + (rand() % 9000) / 100.0f, y0 = 5 + (rand() % 9000) / 100.0f;
+		float x1 = 5 + (rand() % 9000) / 100.0f, y1 = 5 + (rand() % 9000) / 100.0f;
+		float major = fmaxf(fabsf(x1 - x0), fabsf(y1 - y0));
+		if (major < 2) continue;
+		memset(window->buffer, 0, size);
+		driver_framebuffer_line_aa(window, x0, y0, x1, y1, 0xFFFFFF);
+		float total = 0;
+		for (int16_t y = 0; y < TEST_SIZE; y++) {
+			for (int16_t x = 0; x < TEST_SIZE; x++) {
+				float c = coverage(window, x, y);
+				total += c;
+				if (c > 0) assert(distanceToSegment(x, y, x0, y0, x1, y1) < 1.5f);
+			}
+		}
+		assert(fabsf(total - major) <= 2);
+	}
+
+	//A line through the centers of pixels covers them completely, the end points cover half of their pixel
+	memset(window->buffer, 0, size);
+	driver_framebuffer_line_aa(window, 10, 20, 60, 20, 0xFFFFFF);
+	for (int16_t x = 11; x < 60; x++) assert(coverage(window, x, 20) == 1.0f);
+	assert((fabsf(coverage(window, 10, 20) - 0.5f) < 0.01f) && (fabsf(coverage(window, 60, 20) - 0.5f) < 0.01f));
+	for (int16_t x = 10; x <= 60; x++) assert((coverage(window, x, 19) == 0) && (coverage(window, x, 21) == 0));
+}
+
+/* an anti-aliased circle covers its area (filled) or its circumference (outline), with no pixels far from its edge partly covered */
+static void do_test_circle_aa(Window* window)
+{
+	uint32_t size = TEST_SIZE * TEST_SIZE;
+	int16_t center = TEST_SIZE / 2;
+	for (uint16_t r = 1; r < TEST_SIZE / 2 - 1; r++) {
+		for (int fill = 0; fill <= 1; fill++) {
+			memset(window->buffer, 0, size);
+			driver_framebuffer_circle_aa(window, center, center, r, fill, 0xFFFFFF);
+			float total = 0;
+			for (int16_t y = 0; y < TEST_SIZE; y++) {
+				for (int16_t x = 0; x < TEST_SIZE; x++) {
+					float c = coverage(window, x, y);
+					float distance = hypotf(x - center, y - center);
+					total += c;
+					if (distance > r + 1) assert(c == 0);
+					if (fill && (distance < r - 1)) assert(c == 1);
+					if (!fill && (fabsf(distance - r) > 1)) assert(c == 0);
+				}
+			}
+			float expected = fill ? (float) M_PI * r * r : 2 * (float) M_PI * r;
+			assert(fabsf(total - expected) <= (fill ? 0.02f * expected + 2 : 0.1f * expected + 2));
+		}
+	}
+}
+
+static void do_test_time_aa(Window* window)
+{
+	int64_t start = esp_timer_get_time();
+	for (int i = 0; i < 10000; i++) driver_framebuffer_line_aa(window, 0.5f, i % TEST_SIZE, TEST_SIZE - 1, (i * 7) % TEST_SIZE, 0xFFFFFF);
+	int64_t lines = esp_timer_get_time() - start;
+	start = esp_timer_get_time();
+	for (int i = 0; i < 1000; i++) driver_framebuffer_circle_aa(window, TEST_SIZE / 2, TEST_SIZE / 2, 40, i & 1, 0xFFFFFF);
+	int64_t circles = esp_timer_get_time() - start;
+	printf("anti-aliased: %.1f us per %u pixel line, %.1f us per circle with radius 40\n", lines / 10000.0, TEST_SIZE, circles / 1000.0);
+}
+
+int main(void)
+{
+	srand(42);
+	static const pixel_format_t formats[] = {FB_FORMAT_8BPP, FB_FORMAT_8CBPP, FB_FORMAT_12BPP, FB_FORMAT_16BPP, FB_FORMAT_24BPP, FB_FORMAT_32BPP};
+	for (uint8_t i = 0; i < sizeof(formats) / sizeof(formats[0]); i++) do_test_blend(driver_framebuffer_format_ops(formats[i]));
+
+	Window* window = driver_framebuffer_window_create_format("aa", TEST_SIZE, TEST_SIZE, FB_FORMAT_8BPP);
+	assert(window);
+	do_test_line_aa(window);
+	do_test_circle_aa(window);
+	do_test_time_aa(window);
+	driver_framebuffer_window_remove(window);
+	printf("OK\n");
+	return 0;
+}
+
+#endif // DRIVER_FRAMEBUFFER_DRAWING_TEST
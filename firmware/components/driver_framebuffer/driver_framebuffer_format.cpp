@@ -0,0 +1,897 @@
+/*
+ * The functions in this file convert colors to and from
+ * the pixel formats supported by the framebuffer and
+ * read and write pixels and spans in buffers of each format
+ */
+
+/* TEST (from this directory, host/ stands in for ESP-IDF):
+ * gcc -o fb_format_test -DDRIVER_FRAMEBUFFER_FORMAT_TEST -Wall -g -I host -I png \
+ *     $(find ../driver_display_* ../driver_io_disobey_samd -maxdepth 1 -name include -printf '-I %p ') \
+ *     $(find . host png fonts -maxdepth 1 -name '*.c*') -lstdc++ -lm
+ *
+ * Add -DCONFIG_DRIVER_FRAMEBUFFER_SWAP_R_AND_B to test the swapped channel order
+ */
+
+#include "include/driver_framebuffer_internal.h"
+
+#ifdef CONFIG_DRIVER_FRAMEBUFFER_ENABLE
+
+/* Color space conversions */
+
+inline uint16_t convert24to16(uint32_t in) //RGB24 to 565
+{
+#ifdef CONFIG_DRIVER_FRAMEBUFFER_SWAP_R_AND_B
+	uint8_t b = (in>>16)&0xFF;
+	uint8_t r = in&0xFF;
+#else
+	uint8_t r = (in>>16)&0xFF;
+	uint8_t b = in&0xFF;
+#endif
+	uint8_t g = (in>>8)&0xFF;
+	return ((b & 0b11111000) << 8) | ((g & 0b11111100) << 3) | (r >> 3);
+}
+
+inline uint8_t convert24to8C(uint32_t in) //RGB24 to 256-color
+{
+#ifdef CONFIG_DRIVER_FRAMEBUFFER_SWAP_R_AND_B
+	uint8_t r = ( in     &0xFF) >> 5;
+	uint8_t b = ((in>>16)&0xFF) >> 6;
+#else
+	uint8_t r = ((in>>16)&0xFF) >> 5;
+	uint8_t b = ( in     &0xFF) >> 6;
+#endif
+	uint8_t g = ((in>> 8)&0xFF) >> 5;
+	return r | (g<<3) | (b<<6);
+}
+
+inline uint32_t convert8Cto24(uint8_t in) //256-color to RGB24
+{
+#ifdef CONFIG_DRIVER_FRAMEBUFFER_SWAP_R_AND_B
+	uint8_t b = ((in & 0x07) * 255) / 7;
+	uint8_t r = (in >> 6) * 85;
+#else
+	uint8_t r = ((in & 0x07) * 255) / 7;
+	uint8_t b = (in >> 6) * 85;
+#endif
+	uint8_t g = (((in>>3) & 0x07) * 255) / 7;
+	return b | (g << 8) | (r << 16);
+}
+
+inline uint8_t convert24to8(uint32_t in) //RGB24 to 8-bit greyscale
+{
+#ifdef CONFIG_DRIVER_FRAMEBUFFER_SWAP_R_AND_B
+	uint8_t b = (in>>16)&0xFF;
+	uint8_t r = in&0xFF;
+#else
+	uint8_t r = (in>>16)&0xFF;
+	uint8_t b = in&0xFF;
+#endif
+	uint8_t g = (in>>8)&0xFF;
+	return ( r + g + b + 1 ) / 3;
+}
+
+inline bool convert8to1(uint8_t in) //8-bit greyscale to black&white
+{
+	return in >= 128;
+}
+
+/* Shared helpers */
+
+inline bool _store_mask(uint8_t* target, uint8_t mask, uint32_t value)
+{
+	uint8_t oldVal = *target;
+	if (value) {
+		*target |= mask;
+	} else {
+		*target &= ~mask;
+	}
+	return oldVal != *target;
+}
+
+inline uint8_t _span_mask(int16_t first, int16_t last)
+{ //Mask for the bits first%8 to last%8 (inclusive) of a byte
+	return (0xFF << (first % 8)) & (0xFF >> (7 - (last % 8)));
+}
+
+static void _store_words(uint8_t* target, uint32_t count, const uint8_t* pattern, uint8_t pixelBytes)
+{ //Repeat a 2 or 4 byte pattern, using 32-bit stores once the target is aligned
+	uint32_t word;
+	if (pixelBytes == 2) {
+		if (count && ((uintptr_t) target & 2)) {
+			target[0] = pattern[0];
+			target[1] = pattern[1];
+			target += 2;
+			count--;
+		}
+		uint8_t pattern32[4] = {pattern[0], pattern[1], pattern[0], pattern[1]};
+		memcpy(&word, pattern32, 4);
+		uint32_t* target32 = (uint32_t*) target;
+		for (uint32_t i = 0; i < count / 2; i++) target32[i] = word;
+		if (count & 1) {
+			target += (count & ~1) * 2;
+			target[0] = pattern[0];
+			target[1] = pattern[1];
+		}
+	} else {
+		memcpy(&word, pattern, 4);
+		uint32_t* target32 = (uint32_t*) target;
+		for (uint32_t i = 0; i < count; i++) target32[i] = word;
+	}
+}
+
+inline uint32_t _blend_channels(uint32_t target, uint32_t source, uint32_t alpha, uint32_t mask)
+{ //Blend the channels selected by the mask in one go, alpha ranges from 0 to 256 and every channel needs 8 unused bits above it
+	return ((((source & mask) * alpha) + ((target & mask) * (256 - alpha))) >> 8) & mask;
+}
+
+inline uint32_t _blend_alpha(uint8_t alpha)
+{ //Map 0-255 onto 0-256 so that 255 fully replaces the target
+	return alpha + (alpha >> 7);
+}
+
+static uint32_t _encode_1bpp(uint32_t color)
+{
+	return convert8to1(convert24to8(color));
+}
+
+static uint32_t _load_1bpp_bit(uint8_t byte, uint8_t bit)
+{
+	return ((byte >> bit) & 0x01) ? 0xFFFFFF : 0x000000;
+}
+
+static void _fill_bytes(uint8_t* buffer, uint32_t size, uint8_t value)
+{
+	memset(buffer, value, size);
+}
+
+/* 1-bit, horizontally packed */
+
+inline uint32_t _position_1bpp(uint16_t width, int16_t x, int16_t y)
+{
+	return (y * ((width + 7) / 8)) + (x / 8);
+}
+
+static bool _store_1bpp(uint8_t* buffer, uint16_t width, uint16_t height, int16_t x, int16_t y, uint32_t value)
+{
+	return _store_mask(&buffer[_position_1bpp(width, x, y)], 1 << (x % 8), value);
+}
+
+static uint32_t _load_1bpp(const uint8_t* buffer, uint16_t width, uint16_t height, int16_t x, int16_t y)
+{
+	return _load_1bpp_bit(buffer[_position_1bpp(width, x, y)], x % 8);
+}
+
+static void _hspan_1bpp(uint8_t* buffer, uint16_t width, uint16_t height, int16_t x0, int16_t x1, int16_t y, uint32_t value)
+{
+	for (int16_t x = x0; x <= x1; ) {
+		int16_t last = (x | 7) < x1 ? (x | 7) : x1; //Last pixel of the span that shares a byte with x
+		_store_mask(&buffer[_position_1bpp(width, x, y)], _span_mask(x, last), value);
+		x = last + 1;
+	}
+}
+
+static void _vspan_1bpp(uint8_t* buffer, uint16_t width, uint16_t height, int16_t x, int16_t y0, int16_t y1, uint32_t value)
+{
+	for (int16_t y = y0; y <= y1; y++) _store_1bpp(buffer, width, height, x, y, value);
+}
+
+static void _fill_1bpp(uint8_t* buffer, uint16_t width, uint16_t height, uint32_t value)
+{
+	_fill_bytes(buffer, ((width + 7) / 8) * height, value ? 0xFF : 0x00);
+}
+
+/* 1-bit, vertically packed, bytes placed next to each other horizontally */
+
+inline uint32_t _position_1bpp_vert(uint16_t width, int16_t x, int16_t y)
+{
+	return ((y / 8) * width) + x;
+}
+
+static bool _store_1bpp_vert(uint8_t* buffer, uint16_t width, uint16_t height, int16_t x, int16_t y, uint32_t value)
+{
+	return _store_mask(&buffer[_position_1bpp_vert(width, x, y)], 1 << (y % 8), value);
+}
+
+static uint32_t _load_1bpp_vert(const uint8_t* buffer, uint16_t width, uint16_t height, int16_t x, int16_t y)
+{
+	return _load_1bpp_bit(buffer[_position_1bpp_vert(width, x, y)], y % 8);
+}
+
+static void _hspan_1bpp_vert(uint8_t* buffer, uint16_t width, uint16_t height, int16_t x0, int16_t x1, int16_t y, uint32_t value)
+{
+	uint8_t* target = &buffer[_position_1bpp_vert(width, x0, y)];
+	for (int16_t x = x0; x <= x1; x++) _store_mask(target++, 1 << (y % 8), value);
+}
+
+static void _vspan_1bpp_vert(uint8_t* buffer, uint16_t width, uint16_t height, int16_t x, int16_t y0, int16_t y1, uint32_t value)
+{
+	for (int16_t y = y0; y <= y1; ) {
+		int16_t last = (y | 7) < y1 ? (y | 7) : y1; //Last pixel of the span that shares a byte with y
+		_store_mask(&buffer[_position_1bpp_vert(width, x, y)], _span_mask(y, last), value);
+		y = last + 1;
+	}
+}
+
+static void _fill_1bpp_vert(uint8_t* buffer, uint16_t width, uint16_t height, uint32_t value)
+{
+	_fill_bytes(buffer, width * ((height + 7) / 8), value ? 0xFF : 0x00);
+}
+
+/* 1-bit, vertically packed, bytes placed below each other vertically */
+
+inline uint32_t _position_1bpp_vert2(uint16_t height, int16_t x, int16_t y)
+{
+	return (y / 8) + (x * ((height + 7) / 8));
+}
+
+static bool _store_1bpp_vert2(uint8_t* buffer, uint16_t width, uint16_t height, int16_t x, int16_t y, uint32_t value)
+{
+	return _store_mask(&buffer[_position_1bpp_vert2(height, x, y)], 1 << (y % 8), value);
+}
+
+static uint32_t _load_1bpp_vert2(const uint8_t* buffer, uint16_t width, uint16_t height, int16_t x, int16_t y)
+{
+	return _load_1bpp_bit(buffer[_position_1bpp_vert2(height, x, y)], y % 8);
+}
+
+static void _hspan_1bpp_vert2(uint8_t* buffer, uint16_t width, uint16_t height, int16_t x0, int16_t x1, int16_t y, uint32_t value)
+{
+	for (int16_t x = x0; x <= x1; x++) _store_1bpp_vert2(buffer, width, height, x, y, value);
+}
+
+static void _vspan_1bpp_vert2(uint8_t* buffer, uint16_t width, uint16_t height, int16_t x, int16_t y0, int16_t y1, uint32_t value)
+{
+	for (int16_t y = y0; y <= y1; ) {
+		int16_t last = (y | 7) < y1 ? (y | 7) : y1; //Last pixel of the span that shares a byte with y
+		_store_mask(&buffer[_position_1bpp_vert2(height, x, y)], _span_mask(y, last), value);
+		y = last + 1;
+	}
+}
+
+static void _fill_1bpp_vert2(uint8_t* buffer, uint16_t width, uint16_t height, uint32_t value)
+{
+	_fill_bytes(buffer, width * ((height + 7) / 8), value ? 0xFF : 0x00);
+}
+
+/* 1-bit, horizontally packed and mirrored */
+
+inline uint32_t _position_1bpp_ohs(uint16_t width, int16_t x, int16_t y)
+{
+	return ((width - x - 1) + y * width) / 8;
+}
+
+static bool _store_1bpp_ohs(uint8_t* buffer, uint16_t width, uint16_t height, int16_t x, int16_t y, uint32_t value)
+{
+	return _store_mask(&buffer[_position_1bpp_ohs(width, x, y)], 1 << (x % 8), value);
+}
+
+static uint32_t _load_1bpp_ohs(const uint8_t* buffer, uint16_t width, uint16_t height, int16_t x, int16_t y)
+{
+	return _load_1bpp_bit(buffer[_position_1bpp_ohs(width, x, y)], x % 8);
+}
+
+static void _hspan_1bpp_ohs(uint8_t* buffer, uint16_t width, uint16_t height, int16_t x0, int16_t x1, int16_t y, uint32_t value)
+{
+	for (int16_t x = x0; x <= x1; x++) _store_1bpp_ohs(buffer, width, height, x, y, value);
+}
+
+static void _vspan_1bpp_ohs(uint8_t* buffer, uint16_t width, uint16_t height, int16_t x, int16_t y0, int16_t y1, uint32_t value)
+{
+	for (int16_t y = y0; y <= y1; y++) _store_1bpp_ohs(buffer, width, height, x, y, value);
+}
+
+static void _fill_1bpp_ohs(uint8_t* buffer, uint16_t width, uint16_t height, uint32_t value)
+{
+	_fill_bytes(buffer, (width * height + 7) / 8, value ? 0xFF : 0x00);
+}
+
+/* 1-bit blending, pixels are either replaced or left alone */
+
+#define BLEND_1BPP(name) \
+static bool _blend_##name(uint8_t* buffer, uint16_t width, uint16_t height, int16_t x, int16_t y, uint32_t value, uint8_t alpha) \
+{ \
+	return (alpha >= 128) && _store_##name(buffer, width, height, x, y, value); \
+} \
+static void _hblend_##name(uint8_t* buffer, uint16_t width, uint16_t height, int16_t x0, int16_t x1, int16_t y, uint32_t value, uint8_t alpha) \
+{ \
+	if (alpha >= 128) _hspan_##name(buffer, width, height, x0, x1, y, value); \
+}
+
+BLEND_1BPP(1bpp)
+BLEND_1BPP(1bpp_vert)
+BLEND_1BPP(1bpp_vert2)
+BLEND_1BPP(1bpp_ohs)
+
+/* Rows of values for formats that do not store whole bytes per pixel go through the store function */
+
+#define ROW_PIXELS(name) \
+static void _row_##name(uint8_t* buffer, uint16_t width, uint16_t height, int16_t x, int16_t y, int16_t dx, int16_t dy, const uint32_t* values, int16_t count) \
+{ \
+	for (int16_t i = 0; i < count; i++, x += dx, y += dy) _store_##name(buffer, width, height, x, y, values[i]); \
+}
+
+ROW_PIXELS(1bpp)
+ROW_PIXELS(1bpp_vert)
+ROW_PIXELS(1bpp_vert2)
+ROW_PIXELS(1bpp_ohs)
+
+/* 8-bit, greyscale and color */
+
+static uint32_t _encode_8bpp(uint32_t color)
+{
+	return convert24to8(color);
+}
+
+static uint32_t _encode_8cbpp(uint32_t color)
+{
+	return convert24to8C(color);
+}
+
+static bool _store_8bpp(uint8_t* buffer, uint16_t width, uint16_t height, int16_t x, int16_t y, uint32_t value)
+{
+	uint32_t position = (y * width) + x;
+	if (buffer[position] == value) return false;
+	buffer[position] = value;
+	return true;
+}
+
+static uint32_t _load_8bpp(const uint8_t* buffer, uint16_t width, uint16_t height, int16_t x, int16_t y)
+{
+	uint32_t position = (y * width) + x;
+	return (buffer[position] << 16) + (buffer[position]<<8) + buffer[position];
+}
+
+static uint32_t _load_8cbpp(const uint8_t* buffer, uint16_t width, uint16_t height, int16_t x, int16_t y)
+{
+	return convert8Cto24(buffer[(y * width) + x]);
+}
+
+static void _hspan_8bpp(uint8_t* buffer, uint16_t width, uint16_t height, int16_t x0, int16_t x1, int16_t y, uint32_t value)
+{
+	memset(&buffer[(y * width) + x0], value, x1 - x0 + 1);
+}
+
+static void _vspan_8bpp(uint8_t* buffer, uint16_t width, uint16_t height, int16_t x, int16_t y0, int16_t y1, uint32_t value)
+{
+	uint8_t* target = &buffer[(y0 * width) + x];
+	for (int16_t y = y0; y <= y1; y++, target += width) *target = value;
+}
+
+static void _fill_8bpp(uint8_t* buffer, uint16_t width, uint16_t height, uint32_t value)
+{
+	_fill_bytes(buffer, width * height, value);
+}
+
+static void _row_8bpp(uint8_t* buffer, uint16_t width, uint16_t height, int16_t x, int16_t y, int16_t dx, int16_t dy, const uint32_t* values, int16_t count)
+{
+	uint8_t* target = &buffer[(y * width) + x];
+	int32_t step = dy * width + dx;
+	for (int16_t i = 0; i < count; i++, target += step) *target = values[i];
+}
+
+static bool _blend_8bpp(uint8_t* buffer, uint16_t width, uint16_t height, int16_t x, int16_t y, uint32_t value, uint8_t alpha)
+{
+	uint8_t* target = &buffer[(y * width) + x];
+	uint8_t result = _blend_channels(*target, value, _blend_alpha(alpha), 0xFF);
+	if (*target == result) return false;
+	*target = result;
+	return true;
+}
+
+static void _hblend_8bpp(uint8_t* buffer, uint16_t width, uint16_t height, int16_t x0, int16_t x1, int16_t y, uint32_t value, uint8_t alpha)
+{
+	uint32_t a = _blend_alpha(alpha);
+	uint32_t source = value * a; //Constant part of the blend
+	uint8_t* target = &buffer[(y * width) + x0];
+	for (int16_t x = x0; x <= x1; x++, target++) *target = (source + (*target * (256 - a))) >> 8;
+}
+
+static bool _blend_8cbpp(uint8_t* buffer, uint16_t width, uint16_t height, int16_t x, int16_t y, uint32_t value, uint8_t alpha)
+{ //3-3-2 channels are too close together to blend at once
+	uint8_t* target = &buffer[(y * width) + x];
+	uint32_t a = _blend_alpha(alpha);
+	uint8_t result = _blend_channels(*target, value, a, 0x07) | _blend_channels(*target, value, a, 0x38) | _blend_channels(*target, value, a, 0xC0);
+	if (*target == result) return false;
+	*target = result;
+	return true;
+}
+
+static void _hblend_8cbpp(uint8_t* buffer, uint16_t width, uint16_t height, int16_t x0, int16_t x1, int16_t y, uint32_t value, uint8_t alpha)
+{
+	for (int16_t x = x0; x <= x1; x++) _blend_8cbpp(buffer, width, height, x, y, value, alpha);
+}
+
+/* 12-bit color */
+
+static uint32_t _encode_12bpp(uint32_t color)
+{
+	return (((color >> 20) & 0x0F) << 8) | (((color >> 12) & 0x0F) << 4) | ((color >> 4) & 0x0F);
+}
+
+static bool _store_12bpp(uint8_t* buffer, uint16_t width, uint16_t height, int16_t x, int16_t y, uint32_t value)
+{
+	uint32_t positionBits = (x+(y*width))*12;
+	uint32_t positionByte = positionBits/8;
+	uint8_t r = (value >> 8) & 0x0F;
+	uint8_t g = (value >> 4) & 0x0F;
+	uint8_t b =  value       & 0x0F;
+	uint8_t c0, c1;
+	if ((positionBits % 8) == 0) {
+		c0 = (r<<4) | g;
+		c1 = (b<<4) | (buffer[positionByte+1]&0x0F);
+	} else {
+		c0 = (buffer[positionByte+0]&0xF0) | r;
+		c1 = (g<<4) | b;
+	}
+	if (buffer[positionByte+0] == c0 && buffer[positionByte+1] == c1) return false;
+	buffer[positionByte+0] = c0;
+	buffer[positionByte+1] = c1;
+	return true;
+}
+
+static uint32_t _load_12bpp(const uint8_t* buffer, uint16_t width, uint16_t height, int16_t x, int16_t y)
+{
+	uint32_t positionBits = (x+(y*width))*12;
+	uint32_t positionByte = positionBits/8;
+	uint8_t r, g, b;
+	if ((positionBits % 8) == 0) {
+		r = (buffer[positionByte+0] & 0xF0);
+		g = (buffer[positionByte+0] << 4);
+		b = (buffer[positionByte+1] & 0xF0);
+	} else {
+		r = (buffer[positionByte+0] << 4);
+		g = (buffer[positionByte+1] & 0xF0);
+		b = (buffer[positionByte+1] << 4);
+	}
+	r |= r >> 4; //Repeat the 4 bits in the lower half, so that the full range maps onto 0-255
+	g |= g >> 4;
+	b |= b >> 4;
+	return r << 16 | g << 8 | b;
+}
+
+static void _hspan_12bpp(uint8_t* buffer, uint16_t width, uint16_t height, int16_t x0, int16_t x1, int16_t y, uint32_t value)
+{
+	for (int16_t x = x0; x <= x1; x++) _store_12bpp(buffer, width, height, x, y, value);
+}
+
+static void _vspan_12bpp(uint8_t* buffer, uint16_t width, uint16_t height, int16_t x, int16_t y0, int16_t y1, uint32_t value)
+{
+	for (int16_t y = y0; y <= y1; y++) _store_12bpp(buffer, width, height, x, y, value);
+}
+
+static void _fill_12bpp(uint8_t* buffer, uint16_t width, uint16_t height, uint32_t value)
+{
+	for (int16_t y = 0; y < height; y++) _hspan_12bpp(buffer, width, height, 0, width - 1, y, value);
+}
+
+ROW_PIXELS(12bpp)
+
+static bool _blend_12bpp(uint8_t* buffer, uint16_t width, uint16_t height, int16_t x, int16_t y, uint32_t value, uint8_t alpha)
+{
+	uint32_t positionBits = (x+(y*width))*12;
+	uint32_t positionByte = positionBits/8;
+	uint32_t target;
+	if ((positionBits % 8) == 0) {
+		target = (buffer[positionByte+0] << 4) | (buffer[positionByte+1] >> 4);
+	} else {
+		target = ((buffer[positionByte+0] & 0x0F) << 8) | buffer[positionByte+1];
+	}
+	uint32_t a = _blend_alpha(alpha);
+	uint32_t result = _blend_channels(target, value, a, 0xF00) | _blend_channels(target, value, a, 0x0F0) | _blend_channels(target, value, a, 0x00F);
+	return _store_12bpp(buffer, width, height, x, y, result);
+}
+
+static void _hblend_12bpp(uint8_t* buffer, uint16_t width, uint16_t height, int16_t x0, int16_t x1, int16_t y, uint32_t value, uint8_t alpha)
+{
+	for (int16_t x = x0; x <= x1; x++) _blend_12bpp(buffer, width, height, x, y, value, alpha);
+}
+
+/* 16-bit color */
+
+static uint32_t _encode_16bpp(uint32_t color)
+{
+	return convert24to16(color);
+}
+
+static bool _store_16bpp(uint8_t* buffer, uint16_t width, uint16_t height, int16_t x, int16_t y, uint32_t value)
+{
+	uint8_t c0 = (value>>8)&0xFF;
+	uint8_t c1 = value&0xFF;
+	uint32_t position = (y * width * 2) + (x * 2);
+	if (buffer[position + 0] == c0 && buffer[position + 1] == c1) return false;
+	buffer[position + 0] = c0;
+	buffer[position + 1] = c1;
+	return true;
+}
+
+static uint32_t _load_16bpp(const uint8_t* buffer, uint16_t width, uint16_t height, int16_t x, int16_t y)
+{
+	uint32_t position = (y * width * 2) + (x * 2);
+	uint32_t color = (buffer[position] << 8) + (buffer[position + 1]);
+#ifdef CONFIG_DRIVER_FRAMEBUFFER_SWAP_R_AND_B //Same channel order as convert24to16
+	uint8_t r = ((((color >> 11) & 0x1F) * 527) + 23) >> 6;
+	uint8_t b = ((((color      ) & 0x1F) * 527) + 23) >> 6;
+#else
+	uint8_t b = ((((color >> 11) & 0x1F) * 527) + 23) >> 6;
+	uint8_t r = ((((color      ) & 0x1F) * 527) + 23) >> 6;
+#endif
+	uint8_t g = ((((color >> 5 ) & 0x3F) * 259) + 33) >> 6;
+	return r << 16 | g << 8 | b;
+}
+
+static void _hspan_16bpp(uint8_t* buffer, uint16_t width, uint16_t height, int16_t x0, int16_t x1, int16_t y, uint32_t value)
+{
+	uint8_t pattern[2] = {(uint8_t) (value >> 8), (uint8_t) value};
+	_store_words(&buffer[(y * width * 2) + (x0 * 2)], x1 - x0 + 1, pattern, 2);
+}
+
+static void _vspan_16bpp(uint8_t* buffer, uint16_t width, uint16_t height, int16_t x, int16_t y0, int16_t y1, uint32_t value)
+{
+	uint8_t* target = &buffer[(y0 * width * 2) + (x * 2)];
+	for (int16_t y = y0; y <= y1; y++, target += width * 2) {
+		target[0] = (value>>8)&0xFF;
+		target[1] = value&0xFF;
+	}
+}
+
+static void _fill_16bpp(uint8_t* buffer, uint16_t width, uint16_t height, uint32_t value)
+{
+	uint8_t pattern[2] = {(uint8_t) (value >> 8), (uint8_t) value};
+	_store_words(buffer, width * height, pattern, 2);
+}
+
+static void _row_16bpp(uint8_t* buffer, uint16_t width, uint16_t height, int16_t x, int16_t y, int16_t dx, int16_t dy, const uint32_t* values, int16_t count)
+{
+	uint8_t* target = &buffer[(y * width * 2) + (x * 2)];
+	int32_t step = (dy * width + dx) * 2;
+	for (int16_t i = 0; i < count; i++, target += step) {
+		target[0] = values[i] >> 8;
+		target[1] = values[i];
+	}
+}
+
+inline uint32_t _spread_16bpp(uint32_t value)
+{ //Spread the 5-6-5 channels over a 32-bit word, leaving room for blending all of them with one multiplication
+	return (value | (value << 16)) & 0x07E0F81F;
+}
+
+inline uint32_t _blend_16bpp_spread(uint32_t target, uint32_t source, uint32_t alpha)
+{ //Blend spread values, alpha ranges from 0 to 32
+	target = _spread_16bpp(target);
+	target = (target + (((source - target) * alpha) >> 5)) & 0x07E0F81F;
+	return (target | (target >> 16)) & 0xFFFF;
+}
+
+static bool _blend_16bpp(uint8_t* buffer, uint16_t width, uint16_t height, int16_t x, int16_t y, uint32_t value, uint8_t alpha)
+{
+	uint32_t position = (y * width * 2) + (x * 2);
+	uint32_t target = (buffer[position] << 8) | buffer[position + 1];
+	return _store_16bpp(buffer, width, height, x, y, _blend_16bpp_spread(target, _spread_16bpp(value), (alpha + 4) >> 3));
+}
+
+static void _hblend_16bpp(uint8_t* buffer, uint16_t width, uint16_t height, int16_t x0, int16_t x1, int16_t y, uint32_t value, uint8_t alpha)
+{
+	uint32_t source = _spread_16bpp(value);
+	uint32_t a = (alpha + 4) >> 3;
+	uint8_t* target = &buffer[(y * width * 2) + (x0 * 2)];
+	for (int16_t x = x0; x <= x1; x++, target += 2) {
+		uint32_t result = _blend_16bpp_spread((target[0] << 8) | target[1], source, a);
+		target[0] = result >> 8;
+		target[1] = result;
+	}
+}
+
+/* 24-bit color */
+
+static uint32_t _encode_24bpp(uint32_t color)
+{
+	return color & 0xFFFFFF;
+}
+
+static bool _store_24bpp(uint8_t* buffer, uint16_t width, uint16_t height, int16_t x, int16_t y, uint32_t value)
+{
+	uint8_t r = (value>>16)&0xFF;
+	uint8_t g = (value>>8)&0xFF;
+	uint8_t b = value&0xFF;
+	uint32_t position = (y * width * 3) + (x * 3);
+	if (buffer[position + 0] == r && buffer[position + 1] == g && buffer[position + 2] == b) return false;
+	buffer[position + 0] = r;
+	buffer[position + 1] = g;
+	buffer[position + 2] = b;
+	return true;
+}
+
+static uint32_t _load_24bpp(const uint8_t* buffer, uint16_t width, uint16_t height, int16_t x, int16_t y)
+{
+	uint32_t position = (y * width * 3) + (x * 3);
+	return (buffer[position] << 16) + (buffer[position+1] << 8) + (buffer[position + 2]);
+}
+
+static void _hspan_24bpp(uint8_t* buffer, uint16_t width, uint16_t height, int16_t x0, int16_t x1, int16_t y, uint32_t value)
+{
+	uint8_t* target = &buffer[(y * width * 3) + (x0 * 3)];
+	for (int16_t x = x0; x <= x1; x++) {
+		*target++ = (value>>16)&0xFF;
+		*target++ = (value>>8)&0xFF;
+		*target++ = value&0xFF;
+	}
+}
+
+static void _vspan_24bpp(uint8_t* buffer, uint16_t width, uint16_t height, int16_t x, int16_t y0, int16_t y1, uint32_t value)
+{
+	for (int16_t y = y0; y <= y1; y++) _hspan_24bpp(buffer, width, height, x, x, y, value);
+}
+
+static void _fill_24bpp(uint8_t* buffer, uint16_t width, uint16_t height, uint32_t value)
+{
+	for (int16_t y = 0; y < height; y++) _hspan_24bpp(buffer, width, height, 0, width - 1, y, value);
+}
+
+static void _row_24bpp(uint8_t* buffer, uint16_t width, uint16_t height, int16_t x, int16_t y, int16_t dx, int16_t dy, const uint32_t* values, int16_t count)
+{
+	uint8_t* target = &buffer[(y * width * 3) + (x * 3)];
+	int32_t step = (dy * width + dx) * 3;
+	for (int16_t i = 0; i < count; i++, target += step) {
+		target[0] = (values[i]>>16)&0xFF;
+		target[1] = (values[i]>>8)&0xFF;
+		target[2] = values[i]&0xFF;
+	}
+}
+
+inline uint32_t _blend_24bpp_value(uint32_t target, uint32_t source, uint32_t alpha)
+{
+	return _blend_channels(target, source, alpha, 0xFF00FF) | _blend_channels(target, source, alpha, 0x00FF00);
+}
+
+static bool _blend_24bpp(uint8_t* buffer, uint16_t width, uint16_t height, int16_t x, int16_t y, uint32_t value, uint8_t alpha)
+{
+	uint32_t position = (y * width * 3) + (x * 3);
+	uint32_t target = (buffer[position] << 16) | (buffer[position + 1] << 8) | buffer[position + 2];
+	return _store_24bpp(buffer, width, height, x, y, _blend_24bpp_value(target, value, _blend_alpha(alpha)));
+}
+
+static void _hblend_24bpp(uint8_t* buffer, uint16_t width, uint16_t height, int16_t x0, int16_t x1, int16_t y, uint32_t value, uint8_t alpha)
+{
+	uint32_t a = _blend_alpha(alpha);
+	uint8_t* target = &buffer[(y * width * 3) + (x0 * 3)];
+	for (int16_t x = x0; x <= x1; x++, target += 3) {
+		uint32_t result = _blend_24bpp_value((target[0] << 16) | (target[1] << 8) | target[2], value, a);
+		target[0] = result >> 16;
+		target[1] = result >> 8;
+		target[2] = result;
+	}
+}
+
+/* 32-bit color */
+
+static uint32_t _encode_32bpp(uint32_t color)
+{
+	return color;
+}
+
+static bool _store_32bpp(uint8_t* buffer, uint16_t width, uint16_t height, int16_t x, int16_t y, uint32_t value)
+{
+	uint8_t a = (value>>24)&0xFF;
+	uint8_t r = (value>>16)&0xFF;
+	uint8_t g = (value>>8)&0xFF;
+	uint8_t b = value&0xFF;
+	uint32_t position = (y * width * 4) + (x * 4);
+	if (buffer[position + 0] == a && buffer[position + 1] == b && buffer[position + 2] == g && buffer[position + 3] == r) return false;
+	buffer[position + 0] = a;
+	buffer[position + 1] = b;
+	buffer[position + 2] = g;
+	buffer[position + 3] = r;
+	return true;
+}
+
+static uint32_t _load_32bpp(const uint8_t* buffer, uint16_t width, uint16_t height, int16_t x, int16_t y)
+{
+	uint32_t position = (y * width * 4) + (x * 4);
+	return (buffer[position] << 24) + (buffer[position+3] << 16) + (buffer[position+2] << 8) + (buffer[position+1]);
+}
+
+static void _hspan_32bpp(uint8_t* buffer, uint16_t width, uint16_t height, int16_t x0, int16_t x1, int16_t y, uint32_t value)
+{
+	uint8_t pattern[4] = {(uint8_t) (value >> 24), (uint8_t) value, (uint8_t) (value >> 8), (uint8_t) (value >> 16)}; //A, B, G, R
+	_store_words(&buffer[(y * width * 4) + (x0 * 4)], x1 - x0 + 1, pattern, 4);
+}
+
+static void _vspan_32bpp(uint8_t* buffer, uint16_t width, uint16_t height, int16_t x, int16_t y0, int16_t y1, uint32_t value)
+{
+	for (int16_t y = y0; y <= y1; y++) _hspan_32bpp(buffer, width, height, x, x, y, value);
+}
+
+static void _fill_32bpp(uint8_t* buffer, uint16_t width, uint16_t height, uint32_t value)
+{
+	uint8_t pattern[4] = {(uint8_t) (value >> 24), (uint8_t) value, (uint8_t) (value >> 8), (uint8_t) (value >> 16)}; //A, B, G, R
+	_store_words(buffer, width * height, pattern, 4);
+}
+
+ROW_PIXELS(32bpp)
+
+inline uint32_t _blend_32bpp_value(uint32_t target, uint32_t source, uint32_t alpha)
+{ //The alpha channel of the buffer is blended like the color channels
+	return _blend_channels(target, source, alpha, 0x00FF00FF) | (_blend_channels(target >> 8, source >> 8, alpha, 0x00FF00FF) << 8);
+}
+
+static bool _blend_32bpp(uint8_t* buffer, uint16_t width, uint16_t height, int16_t x, int16_t y, uint32_t value, uint8_t alpha)
+{
+	return _store_32bpp(buffer, width, height, x, y, _blend_32bpp_value(_load_32bpp(buffer, width, height, x, y), value, _blend_alpha(alpha)));
+}
+
+static void _hblend_32bpp(uint8_t* buffer, uint16_t width, uint16_t height, int16_t x0, int16_t x1, int16_t y, uint32_t value, uint8_t alpha)
+{
+	uint32_t a = _blend_alpha(alpha);
+	for (int16_t x = x0; x <= x1; x++) {
+		_store_32bpp(buffer, width, height, x, y, _blend_32bpp_value(_load_32bpp(buffer, width, height, x, y), value, a));
+	}
+}
+
+/* Format table */
+
+static const pixel_ops_t pixel_ops[FB_FORMAT_COUNT] = {
+	/* FB_FORMAT_NATIVE is resolved by driver_framebuffer_format_ops */
+	{FB_FORMAT_NATIVE,      0, false, NULL,          NULL,              NULL,             NULL,              NULL,              NULL,             NULL,              NULL,               NULL           },
+	{FB_FORMAT_1BPP,        1, false, _encode_1bpp,  _store_1bpp,       _load_1bpp,       _hspan_1bpp,       _vspan_1bpp,       _fill_1bpp,       _blend_1bpp,       _hblend_1bpp,       _row_1bpp      },
+	{FB_FORMAT_1BPP_VERT,   1, true,  _encode_1bpp,  _store_1bpp_vert,  _load_1bpp_vert,  _hspan_1bpp_vert,  _vspan_1bpp_vert,  _fill_1bpp_vert,  _blend_1bpp_vert,  _hblend_1bpp_vert,  _row_1bpp_vert },
+	{FB_FORMAT_1BPP_VERT2,  1, true,  _encode_1bpp,  _store_1bpp_vert2, _load_1bpp_vert2, _hspan_1bpp_vert2, _vspan_1bpp_vert2, _fill_1bpp_vert2, _blend_1bpp_vert2, _hblend_1bpp_vert2, _row_1bpp_vert2},
+	{FB_FORMAT_1BPP_OHS,    1, false, _encode_1bpp,  _store_1bpp_ohs,   _load_1bpp_ohs,   _hspan_1bpp_ohs,   _vspan_1bpp_ohs,   _fill_1bpp_ohs,   _blend_1bpp_ohs,   _hblend_1bpp_ohs,   _row_1bpp_ohs  },
+	{FB_FORMAT_8BPP,        8, false, _encode_8bpp,  _store_8bpp,       _load_8bpp,       _hspan_8bpp,       _vspan_8bpp,       _fill_8bpp,       _blend_8bpp,       _hblend_8bpp,       _row_8bpp      },
+	{FB_FORMAT_8CBPP,       8, false, _encode_8cbpp, _store_8bpp,       _load_8cbpp,      _hspan_8bpp,       _vspan_8bpp,       _fill_8bpp,       _blend_8cbpp,      _hblend_8cbpp,      _row_8bpp      },
+	{FB_FORMAT_12BPP,      12, false, _encode_12bpp, _store_12bpp,      _load_12bpp,      _hspan_12bpp,      _vspan_12bpp,      _fill_12bpp,      _blend_12bpp,      _hblend_12bpp,      _row_12bpp     },
+	{FB_FORMAT_16BPP,      16, false, _encode_16bpp, _store_16bpp,      _load_16bpp,      _hspan_16bpp,      _vspan_16bpp,      _fill_16bpp,      _blend_16bpp,      _hblend_16bpp,      _row_16bpp     },
+	{FB_FORMAT_24BPP,      24, false, _encode_24bpp, _store_24bpp,      _load_24bpp,      _hspan_24bpp,      _vspan_24bpp,      _fill_24bpp,      _blend_24bpp,      _hblend_24bpp,      _row_24bpp     },
+	{FB_FORMAT_32BPP,      32, false, _encode_32bpp, _store_32bpp,      _load_32bpp,      _hspan_32bpp,      _vspan_32bpp,      _fill_32bpp,      _blend_32bpp,      _hblend_32bpp,      _row_32bpp     },
+};
+
+/* Public functions */
+
+const pixel_ops_t* driver_framebuffer_format_ops(pixel_format_t format)
+{
+	if (format == FB_FORMAT_NATIVE) format = FB_FORMAT;
+	if (format <= FB_FORMAT_NATIVE || format >= FB_FORMAT_COUNT) return NULL;
+	return &pixel_ops[format];
+}
+
+uint32_t driver_framebuffer_format_size(pixel_format_t format, uint16_t width, uint16_t height)
+{
+	if (format == FB_FORMAT_NATIVE) format = FB_FORMAT;
+	switch (format) {
+		case FB_FORMAT_1BPP:       return ((width + 7) / 8) * height;
+		case FB_FORMAT_1BPP_VERT:  return width * ((height + 7) / 8);
+		case FB_FORMAT_1BPP_VERT2: return width * ((height + 7) / 8);
+		case FB_FORMAT_1BPP_OHS:   return (width * height + 7) / 8;
+		case FB_FORMAT_8BPP:       return width * height;
+		case FB_FORMAT_8CBPP:      return width * height;
+		case FB_FORMAT_12BPP:      return ((width * height * 12) / 8) + 1;
+		case FB_FORMAT_16BPP:      return width * height * 2;
+		case FB_FORMAT_24BPP:      return width * height * 3;
+		case FB_FORMAT_32BPP:      return width * height * 4;
+		default:                   return 0;
+	}
+}
+
+#endif
+
+#ifdef DRIVER_FRAMEBUFFER_FORMAT_TEST
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define N_RAND_COLORS 64
+#define GUARD 8
+
+static const char* formatNames[FB_FORMAT_COUNT] = {"NATIVE", "1BPP", "1BPP_VERT", "1BPP_VERT2", "1BPP_OHS", "8BPP", "8CBPP", "12BPP", "16BPP", "24BPP", "32BPP"};
+
+static const struct { uint16_t width, height; } testSizes[] = {{1, 1}, {13, 11}, {16, 9}, {8, 17}, {24, 5}};
+
+static uint8_t channelError(pixel_format_t format)
+{ //Largest difference per channel between a color and the color that is loaded after storing it
+	switch (format) {
+		case FB_FORMAT_8CBPP: return 85; //2 bits for one of the channels
+		case FB_FORMAT_12BPP: return 16;
+		case FB_FORMAT_16BPP: return 8;
+		case FB_FORMAT_24BPP: return 0;
+		case FB_FORMAT_32BPP: return 0;
+		default:              return 255; //Greyscale, tested with grey colors
+	}
+}
+
+static uint32_t randomColor(pixel_format_t format)
+{
+	uint32_t color = ((uint32_t) rand() << 8) ^ rand();
+	switch (format) {
+		case FB_FORMAT_1BPP:
+		case FB_FORMAT_1BPP_VERT:
+		case FB_FORMAT_1BPP_VERT2:
+		case FB_FORMAT_1BPP_OHS:   return (rand() & 1) ? 0xFFFFFF : 0x000000;
+		case FB_FORMAT_8BPP:       return (color & 0xFF) * 0x010101;
+		case FB_FORMAT_32BPP:      return color;
+		default:                   return color & 0xFFFFFF;
+	}
+}
+
+static void checkColor(pixel_format_t format, uint32_t color, uint32_t loaded)
+{
+	uint8_t limit = channelError(format);
+	for (uint8_t shift = 0; shift < 32; shift += 8) {
+		int16_t diff = (int16_t) ((color >> shift) & 0xFF) - (int16_t) ((loaded >> shift) & 0xFF);
+		if (abs(diff) > limit) {
+			printf("%s: stored %08x, loaded %08x\n", formatNames[format], color, loaded);
+			assert(false);
+		}
+	}
+}
+
+static void do_test_format(const pixel_ops_t* ops, uint16_t width, uint16_t height)
+{
+	uint32_t size = driver_framebuffer_format_size(ops->format, width, height);
+	assert(size >= ((uint32_t) width * height * ops->bitsPerPixel + 7) / 8);
+	uint8_t* buffer = (uint8_t*) malloc(size + GUARD);
+	uint32_t* colors = (uint32_t*) malloc(width * height * sizeof(uint32_t));
+	memset(&buffer[size], 0xA5, GUARD);
+
+	//Every pixel keeps its own value, whatever is stored in the pixels around it
+	for (int pass = 0; pass < 4; pass++) {
+		for (int16_t y = 0; y < height; y++) {
+			for (int16_t x = 0; x < width; x++) {
+				uint32_t color = randomColor(ops->format);
+				ops->store(buffer, width, height, x, y, ops->encode(color));
+				colors[y * width + x] = color;
+			}
+		}
+		for (int i = 0; i < width * height; i++) { //Overwrite pixels in random order
+			int16_t x = rand() % width, y = rand() % height;
+			uint32_t color = randomColor(ops->format);
+			ops->store(buffer, width, height, x, y, ops->encode(color));
+			colors[y * width + x] = color;
+		}
+		for (int16_t y = 0; y < height; y++) {
+			for (int16_t x = 0; x < width; x++) {
+				uint32_t value = ops->encode(colors[y * width + x]);
+				uint32_t loaded = ops->load(buffer, width, height, x, y);
+				checkColor(ops->format, colors[y * width + x], loaded);
+				assert(ops->encode(loaded) == value); //Loading undoes encoding for every value that can be stored
+				assert(!ops->store(buffer, width, height, x, y, value)); //Storing the same value changes nothing
+			}
+		}
+	}
+
+	for (int i = 0; i < GUARD; i++) assert(buffer[size + i] == 0xA5);
+	free(colors);
+	free(buffer);
+}
+
+static void do_test_colors(const pixel_ops_t* ops)
+{
+	uint8_t buffer[4] = {0};
+	for (int i = 0; i < N_RAND_COLORS; i++) {
+		uint32_t color = (i < 8) ? ((i & 4) ? 0xFF0000 : 0) | ((i & 2) ? 0xFF00 : 0) | ((i & 1) ? 0xFF : 0) : (((uint32_t) rand() << 8) ^ rand()) & 0xFFFFFF;
+		if (ops->format == FB_FORMAT_32BPP) color |= 0xFF000000;
+		ops->store(buffer, 1, 1, 0, 0, ops->encode(color));
+		uint32_t loaded = ops->load(buffer, 1, 1, 0, 0);
+		if (ops->bitsPerPixel > 8) checkColor(ops->format, color, loaded); //Colors keep their channels apart
+		if ((i < 8) && (ops->format != FB_FORMAT_8BPP)) assert((loaded == color) || (ops->bitsPerPixel == 1)); //Primary colors survive
+	}
+}
+
+int main(void)
+{
+	srand(42);
+	assert(driver_framebuffer_format_ops(FB_FORMAT_NATIVE) == driver_framebuffer_format_ops(FB_FORMAT));
+	assert(driver_framebuffer_format_ops(FB_FORMAT_COUNT) == NULL);
+	for (int f = FB_FORMAT_NATIVE + 1; f < FB_FORMAT_COUNT; f++) {
+		const pixel_ops_t* ops = driver_framebuffer_format_ops((pixel_format_t) f);
+		assert(ops && (ops->format == f));
+		do_test_colors(ops);
+		for (uint8_t i = 0; i < sizeof(testSizes) / sizeof(testSizes[0]); i++) {
+			//The mirrored format packs the bytes of a row in display order, which needs whole bytes per row
+			if ((f == FB_FORMAT_1BPP_OHS) && (testSizes[i].width % 8)) continue;
+			do_test_format(ops, testSizes[i].width, testSizes[i].height);
+		}
+		printf("%s OK\n", formatNames[f]);
+	}
+	return 0;
+}
+
+#endif // DRIVER_FRAMEBUFFER_FORMAT_TEST
@@ -0,0 +1,296 @@
+/*
+ * The functions in this file keep decoded PNG files in memory,
+ * stored in the pixel format they are drawn in, so that drawing
+ * the same file again is a copy instead of a decode
+ *
+ * Entries are found by path and checked against the modification
+ * time and size of the file, the least recently used entries that
+ * are not pinned make room for new images
+ */
+
+#include "include/driver_framebuffer_internal.h"
+#include <sys/stat.h>
+
+#ifdef CONFIG_DRIVER_FRAMEBUFFER_ENABLE
+
+#define TAG "fb-image-cache"
+
+#if CONFIG_DRIVER_FRAMEBUFFER_IMAGE_CACHE > 0
+
+#define IMAGE_CACHE_SIZE    (CONFIG_DRIVER_FRAMEBUFFER_IMAGE_CACHE * 1024)
+#define IMAGE_CACHE_ENTRIES CONFIG_DRIVER_FRAMEBUFFER_IMAGE_CACHE_ENTRIES
+
+typedef struct image_cache_entry_t {
+	char*              path;     // Physical path of the file, NULL for an unused entry
+	time_t             mtime;    // Modification time of the file when it was decoded
+	off_t              fileSize; // Size of the file when it was decoded
+	const pixel_ops_t* target;   // Pixel format the image is drawn in
+	Window             image;    // Decoded image, not part of the list of windows
+	bool               hasAlpha; // The image is stored as 32-bit colors with alpha instead of in the target format
+	uint32_t           bytes;    // Memory used by the image
+	bool               pinned;   // Pinned entries are never evicted to make room
+	uint32_t           lastUsed; // Value of imageCacheClock when the entry was last used
+} image_cache_entry_t;
+
+image_cache_entry_t imageCache[IMAGE_CACHE_ENTRIES];
+uint32_t imageCacheClock  = 0;
+uint32_t imageCacheUsed   = 0;
+uint32_t imageCacheHits   = 0;
+uint32_t imageCacheMisses = 0;
+
+/* Private functions */
+
+void _image_cache_free(image_cache_entry_t* entry)
+{
+	if (entry->path)         free(entry->path);
+	if (entry->image.buffer) free(entry->image.buffer);
+	imageCacheUsed -= entry->bytes;
+	memset(entry, 0, sizeof(image_cache_entry_t));
+}
+
+uint8_t* _image_cache_alloc(uint32_t size)
+{
+	#ifdef CONFIG_DRIVER_FRAMEBUFFER_SPIRAM
+		return (uint8_t*) heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+	#else
+		return (uint8_t*) heap_caps_malloc(size, MALLOC_CAP_8BIT);
+	#endif
+}
+
+// Evicts the least recently used unpinned entries until an image of the given size fits, returns an unused entry or NULL
+image_cache_entry_t* _image_cache_make_room(uint32_t bytes)
+{
+	if (bytes > IMAGE_CACHE_SIZE) return NULL;
+	while (true) {
+		image_cache_entry_t* unused = NULL;
+		image_cache_entry_t* victim = NULL;
+		for (uint16_t i = 0; i < IMAGE_CACHE_ENTRIES; i++) {
+			image_cache_entry_t* entry = &imageCache[i];
+			if (!entry->path) {
+				if (!unused) unused = entry;
+			} else if (!entry->pinned && (!victim || (entry->lastUsed < victim->lastUsed))) {
+				victim = entry;
+			}
+		}
+		if (unused && (imageCacheUsed + bytes <= IMAGE_CACHE_SIZE)) return unused;
+		if (!victim) return NULL;
+		_image_cache_free(victim);
+	}
+}
+
+// Finds the decoded copy of a file for a pixel format, dropping copies of older versions of the file
+image_cache_entry_t* _image_cache_find(const char* path, const struct stat* info, const pixel_ops_t* ops, bool* pinned)
+{
+	*pinned = false;
+	for (uint16_t i = 0; i < IMAGE_CACHE_ENTRIES; i++) {
+		image_cache_entry_t* entry = &imageCache[i];
+		if (!entry->path || (strcmp(entry->path, path) != 0) || (entry->target != ops)) continue;
+		if ((entry->mtime == info->st_mtime) && (entry->fileSize == info->st_size)) {
+			entry->lastUsed = ++imageCacheClock;
+			return entry;
+		}
+		*pinned = entry->pinned;
+		_image_cache_free(entry);
+	}
+	return NULL;
+}
+
+// Decodes a file into the cache, returns NULL if it does not fit or can not be decoded
+image_cache_entry_t* _image_cache_load(const char* path, const struct stat* info, const pixel_ops_t* ops, bool pinned)
+{
+	struct lib_file_reader* fr = lib_file_new(path, 1024);
+	if (!fr) return NULL;
+	struct lib_png_reader* pr = lib_png_new((lib_reader_read_t) &lib_file_read, fr);
+	if (!pr) {
+		lib_file_destroy(fr);
+		return NULL;
+	}
+
+	image_cache_entry_t* entry = NULL;
+	if ((lib_png_read_header(pr) >= 0) && (pr->ihdr.width <= INT16_MAX) && (pr->ihdr.height <= INT16_MAX)) {
+		uint16_t width = pr->ihdr.width, height = pr->ihdr.height;
+		bool hasAlpha = (pr->ihdr.color_type == 4) || (pr->ihdr.color_type == 6);
+		const pixel_ops_t* stored = hasAlpha ? driver_framebuffer_format_ops(FB_FORMAT_32BPP) : ops;
+		uint32_t bytes = driver_framebuffer_format_size(stored->format, width, height);
+		entry = _image_cache_make_room(bytes);
+		if (entry) {
+			entry->path         = strdup(path);
+			entry->image.buffer = _image_cache_alloc(bytes);
+			entry->bytes        = bytes;
+			imageCacheUsed += bytes;
+			if (!entry->path || !entry->image.buffer) {
+				ESP_LOGE(TAG, "image cache out of memory");
+				_image_cache_free(entry);
+				entry = NULL;
+			}
+		}
+		uint8_t* alpha = NULL;
+		if (entry && hasAlpha) {
+			//The decoder stores alpha separately, it is moved into the alpha channel of the stored colors afterwards
+			alpha = (uint8_t*) malloc((uint32_t) width * height);
+			if (!alpha) {
+				ESP_LOGE(TAG, "image cache out of memory");
+				_image_cache_free(entry);
+				entry = NULL;
+			}
+		}
+		if (entry) {
+			Window* image = &entry->image;
+			image->name        = entry->path;
+			image->width       = width;
+			image->height      = height;
+			image->orientation = landscape;
+			image->drawWidth   = width;
+			image->drawHeight  = height;
+			image->format      = stored->format;
+			image->pixelOps    = stored;
+			entry->target      = ops;
+			entry->hasAlpha    = hasAlpha;
+
+			pr->alpha_plane = alpha;
+			if (lib_png_load_image(image, pr, 0, 0, 0, 0, width, height, width) < 0) {
+				_image_cache_free(entry);
+				entry = NULL;
+			} else if (alpha) {
+				for (int16_t y = 0; y < height; y++) {
+					for (int16_t x = 0; x < width; x++) {
+						uint32_t color = stored->load(image->buffer, width, height, x, y);
+						stored->store(image->buffer, width, height, x, y, (color & 0xFFFFFF) | (alpha[y * width + x] << 24));
+					}
+				}
+			}
+		}
+		if (alpha) free(alpha);
+	}
+	lib_png_destroy(pr);
+	lib_file_destroy(fr);
+
+	if (!entry) return NULL;
+	entry->mtime    = info->st_mtime;
+	entry->fileSize = info->st_size;
+	entry->pinned   = pinned;
+	entry->lastUsed = ++imageCacheClock;
+	return entry;
+}
+
+void _image_cache_draw(image_cache_entry_t* entry, Window* window, int16_t x, int16_t y)
+{
+	Window* image = &entry->image;
+	if (!entry->hasAlpha) {
+		image->x = x;
+		image->y = y;
+		driver_framebuffer_blit(image, window);
+		return;
+	}
+
+	//Images with alpha are blended a visible row at a time
+	int16_t width, height;
+	driver_framebuffer_get_orientation_size(window, &width, &height);
+	int32_t x0 = (x < 0) ? -x : 0, y0 = (y < 0) ? -y : 0;
+	int32_t x1 = image->width, y1 = image->height;
+	if (x1 > width  - x) x1 = width  - x;
+	if (y1 > height - y) y1 = height - y;
+	if ((x0 >= x1) || (y0 >= y1)) return;
+
+	int32_t count = x1 - x0;
+	uint32_t* values = (uint32_t*) malloc(count * (sizeof(uint32_t) + 1));
+	if (!values) {
+		ESP_LOGE(TAG, "image cache out of memory");
+		return;
+	}
+	uint8_t* alpha = (uint8_t*) &values[count];
+	dither_row_t* dither = driver_framebuffer_dither_new(entry->target, count);
+	for (int32_t row = y0; row < y1; row++) {
+		for (int32_t i = 0; i < count; i++) {
+			uint32_t color = image->pixelOps->load(image->buffer, image->width, image->height, x0 + i, row);
+			values[i] = dither ? (color & 0xFFFFFF) : entry->target->encode(color & 0xFFFFFF);
+			alpha[i]  = color >> 24;
+		}
+		if (dither) driver_framebuffer_dither_row(dither, values, alpha, count);
+		driver_framebuffer_draw_row(window, x + x0, y + row, values, alpha, count);
+	}
+	if (dither) driver_framebuffer_dither_destroy(dither);
+	free(values);
+	driver_framebuffer_mark_rect(window, x, y, image->width, image->height);
+}
+#endif
+
+/* Public functions */
+
+esp_err_t driver_framebuffer_png_file(Window* window, int16_t x, int16_t y, const char* path)
+{
+	framebuffer_lock_t lock;
+	#if CONFIG_DRIVER_FRAMEBUFFER_IMAGE_CACHE > 0
+		struct stat info;
+		const pixel_ops_t* ops = driver_framebuffer_get_ops(window);
+		if (ops && (stat(path, &info) == 0)) {
+			bool pinned;
+			image_cache_entry_t* entry = _image_cache_find(path, &info, ops, &pinned);
+			if (entry) {
+				imageCacheHits++;
+			} else {
+				imageCacheMisses++;
+				entry = _image_cache_load(path, &info, ops, pinned);
+			}
+			if (entry) {
+				_image_cache_draw(entry, window, x, y);
+				return ESP_OK;
+			}
+		}
+	#endif
+
+	//Files that are not cached are decoded straight into the frame
+	struct lib_file_reader* fr = lib_file_new(path, 1024);
+	if (!fr) return ESP_ERR_NOT_FOUND;
+	esp_err_t res = driver_framebuffer_png(window, x, y, (lib_reader_read_t) &lib_file_read, fr);
+	lib_file_destroy(fr);
+	return res;
+}
+
+bool driver_framebuffer_image_cache_pin(const char* path, bool pin)
+{
+	framebuffer_lock_t lock;
+	#if CONFIG_DRIVER_FRAMEBUFFER_IMAGE_CACHE > 0
+		struct stat info;
+		const pixel_ops_t* ops = driver_framebuffer_get_ops(NULL);
+		if (!ops || (stat(path, &info) != 0)) return false;
+		bool pinned;
+		image_cache_entry_t* entry = _image_cache_find(path, &info, ops, &pinned);
+		if (!entry) entry = _image_cache_load(path, &info, ops, pinned);
+		if (!entry) return false;
+		entry->pinned = pin;
+		return true;
+	#else
+		return false;
+	#endif
+}
+
+void driver_framebuffer_image_cache_evict(const char* path)
+{
+	framebuffer_lock_t lock;
+	#if CONFIG_DRIVER_FRAMEBUFFER_IMAGE_CACHE > 0
+		for (uint16_t i = 0; i < IMAGE_CACHE_ENTRIES; i++) {
+			image_cache_entry_t* entry = &imageCache[i];
+			if (entry->path && (!path || (strcmp(entry->path, path) == 0))) _image_cache_free(entry);
+		}
+	#endif
+}
+
+void driver_framebuffer_image_cache_stats(image_cache_stats_t* stats)
+{
+	framebuffer_lock_t lock;
+	memset(stats, 0, sizeof(image_cache_stats_t));
+	#if CONFIG_DRIVER_FRAMEBUFFER_IMAGE_CACHE > 0
+		stats->hits   = imageCacheHits;
+		stats->misses = imageCacheMisses;
+		stats->used   = imageCacheUsed;
+		stats->size   = IMAGE_CACHE_SIZE;
+		for (uint16_t i = 0; i < IMAGE_CACHE_ENTRIES; i++) {
+			if (!imageCache[i].path) continue;
+			stats->entries++;
+			if (imageCache[i].pinned) stats->pinned++;
+		}
+	#endif
+}
+
+#endif /* CONFIG_DRIVER_FRAMEBUFFER_ENABLE */
@@ -99,9 +99,15 @@ matrix_3d matrix_3d_scale(float x, float y, float z) {
 
 //checks whether or not the matrix is an identity matrix
 //the identity matrix is a special transformation that represents no transformation being applied at all
-bool matrix_2d_is_identity(matrix_2d matrix) {
-    return matrix.var.a0 == 1 && matrix.var.a1 == 0 && matrix.var.a2 == 0 &&
-           matrix.var.b0 == 0 && matrix.var.b1 == 1 && matrix.var.b2 == 0;
+bool matrix_2d_is_identity(const matrix_2d *matrix) {
+    return matrix_2d_is_translate_only(matrix) && matrix->var.a2 == 0 && matrix->var.b2 == 0;
+}
+
+//checks whether or not the matrix only translates, leaving out rotation, scaling and shearing
+//points are then moved by the right column only
+bool matrix_2d_is_translate_only(const matrix_2d *matrix) {
+    return matrix->var.a0 == 1 && matrix->var.a1 == 0 &&
+           matrix->var.b0 == 0 && matrix->var.b1 == 1;
 }
 
 /*
@@ -160,19 +166,19 @@ matrix_2d matrix_2d_multiply(matrix_2d left, matrix_2d right) {
  */
 //transforms the point according to the matrix
 //TODO: potentially convert to assembly for even faster hyperspeeds
-void matrix_2d_transform_point(matrix_2d matrix, float *x, float *y) {
+void matrix_2d_transform_point(const matrix_2d *matrix, float *x, float *y) {
     float xIn = *x;
     float yIn = *y;
-    x[0] = matrix.var.a0*xIn + matrix.var.a1*yIn + matrix.var.a2;
-    y[0] = matrix.var.b0*xIn + matrix.var.b1*yIn + matrix.var.b2;
+    x[0] = matrix->var.a0*xIn + matrix->var.a1*yIn + matrix->var.a2;
+    y[0] = matrix->var.b0*xIn + matrix->var.b1*yIn + matrix->var.b2;
 }
 
 
 //checks whether or not the matrix is an identity matrix
-bool matrix_3d_is_identity(matrix_3d matrix) {
-    return matrix.var.a0 == 1 && matrix.var.a1 == 0 && matrix.var.a2 == 0 && matrix.var.a3 == 0 &&
-           matrix.var.b0 == 0 && matrix.var.b1 == 1 && matrix.var.b2 == 0 && matrix.var.b3 == 0 &&
-           matrix.var.c0 == 0 && matrix.var.c1 == 0 && matrix.var.c2 == 1 && matrix.var.c3 == 0;
+bool matrix_3d_is_identity(const matrix_3d *matrix) {
+    return matrix->var.a0 == 1 && matrix->var.a1 == 0 && matrix->var.a2 == 0 && matrix->var.a3 == 0 &&
+           matrix->var.b0 == 0 && matrix->var.b1 == 1 && matrix->var.b2 == 0 && matrix->var.b3 == 0 &&
+           matrix->var.c0 == 0 && matrix->var.c1 == 0 && matrix->var.c2 == 1 && matrix->var.c3 == 0;
 }
 
 /*
@@ -195,13 +201,13 @@ matrix_3d matrix_3d_multiply(matrix_3d left, matrix_3d right) {
  * [i  j  k  l] [r]  [i]  [j]  [k] [l] [pi + qj + rk + l]
  */
 //transforms the point according to the matrix
-void matrix_3d_transform_point(matrix_3d matrix, float *x, float *y, float *z) {
+void matrix_3d_transform_point(const matrix_3d *matrix, float *x, float *y, float *z) {
     float xIn = *x;
     float yIn = *y;
     float zIn = *z;
-    x[0] = matrix.var.a0*xIn + matrix.var.a1*yIn + matrix.var.a2*zIn + matrix.var.a3;
-    y[0] = matrix.var.b0*xIn + matrix.var.b1*yIn + matrix.var.b2*zIn + matrix.var.b3;
-    z[0] = matrix.var.c0*xIn + matrix.var.c1*yIn + matrix.var.c2*zIn + matrix.var.c3;
+    x[0] = matrix->var.a0*xIn + matrix->var.a1*yIn + matrix->var.a2*zIn + matrix->var.a3;
+    y[0] = matrix->var.b0*xIn + matrix->var.b1*yIn + matrix->var.b2*zIn + matrix->var.b3;
+    z[0] = matrix->var.c0*xIn + matrix->var.c1*yIn + matrix->var.c2*zIn + matrix->var.c3;
 }
 
 
@@ -215,24 +221,19 @@ void matrix_3d_transform_point(matrix_3d matrix, float *x, float *y, float *z) {
 //clear: clear the entire matrix stack, including the current matrix, but assumes that the stack is already initialised
 
 
-//unlinks and deletes the entire stack
-void matrix_stack_2d_unlink_all(matrix_2d_link *link) {
-    matrix_2d_link *next;
-    while (link != NULL) {
-        next = link->next;
-        delete link;
-        link = next;
-    }
-}
+//the stacks are arrays that grow as they are used, a push or pop only copies a matrix
+//and the storage is allocated a few times at most, not for every push
+#define MATRIX_STACK_FIRST_ALLOCATION 8
 
-//unlinks and deletes the entire stack
-void matrix_stack_3d_unlink_all(matrix_3d_link *link) {
-    matrix_3d_link *next;
-    while (link != NULL) {
-        next = link->next;
-        delete link;
-        link = next;
-    }
+//makes room for one more matrix, returns false if there is no memory
+bool matrix_stack_grow(void **matrices, uint16_t *allocated, uint16_t capacity, size_t matrixSize) {
+    uint32_t size = *allocated ? (uint32_t) *allocated * 2 : MATRIX_STACK_FIRST_ALLOCATION;
+    if (size > capacity) size = capacity;
+    void *grown = realloc(*matrices, size * matrixSize);
+    if (grown == NULL) return false;
+    *matrices = grown;
+    *allocated = size;
+    return true;
 }
 
 
@@ -240,20 +241,17 @@ void matrix_stack_3d_unlink_all(matrix_3d_link *link) {
 void matrix_stack_2d_init(matrix_stack_2d *stack) {
     stack->capacity = CONFIG_MATRIX_STACK_SIZE;
     stack->current = matrix_2d_identity();
+    stack->translateOnly = true;
     stack->matrices = NULL;
+    stack->allocated = 0;
     stack->size = 0;
 }
 
 //clears the matrix stack, including the current matrix
 //WARNING: This assumes the stack is already initialised!
 void matrix_stack_2d_clear(matrix_stack_2d *stack) {
-    //unlink all matrices
-    matrix_stack_2d_unlink_all(stack->matrices);
-    stack->matrices = NULL;
-
-    stack->size = 0;
-    stack->capacity = CONFIG_MATRIX_STACK_SIZE;
-    stack->current = matrix_2d_identity();
+    free(stack->matrices);
+    matrix_stack_2d_init(stack);
 }
 
 //returns 1 if the stack would become too big
@@ -261,49 +259,83 @@ esp_err_t matrix_stack_2d_push(matrix_stack_2d *stack) {
     if (stack->size >= stack->capacity) {
         return 1;
     }
-    //enlink current matrix
-    matrix_2d_link *next = stack->matrices;
-    stack->matrices = new matrix_2d_link();
-    stack->matrices->matrix = stack->current;
-    stack->matrices->next = next;
-
-    stack->size ++;
+    if (stack->size >= stack->allocated && !matrix_stack_grow((void **) &stack->matrices, &stack->allocated, stack->capacity, sizeof(matrix_2d))) {
+        return ESP_ERR_NO_MEM;
+    }
+    stack->matrices[stack->size ++] = stack->current;
     return ESP_OK;
 }
 
 //returns 1 if the stack is already empty
 esp_err_t matrix_stack_2d_pop(matrix_stack_2d *stack) {
-    if (stack->size <= 0 || stack->matrices == NULL) {
-        stack->size = 0;
+    if (stack->size <= 0) {
         return 1;
     }
-    //unlink top matrix
-    stack->current = stack->matrices->matrix;
-    stack->matrices = stack->matrices->next;
-
-    stack-> size --;
+    matrix_stack_2d_set(stack, &stack->matrices[-- stack->size]);
     return ESP_OK;
 }
 
+//replaces the active matrix
+void matrix_stack_2d_set(matrix_stack_2d *stack, const matrix_2d *matrix) {
+    stack->current = *matrix;
+    stack->translateOnly = matrix_2d_is_translate_only(matrix);
+}
+
+//applies a transformation after the active matrix
+void matrix_stack_2d_multiply(matrix_stack_2d *stack, const matrix_2d *matrix) {
+    if (matrix_2d_is_translate_only(matrix)) {
+        matrix_stack_2d_translate(stack, matrix->var.a2, matrix->var.b2);
+        return;
+    }
+    matrix_2d result = matrix_2d_multiply(stack->current, *matrix);
+    matrix_stack_2d_set(stack, &result);
+}
+
+//applies a translation after the active matrix, which only moves the right column
+void matrix_stack_2d_translate(matrix_stack_2d *stack, float x, float y) {
+    if (stack->translateOnly) {
+        stack->current.var.a2 += x;
+        stack->current.var.b2 += y;
+    } else {
+        stack->current.var.a2 += stack->current.var.a0*x + stack->current.var.a1*y;
+        stack->current.var.b2 += stack->current.var.b0*x + stack->current.var.b1*y;
+    }
+}
+
+//transforms count points, stored as x and y after each other, according to the active matrix
+void matrix_stack_2d_transform_points(const matrix_stack_2d *stack, float *points, uint16_t count) {
+    const matrix_2d *matrix = &stack->current;
+    float *end = &points[count * 2];
+    if (stack->translateOnly) {
+        for (; points < end; points += 2) {
+            points[0] += matrix->var.a2;
+            points[1] += matrix->var.b2;
+        }
+        return;
+    }
+    for (; points < end; points += 2) {
+        float xIn = points[0];
+        float yIn = points[1];
+        points[0] = matrix->var.a0*xIn + matrix->var.a1*yIn + matrix->var.a2;
+        points[1] = matrix->var.b0*xIn + matrix->var.b1*yIn + matrix->var.b2;
+    }
+}
+
 
 //initialises the given matrix stack so as to be ready for use
 void matrix_stack_3d_init(matrix_stack_3d *stack) {
     stack->capacity = CONFIG_MATRIX_STACK_SIZE;
     stack->current = matrix_3d_identity();
     stack->matrices = NULL;
+    stack->allocated = 0;
     stack->size = 0;
 }
 
 //clears the matrix stack
 //WARNING: This assumes the stack is already initialised!
 void matrix_stack_3d_clear(matrix_stack_3d *stack) {
-    //unlink all matrices
-    matrix_stack_3d_unlink_all(stack->matrices);
-    stack->matrices = NULL;
-
-    stack->size = 0;
-    stack->capacity = CONFIG_MATRIX_STACK_SIZE;
-    stack->current = matrix_3d_identity();
+    free(stack->matrices);
+    matrix_stack_3d_init(stack);
 }
 
 //returns 1 if the stack would become too big
@@ -311,27 +343,19 @@ esp_err_t matrix_stack_3d_push(matrix_stack_3d *stack) {
     if (stack->size >= stack->capacity) {
         return 1;
     }
-    //enlink current matrix
-    matrix_3d_link *next = stack->matrices;
-    stack->matrices = new matrix_3d_link();
-    stack->matrices->matrix = stack->current;
-    stack->matrices->next = next;
-
-    stack->size ++;
+    if (stack->size >= stack->allocated && !matrix_stack_grow((void **) &stack->matrices, &stack->allocated, stack->capacity, sizeof(matrix_3d))) {
+        return ESP_ERR_NO_MEM;
+    }
+    stack->matrices[stack->size ++] = stack->current;
     return ESP_OK;
 }
 
 //returns 1 if the stack is already empty
 esp_err_t matrix_stack_3d_pop(matrix_stack_3d *stack) {
-    if (stack->size <= 0 || stack->matrices == NULL) {
-        stack->size = 0;
+    if (stack->size <= 0) {
         return 1;
     }
-    //unlink top matrix
-    stack->current = stack->matrices->matrix;
-    stack->matrices = stack->matrices->next;
-
-    stack-> size --;
+    stack->current = stack->matrices[-- stack->size];
     return ESP_OK;
 }
 
@@ -1,109 +1,207 @@
+/* TEST (from this directory, host/ stands in for ESP-IDF):
+ * gcc -o fb_matrix_drawing_test -DDRIVER_FRAMEBUFFER_MATRIX_DRAWING_TEST -Wall -g -I host -I png \
+ *     $(find ../driver_display_* ../driver_io_disobey_samd -maxdepth 1 -name include -printf '-I %p ') \
+ *     $(find . host png fonts -maxdepth 1 -name '*.c*') -lstdc++ -lm
+ */
 
 #include "include/driver_framebuffer_internal.h"
 
 #include "sdkconfig.h"
 
 #include <math.h>
-#include <esp_timer.h>
-//#include <task.h>
+#ifdef CONFIG_LIB3D_RENDER_TASK
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#endif
 
 #define TAG "fb-drawing"
 
 #ifdef CONFIG_DRIVER_FRAMEBUFFER_ENABLE
 
-#ifdef CONFIG_G_NEW_TRIANGLE
-void driver_framebuffer_triangle(Window* window, float x0, float y0, float x1, float y1, float x2, float y2, uint32_t color)
+#ifdef CONFIG_G_MATRIX_ENABLE
+/* Triangle rasterizer
+ * Vertices are snapped to fixed point with 4 fractional bits. A pixel is covered when its center
+ * is inside all three edges, pixel centers exactly on an edge belong to the triangle only if that
+ * edge is a top or left edge, so triangles sharing an edge never overlap and never leave a gap.
+ * Every row is produced as a span: each edge bounds the span on one side and that bound is
+ * stepped from row to row with an integer quotient and remainder, without any divisions.
+ */
+
+#define TRI_SUBPIXEL_BITS 4
+#define TRI_ONE           (1 << TRI_SUBPIXEL_BITS)
+#define TRI_HALF          (TRI_ONE >> 1)
+#define TRI_GUARD         16384.0f //Vertices are clamped to this many pixels from the origin
+
+typedef struct tri_edge_t {
+	int64_t quotient;      // First (lower) or last pixel of the span allowed by this edge on the current row
+	int64_t stepQuotient;  // Change of the quotient from one row to the next
+	int32_t remainder;     // Remainder of the bound for the current row, 0 <= remainder < divisor
+	int32_t stepRemainder; // Change of the remainder from one row to the next
+	int32_t divisor;
+	bool lower;            // The edge bounds the left side of the span
+} tri_edge_t;
+
+typedef struct tri_raster_t {
+	tri_edge_t edges[3];
+	uint8_t edgeCount;      // Horizontal edges only limit the rows and are left out
+	int32_t y, yEnd;        // Next row and last row
+	int16_t width;          // Spans are clipped to 0 .. width - 1
+	float x0, y0;           // Snapped position of the first vertex, used for interpolation
+	float dx1, dy1, dx2, dy2; // Snapped positions of the other vertices relative to the first
+} tri_raster_t;
+
+void _tri_divide(int64_t value, int32_t divisor, int64_t* quotient, int32_t* remainder)
+{ //Division rounding down, leaving a remainder that is never negative
+	int64_t q, r;
+	if (value == (int32_t) value) { //A 32-bit division is a lot cheaper when the value allows it
+		q = (int32_t) value / divisor;
+		r = (int32_t) value % divisor;
+	} else {
+		q = value / divisor;
+		r = value % divisor;
+	}
+	if (r < 0) {
+		r += divisor;
+		q--;
+	}
+	*quotient = q;
+	*remainder = r;
+}
+
+int32_t _tri_fixed(float value)
 {
-	//sort the points such that point 0 is the top and point 2 is the bottom
-	//lower number is higher on screen
-	float temp;
-	if (y1 < y0) { //ensure y1 is under y0
-		//swap points 1 and 0
-		temp = y0;
-		y0 = y1;
-		y1 = temp;
-		temp = x0;
-		x0 = x1;
-		x1 = temp;
-	}
-	if (y2 < y1) { //ensure y2 is under y1
-		//swap points 2 and 1
-		temp = y1;
-		y1 = y2;
-		y2 = temp;
-		temp = x1;
-		x1 = x2;
-		x2 = temp;
-	}
-	if (y2 < y0) { //ensure y2 is under y0
-		//swap points 2 and 0
-		temp = y0;
-		y0 = y2;
-		y2 = temp;
-		temp = x0;
-		x0 = x2;
-		x2 = temp;
-	}
-	if (y1 < y0) { //ensure y1 is under y0 once more
-		//swap points 1 and 0
-		temp = y0;
-		y0 = y1;
-		y1 = temp;
-		temp = x0;
-		x0 = x1;
-		x1 = temp;
+	if (!(value > -TRI_GUARD)) value = -TRI_GUARD; //Also catches NaN
+	if (value > TRI_GUARD) value = TRI_GUARD;
+	return (int32_t) floorf(value * TRI_ONE + 0.5f);
+}
+
+bool _tri_setup(tri_raster_t* raster, float x0, float y0, float x1, float y1, float x2, float y2, int16_t width, int16_t height)
+{ //Prepare rasterizing a triangle into an area of width x height pixels, returns false if no pixel is covered
+	int32_t fx[3] = { _tri_fixed(x0), _tri_fixed(x1), _tri_fixed(x2) };
+	int32_t fy[3] = { _tri_fixed(y0), _tri_fixed(y1), _tri_fixed(y2) };
+
+	raster->x0  = fx[0] / (float) TRI_ONE;
+	raster->y0  = fy[0] / (float) TRI_ONE;
+	raster->dx1 = (fx[1] - fx[0]) / (float) TRI_ONE;
+	raster->dy1 = (fy[1] - fy[0]) / (float) TRI_ONE;
+	raster->dx2 = (fx[2] - fx[0]) / (float) TRI_ONE;
+	raster->dy2 = (fy[2] - fy[0]) / (float) TRI_ONE;
+
+	int64_t area = (int64_t) (fx[1] - fx[0]) * (fy[2] - fy[0]) - (int64_t) (fy[1] - fy[0]) * (fx[2] - fx[0]);
+	if (area == 0) return false;
+	if (area < 0) { //Make the winding the same for every triangle so the inside is on the positive side of each edge
+		int32_t t;
+		t = fx[1]; fx[1] = fx[2]; fx[2] = t;
+		t = fy[1]; fy[1] = fy[2]; fy[2] = t;
 	}
-	
-	// From point 0 to point 1
-	float inc01 = (x1 - x0) / (y1 - y0);
-	float add01 = (x0 / inc01 - y0) * inc01;
-	if (inc01 == 0) add01 = x0;
-	// From point 0 to point 2
-	float inc02 = (x2 - x0) / (y2 - y0);
-	float add02 = (x0 / inc02 - y0) * inc02;
-	if (inc02 == 0) add02 = x0;
-	// From point 1 to point 2
-	float inc12 = (x2 - x1) / (y2 - y1);
-	float add12 = (x1 / inc12 - y1) * inc12;
-	if (inc12 == 0) add12 = x1;
-
-	// Check whether we need to draw the top part
-	int yCheck = (int) (y0 + 0.5);
-	if ((float) yCheck + 0.5 <= y1) {
-		// Draw top part
-		int startY = (int) (y0 + 0.5);
-		int endY = (int) (y1 + 0.5);
-		for (int y = startY; y < endY; y++) {
-			int startX = ((float) y + 0.5) * inc01 + add01 + 0.5;
-			int endX = ((float) y + 0.5) * inc02 + add02 + 0.5;
-			if (startX > endX) {
-				int tmp = startX;
-				startX = endX;
-				endX = tmp;
-			}
-			for (int x = startX; x < endX; x++) {
-				driver_framebuffer_setPixel(window, x, y, color);
-			}
+
+	//Rows of which the pixel centers lie between the top and bottom vertex
+	int32_t top = fy[0], bottom = fy[0];
+	for (uint8_t i = 1; i < 3; i++) {
+		if (fy[i] < top) top = fy[i];
+		if (fy[i] > bottom) bottom = fy[i];
+	}
+	int64_t yStart, yEnd, limit;
+	int32_t unused;
+	_tri_divide(top - TRI_HALF + TRI_ONE - 1, TRI_ONE, &yStart, &unused);
+	_tri_divide(bottom - TRI_HALF, TRI_ONE, &yEnd, &unused);
+
+	//Horizontal edges only limit the rows
+	for (uint8_t i = 0; i < 3; i++) {
+		int32_t ya = fy[i], yb = fy[(i + 1) % 3];
+		if (ya != yb) continue;
+		if (fx[(i + 1) % 3] > fx[i]) { //Top edge: pixel centers on the edge are inside
+			_tri_divide(ya - TRI_HALF + TRI_ONE - 1, TRI_ONE, &limit, &unused);
+			if (limit > yStart) yStart = limit;
+		} else { //Bottom edge: pixel centers on the edge are outside
+			_tri_divide(ya - 1 - TRI_HALF, TRI_ONE, &limit, &unused);
+			if (limit < yEnd) yEnd = limit;
 		}
 	}
-	// Check whether we need to draw the bottom part
-	yCheck = (int) (y1 + 0.5);
-	if ((float) yCheck + 0.5 <= y2) {
-		// Draw bottom part
-		int startY = (int) (y1 + 0.5);
-		int endY = (int) (y2 + 0.5);
-		for (int y = startY; y < endY; y++) {
-			int startX = ((float) y + 0.5) * inc12 + add12 + 0.5;
-			int endX = ((float) y + 0.5) * inc02 + add02 + 0.5;
-			if (startX > endX) {
-				int tmp = startX;
-				startX = endX;
-				endX = tmp;
-			}
-			for (int x = startX; x < endX; x++) {
-				driver_framebuffer_setPixel(window, x, y, color);
+	if (yStart < 0) yStart = 0;
+	if (yEnd >= height) yEnd = height - 1;
+	if ((yStart > yEnd) || (width <= 0)) return false;
+
+	raster->edgeCount = 0;
+	for (uint8_t i = 0; i < 3; i++) {
+		int32_t xa = fx[i], ya = fy[i];
+		int32_t xb = fx[(i + 1) % 3], yb = fy[(i + 1) % 3];
+		int32_t a = ya - yb; //The edge function is a * (x - xa) + b * (y - ya)
+		int32_t b = xb - xa;
+		if (a == 0) continue;
+		//Pixel centers on a left edge are inside, on a right edge they are outside
+		int32_t bias = (a > 0) ? 0 : -1;
+		tri_edge_t* edge = &raster->edges[raster->edgeCount++];
+		edge->lower = (a > 0);
+		edge->divisor = (a > 0 ? a : -a) * TRI_ONE;
+		int64_t value = (int64_t) a * (TRI_HALF - xa) + (int64_t) b * (yStart * TRI_ONE + TRI_HALF - ya) + bias;
+		_tri_divide(value, edge->divisor, &edge->quotient, &edge->remainder);
+		_tri_divide((int64_t) b * TRI_ONE, edge->divisor, &edge->stepQuotient, &edge->stepRemainder);
+		if (edge->lower) { //Keep the quotient growing in the direction of the span
+			edge->quotient     = -edge->quotient;
+			edge->stepQuotient = -edge->stepQuotient;
+		}
+	}
+
+	raster->y = yStart;
+	raster->yEnd = yEnd;
+	raster->width = width;
+	return true;
+}
+
+bool _tri_span(tri_raster_t* raster, int16_t* y, int16_t* x0, int16_t* x1)
+{ //Produce the next non-empty span of the triangle, returns false when the triangle is done
+	while (raster->y <= raster->yEnd) {
+		int64_t left = 0, right = raster->width - 1;
+		for (uint8_t i = 0; i < raster->edgeCount; i++) {
+			tri_edge_t* edge = &raster->edges[i];
+			if (edge->lower) {
+				if (edge->quotient > left) left = edge->quotient;
+			} else {
+				if (edge->quotient < right) right = edge->quotient;
 			}
+			int32_t remainder = edge->remainder + edge->stepRemainder;
+			int32_t carry = (remainder >= edge->divisor);
+			edge->remainder = remainder - (edge->divisor & -carry);
+			edge->quotient += edge->stepQuotient + (edge->lower ? -carry : carry);
 		}
+		int16_t row = raster->y++;
+		if (left <= right) {
+			*y  = row;
+			*x0 = left;
+			*x1 = right;
+			return true;
+		}
+	}
+	return false;
+}
+
+void _tri_gradient(const tri_raster_t* raster, float a0, float a1, float a2, float* dx, float* dy)
+{ //Change of a value given at the three vertices per pixel in the horizontal and vertical direction
+	float da1 = a1 - a0, da2 = a2 - a0;
+	float area = raster->dx1 * raster->dy2 - raster->dx2 * raster->dy1;
+	*dx = (da1 * raster->dy2 - da2 * raster->dy1) / area;
+	*dy = (da2 * raster->dx1 - da1 * raster->dx2) / area;
+}
+
+float _tri_value(const tri_raster_t* raster, float a0, float dx, float dy, int16_t x, int16_t y)
+{ //Value at the center of pixel (x, y)
+	return a0 + dx * (x + 0.5f - raster->x0) + dy * (y + 0.5f - raster->y0);
+}
+#endif
+
+#ifdef CONFIG_G_NEW_TRIANGLE
+void driver_framebuffer_triangle(Window* window, float x0, float y0, float x1, float y1, float x2, float y2, uint32_t color)
+{
+	framebuffer_lock_t lock;
+	int16_t width, height;
+	driver_framebuffer_get_orientation_size(window, &width, &height);
+	tri_raster_t raster;
+	if (!_tri_setup(&raster, x0, y0, x1, y1, x2, y2, width, height)) return;
+	int16_t y, xStart, xEnd;
+	while (_tri_span(&raster, &y, &xStart, &xEnd)) {
+		driver_framebuffer_hline(window, xStart, y, xEnd - xStart + 1, color);
 	}
 }
 #endif
@@ -111,159 +209,40 @@ void driver_framebuffer_triangle(Window* window, float x0, float y0, float x1, f
 #ifdef CONFIG_G_NEW_TEXT
 void driver_framebuffer_triangle_textured(Window* window, float x0, float y0, float x1, float y1, float x2, float y2, triangle_uv uv, void *shaderArgs, shader_2d shader)
 {
-	//sort the points such that point 0 is the top and point 2 is the bottom
-	//lower number is higher on screen
-	float temp;
-	if (y1 < y0) { //ensure y1 is under y0
-		//swap points 1 and 0
-		temp = y0;
-		y0 = y1;
-		y1 = temp;
-		temp = x0;
-		x0 = x1;
-		x1 = temp;
-		//also uv
-		temp = uv.u0;
-		uv.u0 = uv.u1;
-		uv.u1 = temp;
-		temp = uv.v0;
-		uv.v0 = uv.v1;
-		uv.v1 = temp;
-	}
-	if (y2 < y1) { //ensure y2 is under y1
-		//swap points 2 and 1
-		temp = y1;
-		y1 = y2;
-		y2 = temp;
-		temp = x1;
-		x1 = x2;
-		x2 = temp;
-		//also uv
-		temp = uv.u2;
-		uv.u2 = uv.u1;
-		uv.u1 = temp;
-		temp = uv.v2;
-		uv.v2 = uv.v1;
-		uv.v1 = temp;
-	}
-	if (y2 < y0) { //ensure y2 is under y0
-		//swap points 2 and 0
-		temp = y0;
-		y0 = y2;
-		y2 = temp;
-		temp = x0;
-		x0 = x2;
-		x2 = temp;
-		//also uv
-		temp = uv.u0;
-		uv.u0 = uv.u2;
-		uv.u2 = temp;
-		temp = uv.v0;
-		uv.v0 = uv.v2;
-		uv.v2 = temp;
-	}
-	if (y1 < y0) { //ensure y1 is under y0 once more
-		//swap points 1 and 0
-		temp = y0;
-		y0 = y1;
-		y1 = temp;
-		temp = x0;
-		x0 = x1;
-		x1 = temp;
-		//also uv
-		temp = uv.u0;
-		uv.u0 = uv.u1;
-		uv.u1 = temp;
-		temp = uv.v0;
-		uv.v0 = uv.v1;
-		uv.v1 = temp;
-	}
-	
-	// From point 0 to point 1
-	float inc01 = (x1 - x0) / (y1 - y0);
-	float add01 = (x0 / inc01 - y0) * inc01;
-	if (inc01 == 0) add01 = x0;
-	// From point 0 to point 2
-	float inc02 = (x2 - x0) / (y2 - y0);
-	float add02 = (x0 / inc02 - y0) * inc02;
-	if (inc02 == 0) add02 = x0;
-	// From point 1 to point 2
-	float inc12 = (x2 - x1) / (y2 - y1);
-	float add12 = (x1 / inc12 - y1) * inc12;
-	if (inc12 == 0) add12 = x1;
-
-	// Does not change per pixel in barycentric interpolation
-	float baryTemp = (y1 - y2) * (x0 - x2) + (x2 - x1) * (y0 - y2);
-
-	// Check whether we need to draw the top part
-	int yCheck = (int) (y0 + 0.5);
-	if ((float) yCheck + 0.5 <= y1) {
-		// Draw top part
-		int startY = (int) (y0 + 0.5);
-		int endY = (int) (y1 + 0.5);
-		for (int y = startY; y < endY; y++) {
-			int startX = ((float) y + 0.5) * inc01 + add01 + 0.5;
-			int endX = ((float) y + 0.5) * inc02 + add02 + 0.5;
-			if (startX > endX) {
-				int tmp = startX;
-				startX = endX;
-				endX = tmp;
-			}
-			for (int x = startX; x < endX; x++) {
-				// Sample texture using barycentric interpolation
-				float baryA = ((y1 - y2) * (x - x2) + (x2 - x1) * (y - y2)) / baryTemp;
-				float baryB = ((y2 - y0) * (x - x2) + (x0 - x2) * (y - y2)) / baryTemp;
-				float baryC = 1 - baryA - baryB;
-				float u = baryA * uv.u0 + baryB * uv.u1 + baryC * uv.u2;
-				float v = baryA * uv.v0 + baryB * uv.v1 + baryC * uv.v2;
-				// u = fmod(u, 1);
-				// v = fmod(v, 1);
-				if (u < 0) u++;
-				if (v < 0) v++;
-				// Because of these shaders, it'll be relatively easy to shade things like this is exciting, weird ways
-				// If alpha blending is added, this is not done by the shader
-				uint32_t color = (*shader)(u, v, x, y, shaderArgs);
-				// Plot color
-				if ((color & 0xff000000) == 0xff000000) {
-					driver_framebuffer_setPixel(window, x, y, color & 0xffffff);
-				}
-			}
-		}
-	}
-	// Check whether we need to draw the bottom part
-	yCheck = (int) (y1 + 0.5);
-	if ((float) yCheck + 0.5 <= y2) {
-		// Draw bottom part
-		int startY = (int) (y1 + 0.5);
-		int endY = (int) (y2 + 0.5);
-		for (int y = startY; y < endY; y++) {
-			int startX = ((float) y + 0.5) * inc12 + add12 + 0.5;
-			int endX = ((float) y + 0.5) * inc02 + add02 + 0.5;
-			if (startX > endX) {
-				int tmp = startX;
-				startX = endX;
-				endX = tmp;
+	framebuffer_lock_t lock;
+	int16_t width, height;
+	driver_framebuffer_get_orientation_size(window, &width, &height);
+	tri_raster_t raster;
+	if (!_tri_setup(&raster, x0, y0, x1, y1, x2, y2, width, height)) return;
+	float dudx, dudy, dvdx, dvdy;
+	_tri_gradient(&raster, uv.u0, uv.u1, uv.u2, &dudx, &dudy);
+	_tri_gradient(&raster, uv.v0, uv.v1, uv.v2, &dvdx, &dvdy);
+
+	int16_t y, xStart, xEnd;
+	while (_tri_span(&raster, &y, &xStart, &xEnd)) {
+		float u = _tri_value(&raster, uv.u0, dudx, dudy, xStart, y);
+		float v = _tri_value(&raster, uv.v0, dvdx, dvdy, xStart, y);
+		//Neighbouring pixels of the same color are drawn together as a single span
+		int16_t runStart = -1;
+		uint32_t runColor = 0;
+		for (int16_t x = xStart; x <= xEnd; x++, u += dudx, v += dvdx) {
+			// Because of these shaders, it'll be relatively easy to shade things like this is exciting, weird ways
+			// Alpha blending is not done by the shader, the texel carries its alpha in the top byte
+			uint32_t color = (*shader)(u < 0 ? u + 1 : u, v < 0 ? v + 1 : v, x, y, shaderArgs);
+			uint8_t alpha = color >> 24;
+			bool opaque = alpha == 255;
+			color &= 0xffffff;
+			if ((runStart >= 0) && (!opaque || (color != runColor))) {
+				driver_framebuffer_hline(window, runStart, y, x - runStart, runColor);
+				runStart = -1;
 			}
-			for (int x = startX; x < endX; x++) {
-				// Sample texture using barycentric interpolation
-				float baryA = ((y1 - y2) * (x - x2) + (x2 - x1) * (y - y2)) / baryTemp;
-				float baryB = ((y2 - y0) * (x - x2) + (x0 - x2) * (y - y2)) / baryTemp;
-				float baryC = 1 - baryA - baryB;
-				float u = baryA * uv.u0 + baryB * uv.u1 + baryC * uv.u2;
-				float v = baryA * uv.v0 + baryB * uv.v1 + baryC * uv.v2;
-				// u = fmod(u, 1);
-				// v = fmod(v, 1);
-				if (u < 0) u++;
-				if (v < 0) v++;
-				// Because of these shaders, it'll be relatively easy to shade things like this is exciting, weird ways
-				// If alpha blending is added, this is not done by the shader
-				uint32_t color = (*shader)(u, v, x, y, shaderArgs);
-				// Plot color
-				if ((color & 0xff000000) == 0xff000000) {
-					driver_framebuffer_setPixel(window, x, y, color & 0xffffff);
-				}
+			if (!opaque && (alpha > 0)) driver_framebuffer_blendPixel(window, x, y, color, alpha);
+			if (opaque && (runStart < 0)) {
+				runStart = x;
+				runColor = color;
 			}
 		}
+		if (runStart >= 0) driver_framebuffer_hline(window, runStart, y, xEnd - runStart + 1, runColor);
 	}
 }
 #endif
@@ -271,6 +250,7 @@ void driver_framebuffer_triangle_textured(Window* window, float x0, float y0, fl
 #ifdef CONFIG_G_NEW_RECT
 void driver_framebuffer_quad(Window* window, float x0, float y0, float x1, float y1, float x2, float y2, float x3, float y3, uint32_t color)
 {
+	framebuffer_lock_t lock;
 	// This is easier to do if represented as triangles.
 	driver_framebuffer_triangle(window, x0, y0, x1, y1, x2, y2, color);
 	driver_framebuffer_triangle(window, x0, y0, x2, y2, x3, y3, color);
@@ -286,7 +266,7 @@ float circle_test_radius(matrix_stack_2d* stack, float radius)
 	float maxSqr = 0;
 	float x = 0;
 	float y = radius;
-	matrix_2d_transform_point(current, &x, &y);
+	matrix_2d_transform_point(&current, &x, &y);
 	float sqrDist = x * x + y * y;
 	if (sqrDist > maxSqr) {
 		maxSqr = sqrDist;
@@ -295,7 +275,7 @@ float circle_test_radius(matrix_stack_2d* stack, float radius)
 	maxSqr = 0;
 	x = 0;
 	y = radius;
-	matrix_2d_transform_point(current, &x, &y);
+	matrix_2d_transform_point(&current, &x, &y);
 	sqrDist = x * x + y * y;
 	if (sqrDist > maxSqr) {
 		maxSqr = sqrDist;
@@ -304,7 +284,7 @@ float circle_test_radius(matrix_stack_2d* stack, float radius)
 	maxSqr = 0;
 	x = 0;
 	y = radius;
-	matrix_2d_transform_point(current, &x, &y);
+	matrix_2d_transform_point(&current, &x, &y);
 	sqrDist = x * x + y * y;
 	if (sqrDist > maxSqr) {
 		maxSqr = sqrDist;
@@ -314,6 +294,29 @@ float circle_test_radius(matrix_stack_2d* stack, float radius)
 
 void driver_framebuffer_circle_new(Window* window, matrix_stack_2d* stack, float x, float y, float radius, float startAngle, float endAngle, bool fill, uint32_t color)
 {
+	framebuffer_lock_t lock;
+	// Rotation, uniform scaling and translation keep a circle a circle and axis-aligned scaling makes it an ellipse,
+	// those are drawn by the integer rasterizer, only other matrices need polygons
+	const matrix_2d *matrix = &stack->current;
+	if (startAngle > endAngle) {
+		// The same part of the circle, walked the other way around
+		float t = startAngle;
+		startAngle = endAngle;
+		endAngle = t;
+	}
+	if (matrix->var.a0 == matrix->var.b1 && matrix->var.a1 == -matrix->var.b0) {
+		float scale = sqrtf(matrix->var.a0 * matrix->var.a0 + matrix->var.b0 * matrix->var.b0);
+		// Angles start at the top here and at the right for the rasterizer
+		float rotation = atan2f(matrix->var.b0, matrix->var.a0) - M_PI * 0.5;
+		matrix_2d_transform_point(matrix, &x, &y);
+		driver_framebuffer_arc(window, lroundf(x), lroundf(y), lroundf(radius * scale), startAngle + rotation, endAngle + rotation, fill, color);
+		return;
+	}
+	if (matrix->var.a1 == 0 && matrix->var.b0 == 0 && endAngle - startAngle >= 2 * M_PI) {
+		matrix_2d_transform_point(matrix, &x, &y);
+		driver_framebuffer_ellipse(window, lroundf(x), lroundf(y), lroundf(radius * fabsf(matrix->var.a0)), lroundf(radius * fabsf(matrix->var.b1)), fill, color);
+		return;
+	}
 	// Test the scale of the stack so as to have enough precision to fool the viewer
 	float effectiveCircumfrence = circle_test_radius(stack, radius) * M_PI;
 	int nSteps = effectiveCircumfrence < 80 ? (int) (effectiveCircumfrence / 1.7) : 60;
@@ -327,17 +330,17 @@ void driver_framebuffer_circle_new(Window* window, matrix_stack_2d* stack, float
 		// Rotate to the starting angle
 		current = matrix_2d_multiply(current, matrix_2d_rotate(startAngle));
 	}
-	matrix_2d_transform_point(stack->current, &x, &y);
+	matrix_2d_transform_point(&stack->current, &x, &y);
 	// Start circling!
 	if (fill) {
 		float lastX = 0;
 		float lastY = -radius;
-		matrix_2d_transform_point(current, &lastX, &lastY);
+		matrix_2d_transform_point(&current, &lastX, &lastY);
 		for (int i = 0; i < nSteps; i++) {
 			float newX = 0;
 			float newY = -radius;
 			current = matrix_2d_multiply(current, rotationStep);
-			matrix_2d_transform_point(current, &newX, &newY);
+			matrix_2d_transform_point(&current, &newX, &newY);
 			driver_framebuffer_triangle(window, x, y, lastX, lastY, newX, newY, color);
 			lastX = newX;
 			lastY = newY;
@@ -347,12 +350,12 @@ void driver_framebuffer_circle_new(Window* window, matrix_stack_2d* stack, float
 	{
 		float lastX = 0;
 		float lastY = -radius;
-		matrix_2d_transform_point(current, &lastX, &lastY);
+		matrix_2d_transform_point(&current, &lastX, &lastY);
 		for (int i = 0; i < nSteps; i++) {
 			float newX = 0;
 			float newY = -radius;
 			current = matrix_2d_multiply(current, rotationStep);
-			matrix_2d_transform_point(current, &newX, &newY);
+			matrix_2d_transform_point(&current, &newX, &newY);
 			driver_framebuffer_line(window, (int) (lastX + 0.5), (int) (lastY + 0.5), (int) (newX + 0.5), (int) (newY + 0.5), color);
 			lastX = newX;
 			lastY = newY;
@@ -364,248 +367,406 @@ void driver_framebuffer_circle_new(Window* window, matrix_stack_2d* stack, float
 extern triangle_buffer_3d tri_buffer_3d_global;
 
 #ifdef CONFIG_LIB3D_ENABLE
-// 3D helper functions
-static inline float depth3d_get(depth_buffer_3d *buffer, int x, int y) {
-	if (x < 0 || x >= buffer->width || y < 0 || y >= buffer->height) {
-		return 0;
-	}
-	uint16_t raw = buffer->buffer[x + y * buffer->height];
-	float out = (raw >> 6) + ((raw & 0x3f) / 64.0f);
-	return out;
-}
-
-static inline void depth3d_set(depth_buffer_3d *buffer, int x, int y, float depth) {
-	if (x < 0 || x >= buffer->width || y < 0 || y >= buffer->height) {
-		return;
-	}
-	uint16_t compressed = (((int) depth) << 6) | ((int) (depth * 64) & 0x3f);
-	buffer->buffer[x + y * buffer->height] = compressed;
-}
+// Depth is stored with 6 fractional bits, it is interpolated with DEPTH_EXTRA_BITS more
+#define DEPTH_EXTRA_BITS 10
+#define DEPTH_LIMIT      16000.0f // Vertex depths are clamped to +/- this value so the interpolation cannot overflow
 
 void depth3d_clear(depth_buffer_3d *buffer) {
 	
-	// Number of indicies to fill.
-	uint32_t size = buffer->width * buffer->height;
+	// Queued triangles still use the depth buffer.
+	driver_framebuffer_tri3d_wait();
 
-	for (int i = 0; i < size; i++) {
-		buffer->buffer[i] = 0xffff;
-	}
+	// Every byte of an empty depth buffer is 0xff.
+	memset(buffer->buffer, 0xff, sizeof(depth_buffer_type_t) * buffer->width * buffer->height);
+
+}
 
+static inline int32_t depth3d_fixed(float depth) {
+	return (int32_t) (depth * (64 << DEPTH_EXTRA_BITS));
 }
 
-void render_tri_colored(triangle_3d triangle, uint32_t color)
+// The projection only depends on the field of view, the clipping planes and the size of the depth buffer,
+// so it is calculated once instead of for every triangle.
+typedef struct projection_3d_t {
+	uint16_t width, height;        // Size of the depth buffer the projection was calculated for
+	float    nearClippingPlane;    // Vertices closer than this are clipped away
+	float    depthScale;           // Depth per unit of view space z
+	float    scale;                // Screen pixels per unit of view space x or y, divided by depth
+	float    centerX, centerY;
+} projection_3d;
+
+static projection_3d projection_3d_global;
+
+static const projection_3d *projection_3d_get()
 {
-	Window *window = NULL;
 	depth_buffer_3d *depthBuffer = &depth_buffer_global;
-	
-	// Temporary method to get 3D started and tested.
-	// First, transform all points...
-	matrix_3d_transform_point(stack_3d_global.current, &triangle.x0, &triangle.y0, &triangle.z0);
-	matrix_3d_transform_point(stack_3d_global.current, &triangle.x1, &triangle.y1, &triangle.z1);
-	matrix_3d_transform_point(stack_3d_global.current, &triangle.x2, &triangle.y2, &triangle.z2);
-	// Next project 3D -> 2D (x, y divided by z)
-	float verticalFieldOfView = 1.0f / tan(M_PI * 0.125f); // 12.5 degrees of vertical field of view
-	float aspectRatio = depthBuffer->width / depthBuffer->height;
+	projection_3d *projection = &projection_3d_global;
+	if (projection->scale != 0 && projection->width == depthBuffer->width && projection->height == depthBuffer->height) {
+		return projection;
+	}
+
+	float verticalFieldOfView = 1.0f / tanf(M_PI * 0.125f); // 12.5 degrees of vertical field of view
 	float farClippingPlane = 1000.0f;
 	float nearClippingPlane = 0.01f;
 
 	// Calculate values required for the clip matrix.
 	// We'll do simple multiplication because of how the clip matrix is contructed.
 	float xPart = verticalFieldOfView;
-	float yPart = verticalFieldOfView;
 	float zPart = (farClippingPlane + nearClippingPlane) / (farClippingPlane - nearClippingPlane);
 	float zWPart = (farClippingPlane * nearClippingPlane * 2) / (farClippingPlane - nearClippingPlane);
+	float zMult = 0.5f;
 
-	float zMult = 0.5;
+	// A vertex ends up at x * xPart / (2 * w) with w = zWPart * depth, which leaves one division per vertex.
+	projection->width = depthBuffer->width;
+	projection->height = depthBuffer->height;
+	projection->nearClippingPlane = nearClippingPlane;
+	projection->depthScale = zMult * zPart;
+	projection->scale = xPart / (2.0f * zWPart);
+	projection->centerX = depthBuffer->width / 2.0f;
+	projection->centerY = depthBuffer->height / 2.0f;
+	return projection;
+}
 
-	float x0 = triangle.x0;
-	float x1 = triangle.x1;
-	float x2 = triangle.x2;
-	float y0 = triangle.y0;
-	float y1 = triangle.y1;
-	float y2 = triangle.y2;
-	float z0 = triangle.z0 * zMult;
-	float z1 = triangle.z1 * zMult;
-	float z2 = triangle.z2 * zMult;
+// A vertex in view space, with its screen position once it is known to be in front of the near plane.
+typedef struct vertex_3d_t {
+	float x, y, z;
+	float sx, sy, depth;
+} vertex_3d;
 
-	// Now, we transform all of the points!
-	x0 = xPart * x0; y0 = yPart * y0; z0 = zPart * z0; float w0 = zWPart * z0;
-	x1 = xPart * x1; y1 = yPart * y1; z1 = zPart * z1; float w1 = zWPart * z1;
-	x2 = xPart * x2; y2 = yPart * y2; z2 = zPart * z2; float w2 = zWPart * z2;
+static inline void vertex_3d_transform(const matrix_3d *matrix, const float *in, vertex_3d *out)
+{
+	out->x = matrix->var.a0 * in[0] + matrix->var.a1 * in[1] + matrix->var.a2 * in[2] + matrix->var.a3;
+	out->y = matrix->var.b0 * in[0] + matrix->var.b1 * in[1] + matrix->var.b2 * in[2] + matrix->var.b3;
+	out->z = matrix->var.c0 * in[0] + matrix->var.c1 * in[1] + matrix->var.c2 * in[2] + matrix->var.c3;
+}
 
-	// Clipping would happen at this point.
+static inline void vertex_3d_project(const projection_3d *projection, vertex_3d *vertex)
+{
+	vertex->depth = vertex->z * projection->depthScale;
+	float factor = projection->scale / vertex->depth;
+	vertex->sx = vertex->x * factor + projection->centerX;
+	vertex->sy = vertex->y * factor + projection->centerY;
+}
 
-	// Now, projection from 3D to 2D.
-	x0 = x0 / (2.0 * w0) + depthBuffer->width / 2.0;
-	y0 = y0 / (2.0 * w0) + depthBuffer->height / 2.0;
-	
-	x1 = x1 / (2.0 * w1) + depthBuffer->width / 2.0;
-	y1 = y1 / (2.0 * w1) + depthBuffer->height / 2.0;
-	
-	x2 = x2 / (2.0 * w2) + depthBuffer->width / 2.0;
-	y2 = y2 / (2.0 * w2) + depthBuffer->height / 2.0;
-
-	// Sort the points such that point 0 is the top and point 2 is the bottom.
-	// Lower y co-ordinate is higher on screen.
-	float temp;
-	if (y1 < y0) { //ensure y1 is under y0
-		//swap points 1 and 0
-		temp = y0;
-		y0 = y1;
-		y1 = temp;
-		temp = x0;
-		x0 = x1;
-		x1 = temp;
-		//and now Z
-		temp = z0;
-		z0 = z1;
-		z1 = temp;
-	}
-	if (y2 < y1) { //ensure y2 is under y1
-		//swap points 2 and 1
-		temp = y1;
-		y1 = y2;
-		y2 = temp;
-		temp = x1;
-		x1 = x2;
-		x2 = temp;
-		//and now Z
-		temp = z2;
-		z2 = z1;
-		z1 = temp;
-	}
-	if (y2 < y0) { //ensure y2 is under y0
-		//swap points 2 and 0
-		temp = y0;
-		y0 = y2;
-		y2 = temp;
-		temp = x0;
-		x0 = x2;
-		x2 = temp;
-		//and now Z
-		temp = z0;
-		z0 = z2;
-		z2 = temp;
-	}
-	if (y1 < y0) { //ensure y1 is under y0 once more
-		//swap points 1 and 0
-		temp = y0;
-		y0 = y1;
-		y1 = temp;
-		temp = x0;
-		x0 = x1;
-		x1 = temp;
-		//and now Z
-		temp = z0;
-		z0 = z1;
-		z1 = temp;
-	}
-	
-	// From point 0 to point 1
-	float inc01 = (x1 - x0) / (y1 - y0);
-	float add01 = (x0 / inc01 - y0) * inc01;
-	if (inc01 == 0) add01 = x0;
-	// From point 0 to point 2
-	float inc02 = (x2 - x0) / (y2 - y0);
-	float add02 = (x0 / inc02 - y0) * inc02;
-	if (inc02 == 0) add02 = x0;
-	// From point 1 to point 2
-	float inc12 = (x2 - x1) / (y2 - y1);
-	float add12 = (x1 / inc12 - y1) * inc12;
-	if (inc12 == 0) add12 = x1;
-
-	// Does not change per pixel in barycentric interpolation
-	float baryTemp = (y1 - y2) * (x0 - x2) + (x2 - x1) * (y0 - y2);
-
-	// Check whether we need to draw the top part
-	int yCheck = (int) (y0 + 0.5);
-	if ((float) yCheck + 0.5 <= y1) {
-		// Draw top part
-		int startY = (int) (y0 + 0.5);
-		int endY = (int) (y1 + 0.5);
-		for (int y = startY; y < endY; y++) {
-			int startX = ((float) y + 0.5) * inc01 + add01 + 0.5;
-			int endX = ((float) y + 0.5) * inc02 + add02 + 0.5;
-			if (startX > endX) {
-				int tmp = startX;
-				startX = endX;
-				endX = tmp;
-			}
-			for (int x = startX; x < endX; x++) {
-				// Get Z using barycentric interpolation
-				float baryA = ((y1 - y2) * (x - x2) + (x2 - x1) * (y - y2)) / baryTemp;
-				float baryB = ((y2 - y0) * (x - x2) + (x0 - x2) * (y - y2)) / baryTemp;
-				float baryC = 1 - baryA - baryB;
-                float z = baryA * z0 + baryB * z1 + baryC * z2;
-                float oldZ = depth3d_get(depthBuffer, x, y);
-                // TODO: proper opacity handling
-                if (z < oldZ) {
-                    depth3d_set(depthBuffer, x, y, z);
-				    driver_framebuffer_setPixel(window, x, y, color);
-                }
+// Gets the screen area a projected triangle can cover, in orientation coordinates.
+// Returns false when the triangle is completely off screen.
+static bool tri_bounds(const triangle_3d_buffered *tri, int16_t *x0, int16_t *y0, int16_t *x1, int16_t *y1)
+{
+	int16_t width, height;
+	driver_framebuffer_get_orientation_size(NULL, &width, &height);
+	float left   = fminf(tri->x0, fminf(tri->x1, tri->x2));
+	float right  = fmaxf(tri->x0, fmaxf(tri->x1, tri->x2));
+	float top    = fminf(tri->y0, fminf(tri->y1, tri->y2));
+	float bottom = fmaxf(tri->y0, fmaxf(tri->y1, tri->y2));
+	if (!(right >= 0) || !(bottom >= 0) || !(left < width) || !(top < height)) return false;
+	*x0 = (left > 0) ? (int16_t) left : 0;
+	*y0 = (top > 0) ? (int16_t) top : 0;
+	*x1 = (right < width - 1) ? (int16_t) right : width - 1;
+	*y1 = (bottom < height - 1) ? (int16_t) bottom : height - 1;
+	return true;
+}
+
+// Marks the area a projected triangle can cover as dirty, with the framebuffer lock held.
+static void mark_tri(const triangle_3d_buffered *tri)
+{
+	int16_t x0, y0, x1, y1;
+	if (!tri_bounds(tri, &x0, &y0, &x1, &y1)) return;
+	driver_framebuffer_orientation_apply(NULL, &x0, &y0);
+	driver_framebuffer_orientation_apply(NULL, &x1, &y1);
+	if (x0 > x1) { int16_t t = x0; x0 = x1; x1 = t; }
+	if (y0 > y1) { int16_t t = y0; y0 = y1; y1 = t; }
+	driver_framebuffer_set_dirty_area(x0, y0, x1, y1, false);
+}
+
+// Draws a projected triangle into the framebuffer and the depth buffer, without marking anything dirty.
+void render_tri_colored(const triangle_3d_buffered *tri)
+{
+	Window *window = NULL;
+	depth_buffer_3d *depthBuffer = &depth_buffer_global;
+
+	// Rasterize within both the framebuffer and the depth buffer.
+	int16_t width, height;
+	driver_framebuffer_get_orientation_size(window, &width, &height);
+	if (width > depthBuffer->width) width = depthBuffer->width;
+	if (height > depthBuffer->height) height = depthBuffer->height;
+	tri_raster_t raster;
+	if (!_tri_setup(&raster, tri->x0, tri->y0, tri->x1, tri->y1, tri->x2, tri->y2, width, height)) return;
+
+	// Depth is a plane over the triangle, so it changes by the same amount from one pixel to the next.
+	float z0 = fmaxf(-DEPTH_LIMIT, fminf(DEPTH_LIMIT, tri->z0));
+	float z1 = fmaxf(-DEPTH_LIMIT, fminf(DEPTH_LIMIT, tri->z1));
+	float z2 = fmaxf(-DEPTH_LIMIT, fminf(DEPTH_LIMIT, tri->z2));
+	float dzdx, dzdy;
+	_tri_gradient(&raster, z0, z1, z2, &dzdx, &dzdy);
+	int32_t zStep = depth3d_fixed(dzdx);
+	uint32_t color = tri->param;
+
+	int16_t y, xStart, xEnd;
+	while (_tri_span(&raster, &y, &xStart, &xEnd)) {
+		int32_t z = depth3d_fixed(_tri_value(&raster, z0, dzdx, dzdy, xStart, y));
+		depth_buffer_type_t *depth = &depthBuffer->buffer[xStart + y * depthBuffer->width];
+		// Visible pixels next to each other are drawn together as a single span.
+		int16_t runStart = -1;
+		for (int16_t x = xStart; x <= xEnd; x++, z += zStep, depth++) {
+			int32_t raw = z >> DEPTH_EXTRA_BITS;
+			if (raw < 0) raw = 0;
+			// TODO: proper opacity handling
+			if (raw < *depth) {
+				*depth = raw;
+				if (runStart < 0) runStart = x;
+			} else if (runStart >= 0) {
+				driver_framebuffer_fill_rect_unmarked(window, runStart, y, x - runStart, 1, color);
+				runStart = -1;
 			}
 		}
+		if (runStart >= 0) driver_framebuffer_fill_rect_unmarked(window, runStart, y, xEnd - runStart + 1, 1, color);
+	}
+}
+
+// Marks and draws a projected triangle, with the framebuffer lock held.
+static void draw_tri(const triangle_3d_buffered *tri)
+{
+	mark_tri(tri);
+	render_tri_colored(tri);
+}
+
+#ifdef CONFIG_LIB3D_RENDER_TASK
+// The triangle buffer is a single producer, single consumer queue: only the task calling driver_framebuffer_tri3d
+// writes providedIndex and only the rasterizer writes usedIndex. Either side that runs out of work raises its
+// waiting flag, checks once more and then sleeps until the other side wakes it up. Waking up a task on the other
+// core costs more than drawing a small triangle, so the rasterizer is only woken once a batch of triangles is
+// waiting, and a producer waiting for space only once a batch of space is free.
+#define TRI_BUFFER_BATCH ((CONFIG_LIB3D_TRI_BUFFER_SIZE + 3) / 4)
+
+static inline int tri_buffer_count(int provided, int used) {
+	return (provided - used + CONFIG_LIB3D_TRI_BUFFER_SIZE) % CONFIG_LIB3D_TRI_BUFFER_SIZE;
+}
+
+static bool tri_buffer_blocked(triangle_buffer_3d *buffer, bool full) {
+	int used = __atomic_load_n(&buffer->usedIndex, __ATOMIC_SEQ_CST);
+	if (full) {
+		return (buffer->providedIndex + 1) % CONFIG_LIB3D_TRI_BUFFER_SIZE == used;
+	}
+	return buffer->providedIndex != used;
+}
+
+// Waits for space in the triangle buffer (full) or for all triangles to be drawn (!full).
+// Returns false when the rasterizer did not make progress in time.
+static bool tri_buffer_wait(triangle_buffer_3d *buffer, bool full, TickType_t timeout) {
+	while (tri_buffer_blocked(buffer, full)) {
+		__atomic_store_n(&buffer->producerWaiting, true, __ATOMIC_SEQ_CST);
+		bool progress = !tri_buffer_blocked(buffer, full) || (xSemaphoreTake((SemaphoreHandle_t) buffer->progress, timeout) == pdTRUE);
+		__atomic_store_n(&buffer->producerWaiting, false, __ATOMIC_SEQ_CST);
+		if (!progress) return false;
 	}
-	// Check whether we need to draw the bottom part
-	yCheck = (int) (y1 + 0.5);
-	if ((float) yCheck + 0.5 <= y2) {
-		// Draw bottom part
-		int startY = (int) (y1 + 0.5);
-		int endY = (int) (y2 + 0.5);
-		for (int y = startY; y < endY; y++) {
-			int startX = ((float) y + 0.5) * inc12 + add12 + 0.5;
-			int endX = ((float) y + 0.5) * inc02 + add02 + 0.5;
-			if (startX > endX) {
-				int tmp = startX;
-				startX = endX;
-				endX = tmp;
+	return true;
+}
+
+void render_tri_task(void *arg)
+{
+	triangle_buffer_3d *buffer = (triangle_buffer_3d *) arg;
+	while (true) {
+		int used = buffer->usedIndex;
+		if (used == __atomic_load_n(&buffer->providedIndex, __ATOMIC_SEQ_CST)) {
+			// Nothing to draw, sleep until driver_framebuffer_tri3d provides a triangle.
+			__atomic_store_n(&buffer->consumerWaiting, true, __ATOMIC_SEQ_CST);
+			if (used == __atomic_load_n(&buffer->providedIndex, __ATOMIC_SEQ_CST)) {
+				ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
 			}
-			for (int x = startX; x < endX; x++) {
-				// Get Z using barycentric interpolation
-				float baryA = ((y1 - y2) * (x - x2) + (x2 - x1) * (y - y2)) / baryTemp;
-				float baryB = ((y2 - y0) * (x - x2) + (x0 - x2) * (y - y2)) / baryTemp;
-				float baryC = 1 - baryA - baryB;
-                float z = baryA * z0 + baryB * z1 + baryC * z2;
-                float oldZ = depth3d_get(depthBuffer, x, y);
-                // TODO: proper opacity handling
-                if (z < oldZ) {
-                    depth3d_set(depthBuffer, x, y, z);
-				    driver_framebuffer_setPixel(window, x, y, color);
-                }
+			__atomic_store_n(&buffer->consumerWaiting, false, __ATOMIC_SEQ_CST);
+			continue;
+		}
+		// Other tasks may draw or flush in between triangles, but not while one is drawn.
+		driver_framebuffer_lock();
+		draw_tri(&buffer->triangles[used]);
+		driver_framebuffer_unlock();
+		used = (used + 1) % CONFIG_LIB3D_TRI_BUFFER_SIZE;
+		__atomic_store_n(&buffer->usedIndex, used, __ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&buffer->producerWaiting, __ATOMIC_SEQ_CST)) {
+			// The producer waits for either space or an empty buffer, while it waits the count only goes down.
+			int count = tri_buffer_count(__atomic_load_n(&buffer->providedIndex, __ATOMIC_SEQ_CST), used);
+			if ((count == 0) || (count == CONFIG_LIB3D_TRI_BUFFER_SIZE - 1 - TRI_BUFFER_BATCH)) {
+				xSemaphoreGive((SemaphoreHandle_t) buffer->progress);
 			}
 		}
 	}
 }
 
+// Allocates the triangle buffer and starts the rasterizer, the first time a triangle is queued.
+static bool tri_buffer_start(triangle_buffer_3d *buffer) {
+	if (buffer->consumer) return true;
+	if (!buffer->triangles) {
+		buffer->triangles = (triangle_3d_buffered *) malloc(sizeof(triangle_3d_buffered) * CONFIG_LIB3D_TRI_BUFFER_SIZE);
+	}
+	if (!buffer->progress) {
+		buffer->progress = xSemaphoreCreateBinary();
+	}
+	if (!buffer->triangles || !buffer->progress) {
+		ESP_LOGE(TAG, "Unable to allocate the triangle buffer.");
+		return false;
+	}
+	buffer->providedIndex = 0;
+	buffer->usedIndex = 0;
+	buffer->producerWaiting = false;
+	buffer->consumerWaiting = false;
+	// MicroPython runs on core 0, so the triangles are drawn on core 1.
+	// The rasterizer runs just above idle priority so it never starves the idle task of that core.
+	TaskHandle_t task;
+	if (xTaskCreatePinnedToCore(&render_tri_task, "fb_3d", 4096, buffer, tskIDLE_PRIORITY + 1, &task, 1) != pdPASS) {
+		ESP_LOGE(TAG, "Unable to start the 3D rasterizer.");
+		return false;
+	}
+	buffer->consumer = task;
+	return true;
+}
+#endif
+
+// Waits until every queued triangle has been drawn, when the calling task queued them.
+void driver_framebuffer_tri3d_wait()
+{
+#ifdef CONFIG_LIB3D_RENDER_TASK
+	triangle_buffer_3d *buffer = &tri_buffer_3d_global;
+	// Other tasks, the rasterizer included, take the framebuffer lock through here and never wait for it.
+	// The producer is only set once the rasterizer is running.
+	if (__atomic_load_n(&buffer->producer, __ATOMIC_SEQ_CST) != xTaskGetCurrentTaskHandle()) return;
+	// Less than a batch of triangles may be waiting for a rasterizer that is asleep.
+	if (__atomic_load_n(&buffer->consumerWaiting, __ATOMIC_SEQ_CST)) {
+		xTaskNotifyGive((TaskHandle_t) buffer->consumer);
+	}
+	tri_buffer_wait(buffer, false, portMAX_DELAY);
+#endif
+}
+
+// Queues a projected triangle into the triangle buffer.
+// Returns 0 on OK, 1 on timeout (likely renderer crashed).
+static int queue_tri(const triangle_3d_buffered *projected)
+{
+#ifdef CONFIG_LIB3D_RENDER_TASK
+	triangle_buffer_3d *buffer = &tri_buffer_3d_global;
+	// Draw right away when the rasterizer is not available, or can not draw because the caller holds the framebuffer.
+	if (driver_framebuffer_lock_held() || !tri_buffer_start(buffer)) {
+		framebuffer_lock_t lock;
+		draw_tri(projected);
+		return 0;
+	}
+	__atomic_store_n(&buffer->producer, xTaskGetCurrentTaskHandle(), __ATOMIC_SEQ_CST);
+	// Sleep while the buffer is full, after a second without progress send an error.
+	if (!tri_buffer_wait(buffer, true, pdMS_TO_TICKS(1000))) {
+		return 1;
+	}
+	buffer->triangles[buffer->providedIndex] = *projected;
+	int provided = (buffer->providedIndex + 1) % CONFIG_LIB3D_TRI_BUFFER_SIZE;
+	__atomic_store_n(&buffer->providedIndex, provided, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&buffer->consumerWaiting, __ATOMIC_SEQ_CST) &&
+		(tri_buffer_count(provided, __atomic_load_n(&buffer->usedIndex, __ATOMIC_SEQ_CST)) >= TRI_BUFFER_BATCH)) {
+		xTaskNotifyGive((TaskHandle_t) buffer->consumer);
+	}
+#else
+	framebuffer_lock_t lock;
+	draw_tri(projected);
+#endif
+	return 0;
+}
+
+// Queues a triangle of projected vertices, unless it faces away (when culling) or is off screen.
+// Front faces go counter-clockwise as seen on the display.
+static int emit_tri(const vertex_3d *v0, const vertex_3d *v1, const vertex_3d *v2, uint32_t param, uint8_t mode, bool cull)
+{
+	float area = (v1->sx - v0->sx) * (v2->sy - v0->sy) - (v1->sy - v0->sy) * (v2->sx - v0->sx);
+	if (!(area != 0) || (cull && area > 0)) return 0;
+	triangle_3d_buffered projected = {
+		.x0 = v0->sx, .y0 = v0->sy, .z0 = v0->depth,
+		.x1 = v1->sx, .y1 = v1->sy, .z1 = v1->depth,
+		.x2 = v2->sx, .y2 = v2->sy, .z2 = v2->depth,
+		.param = param,
+		.mode = mode
+	};
+	int16_t x0, y0, x1, y1;
+	if (!tri_bounds(&projected, &x0, &y0, &x1, &y1)) return 0;
+	return queue_tri(&projected);
+}
+
+// Clips a triangle of view space vertices against the near plane and queues what is left of it.
+// Only vertices in front of the near plane need to be projected already.
+static int clip_tri(const projection_3d *projection, const vertex_3d *v0, const vertex_3d *v1, const vertex_3d *v2, uint32_t param, uint8_t mode, bool cull)
+{
+	float near = projection->nearClippingPlane;
+	bool in0 = v0->z >= near, in1 = v1->z >= near, in2 = v2->z >= near;
+	if (in0 && in1 && in2) return emit_tri(v0, v1, v2, param, mode, cull);
+	if (!in0 && !in1 && !in2) return 0;
+
+	// Cutting a corner off a triangle leaves a triangle or a quad, with the winding of the original.
+	const vertex_3d *in[3] = {v0, v1, v2};
+	vertex_3d polygon[4];
+	int count = 0;
+	for (int i = 0; i < 3; i++) {
+		const vertex_3d *current = in[i];
+		const vertex_3d *next = in[(i + 1) % 3];
+		bool currentIn = current->z >= near;
+		if (currentIn) polygon[count++] = *current;
+		if (currentIn != (next->z >= near)) {
+			float t = (near - current->z) / (next->z - current->z);
+			vertex_3d *cut = &polygon[count++];
+			cut->x = current->x + (next->x - current->x) * t;
+			cut->y = current->y + (next->y - current->y) * t;
+			cut->z = near;
+			vertex_3d_project(projection, cut);
+		}
+	}
+	int res = 0;
+	for (int i = 1; i < count - 1; i++) {
+		res |= emit_tri(&polygon[0], &polygon[i], &polygon[i + 1], param, mode, cull);
+	}
+	return res;
+}
+
 // Queues a 3D triangle into the triangle buffer.
 // Note: Does not currently work with windows, and probably never will.
 // Returns 0 on OK, 1 on timeout (likely renderer crashed).
 int driver_framebuffer_tri3d(triangle_3d triangle, uint32_t param, uint8_t mode)
 {
-	// Temporary: render triangle right away.
-	render_tri_colored(triangle, param);
-	if (1) return 0;
+	const projection_3d *projection = projection_3d_get();
+	const float *points = &triangle.x0;
+	vertex_3d vertices[3];
+	for (int i = 0; i < 3; i++) {
+		vertex_3d_transform(&stack_3d_global.current, &points[i * 3], &vertices[i]);
+		if (vertices[i].z >= projection->nearClippingPlane) vertex_3d_project(projection, &vertices[i]);
+	}
+	return clip_tri(projection, &vertices[0], &vertices[1], &vertices[2], param, mode, false);
+}
 
-	triangle_buffer_3d *buffer = &tri_buffer_3d_global;
-	int64_t start = esp_timer_get_time();
-	int64_t limit = start + 50000; // After 50 millis, send an error.
-	// CONFIG_LIB3D_TRI_BUFFER_SIZE is the size of the buffer
-	while ((buffer->providedIndex + 1) % CONFIG_LIB3D_TRI_BUFFER_SIZE == buffer->usedIndex) {
-		if (esp_timer_get_time() > limit) {
+// Queues the triangles of an indexed mesh, every vertex is transformed and projected once no matter how many
+// triangles share it.
+// Returns 0 on OK, 1 on error.
+int driver_framebuffer_mesh3d(const float *vertices, uint16_t vertexCount, const uint16_t *indices, uint16_t triangleCount, const uint32_t *colors, uint32_t color, bool cull)
+{
+	for (uint32_t i = 0; i < triangleCount * 3; i++) {
+		if (indices[i] >= vertexCount) {
+			ESP_LOGE(TAG, "Mesh index %u is out of range.", indices[i]);
 			return 1;
 		}
-		// Busy wait; just what i would like to avoid...
-		//vTaskDelay(1 / portTICK_PERIOD_MS); // Slack off for a millisecond.
 	}
-	buffer->triangles[buffer->providedIndex] = (triangle_3d_buffered) {
-		.x0 = triangle.x0, .y0 = triangle.y0, .z0 = triangle.z0,
-		.x1 = triangle.x0, .y1 = triangle.y0, .z1 = triangle.z0,
-		.x2 = triangle.x0, .y2 = triangle.y0, .z2 = triangle.z0,
-		.param = param,
-		.mode = mode
-	};
-	buffer->providedIndex = (buffer->providedIndex + 1) % CONFIG_LIB3D_TRI_BUFFER_SIZE;
-	return 0;
+	vertex_3d *transformed = (vertex_3d *) malloc(sizeof(vertex_3d) * vertexCount);
+	if (vertexCount && !transformed) {
+		ESP_LOGE(TAG, "Unable to allocate the mesh vertices.");
+		return 1;
+	}
+
+	const projection_3d *projection = projection_3d_get();
+	matrix_3d matrix = stack_3d_global.current;
+	for (uint16_t i = 0; i < vertexCount; i++) {
+		vertex_3d_transform(&matrix, &vertices[i * 3], &transformed[i]);
+		if (transformed[i].z >= projection->nearClippingPlane) vertex_3d_project(projection, &transformed[i]);
+	}
+
+	int res = 0;
+	for (uint16_t i = 0; i < triangleCount && !res; i++) {
+		const uint16_t *triangle = &indices[i * 3];
+		res = clip_tri(projection, &transformed[triangle[0]], &transformed[triangle[1]], &transformed[triangle[2]],
+			colors ? colors[i] : color, RENDERMODE_SOLID, cull);
+	}
+	free(transformed);
+	return res;
 }
 #endif
 
@@ -672,3 +833,417 @@ uint32_t shader_2d_nolerp(float u, float v, int16_t x, int16_t y, void *args) {
 #endif
 
 #endif
+
+#ifdef DRIVER_FRAMEBUFFER_MATRIX_DRAWING_TEST
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define N_RAND_TRIANGLES 20000
+#define N_RAND_MESHES    200
+#define N_RAND_VIEWS     50
+#define TEST_WIDTH       61
+#define TEST_HEIGHT      43
+#define GRID_CELL        (8 * TRI_ONE)
+#define CLIP_MARGIN      0.125f //Pixels, more than the snapping of the vertices moves an edge
+
+static uint8_t coverage[TEST_HEIGHT][TEST_WIDTH];
+
+static int32_t rand_range(int32_t low, int32_t high)
+{
+	return low + rand() % (high - low + 1);
+}
+
+static bool tri_reference(const int32_t fx[3], const int32_t fy[3], int16_t px, int16_t py)
+{ //The fill rule evaluated for a single pixel center, straight from the edge functions
+	int32_t x[3] = {fx[0], fx[1], fx[2]}, y[3] = {fy[0], fy[1], fy[2]};
+	int64_t area = (int64_t) (x[1] - x[0]) * (y[2] - y[0]) - (int64_t) (y[1] - y[0]) * (x[2] - x[0]);
+	if (area == 0) return false;
+	if (area < 0) {
+		int32_t t;
+		t = x[1]; x[1] = x[2]; x[2] = t;
+		t = y[1]; y[1] = y[2]; y[2] = t;
+	}
+	int64_t cx = px * TRI_ONE + TRI_HALF, cy = py * TRI_ONE + TRI_HALF;
+	for (uint8_t i = 0; i < 3; i++) {
+		int64_t a = y[i] - y[(i + 1) % 3];
+		int64_t b = x[(i + 1) % 3] - x[i];
+		int64_t w = a * (cx - x[i]) + b * (cy - y[i]);
+		if (w < 0) return false;
+		if ((w == 0) && !((a > 0) || ((a == 0) && (b > 0)))) return false; //Only top and left edges include their centers
+	}
+	return true;
+}
+
+static void rasterize(const int32_t fx[3], const int32_t fy[3])
+{ //Adds the spans of a triangle to the coverage counts, checking the order and range of the spans
+	tri_raster_t raster;
+	bool any = _tri_setup(&raster, fx[0] / (float) TRI_ONE, fy[0] / (float) TRI_ONE, fx[1] / (float) TRI_ONE,
+		fy[1] / (float) TRI_ONE, fx[2] / (float) TRI_ONE, fy[2] / (float) TRI_ONE, TEST_WIDTH, TEST_HEIGHT);
+	if (!any) return;
+	int16_t y, x0, x1, previous = -1;
+	while (_tri_span(&raster, &y, &x0, &x1)) {
+		assert(y > previous && y < TEST_HEIGHT);
+		assert(x0 >= 0 && x0 <= x1 && x1 < TEST_WIDTH);
+		previous = y;
+		for (int16_t x = x0; x <= x1; x++) coverage[y][x]++;
+	}
+}
+
+static void check_coverage(uint8_t expected, const char* what, int iteration)
+{
+	for (int16_t y = 0; y < TEST_HEIGHT; y++) {
+		for (int16_t x = 0; x < TEST_WIDTH; x++) {
+			if (coverage[y][x] != expected) {
+				fprintf(stderr, "%s %d: pixel %d,%d covered %u times\n", what, iteration, x, y, coverage[y][x]);
+			}
+			assert(coverage[y][x] == expected);
+		}
+	}
+}
+
+static int32_t rand_vertex(uint8_t snap, int32_t low, int32_t high)
+{ //Vertices on pixel corners or centers land exactly on the pixel centers of their edges
+	int32_t value = rand_range(low, high);
+	return value - value % snap;
+}
+
+static void do_test_reference()
+{ //Random triangles, partly outside the area, match the fill rule for every pixel
+	static const uint8_t snaps[] = {1, TRI_HALF, TRI_ONE};
+	uint32_t pixels = 0;
+	for (int i = 0; i < N_RAND_TRIANGLES; i++) {
+		uint8_t snap = snaps[i % 3];
+		int32_t fx[3], fy[3];
+		for (uint8_t v = 0; v < 3; v++) {
+			fx[v] = rand_vertex(snap, -8 * TRI_ONE, (TEST_WIDTH + 8) * TRI_ONE);
+			fy[v] = rand_vertex(snap, -8 * TRI_ONE, (TEST_HEIGHT + 8) * TRI_ONE);
+		}
+		if (i % 7 == 0) fy[2] = fy[1]; //Horizontal edges
+		if (i % 11 == 0) fx[2] = fx[0]; //Vertical edges
+		memset(coverage, 0, sizeof(coverage));
+		rasterize(fx, fy);
+		for (int16_t y = 0; y < TEST_HEIGHT; y++) {
+			for (int16_t x = 0; x < TEST_WIDTH; x++) {
+				bool expected = tri_reference(fx, fy, x, y);
+				if (coverage[y][x] != expected) {
+					fprintf(stderr, "triangle %d (%d,%d %d,%d %d,%d)/%d: pixel %d,%d covered %u times, expected %u\n", i,
+						fx[0], fy[0], fx[1], fy[1], fx[2], fy[2], TRI_ONE, x, y, coverage[y][x], expected);
+				}
+				assert(coverage[y][x] == expected);
+				pixels += expected;
+			}
+		}
+	}
+	printf("%d triangles covering %u pixels match the fill rule\n", N_RAND_TRIANGLES, pixels);
+}
+
+static void do_test_grid()
+{ //A distorted grid of triangles over more than the whole area covers every pixel exactly once
+	enum { COLUMNS = (TEST_WIDTH * TRI_ONE + 2 * GRID_CELL - 1) / GRID_CELL + 1, ROWS = (TEST_HEIGHT * TRI_ONE + 2 * GRID_CELL - 1) / GRID_CELL + 1 };
+	static const uint8_t snaps[] = {1, TRI_HALF, TRI_ONE};
+	for (int i = 0; i < N_RAND_MESHES; i++) {
+		uint8_t snap = snaps[i % 3];
+		int32_t gx[ROWS + 1][COLUMNS + 1], gy[ROWS + 1][COLUMNS + 1];
+		for (int r = 0; r <= ROWS; r++) {
+			for (int c = 0; c <= COLUMNS; c++) {
+				//The border stays straight, everything inside moves by up to 3/16 of a cell
+				gx[r][c] = (c - 1) * GRID_CELL;
+				gy[r][c] = (r - 1) * GRID_CELL;
+				if ((c > 0) && (c < COLUMNS)) gx[r][c] += rand_vertex(snap, -GRID_CELL * 3 / 16, GRID_CELL * 3 / 16);
+				if ((r > 0) && (r < ROWS)) gy[r][c] += rand_vertex(snap, -GRID_CELL * 3 / 16, GRID_CELL * 3 / 16);
+			}
+		}
+		memset(coverage, 0, sizeof(coverage));
+		for (int r = 0; r < ROWS; r++) {
+			for (int c = 0; c < COLUMNS; c++) {
+				//Both diagonals and both windings
+				int32_t qx[4] = {gx[r][c], gx[r][c + 1], gx[r + 1][c + 1], gx[r + 1][c]};
+				int32_t qy[4] = {gy[r][c], gy[r][c + 1], gy[r + 1][c + 1], gy[r + 1][c]};
+				uint8_t first = rand() & 1, reverse = rand() & 1;
+				for (uint8_t half = 0; half < 2; half++) {
+					uint8_t a = first + 2 * half, b = (a + 1) % 4, d = (a + 2) % 4;
+					if (reverse) { uint8_t t = b; b = d; d = t; }
+					int32_t fx[3] = {qx[a], qx[b], qx[d]}, fy[3] = {qy[a], qy[b], qy[d]};
+					rasterize(fx, fy);
+				}
+			}
+		}
+		check_coverage(1, "grid", i);
+	}
+	printf("%d distorted grids cover every pixel once\n", N_RAND_MESHES);
+}
+
+static void do_test_fan()
+{ //Triangles around a shared vertex inside the area, up to points on the border, cover every pixel exactly once
+	const int32_t width = TEST_WIDTH * TRI_ONE, height = TEST_HEIGHT * TRI_ONE, perimeter = 2 * (width + height);
+	for (int i = 0; i < N_RAND_MESHES; i++) {
+		uint8_t snap = (i & 1) ? 1 : TRI_HALF;
+		int32_t cx = rand_vertex(snap, TRI_ONE, width - TRI_ONE);
+		int32_t cy = rand_vertex(snap, TRI_ONE, height - TRI_ONE);
+		//Positions along the border, the corners included
+		int32_t border[36] = {0, width, width + height, 2 * width + height};
+		int count = 4 + rand() % 32;
+		for (int p = 4; p < count; p++) border[p] = rand_vertex(snap, 0, perimeter - 1);
+		for (int p = 1; p < count; p++) {
+			for (int q = p; (q > 0) && (border[q - 1] > border[q]); q--) {
+				int32_t t = border[q]; border[q] = border[q - 1]; border[q - 1] = t;
+			}
+		}
+		memset(coverage, 0, sizeof(coverage));
+		for (int p = 0; p < count; p++) {
+			int32_t fx[3] = {cx}, fy[3] = {cy};
+			for (uint8_t v = 1; v < 3; v++) {
+				int32_t position = border[(p + v - 1) % count];
+				if (position < width) { fx[v] = position; fy[v] = 0; }
+				else if (position < width + height) { fx[v] = width; fy[v] = position - width; }
+				else if (position < 2 * width + height) { fx[v] = 2 * width + height - position; fy[v] = height; }
+				else { fx[v] = 0; fy[v] = perimeter - position; }
+			}
+			rasterize(fx, fy);
+		}
+		check_coverage(1, "fan", i);
+	}
+	printf("%d fans cover every pixel once\n", N_RAND_MESHES);
+}
+
+static void do_test_quad(Window* window)
+{ //Quads drawn into a window fill the pixels of both of their triangles
+	for (int i = 0; i < N_RAND_MESHES; i++) {
+		int32_t fx[4], fy[4];
+		for (uint8_t v = 0; v < 4; v++) {
+			fx[v] = rand_vertex(1, -4 * TRI_ONE, (TEST_WIDTH + 4) * TRI_ONE);
+			fy[v] = rand_vertex(1, -4 * TRI_ONE, (TEST_HEIGHT + 4) * TRI_ONE);
+		}
+		driver_framebuffer_fill(window, 0);
+		driver_framebuffer_quad(window, fx[0] / (float) TRI_ONE, fy[0] / (float) TRI_ONE, fx[1] / (float) TRI_ONE, fy[1] / (float) TRI_ONE,
+			fx[2] / (float) TRI_ONE, fy[2] / (float) TRI_ONE, fx[3] / (float) TRI_ONE, fy[3] / (float) TRI_ONE, 0xFFFFFF);
+		int32_t ax[3] = {fx[0], fx[1], fx[2]}, ay[3] = {fy[0], fy[1], fy[2]};
+		int32_t bx[3] = {fx[0], fx[2], fx[3]}, by[3] = {fy[0], fy[2], fy[3]};
+		for (int16_t y = 0; y < TEST_HEIGHT; y++) {
+			for (int16_t x = 0; x < TEST_WIDTH; x++) {
+				bool expected = tri_reference(ax, ay, x, y) || tri_reference(bx, by, x, y);
+				assert((driver_framebuffer_getPixel(window, x, y) != 0) == expected);
+			}
+		}
+	}
+}
+
+static uint32_t drawn_pixels()
+{ //Pixels of the cleared framebuffer that have been drawn since
+	int16_t width, height;
+	driver_framebuffer_get_orientation_size(NULL, &width, &height);
+	uint32_t count = 0;
+	for (int16_t y = 0; y < height; y++) {
+		for (int16_t x = 0; x < width; x++) count += driver_framebuffer_getPixel(NULL, x, y) != 0;
+	}
+	return count;
+}
+
+static void clear_3d()
+{
+	driver_framebuffer_fill(NULL, 0);
+	depth3d_clear(&depth_buffer_global);
+}
+
+static void cross(const float* a, const float* b, float* out)
+{
+	out[0] = a[1] * b[2] - a[2] * b[1];
+	out[1] = a[2] * b[0] - a[0] * b[2];
+	out[2] = a[0] * b[1] - a[1] * b[0];
+}
+
+static float dot(const float* a, const float* b)
+{
+	return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+
+static int seen(const float* v, int16_t x, int16_t y)
+{ //Whether the view ray through a pixel center hits the triangle in front of the near plane: 1 if it does, 0 if it does not
+  //and -1 if the center is too close to the edge of the visible part to tell. The ray hits the triangle when it lies
+  //within the three planes through the camera and the edges, and in front of the near plane when it is within a fourth
+  //plane, each of these is a line on the display.
+	const projection_3d* projection = projection_3d_get();
+	float e1[3] = {v[3] - v[0], v[4] - v[1], v[5] - v[2]}, e2[3] = {v[6] - v[0], v[7] - v[1], v[8] - v[2]}, planes[4][4];
+	cross(e1, e2, planes[3]);
+	float volume = dot(planes[3], v);
+	if (volume == 0) return -1;
+	float sign = (volume > 0) ? 1 : -1;
+	for (uint8_t i = 0; i < 3; i++) {
+		cross(&v[((i + 1) % 3) * 3], &v[((i + 2) % 3) * 3], planes[i]);
+		for (uint8_t c = 0; c < 3; c++) planes[i][c] *= sign;
+		planes[i][3] = 0;
+	}
+	for (uint8_t c = 0; c < 3; c++) planes[3][c] *= -sign;
+	planes[3][3] = sign * volume / projection->nearClippingPlane;
+
+	float step = projection->depthScale / projection->scale; //Change of the ray per pixel
+	float rx = (x + 0.5f - projection->centerX) * step, ry = (y + 0.5f - projection->centerY) * step;
+	float nearest = INFINITY;
+	for (uint8_t i = 0; i < 4; i++) {
+		float value = planes[i][0] * rx + planes[i][1] * ry + planes[i][2] + planes[i][3];
+		float slope = sqrtf(planes[i][0] * planes[i][0] + planes[i][1] * planes[i][1]) * step;
+		float distance = (slope > 0) ? value / slope : (value >= 0 ? INFINITY : -INFINITY);
+		if (distance < nearest) nearest = distance;
+	}
+	if (nearest > CLIP_MARGIN) return 1;
+	if (nearest < -CLIP_MARGIN) return 0;
+	return -1;
+}
+
+static void do_test_clipping()
+{ //Triangles through the near plane draw exactly what the view rays see of them in front of it
+	int16_t width, height;
+	driver_framebuffer_get_orientation_size(NULL, &width, &height);
+	stack_3d_global.current = matrix_3d_identity();
+	uint32_t crossing = 0, pixels = 0;
+	for (int i = 0; i < N_RAND_VIEWS; i++) {
+		//Within +/- 1 of the axis the vertices on the near plane stay clear of the rasterizer guard
+		float v[9];
+		uint8_t behind = 0;
+		for (uint8_t p = 0; p < 3; p++) {
+			v[p * 3]     = rand_range(-1000, 1000) / 1000.0f;
+			v[p * 3 + 1] = rand_range(-1000, 1000) / 1000.0f;
+			v[p * 3 + 2] = rand_range(-2000, 4000) / 1000.0f;
+			behind += v[p * 3 + 2] < projection_3d_get()->nearClippingPlane;
+		}
+		static const uint16_t indices[3] = {0, 1, 2};
+		clear_3d();
+		assert(driver_framebuffer_mesh3d(v, 3, indices, 1, NULL, 0xFFFFFF, false) == 0);
+		uint32_t drawn = drawn_pixels();
+		if (behind == 3) assert(drawn == 0);
+		if ((behind > 0) && (behind < 3) && (drawn > 0)) crossing++;
+		pixels += drawn;
+		for (int16_t y = 0; y < height; y++) {
+			for (int16_t x = 0; x < width; x++) {
+				int expected = seen(v, x, y);
+				if (expected < 0) continue;
+				bool set = driver_framebuffer_getPixel(NULL, x, y) != 0;
+				if (set != expected) {
+					fprintf(stderr, "triangle %d (%.3f,%.3f,%.3f %.3f,%.3f,%.3f %.3f,%.3f,%.3f): pixel %d,%d drawn %u, seen %d\n",
+						i, v[0], v[1], v[2], v[3], v[4], v[5], v[6], v[7], v[8], x, y, set, expected);
+				}
+				assert(set == expected);
+			}
+		}
+
+		//A single triangle is drawn the same way
+		clear_3d();
+		triangle_3d triangle = {v[0], v[1], v[2], v[3], v[4], v[5], v[6], v[7], v[8]};
+		assert(driver_framebuffer_tri3d(triangle, 0xFFFFFF, RENDERMODE_SOLID) == 0);
+		assert(drawn_pixels() == drawn);
+	}
+	printf("%d triangles of which %u cross the near plane, %u pixels drawn as seen\n", N_RAND_VIEWS, crossing, pixels);
+}
+
+static void do_test_culling()
+{ //With culling only the faces of a cube that turn their outside to the camera draw anything
+	float vertices[8 * 3];
+	for (uint8_t i = 0; i < 8; i++) {
+		vertices[i * 3]     = (i & 1) ? 1 : -1;
+		vertices[i * 3 + 1] = (i & 2) ? 1 : -1;
+		vertices[i * 3 + 2] = (i & 4) ? 1 : -1;
+	}
+	//Two triangles for every side, wound counter-clockwise as seen from outside the cube
+	uint16_t indices[12 * 3];
+	uint8_t count = 0;
+	for (uint8_t axis = 0; axis < 3; axis++) {
+		for (uint8_t side = 0; side < 2; side++) {
+			uint8_t a = 1 << ((axis + 1) % 3), b = 1 << ((axis + 2) % 3), base = side << axis;
+			uint16_t quad[4] = {base, (uint16_t) (base + a), (uint16_t) (base + a + b), (uint16_t) (base + b)};
+			for (uint8_t half = 0; half < 2; half++) {
+				uint16_t* triangle = &indices[count++ * 3];
+				triangle[0] = quad[0];
+				triangle[1] = quad[1 + half];
+				triangle[2] = quad[2 + half];
+				float e1[3], e2[3], normal[3];
+				for (uint8_t c = 0; c < 3; c++) {
+					e1[c] = vertices[triangle[1] * 3 + c] - vertices[triangle[0] * 3 + c];
+					e2[c] = vertices[triangle[2] * 3 + c] - vertices[triangle[0] * 3 + c];
+				}
+				cross(e1, e2, normal);
+				if (dot(normal, &vertices[triangle[0] * 3]) < 0) {
+					uint16_t t = triangle[1]; triangle[1] = triangle[2]; triangle[2] = t;
+				}
+			}
+		}
+	}
+
+	uint32_t front = 0;
+	for (int i = 0; i < N_RAND_VIEWS; i++) {
+		matrix_3d rotation = matrix_3d_rotate(rand_range(0, 6283) / 1000.0f, rand_range(0, 6283) / 1000.0f, rand_range(0, 6283) / 1000.0f);
+		stack_3d_global.current = matrix_3d_multiply(matrix_3d_translate(0, 0, 8), rotation);
+		for (uint8_t t = 0; t < 12; t++) {
+			//Which way a triangle faces follows from its transformed vertices
+			float v[9], e1[3], e2[3], normal[3];
+			for (uint8_t p = 0; p < 3; p++) {
+				memcpy(&v[p * 3], &vertices[indices[t * 3 + p] * 3], sizeof(float) * 3);
+				matrix_3d_transform_point(&stack_3d_global.current, &v[p * 3], &v[p * 3 + 1], &v[p * 3 + 2]);
+			}
+			for (uint8_t c = 0; c < 3; c++) {
+				e1[c] = v[3 + c] - v[c];
+				e2[c] = v[6 + c] - v[c];
+			}
+			cross(e1, e2, normal);
+			float facing = dot(normal, v) / sqrtf(dot(normal, normal) * dot(v, v));
+			clear_3d();
+			assert(driver_framebuffer_mesh3d(vertices, 8, &indices[t * 3], 1, NULL, 0xFFFFFF, true) == 0);
+			uint32_t drawn = drawn_pixels();
+			if (facing >= 0) assert(drawn == 0);
+			if (facing < -0.05f) {
+				assert(drawn > 0);
+				front++;
+			}
+			//Without culling both sides draw
+			clear_3d();
+			assert(driver_framebuffer_mesh3d(vertices, 8, &indices[t * 3], 1, NULL, 0xFFFFFF, false) == 0);
+			if ((facing < -0.05f) || (facing > 0.05f)) assert(drawn_pixels() > 0);
+		}
+
+		//The whole cube covers the same pixels either way
+		clear_3d();
+		assert(driver_framebuffer_mesh3d(vertices, 8, indices, 12, NULL, 0xFFFFFF, true) == 0);
+		uint32_t culled = drawn_pixels();
+		clear_3d();
+		assert(driver_framebuffer_mesh3d(vertices, 8, indices, 12, NULL, 0xFFFFFF, false) == 0);
+		assert(drawn_pixels() == culled);
+	}
+	printf("%d cubes with %u faces towards the camera drawn\n", N_RAND_VIEWS, front);
+
+	//Out of range indices are rejected before anything is drawn
+	uint16_t bad[6] = {0, 1, 2, 0, 2, 8};
+	stack_3d_global.current = matrix_3d_translate(0, 0, 8);
+	clear_3d();
+	assert(driver_framebuffer_mesh3d(vertices, 8, bad, 2, NULL, 0xFFFFFF, false) == 1);
+	assert(drawn_pixels() == 0);
+	assert(driver_framebuffer_mesh3d(vertices, 8, bad, 0, NULL, 0xFFFFFF, false) == 0);
+}
+
+int main(void)
+{
+	srand(42);
+	do_test_reference();
+	do_test_grid();
+	do_test_fan();
+
+	Window* window = driver_framebuffer_window_create_format("tri", TEST_WIDTH, TEST_HEIGHT, FB_FORMAT_8BPP);
+	assert(window);
+	do_test_quad(window);
+	driver_framebuffer_window_remove(window);
+
+	assert(driver_framebuffer_init() == ESP_OK);
+	int16_t width, height;
+	driver_framebuffer_get_orientation_size(NULL, &width, &height);
+	depth_buffer_global.width = width;
+	depth_buffer_global.height = height;
+	depth_buffer_global.buffer = (depth_buffer_type_t*) malloc(sizeof(depth_buffer_type_t) * width * height);
+	assert(depth_buffer_global.buffer);
+	do_test_clipping();
+	do_test_culling();
+	free(depth_buffer_global.buffer);
+	printf("OK\n");
+	return 0;
+}
+
+#endif // DRIVER_FRAMEBUFFER_MATRIX_DRAWING_TEST
@@ -9,6 +9,12 @@
  * for each of the compositor windows.
  */
 
+/* TEST (from this directory, host/ stands in for ESP-IDF):
+ * gcc -o fb_orientation_test -DDRIVER_FRAMEBUFFER_ORIENTATION_TEST -Wall -g -I host -I png \
+ *     $(find ../driver_display_* ../driver_io_disobey_samd -maxdepth 1 -name include -printf '-I %p ') \
+ *     $(find . host png fonts -maxdepth 1 -name '*.c*') -lstdc++ -lm
+ */
+
 #include "include/driver_framebuffer_internal.h"
 
 #ifdef CONFIG_DRIVER_FRAMEBUFFER_ENABLE
@@ -53,6 +59,7 @@ enum Orientation driver_framebuffer_get_orientation(Window* window)
 
 void driver_framebuffer_set_orientation(Window* window, enum Orientation newOrientation)
 {
+	framebuffer_lock_t lock;
 	enum Orientation *orientation = _getOrientationContext(window);
 	*orientation = newOrientation;
 }
@@ -87,6 +94,7 @@ uint16_t driver_framebuffer_get_orientation_angle(Window* window)
 
 void driver_framebuffer_set_orientation_angle(Window* window, uint16_t angle)
 {
+	framebuffer_lock_t lock;
 	enum Orientation *orientation = _getOrientationContext(window);
 #ifdef CONFIG_DRIVER_FRAMEBUFFER_FLIP
 	switch (angle % 360) {
@@ -121,24 +129,50 @@ void driver_framebuffer_set_orientation_angle(Window* window, uint16_t angle)
 #endif
 }
 
-bool driver_framebuffer_orientation_apply(Window* window, int16_t* x, int16_t* y)
+void driver_framebuffer_orientation_map(Window* window, orientation_map_t* map)
 {
 	enum Orientation *orientation = _getOrientationContext(window);
 	int16_t width, height;
 	_getSizeContext(window, &width, &height);
-	
-	if (*orientation == portrait || *orientation == reverse_portrait) { //90 degrees
-		int16_t t = *y;
-		*y = *x;
-		*x = (width-1)-t;
-	}
-	
-	if (*orientation == reverse_landscape || *orientation == portrait) { //180 degrees
-		*y = (height-1)-*y;
-		*x = (width-1)-*x;
+
+	//Every orientation turns a step to the right and a step down into a step along one of the axes of the buffer
+	switch (*orientation) {
+		case portrait: //90 and 180 degrees
+			map->x      = 0;       map->y      = height-1;
+			map->pixelX = 0;       map->pixelY = -1;
+			map->rowX   = 1;       map->rowY   = 0;
+			break;
+		case reverse_landscape: //180 degrees
+			map->x      = width-1; map->y      = height-1;
+			map->pixelX = -1;      map->pixelY = 0;
+			map->rowX   = 0;       map->rowY   = -1;
+			break;
+		case reverse_portrait: //90 degrees
+			map->x      = width-1; map->y      = 0;
+			map->pixelX = 0;       map->pixelY = 1;
+			map->rowX   = -1;      map->rowY   = 0;
+			break;
+		default:
+		case landscape:
+			map->x      = 0;       map->y      = 0;
+			map->pixelX = 1;       map->pixelY = 0;
+			map->rowX   = 0;       map->rowY   = 1;
+			break;
 	}
-	
-	return (*x >= 0) && (*x < width) && (*y >= 0) && (*y < height);
+	map->width  = (map->pixelX != 0) ? width : height;
+	map->height = (map->pixelX != 0) ? height : width;
+}
+
+bool driver_framebuffer_orientation_apply(Window* window, int16_t* x, int16_t* y)
+{
+	orientation_map_t map;
+	driver_framebuffer_orientation_map(window, &map);
+	bool visible = (*x >= 0) && (*x < map.width) && (*y >= 0) && (*y < map.height);
+	int16_t bx = map.x + map.pixelX * *x + map.rowX * *y;
+	int16_t by = map.y + map.pixelY * *x + map.rowY * *y;
+	*x = bx;
+	*y = by;
+	return visible;
 }
 
 void driver_framebuffer_orientation_revert(Window* window, int16_t* x, int16_t* y)
@@ -192,13 +226,89 @@ void driver_framebuffer_orientation_revert_square(Window* window, int16_t* x0, i
 }
 
 void driver_framebuffer_get_orientation_size(Window* window, int16_t* width, int16_t* height)
+{
+	orientation_map_t map;
+	driver_framebuffer_orientation_map(window, &map);
+	*width  = map.width;
+	*height = map.height;
+}
+
+#endif /* CONFIG_DRIVER_FRAMEBUFFER_ENABLE */
+
+#ifdef DRIVER_FRAMEBUFFER_ORIENTATION_TEST
+#include <assert.h>
+#include <stdio.h>
+
+static const enum Orientation orientations[] = {landscape, portrait, reverse_landscape, reverse_portrait};
+
+/* the per pixel rotation that driver_framebuffer_orientation_map replaced */
+static bool apply_reference(Window* window, int16_t* x, int16_t* y)
 {
 	enum Orientation *orientation = _getOrientationContext(window);
-	if ((*orientation == portrait) || (*orientation == reverse_portrait))  {
-		_getSizeContext(window, height, width); //Swapped
-	} else {
-		_getSizeContext(window, width, height); //Normal
+	int16_t width, height;
+	_getSizeContext(window, &width, &height);
+
+	if (*orientation == portrait || *orientation == reverse_portrait) { //90 degrees
+		int16_t t = *y;
+		*y = *x;
+		*x = (width-1)-t;
 	}
+
+	if (*orientation == reverse_landscape || *orientation == portrait) { //180 degrees
+		*y = (height-1)-*y;
+		*x = (width-1)-*x;
+	}
+
+	return (*x >= 0) && (*x < width) && (*y >= 0) && (*y < height);
 }
 
-#endif /* CONFIG_DRIVER_FRAMEBUFFER_ENABLE */
+static void do_test_orientation(Window* window)
+{
+	int16_t width, height;
+	_getSizeContext(window, &width, &height);
+	for (uint8_t i = 0; i < sizeof(orientations) / sizeof(orientations[0]); i++) {
+		driver_framebuffer_set_orientation(window, orientations[i]);
+		orientation_map_t map;
+		driver_framebuffer_orientation_map(window, &map);
+
+		int16_t userWidth, userHeight;
+		driver_framebuffer_get_orientation_size(window, &userWidth, &userHeight);
+		bool portraitSize = (orientations[i] == portrait) || (orientations[i] == reverse_portrait);
+		assert(userWidth  == (portraitSize ? height : width));
+		assert(userHeight == (portraitSize ? width : height));
+		assert((map.width == userWidth) && (map.height == userHeight));
+
+		//Includes positions outside of the buffer, which have to be reported as such
+		for (int16_t y = -2; y < userHeight + 2; y++) {
+			for (int16_t x = -2; x < userWidth + 2; x++) {
+				int16_t ax = x, ay = y, rx = x, ry = y;
+				bool visible = driver_framebuffer_orientation_apply(window, &ax, &ay);
+				bool visibleReference = apply_reference(window, &rx, &ry);
+				if ((visible != visibleReference) || (ax != rx) || (ay != ry)) {
+					fprintf(stderr, "orientation %d: %d, %d maps to %d, %d instead of %d, %d\n", orientations[i], x, y, ax, ay, rx, ry);
+					assert(false);
+				}
+				//The steps of the map walk the same positions
+				assert(ax == map.x + x * map.pixelX + y * map.rowX);
+				assert(ay == map.y + x * map.pixelY + y * map.rowY);
+			}
+		}
+	}
+	driver_framebuffer_set_orientation(window, landscape);
+}
+
+int main(void)
+{
+	do_test_orientation(NULL);
+	static const struct { uint16_t width, height; } sizes[] = {{1, 1}, {1, 7}, {7, 1}, {16, 16}, {21, 13}, {13, 21}};
+	for (uint8_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		Window* window = driver_framebuffer_window_create("orientation", sizes[i].width, sizes[i].height);
+		assert(window);
+		do_test_orientation(window);
+		driver_framebuffer_window_remove(window);
+	}
+	printf("OK\n");
+	return 0;
+}
+
+#endif // DRIVER_FRAMEBUFFER_ORIENTATION_TEST
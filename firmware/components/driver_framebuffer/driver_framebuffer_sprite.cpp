@@ -0,0 +1,217 @@
+/*
+ * The functions in this file draw sprites: images that were
+ * converted to a pixel format of the framebuffer ahead of time
+ *
+ * Uncompressed frames are blitted straight from the sprite data,
+ * which can be memory mapped flash, so drawing them costs no more
+ * than copying the pixels
+ */
+
+#include "include/driver_framebuffer_internal.h"
+
+#ifdef CONFIG_DRIVER_FRAMEBUFFER_ENABLE
+
+#define TAG "fb-sprite"
+
+/* Private functions */
+
+inline uint16_t _sprite_u16(const uint8_t* data)
+{
+	return data[0] | (data[1] << 8);
+}
+
+inline uint32_t _sprite_u32(const uint8_t* data)
+{
+	return data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t) data[3] << 24);
+}
+
+inline uint16_t _sprite_rows(const sprite_t* sprite)
+{
+	return (sprite->frames + sprite->columns - 1) / sprite->columns;
+}
+
+inline uint32_t _sprite_value(const pixel_ops_t* source, const pixel_ops_t* target, const uint8_t* in)
+{ //Read a stored pixel of a byte aligned format as an encoded value for the target format
+	if (source != target) return target->encode(source->load(in, 1, 1, 0, 0));
+	switch (source->bitsPerPixel) {
+		case 8:  return in[0];
+		case 16: return (in[0] << 8) | in[1];
+		case 24: return (in[0] << 16) | (in[1] << 8) | in[2];
+		default: return ((uint32_t) in[0] << 24) | (in[3] << 16) | (in[2] << 8) | in[1];
+	}
+}
+
+esp_err_t _sprite_draw_raw(Window* window, int16_t x, int16_t y, const sprite_t* sprite, uint16_t frame)
+{
+	//The atlas is drawn as a window that is not part of the list of windows, with the drawing area limited to the frame
+	uint16_t frameX = (frame % sprite->columns) * sprite->width;
+	uint16_t frameY = (frame / sprite->columns) * sprite->height;
+	Window atlas;
+	memset(&atlas, 0, sizeof(Window));
+	atlas.width       = sprite->columns * sprite->width;
+	atlas.height      = _sprite_rows(sprite) * sprite->height;
+	atlas.orientation = landscape;
+	atlas.buffer      = (uint8_t*) &sprite->data[SPRITE_HEADER_SIZE]; //Only read by the blit
+	atlas.format      = sprite->pixelOps->format;
+	atlas.pixelOps    = sprite->pixelOps;
+	atlas.x           = x - frameX;
+	atlas.y           = y - frameY;
+	atlas.hOffset     = frameX;
+	atlas.vOffset     = frameY;
+	atlas.drawWidth   = frameX + sprite->width;
+	atlas.drawHeight  = frameY + sprite->height;
+	driver_framebuffer_blit_key(&atlas, window, (sprite->flags & SPRITE_FLAG_KEYED) ? sprite->key : NULL);
+	return ESP_OK;
+}
+
+esp_err_t _sprite_draw_rle(Window* window, int16_t x, int16_t y, const sprite_t* sprite, uint16_t frame)
+{
+	const pixel_ops_t* ops = driver_framebuffer_get_ops(window);
+	if (!ops) return ESP_FAIL;
+	int16_t orientedWidth, orientedHeight;
+	driver_framebuffer_get_orientation_size(window, &orientedWidth, &orientedHeight);
+
+	uint16_t width = sprite->width;
+	uint32_t* values = (uint32_t*) malloc(width * (sizeof(uint32_t) + 1));
+	if (!values) {
+		ESP_LOGE(TAG, "sprite out of memory");
+		return ESP_ERR_NO_MEM;
+	}
+	uint8_t* alpha = (uint8_t*) &values[width];
+	bool keyed = sprite->flags & SPRITE_FLAG_KEYED;
+	uint8_t pixelBytes = sprite->pixelOps->bitsPerPixel / 8;
+	//Sprites stored in another format are dithered when the target can not show their colors
+	dither_row_t* dither = (sprite->pixelOps != ops) ? driver_framebuffer_dither_new(ops, width) : NULL;
+
+	const uint8_t* in  = &sprite->data[_sprite_u32(&sprite->data[SPRITE_HEADER_SIZE + frame * 4])];
+	const uint8_t* end = &sprite->data[sprite->size];
+	int16_t lastRow = sprite->height;
+	if (lastRow > orientedHeight - y) lastRow = orientedHeight - y;
+	esp_err_t res = ESP_OK;
+	for (int16_t row = 0; (row < lastRow) && (res == ESP_OK); row++) {
+		bool visible = (y + row >= 0);
+		for (uint16_t i = 0; i < width;) {
+			if (in >= end) {
+				res = ESP_ERR_INVALID_SIZE;
+				break;
+			}
+			bool repeat = *in & 0x80;
+			uint16_t count = (*in & 0x7F) + 1;
+			uint32_t length = (repeat ? 1 : count) * pixelBytes;
+			in++;
+			if ((i + count > width) || (length > (uint32_t) (end - in))) {
+				res = ESP_ERR_INVALID_SIZE;
+				break;
+			}
+			if (visible) {
+				uint32_t value = 0;
+				uint8_t opacity = 255;
+				for (uint16_t j = 0; j < count; j++) {
+					if (!repeat || (j == 0)) {
+						const uint8_t* pixel = &in[repeat ? 0 : j * pixelBytes];
+						value   = dither ? (sprite->pixelOps->load(pixel, 1, 1, 0, 0) & 0xFFFFFF) : _sprite_value(sprite->pixelOps, ops, pixel);
+						opacity = (keyed && (memcmp(pixel, sprite->key, pixelBytes) == 0)) ? 0 : 255;
+					}
+					values[i + j] = value;
+					alpha[i + j]  = opacity;
+				}
+			}
+			in += length;
+			i  += count;
+		}
+		if (visible && (res == ESP_OK)) {
+			if (dither) driver_framebuffer_dither_row(dither, values, keyed ? alpha : NULL, width);
+			driver_framebuffer_draw_row(window, x, y + row, values, keyed ? alpha : NULL, width);
+		}
+	}
+	if (dither) driver_framebuffer_dither_destroy(dither);
+	free(values);
+	driver_framebuffer_mark_rect(window, x, y, sprite->width, sprite->height);
+	if (res != ESP_OK) ESP_LOGE(TAG, "sprite frame %u is damaged", frame);
+	return res;
+}
+
+/* Public functions */
+
+esp_err_t driver_framebuffer_sprite_open(sprite_t* sprite, const uint8_t* data, uint32_t size)
+{
+	memset(sprite, 0, sizeof(sprite_t));
+	if ((size < SPRITE_HEADER_SIZE) || (memcmp(data, "FBSP", 4) != 0) || (data[4] != SPRITE_VERSION)) return ESP_ERR_INVALID_ARG;
+	if ((data[5] == FB_FORMAT_NATIVE) || (_sprite_u32(&data[20]) > size) || (_sprite_u32(&data[20]) < SPRITE_HEADER_SIZE)) return ESP_ERR_INVALID_ARG;
+	sprite->data     = data;
+	sprite->size     = _sprite_u32(&data[20]);
+	sprite->pixelOps = driver_framebuffer_format_ops((pixel_format_t) data[5]);
+	sprite->flags    = data[6];
+	sprite->width    = _sprite_u16(&data[8]);
+	sprite->height   = _sprite_u16(&data[10]);
+	sprite->frames   = _sprite_u16(&data[12]);
+	sprite->columns  = _sprite_u16(&data[14]);
+	memcpy(sprite->key, &data[16], 4);
+
+	esp_err_t res = ESP_OK;
+	if (!sprite->pixelOps || !sprite->width || !sprite->height || !sprite->frames || !sprite->columns) {
+		res = ESP_ERR_INVALID_ARG;
+	} else if (sprite->flags & SPRITE_FLAG_RLE) {
+		//Every frame has to start after the table of frames
+		uint32_t first = SPRITE_HEADER_SIZE + sprite->frames * 4;
+		if ((sprite->pixelOps->bitsPerPixel % 8) || (first > sprite->size)) {
+			res = ESP_ERR_INVALID_ARG;
+		} else {
+			for (uint16_t frame = 0; frame < sprite->frames; frame++) {
+				uint32_t offset = _sprite_u32(&data[SPRITE_HEADER_SIZE + frame * 4]);
+				if ((offset < first) || (offset >= sprite->size)) res = ESP_ERR_INVALID_SIZE;
+			}
+		}
+	} else {
+		//The atlas has to fit in a window
+		uint32_t atlasWidth  = (uint32_t) sprite->columns * sprite->width;
+		uint32_t atlasHeight = (uint32_t) _sprite_rows(sprite) * sprite->height;
+		if ((atlasWidth > INT16_MAX) || (atlasHeight > INT16_MAX)) {
+			res = ESP_ERR_INVALID_ARG;
+		} else if (SPRITE_HEADER_SIZE + driver_framebuffer_format_size(sprite->pixelOps->format, atlasWidth, atlasHeight) > sprite->size) {
+			res = ESP_ERR_INVALID_SIZE;
+		}
+	}
+	if (res != ESP_OK) memset(sprite, 0, sizeof(sprite_t));
+	return res;
+}
+
+esp_err_t driver_framebuffer_sprite_map(sprite_t* sprite, const esp_partition_t* partition, uint32_t offset)
+{
+	memset(sprite, 0, sizeof(sprite_t));
+	uint8_t header[SPRITE_HEADER_SIZE];
+	esp_err_t res = esp_partition_read(partition, offset, header, sizeof(header));
+	if (res != ESP_OK) return res;
+	uint32_t size = _sprite_u32(&header[20]);
+	if ((size < SPRITE_HEADER_SIZE) || (size > partition->size) || (offset > partition->size - size)) return ESP_ERR_INVALID_SIZE;
+
+	const void* data;
+	spi_flash_mmap_handle_t handle;
+	res = esp_partition_mmap(partition, offset, size, SPI_FLASH_MMAP_DATA, &data, &handle);
+	if (res != ESP_OK) return res;
+	res = driver_framebuffer_sprite_open(sprite, (const uint8_t*) data, size);
+	if (res != ESP_OK) {
+		spi_flash_munmap(handle);
+		return res;
+	}
+	sprite->mmap   = handle;
+	sprite->mapped = true;
+	return ESP_OK;
+}
+
+void driver_framebuffer_sprite_close(sprite_t* sprite)
+{
+	if (sprite->mapped) spi_flash_munmap(sprite->mmap);
+	memset(sprite, 0, sizeof(sprite_t));
+}
+
+esp_err_t driver_framebuffer_sprite_draw(Window* window, int16_t x, int16_t y, const sprite_t* sprite, uint16_t frame)
+{
+	framebuffer_lock_t lock;
+	if (!sprite->data || (frame >= sprite->frames)) return ESP_ERR_INVALID_ARG;
+	if ((x <= -sprite->width) || (y <= -sprite->height)) return ESP_OK; //Not visible
+	if (sprite->flags & SPRITE_FLAG_RLE) return _sprite_draw_rle(window, x, y, sprite, frame);
+	return _sprite_draw_raw(window, x, y, sprite, frame);
+}
+
+#endif /* CONFIG_DRIVER_FRAMEBUFFER_ENABLE */
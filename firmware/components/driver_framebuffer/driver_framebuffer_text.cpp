@@ -3,6 +3,14 @@
  * Uses parts of the Adafruit GFX Arduino libray
  */
 
+/* TEST (from this directory, host/ stands in for ESP-IDF):
+ * gcc -o fb_text_test -DDRIVER_FRAMEBUFFER_TEXT_TEST -Wall -g -I host -I png \
+ *     $(find ../driver_display_* ../driver_io_disobey_samd -maxdepth 1 -name include -printf '-I %p ') \
+ *     $(find . host png fonts -maxdepth 1 -name '*.c*') -lstdc++ -lm
+ *
+ * Add -DCONFIG_DRIVER_FRAMEBUFFER_GLYPH_CACHE=0 to test without the cache, or a small amount of entries to test evicting them
+ */
+
 /*
 This is the core graphics library for all our displays, providing a common
 set of graphics primitives (points, lines, circles, etc.).  It needs to be
@@ -38,6 +46,8 @@ POSSIBILITY OF SUCH DAMAGE.
 
 #include "include/driver_framebuffer_internal.h"
 
+#include <math.h>
+
 #include "esp_heap_caps.h"
 #include "esp_log.h"
 
@@ -106,9 +116,113 @@ const GFXfont* fontPointers[] = {
 	&Exo2_Bold_12pt7b,
 };
 
+/* Glyph runs */
+
+typedef struct glyph_run_t {
+	uint8_t x, y;          // Position of the run in the glyph bitmap
+	uint8_t width, height; // Size of the run, equal runs on consecutive rows are merged into one
+} glyph_run_t;
+
+#if CONFIG_DRIVER_FRAMEBUFFER_GLYPH_CACHE > 0
+typedef struct glyph_cache_entry_t {
+	const GFXfont* font;     // Font of the glyph, NULL for an unused entry
+	uint16_t       glyph;    // Index of the glyph in the font
+	uint16_t       count;    // Amount of runs
+	glyph_run_t*   runs;     // Runs of set pixels
+	uint32_t       lastUsed; // Value of glyphCacheClock when the entry was last used
+} glyph_cache_entry_t;
+
+glyph_cache_entry_t glyphCache[CONFIG_DRIVER_FRAMEBUFFER_GLYPH_CACHE];
+uint32_t glyphCacheClock = 0;
+#endif
+
 /* Private functions */
+
+#define GLYPH_BIT(bitmap, bit) ((bitmap)[(bit) >> 3] & (0x80 >> ((bit) & 7)))
+
+// Splits a glyph bitmap into horizontal runs of set pixels, merging runs that continue on the next row
+bool _glyph_decode(const GFXfont* font, const GFXglyph* glyph, glyph_run_t** runs, uint16_t* count)
+{
+	const uint8_t* bitmap = font->bitmap + glyph->bitmapOffset;
+	uint32_t pixels = glyph->width * glyph->height;
+
+	//Every run starts at a set pixel following a cleared pixel, merging can only make less of them
+	uint32_t maxRuns = 0;
+	for (uint32_t bit = 0; bit < pixels; bit++) {
+		if (GLYPH_BIT(bitmap, bit) && (((bit % glyph->width) == 0) || !GLYPH_BIT(bitmap, bit - 1))) maxRuns++;
+	}
+	*runs = NULL;
+	*count = 0;
+	if (maxRuns == 0) return true;
+	if (maxRuns > UINT16_MAX) return false;
+	*runs = (glyph_run_t*) malloc(maxRuns * sizeof(glyph_run_t));
+	if (!*runs) return false;
+
+	//Runs that ended on the previous row and runs on the current row, both ordered from left to right
+	uint16_t open[128], next[128];
+	uint8_t openCount = 0, nextCount = 0;
+	uint32_t bit = 0;
+	for (uint8_t y = 0; y < glyph->height; y++) {
+		uint8_t match = 0;
+		nextCount = 0;
+		for (uint8_t x = 0; x < glyph->width;) {
+			if (!GLYPH_BIT(bitmap, bit)) { x++; bit++; continue; }
+			uint8_t start = x;
+			while ((x < glyph->width) && GLYPH_BIT(bitmap, bit)) { x++; bit++; }
+			uint8_t width = x - start;
+			while ((match < openCount) && ((*runs)[open[match]].x < start)) match++;
+			if ((match < openCount) && ((*runs)[open[match]].x == start) && ((*runs)[open[match]].width == width)) {
+				(*runs)[open[match]].height++;
+				next[nextCount++] = open[match++];
+			} else {
+				glyph_run_t* run = &(*runs)[*count];
+				run->x = start; run->y = y; run->width = width; run->height = 1;
+				next[nextCount++] = (*count)++;
+			}
+		}
+		memcpy(open, next, nextCount * sizeof(uint16_t));
+		openCount = nextCount;
+	}
+
+	glyph_run_t* shrunk = (glyph_run_t*) realloc(*runs, *count * sizeof(glyph_run_t));
+	if (shrunk) *runs = shrunk;
+	return true;
+}
+
+#if CONFIG_DRIVER_FRAMEBUFFER_GLYPH_CACHE > 0
+// Finds the runs of a glyph in the cache, decoding the glyph in place of the least recently used entry when missing
+bool _glyph_cache_lookup(const GFXfont* font, uint16_t index, const glyph_run_t** runs, uint16_t* count)
+{
+	glyphCacheClock++;
+	glyph_cache_entry_t* victim = &glyphCache[0];
+	for (uint16_t i = 0; i < CONFIG_DRIVER_FRAMEBUFFER_GLYPH_CACHE; i++) {
+		glyph_cache_entry_t* entry = &glyphCache[i];
+		if ((entry->font == font) && (entry->glyph == index)) {
+			entry->lastUsed = glyphCacheClock;
+			*runs  = entry->runs;
+			*count = entry->count;
+			return true;
+		}
+		if (entry->lastUsed < victim->lastUsed) victim = entry;
+	}
+
+	if (victim->runs) free(victim->runs);
+	victim->font = NULL;
+	victim->runs = NULL;
+	glyph_run_t* decoded;
+	if (!_glyph_decode(font, font->glyph + index, &decoded, count)) return false;
+	victim->font     = font;
+	victim->glyph    = index;
+	victim->count    = *count;
+	victim->runs     = decoded;
+	victim->lastUsed = glyphCacheClock;
+	*runs = decoded;
+	return true;
+}
+#endif
+
 // Draws a character to the screen
-void _print_char(Window* window, unsigned char c, int16_t x0, int16_t y0, uint8_t xScale, uint8_t yScale, uint32_t color, const GFXfont *font)
+void _print_char(Window* window, unsigned char c, int16_t x0, int16_t y0, uint8_t xScale, uint8_t yScale, uint32_t color, uint8_t alpha, const GFXfont *font)
 {
 	if ((c < font->first) || (c > font->last)) {
 		ESP_LOGE(TAG, "print_char called with unprintable character");
@@ -116,33 +230,34 @@ void _print_char(Window* window, unsigned char c, int16_t x0, int16_t y0, uint8_
 	}
 
 	c -= (uint8_t) font->first;
-	const GFXglyph *glyph   = font->glyph + c;
-	const uint8_t  *bitmap  = font->bitmap;
-
-	uint16_t bitmapOffset = glyph->bitmapOffset;
-	uint8_t  width        = glyph->width;
-	uint8_t  height       = glyph->height;
-	int8_t   xOffset      = glyph->xOffset;
-	int8_t   yOffset      = glyph->yOffset;
+	const GFXglyph *glyph = font->glyph + c;
+	const glyph_run_t* runs;
+	uint16_t count;
+	#if CONFIG_DRIVER_FRAMEBUFFER_GLYPH_CACHE > 0
+		bool decoded = _glyph_cache_lookup(font, c, &runs, &count);
+	#else
+		glyph_run_t* uncached;
+		bool decoded = _glyph_decode(font, glyph, &uncached, &count);
+		runs = uncached;
+	#endif
+	if (!decoded) {
+		ESP_LOGE(TAG, "print_char out of memory");
+		return;
+	}
 
-	uint8_t  bit = 0, bits = 0;
-	for (uint8_t y = 0; y < height; y++) {
-		for (uint8_t x = 0; x < width; x++) {
-			if(!(bit++ & 7)) bits = bitmap[bitmapOffset++];
-			if(bits & 0x80) {
-				if (xScale == 1 && yScale == 1) {
-					driver_framebuffer_setPixel(window, x0+xOffset+x, y0+yOffset+y-1, color);
-				} else {
-					driver_framebuffer_rect(window, x0+(xOffset+x)*xScale, y0+(yOffset+y)*yScale-1, xScale, yScale, true, color);
-				}
-			}
-			bits <<= 1;
-		}
+	x0 += glyph->xOffset * xScale;
+	y0 += glyph->yOffset * yScale - 1;
+	for (uint16_t i = 0; i < count; i++) {
+		driver_framebuffer_blend_rect(window, x0 + runs[i].x * xScale, y0 + runs[i].y * yScale, runs[i].width * xScale, runs[i].height * yScale, color, alpha);
 	}
+
+	#if CONFIG_DRIVER_FRAMEBUFFER_GLYPH_CACHE == 0
+		free(uncached);
+	#endif
 }
 
 // Draws a string to the screen
-void _write(Window* window, uint8_t c, int16_t x0, int16_t *x, int16_t *y, uint8_t xScale, uint8_t yScale, uint32_t color, const GFXfont *font)
+void _write(Window* window, uint8_t c, int16_t x0, int16_t *x, int16_t *y, uint8_t xScale, uint8_t yScale, uint32_t color, uint8_t alpha, const GFXfont *font)
 {
 	if (font == NULL) { ESP_LOGE(TAG, "write called without font"); return; }
 	const GFXglyph *glyph = font->glyph + c - (uint8_t) font->first;
@@ -150,14 +265,14 @@ void _write(Window* window, uint8_t c, int16_t x0, int16_t *x, int16_t *y, uint8
 		*x = x0;
 		*y += font->yAdvance * yScale;
 	} else if (c != '\r') {
-		_print_char(window, c, *x, *y+(font->yAdvance*yScale), xScale, yScale, color, font);
+		_print_char(window, c, *x, *y+(font->yAdvance*yScale), xScale, yScale, color, alpha, font);
 		*x += glyph->xAdvance * xScale;
 	}
 }
 
 #ifdef CONFIG_G_NEW_TEXT
 // Maps a character directly onto a texture
-void _print_char_texture(texture_2d* __restrict__ texture, unsigned char c, int16_t x0, int16_t y0, uint8_t xScale, uint8_t yScale, uint32_t color, const GFXfont *font)
+void _print_char_texture(texture_2d* __restrict__ texture, unsigned char c, int16_t x0, int16_t y0, uint8_t xScale, uint8_t yScale, uint32_t color, uint8_t alpha, const GFXfont *font)
 {
 	if ((c < font->first) || (c > font->last)) {
 		ESP_LOGE(TAG, "print_char_texture called with unprintable character");
@@ -183,7 +298,7 @@ void _print_char_texture(texture_2d* __restrict__ texture, unsigned char c, int1
 					int resX = x0+xOffset+x;
 					int resY = y0+yOffset+y-1;
 					if (resX >= 0 && resX < texture->width && resY >= 0 && resY < texture->height) {
-						texture->buffer[resX + resY * texture->width] = color | 0xff000000;
+						texture->buffer[resX + resY * texture->width] = color | (alpha << 24);
 					}
 				} else {
 					int startX = x0+(xOffset+x)*xScale;
@@ -191,7 +306,7 @@ void _print_char_texture(texture_2d* __restrict__ texture, unsigned char c, int1
 					for (int resY = startY; resY < startY + yScale; resY++) {
 						for (int resX = startX; resX < startX + xScale; resX++) {
 							if (resX >= 0 && resX < texture->width && resY >= 0 && resY < texture->height) {
-								texture->buffer[resX + resY * texture->width] = color | 0xff000000;
+								texture->buffer[resX + resY * texture->width] = color | (alpha << 24);
 							}
 						}
 					}
@@ -203,7 +318,7 @@ void _print_char_texture(texture_2d* __restrict__ texture, unsigned char c, int1
 }
 
 //Maps a string to a texture
-void _write_texture(texture_2d* __restrict__ texture, uint8_t c, int16_t x0, int16_t *x, int16_t *y, uint8_t xScale, uint8_t yScale, uint32_t color, const GFXfont *font)
+void _write_texture(texture_2d* __restrict__ texture, uint8_t c, int16_t x0, int16_t *x, int16_t *y, uint8_t xScale, uint8_t yScale, uint32_t color, uint8_t alpha, const GFXfont *font)
 {
 	if (font == NULL) { ESP_LOGE(TAG, "write_texture called without font"); return; }
 	const GFXglyph *glyph = font->glyph + c - (uint8_t) font->first;
@@ -211,7 +326,7 @@ void _write_texture(texture_2d* __restrict__ texture, uint8_t c, int16_t x0, int
 		*x = x0;
 		*y += font->yAdvance * yScale;
 	} else if (c != '\r') {
-		_print_char_texture(texture, c, *x, *y+(font->yAdvance*yScale), xScale, yScale, color, font);
+		_print_char_texture(texture, c, *x, *y+(font->yAdvance*yScale), xScale, yScale, color, alpha, font);
 		*x += glyph->xAdvance * xScale;
 	}
 }
@@ -246,6 +361,13 @@ const GFXfont* driver_framebuffer_findFontByName(const char* fontName)
 
 uint16_t driver_framebuffer_print(Window* window, const char* str, int16_t x0, int16_t y0, uint8_t xScale, uint8_t yScale, uint32_t color, const GFXfont *font)
 {
+	return driver_framebuffer_print_blend(window, str, x0, y0, xScale, yScale, color, 255, font);
+}
+
+uint16_t driver_framebuffer_print_blend(Window* window, const char* str, int16_t x0, int16_t y0, uint8_t xScale, uint8_t yScale, uint32_t color, uint8_t alpha, const GFXfont *font)
+{
+	framebuffer_lock_t lock;
+	if (alpha == 0) return y0;
 	matrix_stack_2d *stack;
 	if (window == NULL) {
 		stack = &stack_2d_global;
@@ -258,13 +380,16 @@ uint16_t driver_framebuffer_print(Window* window, const char* str, int16_t x0, i
 	int16_t x;
 	int16_t y;
 	#ifdef CONFIG_G_NEW_TEXT
-	if (matrix_2d_is_identity(stack->current)) {
+	if (stack->translateOnly) {
+		// A translation moves the text by whole pixels
+		x0 += (int16_t) lroundf(stack->current.var.a2);
+		y0 += (int16_t) lroundf(stack->current.var.b2);
 	#endif
 		x = x0;
 		y = y0;
 		// We can run the non-matrix code if the matrix is (effectively) identity
-		for (uint16_t i = 0; i < strlen(str); i++) {
-			_write(window, str[i], x0, &x, &y, xScale, yScale, color, font);
+		for (uint16_t i = 0; str[i] != '\0'; i++) {
+			_write(window, str[i], x0, &x, &y, xScale, yScale, color, alpha, font);
 		}
 	#ifdef CONFIG_G_NEW_TEXT
 	}
@@ -288,23 +413,22 @@ uint16_t driver_framebuffer_print(Window* window, const char* str, int16_t x0, i
 		// Map the text onto the texture
 		x = 0;
 		y = 0;
-		for (uint16_t i = 0; i < strlen(str); i++) {
-			_write_texture(texture, str[i], x0, &x, &y, xScale, yScale, color, font);
+		for (uint16_t i = 0; str[i] != '\0'; i++) {
+			_write_texture(texture, str[i], x0, &x, &y, xScale, yScale, color, alpha, font);
 		}
 		
 		// Draw using textured triangles
-		float tx0 = x0;
-		float ty0 = y0;
-		float tx1 = x0 + textWidth;
-		float ty1 = y0;
-		float tx2 = x0 + textWidth;
-		float ty2 = y0 + textHeight;
-		float tx3 = x0;
-		float ty3 = y0 + textHeight;
-		matrix_2d_transform_point(stack->current, &tx0, &ty0);
-		matrix_2d_transform_point(stack->current, &tx1, &ty1);
-		matrix_2d_transform_point(stack->current, &tx2, &ty2);
-		matrix_2d_transform_point(stack->current, &tx3, &ty3);
+		float corners[8] = {
+			(float) x0, (float) y0,
+			(float) (x0 + textWidth), (float) y0,
+			(float) (x0 + textWidth), (float) (y0 + textHeight),
+			(float) x0, (float) (y0 + textHeight)
+		};
+		matrix_stack_2d_transform_points(stack, corners, 4);
+		float tx0 = corners[0], ty0 = corners[1];
+		float tx1 = corners[2], ty1 = corners[3];
+		float tx2 = corners[4], ty2 = corners[5];
+		float tx3 = corners[6], ty3 = corners[7];
 		triangle_uv uv0 = {
 			.u0 = 0,
 			.v0 = 0,
@@ -335,9 +459,10 @@ uint16_t driver_framebuffer_print(Window* window, const char* str, int16_t x0, i
 
 uint16_t driver_framebuffer_print_len(Window* window, const char* str, int16_t len, int16_t x0, int16_t y0, uint8_t xScale, uint8_t yScale, uint32_t color, const GFXfont *font)
 {
+	framebuffer_lock_t lock;
 	int16_t x = x0, y = y0;
 	for (uint16_t i = 0; i < len; i++) {
-		_write(window, str[i], x0, &x, &y, xScale, yScale, color, font);
+		_write(window, str[i], x0, &x, &y, xScale, yScale, color, 255, font);
 	}
 	return y;
 }
@@ -346,7 +471,7 @@ uint16_t driver_framebuffer_get_string_width(const char* str, const GFXfont *fon
 {
 	uint16_t width = 0;
 	uint16_t maxWidth = 0;
-	for (uint16_t i = 0; i < strlen(str); i++) {
+	for (uint16_t i = 0; str[i] != '\0'; i++) {
 		if (str[i] == '\n') {
 			if (maxWidth < width) maxWidth = width;
 			width = 0;
@@ -361,11 +486,123 @@ uint16_t driver_framebuffer_get_string_width(const char* str, const GFXfont *fon
 uint16_t driver_framebuffer_get_string_height(const char* str, const GFXfont *font)
 {
 	uint16_t height = font->yAdvance;
-	if (strlen(str) < 1) return 0;
-	for (uint16_t i = 0; i < strlen(str)-1; i++) {
+	if (str[0] == '\0') return 0;
+	for (uint16_t i = 0; str[i+1] != '\0'; i++) {
 		if (str[i]=='\n') height += font->yAdvance;
 	}
 	return height;
 }
 
 #endif
+
+#ifdef DRIVER_FRAMEBUFFER_TEXT_TEST
+#include <assert.h>
+#include <stdio.h>
+
+#define TEST_SIZE 200
+
+/* the bit walk that drew characters before they were split into runs */
+static void print_char_reference(Window* window, unsigned char c, int16_t x0, int16_t y0, uint8_t xScale, uint8_t yScale, uint32_t color, const GFXfont *font)
+{
+	c -= (uint8_t) font->first;
+	const GFXglyph *glyph   = font->glyph + c;
+	const uint8_t  *bitmap  = font->bitmap;
+
+	uint16_t bitmapOffset = glyph->bitmapOffset;
+	uint8_t  width        = glyph->width;
+	uint8_t  height       = glyph->height;
+	int8_t   xOffset      = glyph->xOffset;
+	int8_t   yOffset      = glyph->yOffset;
+
+	uint8_t  bit = 0, bits = 0;
+	for (uint8_t y = 0; y < height; y++) {
+		for (uint8_t x = 0; x < width; x++) {
+			if(!(bit++ & 7)) bits = bitmap[bitmapOffset++];
+			if(bits & 0x80) {
+				if (xScale == 1 && yScale == 1) {
+					driver_framebuffer_setPixel(window, x0+xOffset+x, y0+yOffset+y-1, color);
+				} else {
+					driver_framebuffer_fill_rect(window, x0+(xOffset+x)*xScale, y0+(yOffset+y)*yScale-1, xScale, yScale, color);
+				}
+			}
+			bits <<= 1;
+		}
+	}
+}
+
+/* the runs of a glyph cover every set pixel of its bitmap exactly once and no other pixels */
+static void do_test_runs(const GFXfont* font, uint16_t index, const glyph_run_t* runs, uint16_t count)
+{
+	const GFXglyph* glyph = font->glyph + index;
+	static uint8_t covered[256 * 256];
+	memset(covered, 0, glyph->width * glyph->height);
+	for (uint16_t i = 0; i < count; i++) {
+		assert((runs[i].width > 0) && (runs[i].height > 0));
+		assert((runs[i].x + runs[i].width <= glyph->width) && (runs[i].y + runs[i].height <= glyph->height));
+		for (uint8_t y = runs[i].y; y < runs[i].y + runs[i].height; y++) {
+			for (uint8_t x = runs[i].x; x < runs[i].x + runs[i].width; x++) covered[y * glyph->width + x]++;
+		}
+	}
+	const uint8_t* bitmap = font->bitmap + glyph->bitmapOffset;
+	for (uint32_t bit = 0; bit < (uint32_t) glyph->width * glyph->height; bit++) {
+		assert(covered[bit] == (GLYPH_BIT(bitmap, bit) ? 1 : 0));
+	}
+}
+
+static void do_test_font(const char* name, const GFXfont* font, Window* runs, Window* reference)
+{
+	uint32_t size = driver_framebuffer_format_size(FB_FORMAT_8BPP, TEST_SIZE, TEST_SIZE);
+	uint32_t totalRuns = 0, totalPixels = 0;
+	for (uint16_t c = font->first; c <= font->last; c++) {
+		uint16_t index = c - font->first;
+		const GFXglyph* glyph = font->glyph + index;
+		glyph_run_t* decoded;
+		uint16_t count;
+		assert(_glyph_decode(font, glyph, &decoded, &count));
+		do_test_runs(font, index, decoded, count);
+		totalRuns += count;
+		totalPixels += glyph->width * glyph->height;
+
+		#if CONFIG_DRIVER_FRAMEBUFFER_GLYPH_CACHE > 0
+		//The cache hands out the same runs, whether they were decoded just now or earlier
+		const glyph_run_t* cached;
+		uint16_t cachedCount;
+		assert(_glyph_cache_lookup(font, index, &cached, &cachedCount));
+		assert((cachedCount == count) && ((count == 0) || (memcmp(cached, decoded, count * sizeof(glyph_run_t)) == 0)));
+		const glyph_run_t* again;
+		assert(_glyph_cache_lookup(font, index, &again, &cachedCount) && (again == cached));
+		#endif
+		free(decoded);
+
+		//Drawn at several scales, partly outside of the window as well
+		static const struct { int16_t x, y; uint8_t xScale, yScale; } draws[] = {{10, 10, 1, 1}, {-3, 5, 1, 1}, {20, 0, 2, 3}, {TEST_SIZE - 30, TEST_SIZE - 80, 3, 2}};
+		for (uint8_t i = 0; i < sizeof(draws) / sizeof(draws[0]); i++) {
+			memset(runs->buffer, 0, size);
+			memset(reference->buffer, 0, size);
+			_print_char(runs, c, draws[i].x, draws[i].y + font->yAdvance, draws[i].xScale, draws[i].yScale, 0xFFFFFF, 255, font);
+			print_char_reference(reference, c, draws[i].x, draws[i].y + font->yAdvance, draws[i].xScale, draws[i].yScale, 0xFFFFFF, font);
+			if (memcmp(runs->buffer, reference->buffer, size) != 0) {
+				fprintf(stderr, "%s: character %u at scale %u x %u differs\n", name, c, draws[i].xScale, draws[i].yScale);
+				assert(false);
+			}
+		}
+	}
+	printf("%-22s %5u runs for %6u bitmap pixels\n", name, totalRuns, totalPixels);
+}
+
+int main(void)
+{
+	Window* runs      = driver_framebuffer_window_create_format("runs",      TEST_SIZE, TEST_SIZE, FB_FORMAT_8BPP);
+	Window* reference = driver_framebuffer_window_create_format("reference", TEST_SIZE, TEST_SIZE, FB_FORMAT_8BPP);
+	assert(runs && reference);
+	for (uint8_t i = 0; fontNames[i] != NULL; i++) {
+		assert(driver_framebuffer_findFontByName(fontNames[i]) == fontPointers[i]);
+		do_test_font(fontNames[i], fontPointers[i], runs, reference);
+	}
+	driver_framebuffer_window_remove(runs);
+	driver_framebuffer_window_remove(reference);
+	printf("OK\n");
+	return 0;
+}
+
+#endif // DRIVER_FRAMEBUFFER_TEXT_TEST
@@ -58,8 +58,17 @@ inline void _remove_window_from_linked_list(Window* window)
 
 Window* driver_framebuffer_window_create(const char* name, uint16_t width, uint16_t height)
 {
+	return driver_framebuffer_window_create_format(name, width, height, FB_FORMAT_NATIVE);
+}
+
+Window* driver_framebuffer_window_create_format(const char* name, uint16_t width, uint16_t height, pixel_format_t format)
+{
+	framebuffer_lock_t lock;
 	if (driver_framebuffer_window_find(name)) return NULL; //If the window already exists do nothing and return.
+	const pixel_ops_t* pixelOps = driver_framebuffer_format_ops(format);
+	if (!pixelOps) return NULL; //Unknown pixel format
 	Window* window = _create_window();
+	if (!window) return NULL;
 	
 	/* Set properties */
 	window->name                   = strdup(name);
@@ -77,10 +86,12 @@ Window* driver_framebuffer_window_create(const char* name, uint16_t width, uint1
 	window->drawHeight             = height;
 	
 	/* Buffer */
+	window->format                 = pixelOps->format;
+	window->pixelOps               = pixelOps;
 	#ifdef CONFIG_DRIVER_FRAMEBUFFER_SPIRAM
-		window->buffer = (uint8_t*) heap_caps_malloc(((width*height*PIXEL_SIZE)/8)+1, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+		window->buffer = (uint8_t*) heap_caps_malloc(driver_framebuffer_format_size(format, width, height), MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
 	#else
-		window->buffer = (uint8_t*) heap_caps_malloc(((width*height*PIXEL_SIZE)/8)+1, MALLOC_CAP_8BIT);
+		window->buffer = (uint8_t*) heap_caps_malloc(driver_framebuffer_format_size(format, width, height), MALLOC_CAP_8BIT);
 	#endif
 	
 	#ifdef CONFIG_G_MATRIX_ENABLE
@@ -98,6 +109,8 @@ Window* driver_framebuffer_window_create(const char* name, uint16_t width, uint1
 
 void driver_framebuffer_window_remove(Window* window)
 {
+	driver_framebuffer_animation_stop_window(window); //Before taking the lock, the player needs it to finish
+	framebuffer_lock_t lock;
 	if (window->buffer) free(window->buffer);
 	#ifdef CONFIG_G_MATRIX_ENABLE
 	if (window->is_3d) {
@@ -163,6 +176,7 @@ bool driver_framebuffer_window_rename(Window* window, const char* newName) {
 
 void driver_framebuffer_window_focus(Window* window)
 {
+	framebuffer_lock_t lock;
 	_remove_window_from_linked_list(window);
 	if (windows == window) windows = window->_nextWindow;
 	window->_prevWindow = driver_framebuffer_window_last();
@@ -170,6 +184,26 @@ void driver_framebuffer_window_focus(Window* window)
 	window->_nextWindow = NULL;
 }
 
+void driver_framebuffer_window_move(Window* window, int16_t x, int16_t y)
+{
+	framebuffer_lock_t lock; //Windows are rendered while flushing, possibly from another task
+	window->x = x;
+	window->y = y;
+}
+
+void driver_framebuffer_window_set_visible(Window* window, bool visible)
+{
+	framebuffer_lock_t lock;
+	window->visible = visible;
+}
+
+void driver_framebuffer_window_set_transparency(Window* window, bool enable, uint32_t color)
+{
+	framebuffer_lock_t lock;
+	window->enableTransparentColor = enable;
+	window->transparentColor = color;
+}
+
 void driver_framebuffer_window_getSize(Window* window, int16_t* width, int16_t* height)
 {
 	if (window == NULL) {
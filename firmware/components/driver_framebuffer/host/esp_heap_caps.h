@@ -0,0 +1,8 @@
+#pragma once
+
+#include <stdlib.h>
+
+#define MALLOC_CAP_8BIT   (1 << 2)
+#define MALLOC_CAP_SPIRAM (1 << 10)
+
+#define heap_caps_malloc(size, caps) malloc(size)
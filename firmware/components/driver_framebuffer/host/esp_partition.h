@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+
+#define SPI_FLASH_SEC_SIZE  4096
+#define SPI_FLASH_MMAP_DATA 0
+
+typedef int spi_flash_mmap_handle_t;
+typedef int spi_flash_mmap_memory_t;
+
+typedef struct esp_partition_t {
+	uint32_t address;
+	uint32_t size;
+} esp_partition_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* There is no flash on the host, reading and mapping fail */
+esp_err_t esp_partition_read(const esp_partition_t* partition, size_t src_offset, void* dst, size_t size);
+esp_err_t esp_partition_mmap(const esp_partition_t* partition, size_t offset, size_t size, spi_flash_mmap_memory_t memory, const void** out_ptr, spi_flash_mmap_handle_t* out_handle);
+void spi_flash_munmap(spi_flash_mmap_handle_t handle);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,14 @@
+#pragma once
+
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Newlib has it in string.h, glibc does not */
+char* strlwr(char* s);
+
+#ifdef __cplusplus
+}
+#endif
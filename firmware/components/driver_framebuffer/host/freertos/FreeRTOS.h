@@ -0,0 +1,19 @@
+#pragma once
+
+#include <stdint.h>
+
+typedef void* SemaphoreHandle_t;
+typedef void* QueueHandle_t;
+typedef void* TaskHandle_t;
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+
+#define portMAX_DELAY      ((TickType_t) 0xffffffff)
+#define portNUM_PROCESSORS 2
+#define pdFALSE            0
+#define pdTRUE             1
+#define pdFAIL             pdFALSE
+#define pdPASS             pdTRUE
+#define tskIDLE_PRIORITY   0
+#define pdMS_TO_TICKS(ms)  ((TickType_t) (ms))
@@ -0,0 +1,168 @@
+/*
+ * ESP-IDF and FreeRTOS for the tests of the framebuffer driver, running as a single task
+ * on a computer. Semaphores count, taking one that is not available fails instead of
+ * blocking. Tasks are not created, the driver then does the work itself.
+ */
+
+#include <time.h>
+#include <ctype.h>
+#include <stdlib.h>
+
+#include "sdkconfig.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "esp_partition.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "freertos/queue.h"
+#include "rom/crc.h"
+#include "driver_ili9341.h"
+
+#define HOST_TASK ((TaskHandle_t) 1)
+
+typedef struct {
+	bool         recursive;
+	unsigned int count;
+	TaskHandle_t holder;
+} host_semaphore_t;
+
+/* ESP-IDF */
+
+char* strlwr(char* s)
+{
+	for (char* c = s; *c; c++) *c = tolower((unsigned char) *c);
+	return s;
+}
+
+int64_t esp_timer_get_time(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (int64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t* partition, size_t src_offset, void* dst, size_t size)
+{
+	return ESP_FAIL;
+}
+
+esp_err_t esp_partition_mmap(const esp_partition_t* partition, size_t offset, size_t size, spi_flash_mmap_memory_t memory, const void** out_ptr, spi_flash_mmap_handle_t* out_handle)
+{
+	return ESP_FAIL;
+}
+
+void spi_flash_munmap(spi_flash_mmap_handle_t handle)
+{
+}
+
+uint32_t crc32_le(uint32_t crc, const uint8_t* buf, uint32_t len)
+{
+	crc = ~crc;
+	while (len--) {
+		crc ^= *buf++;
+		for (int bit = 0; bit < 8; bit++) crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+	}
+	return ~crc;
+}
+
+/* FreeRTOS */
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t task, const char* name, uint32_t stack, void* arg, UBaseType_t priority, TaskHandle_t* handle, BaseType_t core)
+{
+	return pdFAIL;
+}
+
+void vTaskDelete(TaskHandle_t task)
+{
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+	return HOST_TASK;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t timeout)
+{
+	return 0;
+}
+
+void xTaskNotifyGive(TaskHandle_t task)
+{
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void)
+{
+	return (SemaphoreHandle_t) calloc(1, sizeof(host_semaphore_t));
+}
+
+SemaphoreHandle_t xSemaphoreCreateRecursiveMutex(void)
+{
+	host_semaphore_t* mutex = (host_semaphore_t*) calloc(1, sizeof(host_semaphore_t));
+	if (mutex) mutex->recursive = true;
+	return (SemaphoreHandle_t) mutex;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t timeout)
+{
+	host_semaphore_t* sem = (host_semaphore_t*) semaphore;
+	if (sem->count == 0) return pdFALSE;
+	sem->count--;
+	return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore)
+{
+	host_semaphore_t* sem = (host_semaphore_t*) semaphore;
+	if (sem->count > 0) return pdFALSE; //Binary semaphore
+	sem->count++;
+	return pdTRUE;
+}
+
+BaseType_t xSemaphoreTakeRecursive(SemaphoreHandle_t mutex, TickType_t timeout)
+{
+	host_semaphore_t* sem = (host_semaphore_t*) mutex;
+	sem->count++;
+	sem->holder = HOST_TASK;
+	return pdTRUE;
+}
+
+BaseType_t xSemaphoreGiveRecursive(SemaphoreHandle_t mutex)
+{
+	host_semaphore_t* sem = (host_semaphore_t*) mutex;
+	if (sem->count == 0) return pdFALSE;
+	if (--sem->count == 0) sem->holder = NULL;
+	return pdTRUE;
+}
+
+TaskHandle_t xSemaphoreGetMutexHolder(SemaphoreHandle_t mutex)
+{
+	return ((host_semaphore_t*) mutex)->holder;
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t size)
+{
+	return NULL;
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void* item, TickType_t timeout)
+{
+	return pdFAIL;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void* item, TickType_t timeout)
+{
+	return pdFAIL;
+}
+
+/* Display, the framebuffer is flushed nowhere */
+
+esp_err_t driver_ili9341_write_partial(const uint8_t *buffer, uint16_t x0, uint16_t y0, uint16_t x1, uint16_t y1)
+{
+	return ESP_OK;
+}
+
+esp_err_t driver_ili9341_set_backlight(uint8_t brightness)
+{
+	return ESP_OK;
+}
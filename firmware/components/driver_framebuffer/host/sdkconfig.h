@@ -0,0 +1,43 @@
+/*
+ * Configuration for building the framebuffer driver on a computer, used by the tests
+ * at the top of the source files (see TEST: in their header comments). The headers in
+ * this directory stand in for ESP-IDF and FreeRTOS, host.cpp implements them for a
+ * single task.
+ *
+ * The framebuffer is that of the ILI9341 (320x240, 16-bit color), other pixel formats
+ * are reached through windows. Numbers can be changed with -D on the command line.
+ */
+
+#pragma once
+
+#define CONFIG_DRIVER_FRAMEBUFFER_ENABLE 1
+#define CONFIG_DRIVER_ILI9341_ENABLE 1
+
+#ifndef CONFIG_DRIVER_FRAMEBUFFER_DIRTY_REGIONS
+#define CONFIG_DRIVER_FRAMEBUFFER_DIRTY_REGIONS 4
+#endif
+#ifndef CONFIG_DRIVER_FRAMEBUFFER_GLYPH_CACHE
+#define CONFIG_DRIVER_FRAMEBUFFER_GLYPH_CACHE 96
+#endif
+#ifndef CONFIG_DRIVER_FRAMEBUFFER_IMAGE_CACHE
+#define CONFIG_DRIVER_FRAMEBUFFER_IMAGE_CACHE 0
+#endif
+#ifndef CONFIG_DRIVER_FRAMEBUFFER_IMAGE_CACHE_ENTRIES
+#define CONFIG_DRIVER_FRAMEBUFFER_IMAGE_CACHE_ENTRIES 16
+#endif
+
+#define CONFIG_G_MATRIX_ENABLE 1
+#ifndef CONFIG_MATRIX_STACK_SIZE
+#define CONFIG_MATRIX_STACK_SIZE 64
+#endif
+#define CONFIG_G_NEW_TRIANGLE 1
+#define CONFIG_G_NEW_CIRCLE 1
+#define CONFIG_G_NEW_QUAD 1
+#define CONFIG_G_NEW_RECT 1
+#define CONFIG_G_NEW_TEXT 1
+
+/* Triangles are drawn by the task that queues them, the host runs no other tasks */
+#define CONFIG_LIB3D_ENABLE 1
+#ifndef CONFIG_LIB3D_TRI_BUFFER_SIZE
+#define CONFIG_LIB3D_TRI_BUFFER_SIZE 64
+#endif
@@ -21,6 +21,12 @@
 #include "mem_reader.h"
 #include "file_reader.h"
 #include "png_reader.h"
+#include "qoi_reader.h"
+
+#include "driver_framebuffer_dither.h"
+#include "driver_framebuffer_image_cache.h"
+#include "driver_framebuffer_sprite.h"
+#include "driver_framebuffer_animation.h"
 
 /* Flags */
 #define FB_FLAG_FORCE          1
@@ -56,15 +62,36 @@ esp_err_t driver_framebuffer_init();
 bool driver_framebuffer_flush(uint32_t flags);
 /* Flush the framebuffer to the display */
 
+void driver_framebuffer_flush_wait();
+/* Wait until the display has received the last flushed frame (only needed when flushing asynchronously) */
+
+void driver_framebuffer_lock();
+/* Take the framebuffer for the calling task, after the 3D triangles it queued have been drawn. The drawing and flush functions take it themselves, it can be taken more than once by the same task */
+
+void driver_framebuffer_unlock();
+/* Give the framebuffer back, once for every time it was taken */
+
 void driver_framebuffer_fill(Window* window, uint32_t value);
 /* Fill the framebuffer or the provided frame with a single color */
 
 void driver_framebuffer_setPixel(Window* window, int16_t x, int16_t y, uint32_t value);
 /* Set a pixel in the framebuffer or the provided frame to a color */
 
+void driver_framebuffer_blendPixel(Window* window, int16_t x, int16_t y, uint32_t value, uint8_t alpha);
+/* Blend a color over a pixel in the framebuffer or the provided frame, alpha 0 keeps the pixel and 255 replaces it */
+
 uint32_t driver_framebuffer_getPixel(Window* window, int16_t x, int16_t y);
 /* Get the color of a pixel in the framebuffer or the provided frame */
 
+const pixel_ops_t* driver_framebuffer_get_ops(Window* window);
+/* Get the pixel operations of the framebuffer or the provided frame, used to encode values for driver_framebuffer_draw_row */
+
+void driver_framebuffer_draw_row(Window* window, int16_t x, int16_t y, const uint32_t* values, const uint8_t* alpha, int16_t count);
+/* Draw count encoded values going right from (x, y), blended with the matching alpha values when alpha is not NULL. The caller marks the area as changed */
+
+void driver_framebuffer_mark_rect(Window* window, int16_t x, int16_t y, int16_t w, int16_t h);
+/* Mark the area of the framebuffer or the provided frame covered by a rectangle as changed */
+
 uint16_t driver_framebuffer_getWidth(Window* window);
 /* Get the width of the framebuffer or the provided window */
 
@@ -74,9 +101,15 @@ uint16_t driver_framebuffer_getHeight(Window* window);
 esp_err_t driver_framebuffer_png(Window* window, int16_t x, int16_t y, lib_reader_read_t reader, void* reader_p);
 /* Draw a PNG image to the framebuffer of the provided window */
 
+esp_err_t driver_framebuffer_qoi(Window* window, int16_t x, int16_t y, lib_reader_read_t reader, void* reader_p);
+/* Draw a QOI image to the framebuffer of the provided window */
+
 void driver_framebuffer_blit(Window* source, Window* target);
 /* Blit a window to the framebuffer of another window or the main framebuffer */
 
+void driver_framebuffer_blit_key(Window* source, Window* target, const uint8_t* key);
+/* Blit a window, skipping the pixels that match the single pixel stored in key using the format of the window (NULL draws every pixel) */
+
 esp_err_t driver_framebuffer_setBacklight(uint8_t level);
 /* Set the brightness of the backlight (0-255) */
 
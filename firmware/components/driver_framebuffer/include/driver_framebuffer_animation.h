@@ -0,0 +1,83 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "esp_err.h"
+#include "driver_framebuffer_compositor.h"
+#include "reader.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Animation files hold a sequence of frames that only store the area that changed since the
+ * frame before (see spriteconvert/animconvert.py in the root of the repository), all values
+ * are little endian:
+ *
+ *  0  "FBAN"
+ *  4  uint8  version (1)
+ *  5  uint8  reserved (0)
+ *  6  uint16 number of frames
+ *  8  uint16 width
+ * 10  uint16 height
+ * 12  frames
+ *
+ * Every frame starts with a header, followed by the image data:
+ *
+ *  0  uint16 x of the changed area
+ *  2  uint16 y of the changed area
+ *  4  uint16 time in milliseconds until the next frame
+ *  6  uint16 reserved (0)
+ *  8  uint32 size of the image data
+ * 12  QOI image of the changed area, nothing (size 0) when the frame did not change
+ *
+ * The first frame covers the whole animation. Frames are opaque, they are drawn over the frame before.
+ *
+ * One animation plays at a time. The player draws into the framebuffer or a window from its own task,
+ * with ANIMATION_FLAG_FLUSH it also flushes. Like every drawing and flush function it takes the
+ * framebuffer lock for that, the application can keep drawing and flushing while it plays.
+ */
+
+#define ANIMATION_HEADER_SIZE        12
+#define ANIMATION_FRAME_HEADER_SIZE  12
+#define ANIMATION_VERSION            1
+
+#define ANIMATION_FLAG_LOOP          1 // Start over after the last frame until stopped
+#define ANIMATION_FLAG_FLUSH         2 // Send every frame to the display
+
+typedef struct animation_info_t {
+	uint16_t width, height;        // Size of the animation
+	uint16_t frames;               // Number of frames
+} animation_info_t;
+
+typedef struct animation_status_t {
+	bool playing;                  // The player is running
+	uint16_t frame;                // Last frame that was drawn
+	uint32_t shown;                // Frames that were shown
+	uint32_t dropped;              // Frames that were drawn but not sent to the display because the player was late
+} animation_status_t;
+
+esp_err_t driver_framebuffer_animation_info(lib_reader_read_t reader, void* reader_p, animation_info_t* info);
+/* Read the header of an animation */
+
+esp_err_t driver_framebuffer_animation_play(Window* window, int16_t x, int16_t y, const uint8_t* data, uint32_t size, uint16_t fps, uint8_t flags);
+/* Play an animation that is in memory (or memory mapped flash) from a background task, the data has to stay available until the animation is stopped.
+   Frames follow the timing of the file when fps is 0. Stops the animation that was playing */
+
+esp_err_t driver_framebuffer_animation_play_file(Window* window, int16_t x, int16_t y, const char* filename, uint16_t fps, uint8_t flags);
+/* Play an animation file from a background task, frames are read from the file while playing. Stops the animation that was playing */
+
+void driver_framebuffer_animation_stop();
+/* Stop the animation that is playing and wait for the player to finish, the last frame stays in the framebuffer */
+
+void driver_framebuffer_animation_stop_window(Window* window);
+/* Stop the animation when it draws into the window, before the window is removed */
+
+void driver_framebuffer_animation_status(animation_status_t* status);
+/* Get the progress of the animation that is playing or was played last */
+
+#ifdef __cplusplus
+}
+#endif
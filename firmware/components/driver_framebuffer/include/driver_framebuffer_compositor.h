@@ -7,6 +7,7 @@
 #include "esp_system.h"
 #include "driver_framebuffer_orientation_internal.h"
 #include "driver_framebuffer_matrix.h"
+#include "driver_framebuffer_format.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -30,7 +31,12 @@ typedef struct triangle_3d_buffered_t {
 typedef struct triangle_buffer_3d_t {
 	triangle_3d_buffered *triangles;   // Circular buffer of triangles.
 	int providedIndex;                 // The index of the provided triangles; more triangles can be given if (providedIndex + 1) % CONFIG_LIB3D_TRI_BUFFER_SIZE != usedIndex.
-	int usedIndex;                     // The index of the used triangles.
+	int usedIndex;                     // The index of the used triangles, only advanced once a triangle has been drawn.
+	bool producerWaiting;              // The producer sleeps until the rasterizer signals progress.
+	bool consumerWaiting;              // The rasterizer sleeps until a triangle is provided.
+	void* progress;                    // Semaphore given by the rasterizer when the producer is waiting.
+	void* consumer;                    // Task handle of the rasterizer.
+	void* producer;                    // Task handle of the task that queued the last triangle.
 } triangle_buffer_3d;
 
 typedef struct depth_buffer_3d_t {
@@ -40,6 +46,19 @@ typedef struct depth_buffer_3d_t {
     bool is_clear;
 } depth_buffer_3d;
 
+typedef struct window_render_state_t {
+	bool valid;                     // The window has been rendered using these settings
+	const struct Window_t* below;   // The window that was rendered before this window
+	int16_t x, y;                   // Position (x, y)
+	int16_t hOffset, vOffset;       // Drawing offset (x, y)
+	uint16_t drawWidth, drawHeight; // Drawing size (width, height)
+	enum Orientation orientation;   // Orientation of the window
+	enum Orientation target;        // Orientation of the framebuffer
+	bool enableTransparentColor;    // Transparency enabled
+	uint32_t transparentColor;      // Transparent color
+	int16_t area[4];                // Area covered in the framebuffer (x0, y0, x1, y1), empty if x0 > x1
+} window_render_state_t;
+
 typedef struct Window_t {
 	/* Linked list */
 	struct Window_t* _prevWindow;
@@ -60,8 +79,14 @@ typedef struct Window_t {
 	
 	/* Buffer */
 	uint8_t* buffer;
+	pixel_format_t format;          // Pixel format of the buffer
+	const pixel_ops_t* pixelOps;    // Pixel operations for the format of the buffer
 	depth_buffer_3d* depth_buffer;  // 3D depth buffer
 
+	/* Compositor */
+	bool changed;                   // The buffer changed since the window was last rendered
+	window_render_state_t rendered; // Settings used the last time the window was rendered
+
 	/* Graphics */
 	bool is_3d;
 	matrix_stack_2d* stack_2d;      // 2D matrix stack
@@ -71,7 +96,10 @@ typedef struct Window_t {
 extern matrix_stack_2d stack_2d_global;
 
 Window* driver_framebuffer_window_create(const char* name, uint16_t width, uint16_t height);
-/* Create a window */
+/* Create a window using the pixel format of the display */
+
+Window* driver_framebuffer_window_create_format(const char* name, uint16_t width, uint16_t height, pixel_format_t format);
+/* Create a window using a specific pixel format */
 
 void driver_framebuffer_window_remove(Window* window);
 /* Delete a window */
@@ -94,6 +122,15 @@ Window* driver_framebuffer_window_last();
 void driver_framebuffer_window_focus(Window* window);
 /* Move a window to the end of the list */
 
+void driver_framebuffer_window_move(Window* window, int16_t x, int16_t y);
+/* Move a window to a position on the screen */
+
+void driver_framebuffer_window_set_visible(Window* window, bool visible);
+/* Show or hide a window */
+
+void driver_framebuffer_window_set_transparency(Window* window, bool enable, uint32_t color);
+/* Enable or disable transparency of a window and set the color that is made transparent */
+
 void driver_framebuffer_window_getSize(Window* window, int16_t* width, int16_t* height);
 /* Get the width and height of a window */
 
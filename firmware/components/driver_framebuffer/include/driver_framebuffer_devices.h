@@ -57,6 +57,7 @@
 	#define FB_TYPE_1BPP
 	#define FB_1BPP_VERT2
 	#define FB_FLUSH(buffer,eink_flags,x0,y0,x1,y1) driver_ssd1306_write_part(buffer,x0,y0,x1,y1)
+	#define FB_FLUSH_REGIONS //FB_FLUSH can be called once for every dirty region
 	#define COLOR_FILL_DEFAULT 0x000000
 	#define COLOR_TEXT_DEFAULT 0xFFFFFF
 
@@ -68,6 +69,7 @@
 	#define FB_TYPE_1BPP
 	#define FB_1BPP_VERT
 	#define FB_FLUSH(buffer,eink_flags,x0,y0,x1,y1) driver_erc12864_write_part(buffer,x0,y0,x1,y1)
+	#define FB_FLUSH_REGIONS //FB_FLUSH can be called once for every dirty region
 	#ifdef CONFIG_DRIVER_DISOBEY_SAMD_ENABLE
 		#define FB_SET_BACKLIGHT(brightness) driver_disobey_samd_write_backlight(brightness)
 	#endif
@@ -86,6 +88,7 @@
 	#endif
 	#define FB_ALPHA_ENABLED
 	#define FB_FLUSH(buffer,eink_flags,x0,y0,x1,y1) driver_ili9341_write_partial(buffer, x0, y0, x1, y1)
+	#define FB_FLUSH_REGIONS //FB_FLUSH can be called once for every dirty region
 	#define FB_SET_BACKLIGHT(brightness) driver_ili9341_set_backlight(brightness)
 	#define COLOR_FILL_DEFAULT 0x000000
 	#define COLOR_TEXT_DEFAULT 0xFFFFFF
@@ -97,6 +100,7 @@
 	#define FB_HEIGHT ST7735_HEIGHT
 	#define FB_TYPE_16BPP
 	#define FB_FLUSH(buffer,eink_flags,x0,y0,x1,y1) driver_st7735_write_partial(buffer, x0, y0, x1, y1)
+	#define FB_FLUSH_REGIONS //FB_FLUSH can be called once for every dirty region
 	#define FB_SET_BACKLIGHT(brightness) driver_st7735_set_backlight(brightness > 127)
 	#define COLOR_FILL_DEFAULT 0x000000
 	#define COLOR_TEXT_DEFAULT 0xFFFFFF
@@ -112,6 +116,7 @@
 			#define FB_TYPE_16BPP
 	#endif
 	#define FB_FLUSH(buffer,eink_flags,x0,y0,x1,y1) driver_st7789v_write_partial(buffer, x0, y0, x1, y1)
+	#define FB_FLUSH_REGIONS //FB_FLUSH can be called once for every dirty region
 	#define FB_SET_BACKLIGHT(brightness) driver_st7789v_set_backlight(brightness > 127)
 	#define COLOR_FILL_DEFAULT 0x000000
 	#define COLOR_TEXT_DEFAULT 0xFFFFFF
@@ -158,6 +163,7 @@
 	#define FB_HEIGHT NOKIA6100_HEIGHT
 	#define FB_TYPE_16BPP //HACK use 12-bit color depth when this mode is ready for use
 	#define FB_FLUSH(buffer,eink_flags,x0,y0,x1,y1) driver_nokia6100_write_partial(buffer, x0, y0, x1, y1)
+	#define FB_FLUSH_REGIONS //FB_FLUSH can be called once for every dirty region
 	#define FB_SET_BACKLIGHT(brightness) driver_nokia6100_set_backlight(brightness > 127)
 	#define COLOR_FILL_DEFAULT 0x000000
 	#define COLOR_TEXT_DEFAULT 0xFFFFFF
@@ -175,6 +181,10 @@
 	#error "Framebuffer driver enabled without a target display available!"
 #endif
 
+#ifdef CONFIG_DRIVER_FRAMEBUFFER_ASYNC_FLUSH
+	#define CONFIG_DRIVER_FRAMEBUFFER_DOUBLE_BUFFERED //Draw in one buffer while the other one is sent to the display
+#endif
+
 #if defined(FB_TYPE_1BPP)
 	#define PIXEL_SIZE 1
 #elif defined(FB_TYPE_8BPP)
@@ -191,4 +201,26 @@
 	#define PIXEL_SIZE 32
 #endif
 
+#if defined(FB_TYPE_1BPP) && defined(FB_1BPP_VERT)
+	#define FB_FORMAT FB_FORMAT_1BPP_VERT
+#elif defined(FB_TYPE_1BPP) && defined(FB_1BPP_VERT2)
+	#define FB_FORMAT FB_FORMAT_1BPP_VERT2
+#elif defined(FB_TYPE_1BPP) && defined(FB_1BPP_OHS)
+	#define FB_FORMAT FB_FORMAT_1BPP_OHS
+#elif defined(FB_TYPE_1BPP)
+	#define FB_FORMAT FB_FORMAT_1BPP
+#elif defined(FB_TYPE_8BPP)
+	#define FB_FORMAT FB_FORMAT_8BPP
+#elif defined(FB_TYPE_8CBPP)
+	#define FB_FORMAT FB_FORMAT_8CBPP
+#elif defined(FB_TYPE_12BPP)
+	#define FB_FORMAT FB_FORMAT_12BPP
+#elif defined(FB_TYPE_16BPP)
+	#define FB_FORMAT FB_FORMAT_16BPP
+#elif defined(FB_TYPE_24BPP)
+	#define FB_FORMAT FB_FORMAT_24BPP
+#elif defined(FB_TYPE_32BPP)
+	#define FB_FORMAT FB_FORMAT_32BPP
+#endif
+
 #endif
@@ -14,7 +14,13 @@ void driver_framebuffer_set_dirty_area(int16_t x0, int16_t y0, int16_t x1, int16
 /* Set the dirty area, either incremental or directly by setting the force flag */
 
 void driver_framebuffer_get_dirty_area(int16_t* x0, int16_t* y0, int16_t* x1, int16_t* y1);
-/* Get the dirty area */
+/* Get the bounding box of all dirty areas */
+
+uint8_t driver_framebuffer_get_dirty_region_count();
+/* Get the amount of separate dirty areas */
+
+bool driver_framebuffer_get_dirty_region(uint8_t index, int16_t* x0, int16_t* y0, int16_t* x1, int16_t* y1);
+/* Get one of the separate dirty areas, returns false if the index is out of range */
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "driver_framebuffer_format.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Black and white and 8-bit color (3-3-2) buffers can show few of the colors that are drawn to them.
+ * With CONFIG_DRIVER_FRAMEBUFFER_DITHER the colors they can not show are dithered instead of rounded:
+ *
+ *  - Pixels, lines and shapes use a 4x4 ordered (Bayer) pattern, which only depends on the position of
+ *    a pixel in the buffer so it can be drawn in any order. Colors the format shows exactly are stored
+ *    as before, filling with them costs nothing extra.
+ *  - Decoded images (PNG, QOI, sprites in another format) are diffused row by row (Floyd-Steinberg, in
+ *    alternating directions), the error is kept in a fixed-point buffer of one row.
+ */
+
+typedef struct dither_row_t dither_row_t;
+
+bool driver_framebuffer_dither_active(const pixel_ops_t* ops);
+/* Returns true if colors drawn in the pixel format are dithered */
+
+uint32_t driver_framebuffer_dither_value(const pixel_ops_t* ops, uint32_t color, int16_t x, int16_t y);
+/* Encode a 24-bit color for buffer position (x, y) with the ordered pattern, formats that are not dithered encode it as is */
+
+bool driver_framebuffer_dither_pattern(const pixel_ops_t* ops, uint32_t color, uint32_t* pattern);
+/* Encode the 16 values of the ordered pattern for a 24-bit color, the value for buffer position (x, y) is pattern[(y & 3) * 4 + (x & 3)].
+   Returns false, without touching pattern, if the color needs no dithering */
+
+dither_row_t* driver_framebuffer_dither_new(const pixel_ops_t* ops, uint16_t width);
+/* Start diffusing the error over rows of up to width pixels, returns NULL if the format is not dithered or out of memory */
+
+void driver_framebuffer_dither_row(dither_row_t* dither, uint32_t* values, const uint8_t* alpha, uint16_t count);
+/* Replace the 24-bit colors of the next row by encoded values, pixels with alpha 0 are skipped. Rows follow each other from top to bottom */
+
+void driver_framebuffer_dither_destroy(dither_row_t* dither);
+/* Free the error buffer */
+
+#ifdef __cplusplus
+}
+#endif
@@ -8,6 +8,21 @@
 extern "C" {
 #endif
 
+void driver_framebuffer_fill_rect(Window* window, int16_t x, int16_t y, int16_t w, int16_t h, uint32_t color);
+/* Fill the area from point (x, y) to point (x+w-1, y+h-1) with a color, writing whole spans instead of single pixels */
+
+void driver_framebuffer_blend_rect(Window* window, int16_t x, int16_t y, int16_t w, int16_t h, uint32_t color, uint8_t alpha);
+/* Blend a color over the area from point (x, y) to point (x+w-1, y+h-1), alpha 0 keeps the area and 255 fills it */
+
+void driver_framebuffer_fill_rect_unmarked(Window* window, int16_t x, int16_t y, int16_t w, int16_t h, uint32_t color);
+/* Fill a rectangle like driver_framebuffer_fill_rect without marking it dirty, for callers that mark the whole area they draw at once */
+
+void driver_framebuffer_hline(Window* window, int16_t x, int16_t y, int16_t length, uint32_t color);
+/* Draw a horizontal line of length pixels starting at point (x, y) */
+
+void driver_framebuffer_vline(Window* window, int16_t x, int16_t y, int16_t length, uint32_t color);
+/* Draw a vertical line of length pixels starting at point (x, y) */
+
 void driver_framebuffer_line(Window* window, int16_t x0, int16_t y0, int16_t x1, int16_t y1, uint32_t color);
 /* Draw a line from point (x0, y0) to point (x1, y1) */
 
@@ -15,7 +30,20 @@ void driver_framebuffer_rect(Window* window, int16_t x, int16_t y, uint16_t w, u
 /* Draw a rectangle (filled or only the outline) from point (x, y) to point (x+w, y+h) */
 
 void driver_framebuffer_circle(Window* window, int16_t x0, int16_t y0, uint16_t r, uint16_t a0, uint16_t a1, bool fill, uint32_t color);
-/* Draw a circle (filled or only the outline) at center point (x0, y0) with a radius r starting at angle a0 and ending at angle a1 */
+/* Draw a circle (filled or only the outline) at center point (x0, y0) with a radius r starting at angle a0 and ending at angle a1,
+   in degrees from the right going clockwise. A filled part of a circle is a pie slice */
+
+void driver_framebuffer_arc(Window* window, int16_t x0, int16_t y0, uint16_t r, float a0, float a1, bool fill, uint32_t color);
+/* Draw a circle like driver_framebuffer_circle with the angles in radians */
+
+void driver_framebuffer_ellipse(Window* window, int16_t x0, int16_t y0, uint16_t rx, uint16_t ry, bool fill, uint32_t color);
+/* Draw an ellipse (filled or only the outline) at center point (x0, y0) with a horizontal radius rx and a vertical radius ry */
+
+void driver_framebuffer_line_aa(Window* window, float x0, float y0, float x1, float y1, uint32_t color);
+/* Draw an anti-aliased line from point (x0, y0) to point (x1, y1), pixels are blended by how much the line covers them */
+
+void driver_framebuffer_circle_aa(Window* window, int16_t x0, int16_t y0, uint16_t r, bool fill, uint32_t color);
+/* Draw an anti-aliased circle (filled or only the outline) at center point (x0, y0) with a radius r */
 
 #ifdef __cplusplus
 }
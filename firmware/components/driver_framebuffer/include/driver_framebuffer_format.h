@@ -0,0 +1,66 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum pixel_format_t {
+	FB_FORMAT_NATIVE = 0,  // The pixel format of the display
+	FB_FORMAT_1BPP,        // Black and white, 8 horizontally adjacent pixels per byte
+	FB_FORMAT_1BPP_VERT,   // Black and white, 8 vertically adjacent pixels per byte, bytes placed next to each other horizontally
+	FB_FORMAT_1BPP_VERT2,  // Black and white, 8 vertically adjacent pixels per byte, bytes placed below each other vertically
+	FB_FORMAT_1BPP_OHS,    // Black and white, 8 horizontally adjacent pixels per byte, horizontally mirrored
+	FB_FORMAT_8BPP,        // 8-bit greyscale
+	FB_FORMAT_8CBPP,       // 8-bit color (3-3-2)
+	FB_FORMAT_12BPP,       // 12-bit color (RRRRGGGGBBBB)
+	FB_FORMAT_16BPP,       // 16-bit color (5-6-5), big endian
+	FB_FORMAT_24BPP,       // 24-bit color
+	FB_FORMAT_32BPP,       // 32-bit color with alpha
+	FB_FORMAT_COUNT
+} pixel_format_t;
+
+typedef struct pixel_ops_t {
+	pixel_format_t format;
+	uint8_t  bitsPerPixel;
+	bool     packedVertically; // A byte holds vertically adjacent pixels, spans are cheaper in the vertical direction
+
+	uint32_t (*encode)(uint32_t color);
+	/* Convert a 24-bit color into the value stored in the buffer */
+
+	bool     (*store)(uint8_t* buffer, uint16_t width, uint16_t height, int16_t x, int16_t y, uint32_t value);
+	/* Store an encoded value at buffer position (x, y), returns true if the buffer changed */
+
+	uint32_t (*load)(const uint8_t* buffer, uint16_t width, uint16_t height, int16_t x, int16_t y);
+	/* Load the pixel at buffer position (x, y) as a 24-bit color (32-bit with alpha for FB_FORMAT_32BPP) */
+
+	void     (*hspan)(uint8_t* buffer, uint16_t width, uint16_t height, int16_t x0, int16_t x1, int16_t y, uint32_t value);
+	/* Store an encoded value from buffer position (x0, y) to position (x1, y), inclusive */
+
+	void     (*vspan)(uint8_t* buffer, uint16_t width, uint16_t height, int16_t x, int16_t y0, int16_t y1, uint32_t value);
+	/* Store an encoded value from buffer position (x, y0) to position (x, y1), inclusive */
+
+	void     (*fill)(uint8_t* buffer, uint16_t width, uint16_t height, uint32_t value);
+	/* Store an encoded value in every pixel of the buffer */
+
+	bool     (*blend)(uint8_t* buffer, uint16_t width, uint16_t height, int16_t x, int16_t y, uint32_t value, uint8_t alpha);
+	/* Blend an encoded value over the pixel at buffer position (x, y), alpha 0 keeps the pixel and 255 replaces it, returns true if the buffer changed */
+
+	void     (*hblend)(uint8_t* buffer, uint16_t width, uint16_t height, int16_t x0, int16_t x1, int16_t y, uint32_t value, uint8_t alpha);
+	/* Blend an encoded value over the pixels from buffer position (x0, y) to position (x1, y), inclusive */
+
+	void     (*row)(uint8_t* buffer, uint16_t width, uint16_t height, int16_t x, int16_t y, int16_t dx, int16_t dy, const uint32_t* values, int16_t count);
+	/* Store count encoded values from buffer position (x, y), one value per pixel, moving (dx, dy) after every pixel (one step along one of the axes) */
+} pixel_ops_t;
+
+const pixel_ops_t* driver_framebuffer_format_ops(pixel_format_t format);
+/* Get the pixel operations for a format, FB_FORMAT_NATIVE resolves to the format of the display. Returns NULL for invalid formats */
+
+uint32_t driver_framebuffer_format_size(pixel_format_t format, uint16_t width, uint16_t height);
+/* Get the amount of bytes needed for a buffer of width x height pixels */
+
+#ifdef __cplusplus
+}
+#endif
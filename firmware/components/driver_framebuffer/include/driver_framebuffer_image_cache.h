@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "esp_err.h"
+#include "driver_framebuffer_compositor.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct image_cache_stats_t {
+	uint32_t hits;    // Draws served from the cache
+	uint32_t misses;  // Draws that had to decode the file
+	uint16_t entries; // Images currently in the cache
+	uint16_t pinned;  // Images that are never evicted to make room
+	uint32_t used;    // Bytes used by the images in the cache
+	uint32_t size;    // Bytes available to the cache
+} image_cache_stats_t;
+
+esp_err_t driver_framebuffer_png_file(Window* window, int16_t x, int16_t y, const char* path);
+/* Draw a PNG file to the framebuffer of the provided window, through the image cache when it is enabled */
+
+bool driver_framebuffer_image_cache_pin(const char* path, bool pin);
+/* Load a PNG file into the image cache and keep it there (pin true) or allow evicting it again (pin false), returns false if the image does not fit */
+
+void driver_framebuffer_image_cache_evict(const char* path);
+/* Remove every copy of a file from the image cache, a NULL path empties the whole cache */
+
+void driver_framebuffer_image_cache_stats(image_cache_stats_t* stats);
+/* Get the usage and hit rate counters of the image cache */
+
+#ifdef __cplusplus
+}
+#endif
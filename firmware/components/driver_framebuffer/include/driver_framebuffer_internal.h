@@ -22,3 +22,15 @@
 #include "mem_reader.h"
 #include "file_reader.h"
 #include "png_reader.h"
+#include "qoi_reader.h"
+
+bool driver_framebuffer_lock_held();
+// True when the calling task holds the framebuffer lock
+
+#ifdef __cplusplus
+// Holds the framebuffer lock until the end of the scope, the public drawing and flush functions start with one
+struct framebuffer_lock_t {
+	framebuffer_lock_t()  { driver_framebuffer_lock(); }
+	~framebuffer_lock_t() { driver_framebuffer_unlock(); }
+};
+#endif
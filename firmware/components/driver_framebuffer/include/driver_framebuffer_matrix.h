@@ -24,17 +24,13 @@ typedef union matrix_2d_t {						// Used by the driver for 2D transformations
 	matrix_var arr[6];							// Represented as array where index 0->2 is top row, index 3->5 is bottom row
 } matrix_2d;
 
-typedef struct matrix_2d_link_t matrix_2d_link;	// Forward declare so as to allow self reference
-typedef struct matrix_2d_link_t {				// Used by the driver for creating the 2D matrix stack
-	matrix_2d matrix;
-	matrix_2d_link *next;
-} matrix_2d_link;
-
 typedef struct matrix_stack_2d_t {
 	uint16_t capacity;							// How many matrices the current stack can hold in total
 	uint16_t size;								// How many matrices are currently on the stack
-	matrix_2d_link *matrices;					// The stack, as a linked list
-    matrix_2d current;							// The active matrix
+	uint16_t allocated;							// How many matrices fit in the storage before it has to grow
+	matrix_2d *matrices;						// The stack, as an array with the bottom first, NULL until the first push
+	matrix_2d current;							// The active matrix, change it through the stack operations
+	bool translateOnly;							// The active matrix only translates, kept up to date by the stack operations
 } matrix_stack_2d;
 
 typedef union matrix_3d_t {						// Used by driver for 3D transformations
@@ -46,17 +42,12 @@ typedef union matrix_3d_t {						// Used by driver for 3D transformations
 	matrix_var arr[12];
 } matrix_3d;
 
-typedef struct matrix_3d_link_t matrix_3d_link;	// Forward declare so as to allow self reference
-typedef struct matrix_3d_link_t {				// Used by the driver for creating the 3D matrix stack
-	matrix_3d matrix;
-	matrix_3d_link *next;
-} matrix_3d_link;
-
 typedef struct matrix_stack_3d_t {
 	uint16_t capacity;							// How many matrices the current stack can hold in total
 	uint16_t size;								// How many matrices are currently on the stack
-	matrix_3d_link *matrices;					// The stack, as a linked list
-    matrix_3d current;							// The active matrix
+	uint16_t allocated;							// How many matrices fit in the storage before it has to grow
+	matrix_3d *matrices;						// The stack, as an array with the bottom first, NULL until the first push
+	matrix_3d current;							// The active matrix
 } matrix_stack_3d;
 
 
@@ -107,23 +98,26 @@ matrix_3d matrix_3d_scale(float x, float y, float z);
 
 
 //checks whether or not the matrix is an identity matrix
-bool matrix_2d_is_identity(matrix_2d matrix);
+bool matrix_2d_is_identity(const matrix_2d *matrix);
+
+//checks whether or not the matrix only translates, leaving out rotation, scaling and shearing
+bool matrix_2d_is_translate_only(const matrix_2d *matrix);
 
 //performs a matrix multiplication, internally factors in the bottom row which is omitted in storage
 matrix_2d matrix_2d_multiply(matrix_2d left, matrix_2d right);
 
 //transforms the point according to the matrix
-void matrix_2d_transform_point(matrix_2d matrix, float *x, float *y);
+void matrix_2d_transform_point(const matrix_2d *matrix, float *x, float *y);
 
 
 //checks whether or not the matrix is an identity matrix
-bool matrix_3d_is_identity(matrix_3d matrix);
+bool matrix_3d_is_identity(const matrix_3d *matrix);
 
 //performs a matrix multiplication, internally factors in the bottom row which is omitted in storage
 matrix_3d matrix_3d_multiply(matrix_3d left, matrix_3d right);
 
 //transforms the point according to the matrix
-void matrix_3d_transform_point(matrix_3d matrix, float *x, float *y, float *z);
+void matrix_3d_transform_point(const matrix_3d *matrix, float *x, float *y, float *z);
 
 
 /* ==== STACK OPERATIONS ==== */
@@ -142,6 +136,19 @@ esp_err_t matrix_stack_2d_push(matrix_stack_2d *stack);
 //returns 1 if the stack is already empty
 esp_err_t matrix_stack_2d_pop(matrix_stack_2d *stack);
 
+//replaces the active matrix
+void matrix_stack_2d_set(matrix_stack_2d *stack, const matrix_2d *matrix);
+
+//applies a transformation after the active matrix, like drawing in the coordinates of the transformation
+void matrix_stack_2d_multiply(matrix_stack_2d *stack, const matrix_2d *matrix);
+
+//applies a translation after the active matrix, without a full matrix multiplication
+void matrix_stack_2d_translate(matrix_stack_2d *stack, float x, float y);
+
+//transforms count points, stored as x and y after each other, according to the active matrix
+//while it only translates the points are moved without any multiplications
+void matrix_stack_2d_transform_points(const matrix_stack_2d *stack, float *points, uint16_t count);
+
 
 //initialises the given matrix stack so as to be ready for use
 void matrix_stack_3d_init(matrix_stack_3d *stack);
@@ -63,6 +63,14 @@ void depth3d_clear(depth_buffer_3d *buffer);
 int driver_framebuffer_tri3d(triangle_3d triangle, uint32_t param, uint8_t mode);
 /* Queues a triangle to be drawn, or waits if neccesary. Returns 0 on OK, 1 on error. */
 
+int driver_framebuffer_mesh3d(const float *vertices, uint16_t vertexCount, const uint16_t *indices, uint16_t triangleCount, const uint32_t *colors, uint32_t color, bool cull);
+/* Queues the triangles of a mesh: x, y, z for every vertex and three vertex indices for every triangle.
+   Colors holds a color for every triangle, or is NULL to draw every triangle in color.
+   With cull set triangles that are clockwise on the display are skipped. Returns 0 on OK, 1 on error. */
+
+void driver_framebuffer_tri3d_wait();
+/* Waits until all triangles queued by the calling task have been drawn, 2D drawing and flushing by that task wait for them by themselves. */
+
 /* shaders */
 
 uint32_t shader_2d_lerp(float u, float v, int16_t x, int16_t y, void *args);
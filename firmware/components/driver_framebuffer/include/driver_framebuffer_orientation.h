@@ -9,6 +9,13 @@
 extern "C" {
 #endif
 
+typedef struct orientation_map_t {
+	int16_t x, y;           // Buffer position of the top left pixel from the users perspective
+	int16_t pixelX, pixelY; // Buffer step for one pixel to the right
+	int16_t rowX, rowY;     // Buffer step for one pixel down
+	int16_t width, height;  // Size from the users perspective
+} orientation_map_t;
+
 enum Orientation driver_framebuffer_get_orientation(Window *window);
 /* Get the orientation of the window */
 
@@ -21,6 +28,10 @@ uint16_t driver_framebuffer_get_orientation_angle(Window *window);
 void driver_framebuffer_set_orientation_angle(Window *window, uint16_t angle);
 /* Set the orientation of the window as angle */
 
+void driver_framebuffer_orientation_map(Window *window, orientation_map_t *map);
+/* Resolve the orientation of the window into the buffer position of (0, 0) and a step per pixel and per row,
+   user position (x, y) is stored at buffer position (map.x + x * map.pixelX + y * map.rowX, map.y + x * map.pixelY + y * map.rowY) */
+
 bool driver_framebuffer_orientation_apply(Window *window, int16_t *x, int16_t *y);
 /* Apply the orientation of the window to the provided coordinates. (the provided coordinates are from the users perspective) */
 
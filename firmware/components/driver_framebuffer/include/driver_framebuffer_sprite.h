@@ -0,0 +1,74 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "esp_err.h"
+#include "esp_partition.h"
+#include "driver_framebuffer_compositor.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Sprite files hold images that were converted to a pixel format of the framebuffer
+ * ahead of time (see spriteconvert/spriteconvert.py in the root of the repository),
+ * all values are little endian:
+ *
+ *  0  "FBSP"
+ *  4  uint8  version (1)
+ *  5  uint8  pixel format (pixel_format_t)
+ *  6  uint8  flags (SPRITE_FLAG_*)
+ *  7  uint8  reserved (0)
+ *  8  uint16 frame width
+ * 10  uint16 frame height
+ * 12  uint16 number of frames
+ * 14  uint16 frames per row of the atlas
+ * 16  uint8  transparent pixel as stored in a 1x1 buffer of the pixel format [4]
+ * 20  uint32 size of the file
+ * 24  pixel data
+ *
+ * Without SPRITE_FLAG_RLE the pixel data is one buffer holding all frames in a grid, laid out
+ * exactly like the buffer of a window of that size, so frames are drawn straight from it.
+ *
+ * With SPRITE_FLAG_RLE (byte aligned formats only) the pixel data starts with a uint32 offset
+ * from the start of the file for every frame. A frame is a sequence of packets, rows follow each
+ * other without padding. A packet starts with a byte n, followed by n + 1 stored pixels if bit 7
+ * is clear, or by one stored pixel that repeats (n & 0x7F) + 1 times if bit 7 is set.
+ */
+
+#define SPRITE_HEADER_SIZE 24
+#define SPRITE_VERSION     1
+
+#define SPRITE_FLAG_RLE    1 // Frames are run-length encoded
+#define SPRITE_FLAG_KEYED  2 // Pixels that match the transparent pixel are not drawn
+
+typedef struct sprite_t {
+	const uint8_t* data;           // Start of the sprite file
+	uint32_t size;                 // Size of the sprite file
+	const pixel_ops_t* pixelOps;   // Pixel operations for the format of the sprite
+	uint8_t flags;                 // SPRITE_FLAG_*
+	uint16_t width, height;        // Size of a frame
+	uint16_t frames;               // Number of frames
+	uint16_t columns;              // Frames per row of the atlas
+	uint8_t key[4];                // Transparent pixel, stored in a 1x1 buffer of the pixel format
+	spi_flash_mmap_handle_t mmap;  // Mapping of the flash when the sprite was mapped from a partition
+	bool mapped;                   // The sprite was mapped from a partition
+} sprite_t;
+
+esp_err_t driver_framebuffer_sprite_open(sprite_t* sprite, const uint8_t* data, uint32_t size);
+/* Use a sprite file that is already in memory (or memory mapped flash), the data is used in place and has to stay available */
+
+esp_err_t driver_framebuffer_sprite_map(sprite_t* sprite, const esp_partition_t* partition, uint32_t offset);
+/* Map a sprite file stored in a flash partition into memory, without copying it */
+
+void driver_framebuffer_sprite_close(sprite_t* sprite);
+/* Stop using a sprite, unmaps the flash if the sprite was mapped from a partition */
+
+esp_err_t driver_framebuffer_sprite_draw(Window* window, int16_t x, int16_t y, const sprite_t* sprite, uint16_t frame);
+/* Draw a frame of a sprite to the framebuffer of the provided window */
+
+#ifdef __cplusplus
+}
+#endif
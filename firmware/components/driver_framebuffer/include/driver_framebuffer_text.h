@@ -39,6 +39,8 @@ extern const GFXfont ipane7x5;
 const GFXfont* driver_framebuffer_findFontByName(const char* fontName);
 uint16_t driver_framebuffer_print(Window* window, const char* str, int16_t x0, int16_t y0, uint8_t xScale, uint8_t yScale, uint32_t color, const GFXfont *font);
 uint16_t driver_framebuffer_print_len(Window* window, const char* str, int16_t len, int16_t x0, int16_t y0, uint8_t xScale, uint8_t yScale, uint32_t color, const GFXfont *font);
+uint16_t driver_framebuffer_print_blend(Window* window, const char* str, int16_t x0, int16_t y0, uint8_t xScale, uint8_t yScale, uint32_t color, uint8_t alpha, const GFXfont *font);
+/* Same as driver_framebuffer_print with the text mixed over what is below it, alpha 255 is opaque. GFX fonts are 1-bit, so every pixel of the text gets the same alpha */
 uint16_t driver_framebuffer_get_string_width(const char* str, const GFXfont *font);
 uint16_t driver_framebuffer_get_string_height(const char* str, const GFXfont *font);
 
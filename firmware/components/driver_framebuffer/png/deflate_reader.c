@@ -1,4 +1,12 @@
+/* TEST:
+ * gcc -o deflate_reader deflate_reader.c adler32.c -Wall -DLIB_DEFLATE_READER_TEST -g
+ *
+ * Streams made by zlib and streams with random stored, fixed and dynamic blocks written by the test itself are
+ * inflated through short reads and checked against their data and Adler-32, broken streams must be rejected.
+ */
+
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -9,158 +17,251 @@
 #define likely(x)   __builtin_expect(!!(x), 1)
 #define unlikely(x) __builtin_expect(!!(x), 0)
 
+// The read callback may return less than asked for; input is buffered in in_buf and only read when bits are
+// needed, so nothing past the end of the deflate stream is consumed from the underlying reader.
 static inline int
-lib_deflate_get_bits_long(struct lib_deflate_reader *dr, int num)
+lib_deflate_refill(struct lib_deflate_reader *dr)
 {
-	int value = dr->bitbuf[1];
-	if (num > dr->bitlen + 8)
+	ssize_t res = dr->read(dr->read_p, dr->in_buf, sizeof(dr->in_buf));
+	if (unlikely(res <= 0))
 	{
-		ssize_t res = dr->read(dr->read_p, dr->bitbuf, 2);
-		if (unlikely(res < 2))
-		{
-			if (res < 0)
-				return res;
-			return -LIB_DEFLATE_ERROR_UNEXPECTED_END_OF_FILE;
-		}
-		uint16_t *bitbuf = (uint16_t *) dr->bitbuf;
-#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
-		value |= *bitbuf << 8;
-#elif __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
-		value |= __builtin_bswap16(*bitbuf) << 8;
-#endif
+		if (res < 0)
+			return res;
+		return -LIB_DEFLATE_ERROR_UNEXPECTED_END_OF_FILE;
 	}
-	else if (num > dr->bitlen)
+	dr->in_pos = 0;
+	dr->in_len = res;
+	return 0;
+}
+
+// ensure at least num (<= 25) bits are in the bit buffer.
+static inline int
+lib_deflate_need_bits(struct lib_deflate_reader *dr, int num)
+{
+	while (dr->bitlen < num)
 	{
-		ssize_t res = dr->read(dr->read_p, &(dr->bitbuf[1]), 1);
-		if (unlikely(res < 1))
+		if (unlikely(dr->in_pos == dr->in_len))
 		{
-			if (res < 0)
+			int res = lib_deflate_refill(dr);
+			if (unlikely(res < 0))
 				return res;
-			return -LIB_DEFLATE_ERROR_UNEXPECTED_END_OF_FILE;
 		}
-		value |= dr->bitbuf[1] << 8;
+		dr->bitbuf |= (uint32_t) dr->in_buf[ dr->in_pos++ ] << dr->bitlen;
+		dr->bitlen += 8;
 	}
 
-	value >>= 8 - dr->bitlen;
-	value &= (1 << num) - 1;
-	dr->bitlen -= num;
-	dr->bitlen &= 7;
+	return 0;
+}
 
-	return value;
+static inline void
+lib_deflate_drop_bits(struct lib_deflate_reader *dr, int num)
+{
+	dr->bitbuf >>= num;
+	dr->bitlen -= num;
 }
 
 static inline int
 lib_deflate_get_bits(struct lib_deflate_reader *dr, int num)
 {
-	int value = dr->bitbuf[1];
-	if (num > dr->bitlen)
+	int res = lib_deflate_need_bits(dr, num);
+	if (unlikely(res < 0))
+		return res;
+
+	int value = dr->bitbuf & ((1 << num) - 1);
+	lib_deflate_drop_bits(dr, num);
+
+	return value;
+}
+
+// read whole bytes, after dropping the bits left of the current byte.
+static ssize_t
+lib_deflate_get_bytes(struct lib_deflate_reader *dr, uint8_t *buf, size_t buf_len)
+{
+	lib_deflate_drop_bits(dr, dr->bitlen & 7);
+
+	size_t pos = 0;
+	while (pos < buf_len && dr->bitlen > 0)
 	{
-		ssize_t res = dr->read(dr->read_p, &(dr->bitbuf[1]), 1);
-		if (unlikely(res < 1))
+		buf[pos++] = dr->bitbuf;
+		lib_deflate_drop_bits(dr, 8);
+	}
+
+	size_t copylen = dr->in_len - dr->in_pos;
+	if (copylen > buf_len - pos)
+		copylen = buf_len - pos;
+	memcpy(&buf[pos], &dr->in_buf[ dr->in_pos ], copylen);
+	dr->in_pos += copylen;
+	pos += copylen;
+
+	while (pos < buf_len)
+	{
+		ssize_t res = dr->read(dr->read_p, &buf[pos], buf_len - pos);
+		if (unlikely(res <= 0))
 		{
 			if (res < 0)
 				return res;
 			return -LIB_DEFLATE_ERROR_UNEXPECTED_END_OF_FILE;
 		}
-		value |= dr->bitbuf[1] << 8;
+		pos += res;
 	}
 
-	value >>= 8 - dr->bitlen;
-	value &= (1 << num) - 1;
-	dr->bitlen -= num;
-	dr->bitlen &= 7;
-
-	return value;
+	return pos;
 }
 
+// A table entry holds the symbol in the top 11 bits and the code length in the bottom 4 bits. Codes longer
+// than root bits have a link in the first-level table instead, holding the offset of the second-level table
+// and the number of bits indexing it.
+#define LIB_DEFLATE_ENTRY_LINK 0x10
+
 static inline int
-lib_deflate_build_huffman(const uint8_t *tbl, int tbl_len, uint16_t *tree)
+lib_deflate_build_huffman(const uint8_t *lens, int num, uint16_t *table, int root, int table_size)
 {
-	int bits;
-	int bits_prev = 0;
-	int total = 0;
-	for (bits=1; bits<16; bits++)
+	uint16_t count[16] = {0};
+	int i;
+	for (i=0; i<num; i++)
+		count[ lens[i] ]++;
+	count[0] = 0;
+
+	int left = 1;
+	int len;
+	for (len=1; len<16; len++)
 	{
-		int i;
-		for (i=0; i<tbl_len; i++)
+		left <<= 1;
+		left -= count[len];
+		if (unlikely(left < 0))
+			break;
+	}
+	if (unlikely(left != 0))
+	{
+		// table not well-balanced. something is wrong.
+		return -LIB_DEFLATE_ERROR_UNBALANCED_HUFFMAN_TREE;
+	}
+
+	// sort the symbols by code length; canonical codes are handed out in this order.
+	uint16_t offs[16];
+	uint16_t sorted[288];
+	offs[1] = 0;
+	for (len=1; len<15; len++)
+		offs[len + 1] = offs[len] + count[len];
+	for (i=0; i<num; i++)
+		if (lens[i])
+			sorted[ offs[ lens[i] ]++ ] = i;
+
+	// deflate sends codes starting at the most significant bit, the table is indexed by the bit-reversed code.
+	// rev counts through the canonical codes in that reversed order.
+	int used = 1 << root;
+	int rev = 0;
+	int sub_prefix = -1;
+	int sub_start = 0;
+	int sub_bits = 0;
+	uint16_t *symbol = sorted;
+	for (len=1; len<16; len++)
+	{
+		for (; count[len] > 0; count[len]--)
 		{
-			if (unlikely(tbl[i] == bits))
+			uint16_t entry = (*symbol++ << 5) | len;
+			if (len <= root)
 			{
-				if (unlikely(bits - bits_prev > 8))
-				{
-					*tree++ = 8;
-					bits_prev += 8;
-				}
-				uint16_t *base = tree++;
-				*tree++ = i;
-				int count = 1;
-				i++;
-				for (; i<tbl_len; i++)
-				{
-					if (unlikely(tbl[i] == bits))
+				for (i=rev; i<(1 << root); i+=(1 << len))
+					table[i] = entry;
+			}
+			else
+			{
+				int prefix = rev & ((1 << root) - 1);
+				if (prefix != sub_prefix)
+				{ // the first code with this prefix; size the second-level table for the codes that follow it.
+					sub_bits = len - root;
+					int sub_left = (1 << sub_bits) - count[len];
+					while (sub_left > 0 && sub_bits + root < 15)
 					{
-						*tree++ = i;
-						count++;
+						sub_bits++;
+						sub_left = (sub_left << 1) - count[sub_bits + root];
 					}
+					sub_start = used;
+					used += 1 << sub_bits;
+					if (unlikely(used > table_size))
+						return -LIB_DEFLATE_ERROR_UNBALANCED_HUFFMAN_TREE;
+					sub_prefix = prefix;
+					table[prefix] = (sub_start << 5) | LIB_DEFLATE_ENTRY_LINK | sub_bits;
 				}
-				*base = (count << 4) | (bits - bits_prev);
-				bits_prev = bits;
-				total += (0x10000 * count) >> bits;
-				break;
+				for (i=rev >> root; i<(1 << sub_bits); i+=(1 << (len - root)))
+					table[sub_start + i] = entry;
 			}
-		}
-	}
 
-	if (unlikely(total != 0x10000))
-	{
-		// table not well-balanced. something is wrong.
-		return -LIB_DEFLATE_ERROR_UNBALANCED_HUFFMAN_TREE;
+			int incr = 1 << (len - 1);
+			while (rev & incr)
+				incr >>= 1;
+			rev = incr ? (rev & (incr - 1)) + incr : 0;
+		}
 	}
 
 	return 0;
 }
 
 static inline int
-lib_deflate_get_huffman(struct lib_deflate_reader *dr, const uint16_t *tbl)
+lib_deflate_get_huffman(struct lib_deflate_reader *dr, const uint16_t *table, int root)
 {
-	int value = 0;
-	while (1)
-	{
-		uint16_t bits = *tbl++;
-		uint16_t entries = bits >> 4;
-
-		bits &= 15;
-		int res = lib_deflate_get_bits(dr, bits);
-		if (unlikely(res < 0))
-			return res;
-
-		// shift res into value, in reverse order.
-		switch (bits)
+	if (unlikely(dr->bitlen < 15))
+	{ // near the end of the input less than the longest code may be left, only fail if the code itself is cut off.
+		while (dr->bitlen < 15)
 		{
-			case 8: value <<= 1; value += res & 1; res >>= 1;
-			case 7: value <<= 1; value += res & 1; res >>= 1;
-			case 6: value <<= 1; value += res & 1; res >>= 1;
-			case 5: value <<= 1; value += res & 1; res >>= 1;
-			case 4: value <<= 1; value += res & 1; res >>= 1;
-			case 3: value <<= 1; value += res & 1; res >>= 1;
-			case 2: value <<= 1; value += res & 1; res >>= 1;
-			case 1: value <<= 1; value += res;
+			if (unlikely(dr->in_pos == dr->in_len))
+			{
+				ssize_t res = dr->read(dr->read_p, dr->in_buf, sizeof(dr->in_buf));
+				if (unlikely(res < 0))
+					return res;
+				if (res == 0)
+					break;
+				dr->in_pos = 0;
+				dr->in_len = res;
+			}
+			dr->bitbuf |= (uint32_t) dr->in_buf[ dr->in_pos++ ] << dr->bitlen;
+			dr->bitlen += 8;
 		}
+	}
 
-		if (value < entries)
-			return tbl[value];
+	uint16_t entry = table[ dr->bitbuf & ((1 << root) - 1) ];
+	if (entry & LIB_DEFLATE_ENTRY_LINK)
+		entry = table[ (entry >> 5) + ((dr->bitbuf >> root) & ((1 << (entry & 15)) - 1)) ];
 
-		value -= entries;
-		tbl = &tbl[entries];
-	}
+	int len = entry & 15;
+	if (unlikely(len > dr->bitlen))
+		return -LIB_DEFLATE_ERROR_UNEXPECTED_END_OF_FILE;
+	lib_deflate_drop_bits(dr, len);
 
-	return value;
+	return entry >> 5;
+}
+
+// the tables for static huffman blocks are the same for every stream; they are built once and shared.
+// none of their codes are longer than the roots, so they need no second-level tables.
+static uint16_t lib_deflate_fixed_lc_table[1 << LIB_DEFLATE_LC_ROOT];
+static uint16_t lib_deflate_fixed_dc_table[1 << LIB_DEFLATE_DC_ROOT];
+static bool lib_deflate_fixed_built;
+
+static void
+lib_deflate_fixed_tables(void)
+{
+	if (likely(__atomic_load_n(&lib_deflate_fixed_built, __ATOMIC_ACQUIRE)))
+		return;
+
+	uint8_t huffman[288];
+	memset(&huffman[0], 8, 144);
+	memset(&huffman[144], 9, 256-144);
+	memset(&huffman[256], 7, 280-256);
+	memset(&huffman[280], 8, 288-280);
+	lib_deflate_build_huffman(huffman, 288, lib_deflate_fixed_lc_table, LIB_DEFLATE_LC_ROOT, 1 << LIB_DEFLATE_LC_ROOT);
+
+	memset(huffman, 5, 32);
+	lib_deflate_build_huffman(huffman, 32, lib_deflate_fixed_dc_table, LIB_DEFLATE_DC_ROOT, 1 << LIB_DEFLATE_DC_ROOT);
+
+	// building twice at the same time is harmless, both write the same values.
+	__atomic_store_n(&lib_deflate_fixed_built, true, __ATOMIC_RELEASE);
 }
 
 void
 lib_deflate_init(struct lib_deflate_reader *dr, lib_reader_read_t read, void *read_p)
 {
-	memset(dr, 0, sizeof(struct lib_deflate_reader));
+	memset(dr, 0, offsetof(struct lib_deflate_reader, in_buf));
 	dr->read = read;
 	dr->read_p = read_p;
 }
@@ -198,16 +299,10 @@ lib_deflate_read(struct lib_deflate_reader *dr, uint8_t *buf, size_t buf_len)
 
 			if (block_type == 0)
 			{ // stored block
-				dr->bitlen = 0;
-
 				uint16_t rd_buf[2];
-				ssize_t res = dr->read(dr->read_p, (uint8_t *) rd_buf, 4);
-				if (unlikely(res < 4))
-				{
-					if (res < 0)
-						return res;
-					return -LIB_DEFLATE_ERROR_UNEXPECTED_END_OF_FILE;
-				}
+				ssize_t res = lib_deflate_get_bytes(dr, (uint8_t *) rd_buf, 4);
+				if (unlikely(res < 0))
+					return res;
 
 #if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
 				int len = rd_buf[0];
@@ -224,30 +319,15 @@ lib_deflate_read(struct lib_deflate_reader *dr, uint8_t *buf, size_t buf_len)
 			}
 			else if (block_type == 1)
 			{ // static huffman
-				int i;
-				uint16_t *tree = dr->huffman_lc_tree;
-				*tree++ = ((280-256) << 4) | 7;
-				for (i=256; i<280; i++)
-					*tree++ = i;
-				*tree++ = ((144-0+288-280) << 4) | 1;
-				for (i=0; i<144; i++)
-					*tree++ = i;
-				for (i=280; i<288; i++)
-					*tree++ = i;
-				*tree++ = ((256-144) << 4) | 1;
-				for (i=144; i<256; i++)
-					*tree++ = i;
-
-				tree = dr->huffman_dc_tree;
-				*tree++ = ((32-0) << 4) | 5;
-				for (i=0; i<32; i++)
-					*tree++ = i;
+				lib_deflate_fixed_tables();
+				dr->lc_table = lib_deflate_fixed_lc_table;
+				dr->dc_table = lib_deflate_fixed_dc_table;
 
 				dr->state = LIB_DEFLATE_STATE_HUFFMAN;
 			}
 			else if (block_type == 2)
 			{ // dynamic huffman
-				int blc_dc_lc = lib_deflate_get_bits_long(dr, 14);
+				int blc_dc_lc = lib_deflate_get_bits(dr, 14);
 				if (unlikely(blc_dc_lc < 0))
 					return blc_dc_lc;
 
@@ -256,7 +336,7 @@ lib_deflate_read(struct lib_deflate_reader *dr, uint8_t *buf, size_t buf_len)
 				int blc_num = 4   +  (blc_dc_lc >> 10);
 
 				// use the temp huffman array for all huffman table creates.
-				uint8_t huffman[288];
+				uint8_t huffman[288 + 32];
 
 				static const uint8_t blc_order[19] = {
 					16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15, 
@@ -271,35 +351,37 @@ lib_deflate_read(struct lib_deflate_reader *dr, uint8_t *buf, size_t buf_len)
 					huffman[blc_order[i]] = bits;
 				}
 
-				uint16_t blc_tree[19 + 7];
-				int res = lib_deflate_build_huffman(huffman, 19, blc_tree);
+				uint16_t blc_table[1 << 7];
+				int res = lib_deflate_build_huffman(huffman, 19, blc_table, 7, sizeof(blc_table) / sizeof(blc_table[0]));
 				if (unlikely(res < 0))
 					return res; // invalid table
 
-				int lc_i=0;
-				while (lc_i < lc_num)
+				// the literal/length and distance code lengths are a single sequence, repeats may run from one into the other.
+				int lens_num = lc_num + dc_num;
+				int lens_i=0;
+				while (lens_i < lens_num)
 				{
-					int len = lib_deflate_get_huffman(dr, blc_tree);
+					int len = lib_deflate_get_huffman(dr, blc_table, 7);
 					if (unlikely(len < 0))
 						return len;
 
 					if (len < 16)
 					{
-						huffman[lc_i++] = len;
+						huffman[lens_i++] = len;
 					}
 					else if (len == 16)
 					{
-						if (unlikely(lc_i == 0))
+						if (unlikely(lens_i == 0))
 							return -LIB_DEFLATE_ERROR_DYNAMIC_HUFFMAN_SETUP_ERROR;
-						uint8_t prev_len = huffman[lc_i - 1];
+						uint8_t prev_len = huffman[lens_i - 1];
 						int repeat = lib_deflate_get_bits(dr, 2);
 						if (unlikely(repeat < 0))
 							return repeat;
 						repeat += 3;
-						if (unlikely(lc_i + repeat > lc_num))
+						if (unlikely(lens_i + repeat > lens_num))
 							return -LIB_DEFLATE_ERROR_DYNAMIC_HUFFMAN_SETUP_ERROR; // overflow
 						while (repeat--)
-							huffman[lc_i++] = prev_len;
+							huffman[lens_i++] = prev_len;
 					}
 					else if (len == 17)
 					{
@@ -307,10 +389,10 @@ lib_deflate_read(struct lib_deflate_reader *dr, uint8_t *buf, size_t buf_len)
 						if (unlikely(repeat < 0))
 							return repeat;
 						repeat += 3;
-						if (unlikely(lc_i + repeat > lc_num))
+						if (unlikely(lens_i + repeat > lens_num))
 							return -LIB_DEFLATE_ERROR_DYNAMIC_HUFFMAN_SETUP_ERROR; // overflow
 						while (repeat--)
-							huffman[lc_i++] = 0;
+							huffman[lens_i++] = 0;
 					}
 					else if (len == 18)
 					{
@@ -318,72 +400,25 @@ lib_deflate_read(struct lib_deflate_reader *dr, uint8_t *buf, size_t buf_len)
 						if (unlikely(repeat < 0))
 							return repeat;
 						repeat += 11;
-						if (unlikely(lc_i + repeat > lc_num))
+						if (unlikely(lens_i + repeat > lens_num))
 							return -LIB_DEFLATE_ERROR_DYNAMIC_HUFFMAN_SETUP_ERROR; // overflow
 						while (repeat--)
-							huffman[lc_i++] = 0;
+							huffman[lens_i++] = 0;
 					}
 					else return -LIB_DEFLATE_ERROR_DYNAMIC_HUFFMAN_SETUP_ERROR;
 				}
 
-				res = lib_deflate_build_huffman(huffman, lc_i, dr->huffman_lc_tree);
+				res = lib_deflate_build_huffman(huffman, lc_num, dr->huffman_lc_table, LIB_DEFLATE_LC_ROOT, LIB_DEFLATE_LC_TABLE_SIZE);
 				if (unlikely(res < 0))
 					return res; // invalid table
 
-				int dc_i=0;
-				while (dc_i < dc_num)
-				{
-					int len = lib_deflate_get_huffman(dr, blc_tree);
-					if (unlikely(len < 0))
-						return len;
-
-					if (len < 16)
-					{
-						huffman[dc_i++] = len;
-					}
-					else if (len == 16)
-					{
-						if (unlikely(dc_i == 0))
-							return -LIB_DEFLATE_ERROR_DYNAMIC_HUFFMAN_SETUP_ERROR;
-						uint8_t prev_len = huffman[dc_i - 1];
-						int repeat = lib_deflate_get_bits(dr, 2);
-						if (unlikely(repeat < 0))
-							return repeat;
-						repeat += 3;
-						if (unlikely(dc_i + repeat > dc_num))
-							return -LIB_DEFLATE_ERROR_DYNAMIC_HUFFMAN_SETUP_ERROR; // overflow
-						while (repeat--)
-							huffman[dc_i++] = prev_len;
-					}
-					else if (len == 17)
-					{
-						int repeat = lib_deflate_get_bits(dr, 3);
-						if (unlikely(repeat < 0))
-							return repeat;
-						repeat += 3;
-						if (unlikely(dc_i + repeat > dc_num))
-							return -LIB_DEFLATE_ERROR_DYNAMIC_HUFFMAN_SETUP_ERROR; // overflow
-						while (repeat--)
-							huffman[dc_i++] = 0;
-					}
-					else if (len == 18)
-					{
-						int repeat = lib_deflate_get_bits(dr, 7);
-						if (unlikely(repeat < 0))
-							return repeat;
-						repeat += 11;
-						if (unlikely(dc_i + repeat > dc_num))
-							return -LIB_DEFLATE_ERROR_DYNAMIC_HUFFMAN_SETUP_ERROR; // overflow
-						while (repeat--)
-							huffman[dc_i++] = 0;
-					}
-					else return -LIB_DEFLATE_ERROR_DYNAMIC_HUFFMAN_SETUP_ERROR;
-				}
-
-				res = lib_deflate_build_huffman(huffman, dc_i, dr->huffman_dc_tree);
+				res = lib_deflate_build_huffman(&huffman[lc_num], dc_num, dr->huffman_dc_table, LIB_DEFLATE_DC_ROOT, LIB_DEFLATE_DC_TABLE_SIZE);
 				if (unlikely(res < 0))
 					return res; // invalid table
 
+				dr->lc_table = dr->huffman_lc_table;
+				dr->dc_table = dr->huffman_dc_table;
+
 				dr->state = LIB_DEFLATE_STATE_HUFFMAN;
 			}
 			else
@@ -406,13 +441,9 @@ lib_deflate_read(struct lib_deflate_reader *dr, uint8_t *buf, size_t buf_len)
 					copylen = dr->lb_capacity - dr->lb_pos;
 
 				uint8_t *rd_buf = &dr->look_behind[ dr->lb_pos ];
-				ssize_t res = dr->read(dr->read_p, rd_buf, copylen);
-				if (unlikely(res < copylen))
-				{
-					if (res < 0)
-						return res;
-					return -LIB_DEFLATE_ERROR_UNEXPECTED_END_OF_FILE;
-				}
+				ssize_t res = lib_deflate_get_bytes(dr, rd_buf, copylen);
+				if (unlikely(res < 0))
+					return res;
 
 				memcpy(&buf[buf_pos], rd_buf, copylen);
 				buf_pos += copylen;
@@ -429,20 +460,27 @@ lib_deflate_read(struct lib_deflate_reader *dr, uint8_t *buf, size_t buf_len)
 
 		if (dr->state == LIB_DEFLATE_STATE_HUFFMAN)
 		{ // huffman encoded block.
-			int token = lib_deflate_get_huffman(dr, dr->huffman_lc_tree);
-			if (unlikely(token < 0))
-				return token;
-			if (token < 256)
-			{ // store token and return
-				buf[buf_pos++] = token;
+			int lb_mask = dr->lb_capacity - 1;
+			int token;
+			while (1)
+			{
+				token = lib_deflate_get_huffman(dr, dr->lc_table, LIB_DEFLATE_LC_ROOT);
+				if (unlikely(token < 0))
+					return token;
+				if (token >= 256)
+					break;
 
+				// store literals until the buffer is full or something else comes along.
+				buf[buf_pos++] = token;
 				dr->look_behind[ dr->lb_pos ] = token;
-				dr->lb_pos++;
-				dr->lb_pos &= (dr->lb_capacity-1);
+				dr->lb_pos = (dr->lb_pos + 1) & lb_mask;
 				if (dr->lb_size < dr->lb_capacity)
 					dr->lb_size++;
+				if (buf_pos >= buf_len)
+					return buf_pos;
 			}
-			else if (token == 256)
+
+			if (token == 256)
 			{ // next block
 				dr->state = LIB_DEFLATE_STATE_NEW_BLOCK;
 			}
@@ -466,7 +504,7 @@ lib_deflate_read(struct lib_deflate_reader *dr, uint8_t *buf, size_t buf_len)
 				copy_len += clp[ token ];
 
 				// determine distance
-				int token = lib_deflate_get_huffman(dr, dr->huffman_dc_tree);
+				int token = lib_deflate_get_huffman(dr, dr->dc_table, LIB_DEFLATE_DC_ROOT);
 				if (unlikely(token < 0))
 					return token;
 				if (unlikely(token >= 30))
@@ -479,7 +517,7 @@ lib_deflate_read(struct lib_deflate_reader *dr, uint8_t *buf, size_t buf_len)
 					0,0,0,0,1,1,2,2,3,3,4,4,5,5,6,6,7,7,8,8,9,9,10,10,11,11,12,12,13,13
 				};
 
-				int dist = dcb[ token ] ? lib_deflate_get_bits_long(dr, dcb[ token ]) : 0;
+				int dist = dcb[ token ] ? lib_deflate_get_bits(dr, dcb[ token ]) : 0;
 				if (unlikely(dist < 0))
 					return dist;
 				dist += dcp[ token ];
@@ -500,22 +538,40 @@ lib_deflate_read(struct lib_deflate_reader *dr, uint8_t *buf, size_t buf_len)
 				if (buf_pos >= buf_len)
 					return buf_pos;
 
-				// int copylen = dr->copy_len;
-				// copylen = buf_len - buf_pos if copylen > buf_len - buf_pos
-				// copylen = dr->copy_dist if copylen > dr->copy_dist
-				// copylen = dr->lb_capacity - dr->lb_pos if copylen > dr->lb_capacity - dr->lb_pos
-				// copylen = dr->lb_capacity - pos if copylen > dr->lb_capacity - pos
-				dr->copy_len--;
+				// copy in runs that do not wrap around the look_behind buffer on either end.
 				int pos = (dr->lb_pos - dr->copy_dist) & (dr->lb_capacity-1);
-				int token = dr->look_behind[ pos ];
+				int copylen = dr->copy_len;
+				if (copylen > buf_len - buf_pos)
+					copylen = buf_len - buf_pos;
+				if (copylen > dr->lb_capacity - dr->lb_pos)
+					copylen = dr->lb_capacity - dr->lb_pos;
+				if (copylen > dr->lb_capacity - pos)
+					copylen = dr->lb_capacity - pos;
 
-				buf[buf_pos++] = token;
+				uint8_t *src = &dr->look_behind[ pos ];
+				uint8_t *dst = &dr->look_behind[ dr->lb_pos ];
+				if (dr->copy_dist >= copylen)
+				{
+					memcpy(dst, src, copylen);
+				}
+				else
+				{ // overlapping copy repeats the last copy_dist bytes.
+					int i;
+					for (i=0; i<copylen; i++)
+						dst[i] = src[i];
+				}
+				memcpy(&buf[buf_pos], dst, copylen);
+				buf_pos += copylen;
 
-				dr->look_behind[ dr->lb_pos ] = token;
-				dr->lb_pos++;
+				dr->copy_len -= copylen;
+				dr->lb_pos += copylen;
 				dr->lb_pos &= (dr->lb_capacity-1);
 				if (dr->lb_size < dr->lb_capacity)
-					dr->lb_size++;
+				{
+					dr->lb_size += copylen;
+					if (dr->lb_size > dr->lb_capacity)
+						dr->lb_size = dr->lb_capacity;
+				}
 			}
 			dr->state = LIB_DEFLATE_STATE_HUFFMAN;
 		}
@@ -524,8 +580,664 @@ lib_deflate_read(struct lib_deflate_reader *dr, uint8_t *buf, size_t buf_len)
 	return buf_pos;
 }
 
+ssize_t
+lib_deflate_read_trailer(struct lib_deflate_reader *dr, uint8_t *buf, size_t buf_len)
+{ // the deflate stream ends at a byte boundary; read what follows it, like the zlib checksum.
+	return lib_deflate_get_bytes(dr, buf, buf_len);
+}
+
 void
 lib_deflate_destroy(struct lib_deflate_reader *dr)
 {
 	free(dr);
 }
+
+#ifdef LIB_DEFLATE_READER_TEST
+#include <assert.h>
+#include <stdio.h>
+
+#include "adler32.h"
+
+#define N_RAND_STREAMS 300
+#define MAX_OUTPUT     (1 << 20)
+#define BAD_ADLER      (-1)
+
+// zlib.compress() of "BADGE.TEAM framebuffer" at level 0 and 6, and of the text made by make_ref_text() at level 9.
+static const uint8_t ref_stored[] = {
+	0x78, 0x01, 0x01, 0x16, 0x00, 0xe9, 0xff, 0x42, 0x41, 0x44, 0x47, 0x45, 0x2e, 0x54, 0x45, 0x41,
+	0x4d, 0x20, 0x66, 0x72, 0x61, 0x6d, 0x65, 0x62, 0x75, 0x66, 0x66, 0x65, 0x72, 0x4a, 0xdb, 0x07,
+	0x4e,
+};
+static const uint8_t ref_fixed[] = {
+	0x78, 0x9c, 0x73, 0x72, 0x74, 0x71, 0x77, 0xd5, 0x0b, 0x71, 0x75, 0xf4, 0x55, 0x48, 0x2b, 0x4a,
+	0xcc, 0x4d, 0x4d, 0x2a, 0x4d, 0x4b, 0x4b, 0x2d, 0x02, 0x00, 0x4a, 0xdb, 0x07, 0x4e,
+};
+static const uint8_t ref_dynamic[] = {
+	0x78, 0xda, 0xc5, 0xce, 0x65, 0x12, 0x83, 0x30, 0x18, 0x45, 0xd1, 0xad, 0x7c, 0x2b, 0x60, 0xea,
+	0xee, 0xee, 0xa5, 0x2d, 0x75, 0x45, 0x02, 0x04, 0x0b, 0x04, 0x67, 0xf5, 0xcd, 0x26, 0x3a, 0xfd,
+	0xfd, 0xee, 0xcc, 0x79, 0x82, 0x8e, 0xc0, 0x0b, 0xb1, 0x6c, 0x82, 0x44, 0x49, 0xec, 0x80, 0x4a,
+	0x12, 0x30, 0x42, 0xdb, 0xf5, 0x81, 0x44, 0x88, 0x42, 0xc0, 0x66, 0x4b, 0xcc, 0x52, 0x50, 0x88,
+	0xc6, 0x81, 0xf0, 0xb3, 0x38, 0x97, 0x2f, 0x14, 0x4b, 0xe5, 0x4a, 0xb5, 0x56, 0x6f, 0x34, 0x5b,
+	0xed, 0x4e, 0xb7, 0xd7, 0x1f, 0x0c, 0x47, 0xe3, 0xc9, 0x74, 0x36, 0x5f, 0x2c, 0x57, 0xeb, 0xcd,
+	0x96, 0xdf, 0xed, 0x0f, 0xc2, 0xf1, 0x74, 0xbe, 0x5c, 0x6f, 0xf7, 0xc7, 0xf3, 0xf5, 0xfe, 0x88,
+	0x92, 0xac, 0x20, 0x55, 0xd3, 0xb1, 0x61, 0x5a, 0xb6, 0x43, 0x5c, 0x8f, 0xfa, 0x41, 0x18, 0xc5,
+	0x49, 0x9a, 0xf1, 0x22, 0x23, 0xed, 0x14, 0x24, 0xe6, 0xc5, 0x38, 0xd0, 0x41, 0xc5, 0x11, 0x62,
+	0x4a, 0x86, 0x1c, 0xb0, 0xb0, 0x17, 0x12, 0xca, 0x6e, 0x68, 0x3e, 0x07, 0x7f, 0x0c, 0xbf, 0x53,
+	0x20, 0x84, 0x39,
+};
+
+static size_t
+make_ref_text(uint8_t *text)
+{
+	size_t len = 0;
+	int i;
+	for (i=0; i<3; i++)
+	{
+		memcpy(&text[len], "The quick brown fox jumps over the lazy dog. ", 45);
+		len += 45;
+	}
+	for (i='0'; i<='z'; i++)
+		text[len++] = i;
+	for (i=0; i<4; i++)
+	{
+		memcpy(&text[len], "Pack my box with five dozen liquor jugs. ", 41);
+		len += 41;
+	}
+	return len;
+}
+
+// the input is handed out a random number of bytes at a time, at most max_read.
+struct test_reader {
+	const uint8_t *data;
+	size_t len;
+	size_t max_read;
+};
+
+static ssize_t
+test_read(void *p, void *buf, size_t buf_len)
+{
+	struct test_reader *tr = (struct test_reader *) p;
+	size_t len = 1 + rand() % tr->max_read;
+	if (len > buf_len)
+		len = buf_len;
+	if (len > tr->len)
+		len = tr->len;
+	memcpy(buf, tr->data, len);
+	tr->data += len;
+	tr->len -= len;
+	return len;
+}
+
+// inflates a zlib stream, asking for a random number of bytes at a time. returns the length of the data, or an error.
+static ssize_t
+test_inflate(const uint8_t *zlib, size_t zlib_len, uint8_t *out, size_t out_cap)
+{
+	struct test_reader tr = { zlib, zlib_len, 1 + rand() % 300 };
+	uint8_t hdr[2];
+	assert(zlib_len >= 2);
+	test_read(&tr, hdr, 1);
+	test_read(&tr, &hdr[1], 1);
+	assert((hdr[0] & 0x0f) == 8 && ((hdr[0] << 8) | hdr[1]) % 31 == 0);
+
+	struct lib_deflate_reader *dr = lib_deflate_new(test_read, &tr, 1 << ((hdr[0] >> 4) + 8));
+	assert(dr != NULL);
+	size_t out_len = 0;
+	ssize_t res;
+	do
+	{
+		size_t len = 1 + rand() % (rand() & 1 ? 16 : 4096);
+		if (len > out_cap - out_len)
+			len = out_cap - out_len;
+		res = lib_deflate_read(dr, &out[out_len], len);
+		if (res > 0)
+			out_len += res;
+	}
+	while (res > 0);
+
+	if (res == 0)
+	{
+		uint8_t trailer[4];
+		res = lib_deflate_read_trailer(dr, trailer, 4);
+		if (res >= 0)
+		{
+			uint32_t adler = ((uint32_t) trailer[0] << 24) | (trailer[1] << 16) | (trailer[2] << 8) | trailer[3];
+			res = (adler == lib_adler32(out, out_len, LIB_ADLER32_INIT)) ? (ssize_t) out_len : BAD_ADLER;
+		}
+	}
+	lib_deflate_destroy(dr);
+	return res;
+}
+
+// a deflate writer, just enough to write every kind of block.
+struct test_writer {
+	uint8_t *buf;
+	size_t len;
+	uint32_t bits;
+	int bitlen;
+};
+
+static void
+put_bits(struct test_writer *tw, uint32_t value, int num)
+{
+	tw->bits |= value << tw->bitlen;
+	tw->bitlen += num;
+	while (tw->bitlen >= 8)
+	{
+		tw->buf[tw->len++] = tw->bits;
+		tw->bits >>= 8;
+		tw->bitlen -= 8;
+	}
+}
+
+static void
+put_code(struct test_writer *tw, uint16_t code, int len)
+{ // huffman codes are sent starting at the most significant bit.
+	int i;
+	for (i=len-1; i>=0; i--)
+		put_bits(tw, (code >> i) & 1, 1);
+}
+
+static void
+put_align(struct test_writer *tw)
+{
+	if (tw->bitlen & 7)
+		put_bits(tw, 0, 8 - (tw->bitlen & 7));
+}
+
+static void
+canonical_codes(const uint8_t *lens, int num, uint16_t *codes)
+{ // RFC 1951 section 3.2.2
+	int count[16] = {0};
+	int next[16];
+	int i;
+	for (i=0; i<num; i++)
+		count[ lens[i] ]++;
+	count[0] = 0;
+	int code = 0;
+	for (i=1; i<16; i++)
+	{
+		code = (code + count[i - 1]) << 1;
+		next[i] = code;
+	}
+	for (i=0; i<num; i++)
+		if (lens[i])
+			codes[i] = next[ lens[i] ]++;
+}
+
+static void
+shuffle(uint16_t *values, int num)
+{
+	int i;
+	for (i=num-1; i>0; i--)
+	{
+		int j = rand() % (i + 1);
+		uint16_t t = values[i];
+		values[i] = values[j];
+		values[j] = t;
+	}
+}
+
+static void
+random_lengths(uint8_t *lens, int num, const uint16_t *symbols, int used, int max_len)
+{ // a complete code for the used symbols: leaves of a random tree, now and then grown as deep as allowed.
+	uint8_t depths[288];
+	int leaves = 2;
+	depths[0] = depths[1] = 1;
+	while (leaves < used)
+	{
+		int i = rand() % leaves;
+		if (rand() % 4 == 0)
+		{
+			int j;
+			for (j=0; j<leaves; j++)
+				if (depths[j] < max_len && depths[j] > depths[i])
+					i = j;
+		}
+		if (depths[i] >= max_len)
+			continue;
+		depths[i]++;
+		depths[leaves++] = depths[i];
+	}
+	memset(lens, 0, num);
+	int i;
+	for (i=0; i<used; i++)
+		lens[ symbols[i] ] = depths[i];
+}
+
+static const uint16_t test_clp[29] = {
+	3,4,5,6,7,8,9,10,11,13,15,17,19,23,27,31,35,43,51,59,67,83,99,115,131,163,195,227,258
+};
+static const uint8_t test_clb[29] = {
+	0,0,0,0,0,0,0,0,1,1,1,1,2,2,2,2,3,3,3,3,4,4,4,4,5,5,5,5,0
+};
+static const uint16_t test_dcp[30] = {
+	1,2,3,4,5,7,9,13,17,25,33,49,65,97,129,193,257,385,513,769,1025,1537,2049,3073,4097,6145,8193,12289,16385,24577
+};
+static const uint8_t test_dcb[30] = {
+	0,0,0,0,1,1,2,2,3,3,4,4,5,5,6,6,7,7,8,8,9,9,10,10,11,11,12,12,13,13
+};
+
+static void
+put_lengths(struct test_writer *tw, const uint8_t *lc_lens, int lc_num, const uint8_t *dc_lens, int dc_num)
+{ // the code lengths of a dynamic block, as one run-length coded sequence with a random code for the 19 symbols.
+	static const uint8_t blc_order[19] = {
+		16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15,
+	};
+	uint8_t lens[288 + 32];
+	memcpy(lens, lc_lens, lc_num);
+	memcpy(&lens[lc_num], dc_lens, dc_num);
+	int num = lc_num + dc_num;
+
+	uint16_t symbols[19];
+	uint8_t blc_lens[19];
+	uint16_t blc_codes[19];
+	int i;
+	for (i=0; i<19; i++)
+		symbols[i] = i;
+	shuffle(symbols, 19);
+	random_lengths(blc_lens, 19, symbols, 19, 7);
+	canonical_codes(blc_lens, 19, blc_codes);
+
+	put_bits(tw, lc_num - 257, 5);
+	put_bits(tw, dc_num - 1, 5);
+	put_bits(tw, 19 - 4, 4);
+	for (i=0; i<19; i++)
+		put_bits(tw, blc_lens[ blc_order[i] ], 3);
+
+	i = 0;
+	while (i < num)
+	{
+		int run = 1;
+		while (i + run < num && lens[i + run] == lens[i])
+			run++;
+		if (lens[i] == 0 && run >= 11 && rand() % 4)
+		{
+			run = 11 + rand() % ((run > 138 ? 138 : run) - 10);
+			put_code(tw, blc_codes[18], blc_lens[18]);
+			put_bits(tw, run - 11, 7);
+		}
+		else if (lens[i] == 0 && run >= 3 && rand() % 4)
+		{
+			run = 3 + rand() % ((run > 10 ? 10 : run) - 2);
+			put_code(tw, blc_codes[17], blc_lens[17]);
+			put_bits(tw, run - 3, 3);
+		}
+		else if (i > 0 && lens[i] == lens[i - 1] && run >= 3 && rand() % 4)
+		{
+			run = 3 + rand() % ((run > 6 ? 6 : run) - 2);
+			put_code(tw, blc_codes[16], blc_lens[16]);
+			put_bits(tw, run - 3, 2);
+		}
+		else
+		{
+			run = 1;
+			put_code(tw, blc_codes[ lens[i] ], blc_lens[ lens[i] ]);
+		}
+		i += run;
+	}
+}
+
+static void
+put_block(struct test_writer *tw, bool last, uint8_t *out, size_t *out_len, size_t out_cap, int window)
+{ // a random block, its data is added to out.
+	int type = rand() % 3;
+	put_bits(tw, last | (type << 1), 3);
+
+	if (type == 0)
+	{
+		int len = rand() % (rand() % 8 ? 2000 : 65536);
+		if (len > out_cap - *out_len)
+			len = out_cap - *out_len;
+		put_align(tw);
+		put_bits(tw, len, 16);
+		put_bits(tw, len ^ 0xffff, 16);
+		int i;
+		for (i=0; i<len; i++)
+		{
+			out[*out_len] = rand();
+			put_bits(tw, out[(*out_len)++], 8);
+		}
+		return;
+	}
+
+	uint8_t lc_lens[288], dc_lens[32];
+	uint16_t lc_codes[288], dc_codes[32];
+	int lc_num = 288, dc_num = 32;
+	if (type == 1)
+	{
+		memset(&lc_lens[0], 8, 144);
+		memset(&lc_lens[144], 9, 256-144);
+		memset(&lc_lens[256], 7, 280-256);
+		memset(&lc_lens[280], 8, 288-280);
+		memset(dc_lens, 5, 32);
+	}
+	else
+	{ // the end of block, some literals and some lengths and distances.
+		uint16_t symbols[286];
+		int i, used = 0;
+		for (i=0; i<256; i++)
+			symbols[i] = i;
+		shuffle(symbols, 256);
+		used = 1 + rand() % 256;
+		symbols[used++] = 256;
+		uint16_t lengths[29];
+		for (i=0; i<29; i++)
+			lengths[i] = 257 + i;
+		shuffle(lengths, 29);
+		int lengths_used = rand() % 30;
+		memcpy(&symbols[used], lengths, lengths_used * sizeof(uint16_t));
+		used += lengths_used;
+		random_lengths(lc_lens, 286, symbols, used, 15);
+
+		uint16_t distances[30];
+		for (i=0; i<30; i++)
+			distances[i] = i;
+		shuffle(distances, 30);
+		random_lengths(dc_lens, 30, distances, 2 + rand() % 29, 15);
+
+		for (lc_num=286; lc_lens[lc_num - 1] == 0; lc_num--);
+		for (dc_num=30; dc_num > 1 && dc_lens[dc_num - 1] == 0; dc_num--);
+		put_lengths(tw, lc_lens, lc_num, dc_lens, dc_num);
+	}
+	canonical_codes(lc_lens, lc_num, lc_codes);
+	canonical_codes(dc_lens, dc_num, dc_codes);
+
+	int tokens = rand() % 3000;
+	while (tokens-- > 0 && *out_len + 258 <= out_cap)
+	{
+		int lc = rand() % 286;
+		if (lc_lens[lc] == 0 || lc == 256)
+			continue;
+		if (lc < 256)
+		{
+			put_code(tw, lc_codes[lc], lc_lens[lc]);
+			out[(*out_len)++] = lc;
+			continue;
+		}
+		int limit = *out_len < window ? *out_len : window;
+		int dc = rand() % 30;
+		if (dc_lens[dc] == 0 || test_dcp[dc] > limit)
+			continue;
+		int len_extra = test_clb[lc - 257] ? rand() % (1 << test_clb[lc - 257]) : 0;
+		int dist_extra = test_dcb[dc] ? rand() % (1 << test_dcb[dc]) : 0;
+		if (test_dcp[dc] + dist_extra > limit)
+			dist_extra = limit - test_dcp[dc];
+		put_code(tw, lc_codes[lc], lc_lens[lc]);
+		put_bits(tw, len_extra, test_clb[lc - 257]);
+		put_code(tw, dc_codes[dc], dc_lens[dc]);
+		put_bits(tw, dist_extra, test_dcb[dc]);
+		int len = test_clp[lc - 257] + len_extra;
+		int dist = test_dcp[dc] + dist_extra;
+		while (len-- > 0)
+		{
+			out[*out_len] = out[*out_len - dist];
+			(*out_len)++;
+		}
+	}
+	put_code(tw, lc_codes[256], lc_lens[256]);
+}
+
+static void
+put_zlib_header(struct test_writer *tw, int window_bits)
+{
+	uint8_t cmf = ((window_bits - 8) << 4) | 8;
+	put_bits(tw, cmf, 8);
+	put_bits(tw, (31 - (cmf << 8) % 31) % 31, 8);
+}
+
+static void
+put_adler(struct test_writer *tw, const uint8_t *data, size_t len)
+{
+	put_align(tw);
+	uint32_t adler = lib_adler32(data, len, LIB_ADLER32_INIT);
+	int i;
+	for (i=24; i>=0; i-=8)
+		put_bits(tw, (adler >> i) & 0xff, 8);
+}
+
+static void
+do_test_reference(void)
+{ // streams from zlib itself, one of every block type.
+	static uint8_t text[400], out[400];
+	size_t text_len = make_ref_text(text);
+	assert(((ref_stored[2] >> 1) & 3) == 0 && ((ref_fixed[2] >> 1) & 3) == 1 && ((ref_dynamic[2] >> 1) & 3) == 2);
+
+	assert(test_inflate(ref_stored, sizeof(ref_stored), out, sizeof(out)) == 22);
+	assert(memcmp(out, "BADGE.TEAM framebuffer", 22) == 0);
+	assert(test_inflate(ref_fixed, sizeof(ref_fixed), out, sizeof(out)) == 22);
+	assert(memcmp(out, "BADGE.TEAM framebuffer", 22) == 0);
+	assert(test_inflate(ref_dynamic, sizeof(ref_dynamic), out, sizeof(out)) == text_len);
+	assert(memcmp(out, text, text_len) == 0);
+}
+
+static void
+do_test_random(uint8_t *zlib, uint8_t *data, uint8_t *out)
+{ // streams of random blocks with matches reaching as far back as the window allows, also truncated ones.
+	size_t total = 0, truncated = 0;
+	int i;
+	for (i=0; i<N_RAND_STREAMS; i++)
+	{
+		struct test_writer tw = { zlib, 0, 0, 0 };
+		int window_bits = 8 + rand() % 8;
+		put_zlib_header(&tw, window_bits);
+		size_t data_len = 0;
+		int blocks = 1 + rand() % 6;
+		while (blocks-- > 0)
+			put_block(&tw, blocks == 0, data, &data_len, MAX_OUTPUT / 2, 1 << window_bits);
+		put_adler(&tw, data, data_len);
+
+		ssize_t res = test_inflate(zlib, tw.len, out, MAX_OUTPUT);
+		if (res != data_len)
+			fprintf(stderr, "stream %d: %d bytes of %u\n", i, (int) res, (unsigned int) data_len);
+		assert(res == data_len);
+		assert(memcmp(out, data, data_len) == 0);
+		total += data_len;
+
+		// a stream cut short anywhere fails, with a wrong checksum at worst.
+		int j;
+		for (j=0; j<8; j++)
+		{
+			size_t len = 2 + rand() % (tw.len - 2);
+			res = test_inflate(zlib, len, out, MAX_OUTPUT);
+			if (res >= 0)
+				fprintf(stderr, "stream %d cut to %u of %u bytes: %d bytes\n", i, (unsigned int) len, (unsigned int) tw.len, (int) res);
+			assert(res < 0);
+			truncated++;
+		}
+	}
+	printf("%d streams inflated to %u bytes, %u truncated streams rejected\n", N_RAND_STREAMS, (unsigned int) total, (unsigned int) truncated);
+}
+
+static ssize_t
+test_dynamic(const uint8_t *lc_lens, int lc_num, const uint8_t *dc_lens, int dc_num)
+{ // inflates a single empty dynamic block with the given code lengths.
+	static uint8_t lc_all[288], dc_all[32];
+	uint8_t zlib[1024], out[1];
+	struct test_writer tw = { zlib, 0, 0, 0 };
+	memcpy(lc_all, lc_lens, lc_num);
+	memcpy(dc_all, dc_lens, dc_num);
+	put_zlib_header(&tw, 15);
+	put_bits(&tw, 1 | (2 << 1), 3);
+	put_lengths(&tw, lc_all, lc_num, dc_all, dc_num);
+	uint16_t lc_codes[288];
+	canonical_codes(lc_all, lc_num, lc_codes);
+	if (lc_all[256])
+		put_code(&tw, lc_codes[256], lc_all[256]);
+	put_adler(&tw, out, 0);
+	return test_inflate(zlib, tw.len, out, sizeof(out));
+}
+
+static ssize_t
+test_fixed(int lc, int dc, int dist_extra)
+{ // inflates a fixed block holding the literal 'x' followed by a single symbol, or a match when dc >= 0.
+	uint8_t zlib[64], out[512];
+	struct test_writer tw = { zlib, 0, 0, 0 };
+	put_zlib_header(&tw, 15);
+	put_bits(&tw, 1 | (1 << 1), 3);
+	put_code(&tw, 0x30 + 'x', 8);
+	if (lc < 280)
+		put_code(&tw, lc - 256, 7);
+	else
+		put_code(&tw, 0xc0 + lc - 280, 8);
+	if (dc >= 0)
+	{
+		put_code(&tw, dc, 5);
+		put_bits(&tw, dist_extra, test_dcb[dc % 30]);
+		put_code(&tw, 0, 7);
+	}
+	put_adler(&tw, (const uint8_t *) "x", 1);
+	return test_inflate(zlib, tw.len, out, sizeof(out));
+}
+
+static void
+do_test_crossing(void)
+{ // a repeated code length may run on from the literal/length into the distance code lengths.
+	static const uint8_t blc_lens[16] = { 2, 2, 2, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 2 };
+	uint8_t zlib[64], out[16];
+	struct test_writer tw = { zlib, 0, 0, 0 };
+	put_zlib_header(&tw, 15);
+	put_bits(&tw, 1 | (2 << 1), 3);
+	put_bits(&tw, 258 - 257, 5);
+	put_bits(&tw, 4 - 1, 5);
+	put_bits(&tw, 16 - 4, 4);
+	int i;
+	for (i=0; i<16; i++)
+		put_bits(&tw, blc_lens[i], 3); // 2, 16, 17 and 18 are 00, 01, 10 and 11
+
+	// 254 zeros, then length 2 for the literals 254 and 255, the end of block, length 3 and the four distances.
+	put_code(&tw, 3, 2);
+	put_bits(&tw, 138 - 11, 7);
+	put_code(&tw, 3, 2);
+	put_bits(&tw, 116 - 11, 7);
+	put_code(&tw, 0, 2);
+	put_code(&tw, 1, 2);
+	put_bits(&tw, 6 - 3, 2);
+	put_code(&tw, 0, 2);
+
+	// 254 and 255, three bytes from two back and the end of block.
+	static const uint8_t data[5] = { 254, 255, 254, 255, 254 };
+	put_code(&tw, 0, 2);
+	put_code(&tw, 1, 2);
+	put_code(&tw, 3, 2);
+	put_code(&tw, 1, 2);
+	put_code(&tw, 2, 2);
+	put_adler(&tw, data, sizeof(data));
+	assert(test_inflate(zlib, tw.len, out, sizeof(out)) == sizeof(data));
+	assert(memcmp(out, data, sizeof(data)) == 0);
+}
+
+static void
+do_test_errors(void)
+{ // streams that break the rules are rejected with the matching error.
+	// over-subscribed and incomplete literal/length and distance codes.
+	uint8_t lc_lens[288] = {0}, dc_lens[32] = {0};
+	dc_lens[0] = dc_lens[1] = 1;
+	lc_lens[0] = lc_lens[1] = lc_lens[256] = 1;
+	assert(test_dynamic(lc_lens, 257, dc_lens, 2) == -LIB_DEFLATE_ERROR_UNBALANCED_HUFFMAN_TREE);
+	lc_lens[1] = 0;
+	lc_lens[256] = 2;
+	assert(test_dynamic(lc_lens, 257, dc_lens, 2) == -LIB_DEFLATE_ERROR_UNBALANCED_HUFFMAN_TREE);
+	lc_lens[1] = 2;
+	assert(test_dynamic(lc_lens, 257, dc_lens, 2) == 0);
+	dc_lens[2] = 1;
+	assert(test_dynamic(lc_lens, 257, dc_lens, 3) == -LIB_DEFLATE_ERROR_UNBALANCED_HUFFMAN_TREE);
+	dc_lens[2] = 0;
+	dc_lens[1] = 2;
+	assert(test_dynamic(lc_lens, 257, dc_lens, 2) == -LIB_DEFLATE_ERROR_UNBALANCED_HUFFMAN_TREE);
+
+	// an incomplete code for the code lengths, a repeat of nothing and a repeat past the last code length.
+	uint8_t zlib[64], out[1];
+	struct test_writer tw = { zlib, 0, 0, 0 };
+	put_zlib_header(&tw, 15);
+	put_bits(&tw, 1 | (2 << 1), 3);
+	put_bits(&tw, 0, 5);
+	put_bits(&tw, 0, 5);
+	put_bits(&tw, 0, 4);
+	put_bits(&tw, 1, 3);
+	put_bits(&tw, 0, 9);
+	put_align(&tw);
+	assert(test_inflate(zlib, tw.len, out, sizeof(out)) == -LIB_DEFLATE_ERROR_UNBALANCED_HUFFMAN_TREE);
+
+	int repeat;
+	for (repeat=16; repeat<=18; repeat++)
+	{ // the repeat code of one bit, two other code lengths of two bits.
+		static const uint8_t blc_lens[3][4] = { { 1, 2, 2, 0 }, { 2, 1, 0, 2 }, { 2, 0, 1, 2 } };
+		tw.len = tw.bits = tw.bitlen = 0;
+		put_zlib_header(&tw, 15);
+		put_bits(&tw, 1 | (2 << 1), 3);
+		put_bits(&tw, 0, 5);
+		put_bits(&tw, 0, 5);
+		put_bits(&tw, 0, 4);
+		int i;
+		for (i=0; i<4; i++)
+			put_bits(&tw, blc_lens[repeat - 16][i], 3);
+		if (repeat == 16)
+		{
+			put_code(&tw, 0, 1);
+			put_bits(&tw, 0, 2);
+		}
+		else
+		{ // as many zeros as allowed at once, until there are more than 257 + 1 code lengths.
+			int max = (repeat == 17) ? 10 : 138;
+			for (i=0; i<258/max+1; i++)
+			{
+				put_code(&tw, 0, 1);
+				put_bits(&tw, (repeat == 17) ? 7 : 127, (repeat == 17) ? 3 : 7);
+			}
+		}
+		put_align(&tw);
+		put_bits(&tw, 0, 32);
+		assert(test_inflate(zlib, tw.len, out, sizeof(out)) == -LIB_DEFLATE_ERROR_DYNAMIC_HUFFMAN_SETUP_ERROR);
+	}
+
+	// stored blocks must have their length twice, the second time inverted.
+	tw.len = tw.bits = tw.bitlen = 0;
+	put_zlib_header(&tw, 15);
+	put_bits(&tw, 1, 3);
+	put_align(&tw);
+	put_bits(&tw, 1, 16);
+	put_bits(&tw, 0xffff, 16);
+	put_bits(&tw, 'x', 8);
+	put_adler(&tw, (const uint8_t *) "x", 1);
+	assert(test_inflate(zlib, tw.len, out, sizeof(out)) == -LIB_DEFLATE_ERROR_INVALID_COPY_LENGTH);
+
+	// the reserved block type.
+	tw.len = tw.bits = tw.bitlen = 0;
+	put_zlib_header(&tw, 15);
+	put_bits(&tw, 1 | (3 << 1), 3);
+	put_align(&tw);
+	put_bits(&tw, 0, 32);
+	assert(test_inflate(zlib, tw.len, out, sizeof(out)) == -LIB_DEFLATE_ERROR_RESERVED_BLOCK_TYPE);
+
+	// fixed blocks: a match right after the only byte is fine, reaching further back or the reserved symbols are not.
+	assert(test_fixed(256, -1, 0) == 1);
+	assert(test_fixed(257, 0, 0) == BAD_ADLER);
+	assert(test_fixed(257, 1, 0) == -LIB_DEFLATE_ERROR_HUFFMAN_INVALID_DISTANCE);
+	assert(test_fixed(286, 0, 0) == -LIB_DEFLATE_ERROR_HUFFMAN_RESERVED_LENGTH);
+	assert(test_fixed(287, 0, 0) == -LIB_DEFLATE_ERROR_HUFFMAN_RESERVED_LENGTH);
+	assert(test_fixed(257, 30, 0) == -LIB_DEFLATE_ERROR_HUFFMAN_RESERVED_LENGTH);
+	assert(test_fixed(257, 31, 0) == -LIB_DEFLATE_ERROR_HUFFMAN_RESERVED_LENGTH);
+}
+
+int
+main(void)
+{
+	srand(42);
+	uint8_t *zlib = (uint8_t *) malloc(2 * MAX_OUTPUT);
+	uint8_t *data = (uint8_t *) malloc(MAX_OUTPUT);
+	uint8_t *out = (uint8_t *) malloc(MAX_OUTPUT);
+	assert(zlib && data && out);
+
+	do_test_reference();
+	do_test_random(zlib, data, out);
+	do_test_crossing();
+	do_test_errors();
+
+	free(zlib);
+	free(data);
+	free(out);
+	printf("OK\n");
+	return 0;
+}
+
+#endif // LIB_DEFLATE_READER_TEST
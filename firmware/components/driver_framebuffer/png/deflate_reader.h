@@ -26,13 +26,23 @@ enum lib_deflate_error_t {
 	LIB_DEFLATE_ERROR_TOP,
 };
 
+// Huffman codes are decoded with a lookup table indexed by the next ROOT bits of input, codes longer than
+// that continue in a second-level table. The sizes are the worst case for the number of symbols (zlib's ENOUGH).
+#define LIB_DEFLATE_LC_ROOT 9
+#define LIB_DEFLATE_LC_TABLE_SIZE 852
+#define LIB_DEFLATE_DC_ROOT 6
+#define LIB_DEFLATE_DC_TABLE_SIZE 592
+
 struct lib_deflate_reader {
 	lib_reader_read_t read;
 	void *read_p;
 
-	uint8_t bitbuf[2];
+	uint32_t bitbuf;
 	uint8_t bitlen;
 
+	int in_pos;
+	int in_len;
+
 	bool is_last_block;
 	enum lib_deflate_state_t state;
 	int lb_size;
@@ -42,8 +52,13 @@ struct lib_deflate_reader {
 	int copy_dist;
 	int copy_len;
 
-	uint16_t huffman_lc_tree[288+15];
-	uint16_t huffman_dc_tree[32+15];
+	const uint16_t *lc_table;
+	const uint16_t *dc_table;
+
+	// not cleared by lib_deflate_init
+	uint8_t in_buf[128];
+	uint16_t huffman_lc_table[LIB_DEFLATE_LC_TABLE_SIZE];
+	uint16_t huffman_dc_table[LIB_DEFLATE_DC_TABLE_SIZE];
 
 	uint8_t look_behind[];
 };
@@ -51,6 +66,7 @@ struct lib_deflate_reader {
 extern struct lib_deflate_reader * lib_deflate_new(lib_reader_read_t read, void *read_p, int lb_capacity);
 extern void lib_deflate_init(struct lib_deflate_reader *dr, lib_reader_read_t read, void *read_p);
 extern ssize_t lib_deflate_read(struct lib_deflate_reader *dr, uint8_t *buf, size_t buf_len);
+extern ssize_t lib_deflate_read_trailer(struct lib_deflate_reader *dr, uint8_t *buf, size_t buf_len);
 extern void lib_deflate_destroy(struct lib_deflate_reader *dr);
 
 #endif // LIB_DEFLATE_READER_H
@@ -3,6 +3,11 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include <unistd.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
 
 struct lib_file_reader {
 	int fd;
@@ -16,4 +21,8 @@ extern struct lib_file_reader * lib_file_new(const char *filename, int bufsize);
 extern ssize_t lib_file_read(struct lib_file_reader *fr, uint8_t *buf, size_t buf_len);
 extern void lib_file_destroy(struct lib_file_reader *fr);
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif // LIB_FILE_READER_H
@@ -3,6 +3,11 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include <unistd.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
 
 struct lib_mem_reader {
 	const uint8_t *data;
@@ -13,4 +18,8 @@ extern struct lib_mem_reader * lib_mem_new(const uint8_t *data, size_t len);
 extern ssize_t lib_mem_read(struct lib_mem_reader *mr, uint8_t *buf, size_t buf_len);
 extern void lib_mem_destroy(struct lib_mem_reader *mr);
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif // LIB_MEM_READER_H
@@ -116,10 +116,9 @@ lib_png_chunk_read_data(struct lib_png_reader *pr, uint8_t *buf, size_t buf_len)
 	return buf_len;
 }
 
-ssize_t
-lib_png_chunk_read_idat(struct lib_png_reader *pr, uint8_t *buf, size_t buf_len)
-{
-	ssize_t res_len = 0;
+static ssize_t
+lib_png_chunk_read_idat_some(struct lib_png_reader *pr, uint8_t *buf, size_t buf_len)
+{ // reads no further than the end of the current IDAT chunk, so the deflate reader never reads past the image data
 	while (buf_len > 0)
 	{
 		while (!pr->chunk.in_chunk)
@@ -144,6 +143,20 @@ lib_png_chunk_read_idat(struct lib_png_reader *pr, uint8_t *buf, size_t buf_len)
 		}
 
 		ssize_t res = lib_png_chunk_read_data(pr, buf, buf_len);
+		if (res != 0)
+			return res;
+	}
+
+	return 0;
+}
+
+ssize_t
+lib_png_chunk_read_idat(struct lib_png_reader *pr, uint8_t *buf, size_t buf_len)
+{
+	ssize_t res_len = 0;
+	while (buf_len > 0)
+	{
+		ssize_t res = lib_png_chunk_read_idat_some(pr, buf, buf_len);
 		if (res < 0)
 			return res;
 
@@ -189,11 +202,73 @@ lib_png_paeth(uint8_t _a, uint8_t _b, uint8_t _c)
 	return _c;
 }
 
+#ifdef CONFIG_DRIVER_FRAMEBUFFER_ENABLE
+static uint32_t
+lib_png_color(uint32_t color)
+{
+	return color; // rows that are dithered hold colors until the whole row is known
+}
+#endif
+
 static inline int
 lib_png_decode(Window* window, struct lib_png_reader *pr, uint32_t width, uint32_t height, uint32_t scanline_width, uint16_t offset_x, uint16_t offset_y, uint32_t dst_min_x, uint32_t dst_min_y, uint32_t dst_width, uint32_t dst_height, uint32_t dst_pixlen, uint32_t dst_linelen)
 {
 	memset(pr->scanline, 0, scanline_width);
 
+#ifdef CONFIG_DRIVER_FRAMEBUFFER_ENABLE
+	// rows are converted to the pixel format of the target, only as far as they are visible
+	const pixel_ops_t *ops = driver_framebuffer_get_ops(window);
+	if (ops == NULL)
+		return 0;
+
+	uint32_t row_end = width < dst_width ? width : dst_width;
+	if ((int32_t) dst_width < 0 || row_end < dst_min_x)
+		row_end = dst_min_x; // nothing is visible
+	uint32_t row_len = row_end - dst_min_x;
+
+	pr->row = (uint32_t *) malloc((row_len + 1) * sizeof(uint32_t));
+	if (pr->row == NULL)
+		return -LIB_PNG_ERROR_OUT_OF_MEMORY;
+
+	// formats that can not show every color diffuse the error of every pixel over the pixels around it
+	pr->dither = driver_framebuffer_dither_new(ops, row_len);
+	uint32_t (*encode)(uint32_t) = pr->dither != NULL ? lib_png_color : ops->encode;
+
+	uint8_t depth = pr->ihdr.bit_depth;
+	uint8_t channel = depth == 16 ? 2 : 1; // bytes per channel, only the most significant byte is used
+	if (pr->ihdr.color_type == 4 || pr->ihdr.color_type == 6)
+	{
+		pr->row_alpha = (uint8_t *) malloc(row_len + 1);
+		if (pr->row_alpha == NULL)
+			return -LIB_PNG_ERROR_OUT_OF_MEMORY;
+	}
+
+	// grey levels and palette entries are converted once
+	if (pr->ihdr.color_type == 0 || pr->ihdr.color_type == 3 || pr->ihdr.color_type == 4)
+	{
+		pr->lut = (uint32_t *) malloc(256 * sizeof(uint32_t));
+		if (pr->lut == NULL)
+			return -LIB_PNG_ERROR_OUT_OF_MEMORY;
+
+		uint32_t i;
+		for (i=0; i<256; i++)
+		{
+			uint32_t color = 0; // palette indices out of range are black
+			if (pr->ihdr.color_type == 3)
+			{
+				if ((int) i < pr->palette_len)
+					color = (pr->palette[i*3 + 0] << 16) | (pr->palette[i*3 + 1] << 8) | pr->palette[i*3 + 2];
+			}
+			else
+			{
+				uint32_t grey = depth < 8 ? (i & ((1 << depth) - 1)) * (255 / ((1 << depth) - 1)) : i;
+				color = grey * 0x010101;
+			}
+			pr->lut[i] = encode(color);
+		}
+	}
+#endif
+
 	uint32_t y;
 	for (y=0; y<height; y++)
 	{
@@ -285,115 +360,69 @@ lib_png_decode(Window* window, struct lib_png_reader *pr, uint32_t width, uint32
 				return -LIB_PNG_ERROR_INVALID_PNG_SCANLINE_TYPE;
 		}
 
-		for (x=0; x<width; x++)
+#ifdef CONFIG_DRIVER_FRAMEBUFFER_ENABLE
+		if (y < dst_min_y || (int32_t) y >= (int32_t) dst_height || row_len == 0)
+			continue;
+
+		const uint8_t *line = pr->scanline;
+		uint32_t *out = pr->row;
+		uint8_t *alpha_out = pr->row_alpha;
+		switch (pr->ihdr.color_type)
 		{
-			uint16_t r=0, g=0, b=0, a=0;
-			switch (pr->ihdr.color_type)
-			{
-				case 0:
-					a = 0xffff;
-					switch (pr->ihdr.bit_depth)
-					{
-						case 16:
-							r = g = b = (pr->scanline[x*2 + 0] << 8) | pr->scanline[x*2 + 1];
-							break;
-						case 8:
-							r = g = b = pr->scanline[x] * 0x0101;
-							break;
-						case 4:
-							r = g = b = ((pr->scanline[x>>1] >> (((x^1)&1)*4)) & 15) * 0x1111;
-							break;
-						case 2:
-							r = g = b = ((pr->scanline[x>>2] >> (((x^3)&3)*2)) & 3) * 0x5555;
-							break;
-						case 1:
-							r = g = b = ((pr->scanline[x>>3] >> ((x^7)&7)) & 1) * 0xffff;
-							break;
-					}
-					break;
-				case 2:
-					a = 0xffff;
-					switch (pr->ihdr.bit_depth)
-					{
-						case 16:
-							r = (pr->scanline[x*6 + 0] << 8) | pr->scanline[x*6 + 1];
-							g = (pr->scanline[x*6 + 2] << 8) | pr->scanline[x*6 + 3];
-							b = (pr->scanline[x*6 + 4] << 8) | pr->scanline[x*6 + 5];
-							break;
-						case 8:
-							r = pr->scanline[x*3 + 0] * 0x0101;
-							g = pr->scanline[x*3 + 1] * 0x0101;
-							b = pr->scanline[x*3 + 2] * 0x0101;
-							break;
-					}
-					break;
-				case 3:
-					a = 0xffff;
-					switch (pr->ihdr.bit_depth)
-					{
-						case 8:
-							b = pr->scanline[x];
-							break;
-						case 4:
-							b = (pr->scanline[x>>1] >> (((x^1)&1)*4)) & 15;
-							break;
-						case 2:
-							b = (pr->scanline[x>>2] >> (((x^3)&3)*2)) & 3;
-							break;
-						case 1:
-							b = (pr->scanline[x>>3] >> ((x^7)&7)) & 1;
-							break;
-					}
-					if (b < pr->palette_len)
-					{
-						r = pr->palette[b*3 + 0] * 0x0101;
-						g = pr->palette[b*3 + 1] * 0x0101;
-						b = pr->palette[b*3 + 2] * 0x0101;
-					}
-					else
-					{
-						r = g = b = 0; // or should this be an error?
-					}
-					break;
-				case 4:
-					switch (pr->ihdr.bit_depth)
-					{
-						case 16:
-							r = g = b = (pr->scanline[x*4 + 0] << 8) | pr->scanline[x*4 + 1];
-							a = (pr->scanline[x*4 + 2] << 8) | pr->scanline[x*4 + 3];
-							break;
-						case 8:
-							r = g = b = pr->scanline[x*2 + 0] * 0x0101;
-							a = pr->scanline[x*2 + 1] * 0x0101;
-							break;
-					}
-					break;
-				case 6:
-					switch (pr->ihdr.bit_depth)
+			case 0:
+			case 3:
+				if (depth < 8)
+				{
+					uint32_t mask = (1 << depth) - 1;
+					for (x=dst_min_x; x<row_end; x++)
 					{
-						case 16:
-							r = (pr->scanline[x*8 + 0] << 8) | pr->scanline[x*8 + 1];
-							g = (pr->scanline[x*8 + 2] << 8) | pr->scanline[x*8 + 3];
-							b = (pr->scanline[x*8 + 4] << 8) | pr->scanline[x*8 + 5];
-							a = (pr->scanline[x*8 + 6] << 8) | pr->scanline[x*8 + 7];
-							break;
-						case 8:
-							r = pr->scanline[x*4 + 0] * 0x0101;
-							g = pr->scanline[x*4 + 1] * 0x0101;
-							b = pr->scanline[x*4 + 2] * 0x0101;
-							a = pr->scanline[x*4 + 3] * 0x0101;
-							break;
+						uint32_t bit = x * depth;
+						*out++ = pr->lut[(line[bit >> 3] >> (8 - depth - (bit & 7))) & mask];
 					}
-					break;
-			}
+				}
+				else
+				{
+					for (x=dst_min_x; x<row_end; x++)
+						*out++ = pr->lut[line[x * channel]];
+				}
+				break;
+			case 2:
+				for (x=dst_min_x; x<row_end; x++)
+				{
+					const uint8_t *pixel = &line[x * channel * 3];
+					*out++ = encode((pixel[0] << 16) | (pixel[channel] << 8) | pixel[channel * 2]);
+				}
+				break;
+			case 4:
+				for (x=dst_min_x; x<row_end; x++)
+				{
+					const uint8_t *pixel = &line[x * channel * 2];
+					*out++ = pr->lut[pixel[0]];
+					*alpha_out++ = pixel[channel];
+				}
+				break;
+			case 6:
+				for (x=dst_min_x; x<row_end; x++)
+				{
+					const uint8_t *pixel = &line[x * channel * 4];
+					*out++ = encode((pixel[0] << 16) | (pixel[channel] << 8) | pixel[channel * 2]);
+					*alpha_out++ = pixel[channel * 3];
+				}
+				break;
+		}
 
-			if (a != 0 && x >= dst_min_x && x < dst_width && y >= dst_min_y && y < dst_height)
-			{
-				#ifdef CONFIG_DRIVER_FRAMEBUFFER_ENABLE
-				driver_framebuffer_setPixel(window, offset_x + x, offset_y + y, ((r>>8)<<16)+((g>>8)<<8)+(b>>8));
-				#endif
-			}
+		if (pr->dither != NULL)
+			driver_framebuffer_dither_row(pr->dither, pr->row, pr->row_alpha, row_len);
+
+		uint8_t *alpha = pr->row_alpha;
+		if (alpha != NULL && pr->alpha_plane != NULL)
+		{
+			memcpy(&pr->alpha_plane[y * width + dst_min_x], alpha, row_len);
+			alpha = NULL;
 		}
+
+		driver_framebuffer_draw_row(window, (int16_t) (offset_x + dst_min_x), (int16_t) (offset_y + y), pr->row, alpha, row_len);
+#endif
 	}
 
 	return 0;
@@ -576,7 +605,7 @@ int lib_png_load_image(Window* window, struct lib_png_reader *pr, uint16_t offse
 	if (((rfc1950_hdr[0] << 8) + rfc1950_hdr[1]) % 31 != 0) // check checksum
 		return -LIB_PNG_ERROR_INVALID_DEFLATE_HEADER;
 
-	pr->dr = lib_deflate_new((lib_reader_read_t) &lib_png_chunk_read_idat, pr, windowsize);
+	pr->dr = lib_deflate_new((lib_reader_read_t) &lib_png_chunk_read_idat_some, pr, windowsize);
     //printf("allocated deflate with header: %d\n", windowsize);
 	if (pr->dr == NULL)
 		return -LIB_PNG_ERROR_OUT_OF_MEMORY;
@@ -596,13 +625,11 @@ int lib_png_load_image(Window* window, struct lib_png_reader *pr, uint16_t offse
 			return -LIB_PNG_ERROR_CHUNK_TOO_LARGE;
 	}
 
-	// verify adler
+	// verify adler, the deflate reader may already hold its bytes
 	uint32_t adler_chk;
-	res = lib_png_chunk_read_idat(pr, (uint8_t *) &adler_chk, 4);
+	res = lib_deflate_read_trailer(pr->dr, (uint8_t *) &adler_chk, 4);
 	if (res < 0)
 		return res;
-	if (res < 4)
-		return -LIB_PNG_ERROR_UNEXPECTED_END_OF_CHUNK;
 
 #if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
 	adler_chk = __builtin_bswap32(adler_chk);
@@ -655,6 +682,24 @@ lib_png_destroy(struct lib_png_reader *pr)
 		free(pr->scanline);
 	pr->scanline = NULL;
 
+	if (pr->lut)
+		free(pr->lut);
+	pr->lut = NULL;
+
+	if (pr->row)
+		free(pr->row);
+	pr->row = NULL;
+
+	if (pr->row_alpha)
+		free(pr->row_alpha);
+	pr->row_alpha = NULL;
+
+#ifdef CONFIG_DRIVER_FRAMEBUFFER_ENABLE
+	if (pr->dither)
+		driver_framebuffer_dither_destroy(pr->dither);
+	pr->dither = NULL;
+#endif
+
 	if (pr->dr)
 		lib_deflate_destroy(pr->dr);
 	pr->dr = NULL;
@@ -6,6 +6,7 @@
 
 #include "../include/driver_framebuffer_compositor.h"
 #include "../include/driver_framebuffer.h"
+#include "../include/driver_framebuffer_dither.h"
 
 #include "reader.h"
 
@@ -65,6 +66,12 @@ struct lib_png_reader {
 	uint32_t scanline_width;
 	uint8_t *scanline; // large enough for scanline + temp secondary scanline
 
+	uint32_t *lut; // grey level or palette index to pixel value of the target
+	uint32_t *row; // visible part of the scanline as pixel values of the target
+	uint8_t *row_alpha; // alpha of the visible part of the scanline, for images with an alpha channel
+	uint8_t *alpha_plane; // when set, alpha is stored here (width bytes per row) instead of being blended
+	dither_row_t *dither; // error carried to the next row, for targets that are dithered
+
 	struct lib_deflate_reader *dr;
 	uint32_t adler;
 };
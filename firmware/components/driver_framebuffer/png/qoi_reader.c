@@ -0,0 +1,612 @@
+/* TEST (from the driver_framebuffer directory, host/ stands in for ESP-IDF):
+ * gcc -o qoi_reader_test -DLIB_QOI_READER_TEST -Wall -g -I host -I png \
+ *     $(find ../driver_display_* ../driver_io_disobey_samd -maxdepth 1 -name include -printf '-I %p ') \
+ *     $(find . host png fonts -maxdepth 1 -name '*.c*') -lstdc++ -lm
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "qoi_reader.h"
+
+/* https://qoiformat.org/qoi-specification.pdf */
+
+#define QOI_OP_INDEX 0x00
+#define QOI_OP_DIFF  0x40
+#define QOI_OP_LUMA  0x80
+#define QOI_OP_RUN   0xC0
+#define QOI_OP_RGB   0xFE
+#define QOI_OP_RGBA  0xFF
+
+#define QOI_HEADER_SIZE 14
+#define QOI_END_SIZE    8
+#define QOI_PIXELS_MAX  400000000
+
+struct lib_qoi_reader *
+lib_qoi_new(lib_reader_read_t read, void *read_p)
+{
+	struct lib_qoi_reader *qr = (struct lib_qoi_reader *) malloc(sizeof(struct lib_qoi_reader));
+	if (qr == NULL)
+		return NULL;
+
+	memset(qr, 0, sizeof(struct lib_qoi_reader));
+	qr->read = read;
+	qr->read_p = read_p;
+
+	return qr;
+}
+
+static int
+lib_qoi_refill(struct lib_qoi_reader *qr, uint32_t trailer)
+{
+	// a valid image still holds at least one byte for every 62 pixels and the rest of the end marker,
+	// reading no more than that keeps readers that can not read past the end (flash) working
+	uint32_t want = (qr->pixels_left + 61) / 62 + trailer;
+	if (want > sizeof(qr->buf))
+		want = sizeof(qr->buf);
+
+	ssize_t res = qr->read(qr->read_p, qr->buf, want);
+	if (res < 0)
+		return res;
+	if (res == 0)
+		return -LIB_QOI_ERROR_UNEXPECTED_END_OF_FILE;
+
+	qr->buf_pos = 0;
+	qr->buf_len = res;
+	return 0;
+}
+
+static inline int
+lib_qoi_byte(struct lib_qoi_reader *qr, uint32_t trailer)
+{
+	if (qr->buf_pos == qr->buf_len)
+	{
+		int res = lib_qoi_refill(qr, trailer);
+		if (res < 0)
+			return res;
+	}
+
+	return qr->buf[qr->buf_pos++];
+}
+
+int
+lib_qoi_read_header(struct lib_qoi_reader *qr)
+{
+	// check if header is already read
+	if (qr->header_read)
+		return 0;
+
+	uint8_t hdr[QOI_HEADER_SIZE];
+	ssize_t res = qr->read(qr->read_p, hdr, QOI_HEADER_SIZE);
+	if (res < 0)
+		return res;
+	if (res < QOI_HEADER_SIZE)
+		return -LIB_QOI_ERROR_UNEXPECTED_END_OF_FILE;
+
+	if (memcmp(hdr, "qoif", 4) != 0)
+		return -LIB_QOI_ERROR_MISSING_SIGNATURE;
+
+	qr->header.width      = (hdr[4] << 24) | (hdr[5] << 16) | (hdr[6] << 8) | hdr[7];
+	qr->header.height     = (hdr[8] << 24) | (hdr[9] << 16) | (hdr[10] << 8) | hdr[11];
+	qr->header.channels   = hdr[12];
+	qr->header.colorspace = hdr[13];
+
+	// verify header
+	if (qr->header.width == 0 || qr->header.height == 0)
+		return -LIB_QOI_ERROR_INVALID_QOI_TYPE;
+	if (qr->header.height > QOI_PIXELS_MAX / qr->header.width)
+		return -LIB_QOI_ERROR_INVALID_QOI_TYPE;
+	if (qr->header.channels != 3 && qr->header.channels != 4)
+		return -LIB_QOI_ERROR_INVALID_QOI_TYPE;
+	if (qr->header.colorspace > 1)
+		return -LIB_QOI_ERROR_INVALID_QOI_TYPE;
+
+	qr->header_read = true;
+	qr->pixels_left = qr->header.width * qr->header.height;
+
+	return 0;
+}
+
+int
+lib_qoi_load_image(Window* window, struct lib_qoi_reader *qr, uint16_t offset_x, uint16_t offset_y, uint32_t dst_min_x, uint32_t dst_min_y, uint32_t dst_width, uint32_t dst_height)
+{
+	// read header
+	int res = lib_qoi_read_header(qr);
+	if (res < 0)
+		return res;
+
+#ifndef CONFIG_DRIVER_FRAMEBUFFER_ENABLE
+	return 0; // nothing to draw to
+#else
+	uint32_t width = qr->header.width;
+	uint32_t height = qr->header.height;
+
+	// rows are converted to the pixel format of the target, only as far as they are visible
+	const pixel_ops_t *ops = driver_framebuffer_get_ops(window);
+	if (ops == NULL)
+		return 0;
+
+	uint32_t row_end = width < dst_width ? width : dst_width;
+	if ((int32_t) dst_width < 0 || row_end < dst_min_x)
+		row_end = dst_min_x; // nothing is visible
+	uint32_t row_len = row_end - dst_min_x;
+
+	// rows below the visible area are not decoded at all
+	uint32_t last_row = height < dst_height ? height : dst_height;
+	if ((int32_t) dst_height < 0)
+		last_row = 0;
+
+	qr->row = (uint32_t *) malloc((row_len + 1) * sizeof(uint32_t));
+	if (qr->row == NULL)
+		return -LIB_QOI_ERROR_OUT_OF_MEMORY;
+
+	if (qr->header.channels == 4)
+	{
+		qr->row_alpha = (uint8_t *) malloc(row_len + 1);
+		if (qr->row_alpha == NULL)
+			return -LIB_QOI_ERROR_OUT_OF_MEMORY;
+	}
+
+	// formats that can not show every color diffuse the error of every pixel over the pixels around it
+	qr->dither = driver_framebuffer_dither_new(ops, row_len);
+
+	memset(qr->index, 0, sizeof(qr->index));
+	uint32_t px = 0xFF000000; // opaque black
+	uint32_t run = 0;
+
+	// runs and repeated colors are only encoded once, rows that are dithered hold colors until the whole row is known
+	uint32_t value_px = px;
+	uint32_t value = qr->dither != NULL ? px & 0xFFFFFF : ops->encode(px & 0xFFFFFF);
+
+	uint32_t y;
+	for (y=0; y<last_row; y++)
+	{
+		bool visible = y >= dst_min_y && row_len > 0;
+		uint32_t *out = qr->row;
+		uint8_t *alpha_out = qr->row_alpha;
+
+		uint32_t x;
+		for (x=0; x<width; x++)
+		{
+			if (run > 0)
+			{
+				run--;
+			}
+			else
+			{
+				int b1 = lib_qoi_byte(qr, QOI_END_SIZE);
+				if (b1 < 0)
+					return b1;
+
+				if (b1 == QOI_OP_RGB || b1 == QOI_OP_RGBA)
+				{
+					uint32_t channels = b1 == QOI_OP_RGBA ? 4 : 3;
+					uint32_t c;
+					uint32_t color = 0;
+					for (c=0; c<channels; c++)
+					{
+						int b = lib_qoi_byte(qr, QOI_END_SIZE);
+						if (b < 0)
+							return b;
+						color = (color << 8) | b;
+					}
+					// rgb keeps the alpha, rgba arrives as r, g, b, a
+					px = channels == 3 ? (px & 0xFF000000) | color : (color >> 8) | (color << 24);
+				}
+				else
+				{
+					uint32_t r = (px >> 16) & 0xFF;
+					uint32_t g = (px >> 8) & 0xFF;
+					uint32_t b = px & 0xFF;
+					switch (b1 & 0xC0)
+					{
+						case QOI_OP_INDEX:
+							px = qr->index[b1];
+							break;
+
+						case QOI_OP_DIFF:
+							r = (r + ((b1 >> 4) & 0x03) - 2) & 0xFF;
+							g = (g + ((b1 >> 2) & 0x03) - 2) & 0xFF;
+							b = (b + ( b1       & 0x03) - 2) & 0xFF;
+							px = (px & 0xFF000000) | (r << 16) | (g << 8) | b;
+							break;
+
+						case QOI_OP_LUMA:
+						{
+							int b2 = lib_qoi_byte(qr, QOI_END_SIZE);
+							if (b2 < 0)
+								return b2;
+							uint32_t vg = (b1 & 0x3F) - 32;
+							r = (r + vg - 8 + ((b2 >> 4) & 0x0F)) & 0xFF;
+							g = (g + vg) & 0xFF;
+							b = (b + vg - 8 + (b2 & 0x0F)) & 0xFF;
+							px = (px & 0xFF000000) | (r << 16) | (g << 8) | b;
+							break;
+						}
+
+						case QOI_OP_RUN:
+							run = b1 & 0x3F;
+							break;
+					}
+				}
+
+				uint32_t a = px >> 24;
+				qr->index[(((px >> 16) & 0xFF) * 3 + ((px >> 8) & 0xFF) * 5 + (px & 0xFF) * 7 + a * 11) & 63] = px;
+			}
+			qr->pixels_left--;
+
+			if (visible && x >= dst_min_x && x < row_end)
+			{
+				if (px != value_px)
+				{
+					value_px = px;
+					value = qr->dither != NULL ? px & 0xFFFFFF : ops->encode(px & 0xFFFFFF);
+				}
+				*out++ = value;
+				if (alpha_out != NULL)
+					*alpha_out++ = px >> 24;
+			}
+		}
+
+		if (visible && qr->dither != NULL)
+			driver_framebuffer_dither_row(qr->dither, qr->row, qr->row_alpha, row_len);
+		if (visible)
+			driver_framebuffer_draw_row(window, (int16_t) (offset_x + dst_min_x), (int16_t) (offset_y + y), qr->row, qr->row_alpha, row_len);
+	}
+
+	if (y < height)
+		return 0; // the rest of the image is not visible
+
+	// verify the end marker, a run may still be pending only in broken images
+	uint32_t i;
+	for (i=0; i<QOI_END_SIZE; i++)
+	{
+		int b = lib_qoi_byte(qr, QOI_END_SIZE - i);
+		if (b < 0)
+			return b;
+		if (run > 0 || b != (i == QOI_END_SIZE - 1 ? 1 : 0))
+			return -LIB_QOI_ERROR_MISSING_END_MARKER;
+	}
+
+	return 0;
+#endif
+}
+
+void
+lib_qoi_destroy(struct lib_qoi_reader *qr)
+{
+	if (qr->row)
+		free(qr->row);
+	qr->row = NULL;
+
+	if (qr->row_alpha)
+		free(qr->row_alpha);
+	qr->row_alpha = NULL;
+
+#ifdef CONFIG_DRIVER_FRAMEBUFFER_ENABLE
+	if (qr->dither)
+		driver_framebuffer_dither_destroy(qr->dither);
+	qr->dither = NULL;
+#endif
+
+	free(qr);
+}
+
+#ifdef LIB_QOI_READER_TEST
+#include <assert.h>
+#include <stdio.h>
+
+#define N_RAND_TESTS 20
+
+// Made by the encoder of the reference implementation (qoi.h) from the pixels of test_pixel(), kind 0 to 2.
+// Between them they hold every op, runs across rows and runs of the maximum length.
+static const uint8_t ref_rgb[] = {
+	0x71, 0x6f, 0x69, 0x66, 0x00, 0x00, 0x00, 0x18, 0x00, 0x00, 0x00, 0x0c, 0x03, 0x00, 0xfe, 0x28,
+	0x50, 0x78, 0xc8, 0xfe, 0x32, 0x5a, 0x6e, 0x7d, 0x7d, 0x7d, 0x7d, 0x7d, 0x7d, 0x7d, 0x7d, 0x7d,
+	0x7d, 0x7d, 0x7d, 0x7d, 0xfe, 0x00, 0xff, 0x00, 0x6d, 0x5b, 0x30, 0x2e, 0x32, 0x30, 0x2e, 0x32,
+	0x30, 0x2e, 0x32, 0x30, 0x2e, 0x32, 0x30, 0x2e, 0x32, 0x30, 0x2e, 0x32, 0x30, 0x2e, 0x32, 0xa2,
+	0xe5, 0xad, 0x88, 0xad, 0x88, 0xad, 0x88, 0xad, 0x88, 0xad, 0x88, 0xad, 0x88, 0xad, 0x88, 0xad,
+	0x88, 0xad, 0x88, 0xad, 0x88, 0xad, 0x88, 0xad, 0x88, 0xad, 0x88, 0xad, 0x88, 0xad, 0x88, 0xad,
+	0x88, 0xad, 0x88, 0xad, 0x88, 0xad, 0x88, 0xad, 0x88, 0xad, 0x88, 0xad, 0x88, 0xad, 0x88, 0xfe,
+	0xdf, 0xaf, 0x4a, 0xfe, 0x15, 0xbc, 0xa4, 0xfe, 0x4b, 0xc9, 0xfe, 0xfe, 0x81, 0xd7, 0x59, 0xfe,
+	0xb7, 0xe4, 0xb3, 0xfe, 0xed, 0xf2, 0x0d, 0xfe, 0x23, 0xff, 0x67, 0xfe, 0x5a, 0x0c, 0xc1, 0xfe,
+	0x90, 0x1a, 0x1c, 0xfe, 0xc6, 0x27, 0x76, 0xfe, 0xfc, 0x34, 0xd0, 0xfe, 0x32, 0x42, 0x2a, 0xfe,
+	0x68, 0x4f, 0x85, 0xfe, 0x9e, 0x5c, 0xdf, 0xfe, 0xd4, 0x6a, 0x39, 0xfe, 0x0a, 0x77, 0x93, 0xfe,
+	0x40, 0x84, 0xee, 0xfe, 0x76, 0x92, 0x48, 0xfe, 0xac, 0x9f, 0xa2, 0xfe, 0xe2, 0xac, 0xfc, 0xfe,
+	0x18, 0xba, 0x57, 0xfe, 0x4e, 0xc7, 0xb1, 0xfe, 0x84, 0xd5, 0x0b, 0xfe, 0xba, 0xe2, 0x65, 0x05,
+	0xc8, 0xfe, 0x32, 0x5a, 0x6e, 0x7d, 0x7d, 0x7d, 0x7d, 0x14, 0x15, 0x7d, 0x17, 0x18, 0x7d, 0x7d,
+	0x7d, 0x7d, 0xfe, 0x00, 0x00, 0xff, 0x32, 0x30, 0x2e, 0x32, 0x30, 0x2e, 0x32, 0x30, 0x2e, 0x32,
+	0x30, 0x2e, 0x32, 0x30, 0x2e, 0x32, 0x30, 0x2e, 0x32, 0x30, 0x2e, 0x32, 0x30, 0x09, 0x0c, 0xad,
+	0x88, 0xad, 0x88, 0xad, 0x88, 0xad, 0x88, 0xad, 0x88, 0xad, 0x88, 0xad, 0x88, 0xad, 0x88, 0xad,
+	0x88, 0xad, 0x88, 0xad, 0x88, 0xad, 0x88, 0xad, 0x88, 0xad, 0x88, 0xad, 0x88, 0xad, 0x88, 0xad,
+	0x88, 0xad, 0x88, 0xad, 0x88, 0xad, 0x88, 0xad, 0x88, 0xad, 0x88, 0xfe, 0x33, 0x09, 0xf7, 0xfe,
+	0x69, 0x17, 0x51, 0xfe, 0x9f, 0x24, 0xab, 0xfe, 0xd5, 0x32, 0x06, 0xfe, 0x0b, 0x3f, 0x60, 0xfe,
+	0x41, 0x4c, 0xba, 0xfe, 0x77, 0x5a, 0x14, 0xfe, 0xad, 0x67, 0x6f, 0xfe, 0xe3, 0x74, 0xc9, 0xfe,
+	0x19, 0x82, 0x23, 0xfe, 0x4f, 0x8f, 0x7d, 0xfe, 0x85, 0x9c, 0xd8, 0xfe, 0xbb, 0xaa, 0x32, 0xfe,
+	0xf1, 0xb7, 0x8c, 0xfe, 0x27, 0xc4, 0xe6, 0xfe, 0x5d, 0xd2, 0x41, 0xfe, 0x93, 0xdf, 0x9b, 0xfe,
+	0xc9, 0xec, 0xf5, 0xfe, 0xff, 0xfa, 0x4f, 0xfe, 0x36, 0x07, 0xaa, 0xfe, 0x6c, 0x15, 0x04, 0xfe,
+	0xa2, 0x22, 0x5e, 0xfe, 0xd8, 0x2f, 0xb8, 0xfe, 0x0e, 0x3d, 0x13, 0xfe, 0x28, 0x50, 0x78, 0xc8,
+	0xfe, 0x32, 0x5a, 0x6e, 0x10, 0x11, 0x7d, 0x13, 0x14, 0x7d, 0x7d, 0x7d, 0x7d, 0x19, 0x7d, 0x7d,
+	0x1c, 0x32, 0x76, 0x2e, 0x32, 0x30, 0x2e, 0x32, 0x30, 0x2e, 0x32, 0x30, 0x2e, 0x32, 0x30, 0x2e,
+	0x32, 0x30, 0x2e, 0x32, 0x30, 0x2e, 0x32, 0x30, 0x2e, 0xaa, 0xd6, 0xad, 0x88, 0x0b, 0x0e, 0xad,
+	0x88, 0xad, 0x88, 0xad, 0x88, 0xad, 0x88, 0xad, 0x88, 0xad, 0x88, 0xad, 0x88, 0xad, 0x88, 0xad,
+	0x88, 0xad, 0x88, 0xad, 0x88, 0xad, 0x88, 0xad, 0x88, 0xad, 0x88, 0xad, 0x88, 0xad, 0x88, 0xad,
+	0x88, 0xad, 0x88, 0xad, 0x88, 0xad, 0x88, 0xfe, 0x86, 0x64, 0xa4, 0xfe, 0xbc, 0x71, 0xfe, 0xfe,
+	0xf2, 0x7f, 0x59, 0xfe, 0x28, 0x8c, 0xb3, 0xfe, 0x5e, 0x9a, 0x0d, 0xfe, 0x94, 0xa7, 0x67, 0xfe,
+	0xca, 0xb4, 0xc2, 0xfe, 0x00, 0xc2, 0x1c, 0xfe, 0x36, 0xcf, 0x76, 0xfe, 0x6c, 0xdc, 0xd0, 0xfe,
+	0xa2, 0xea, 0x2b, 0xfe, 0xd8, 0xf7, 0x85, 0xfe, 0x0f, 0x04, 0xdf, 0xfe, 0x45, 0x12, 0x39, 0xfe,
+	0x7b, 0x1f, 0x93, 0xfe, 0xb1, 0x2c, 0xee, 0xfe, 0xe7, 0x3a, 0x48, 0xfe, 0x1d, 0x47, 0xa2, 0xfe,
+	0x53, 0x54, 0xfc, 0xfe, 0x89, 0x62, 0x57, 0xfe, 0xbf, 0x6f, 0xb1, 0xfe, 0xf5, 0x7d, 0x0b, 0xfe,
+	0x2b, 0x8a, 0x65, 0xfe, 0x61, 0x97, 0xc0, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01,
+};
+static const uint8_t ref_rgba[] = {
+	0x71, 0x6f, 0x69, 0x66, 0x00, 0x00, 0x00, 0x17, 0x00, 0x00, 0x00, 0x0d, 0x04, 0x00, 0xfe, 0x28,
+	0x50, 0x78, 0xc8, 0xfe, 0x32, 0x5a, 0x6e, 0x7d, 0x7d, 0x7d, 0x7d, 0x7d, 0x7d, 0x7d, 0x7d, 0x7d,
+	0x7d, 0x7d, 0x7d, 0xff, 0x00, 0xff, 0x00, 0x80, 0xff, 0x00, 0x00, 0xff, 0xff, 0x5b, 0x76, 0x2e,
+	0xff, 0xff, 0x00, 0x00, 0x80, 0x30, 0x2e, 0x32, 0x30, 0xff, 0x00, 0x00, 0xff, 0x80, 0x32, 0x30,
+	0x2e, 0x32, 0x3b, 0x2e, 0x32, 0x30, 0x2e, 0x3d, 0x30, 0x2e, 0xa2, 0xd6, 0xad, 0x88, 0xad, 0x88,
+	0xad, 0x88, 0xad, 0x88, 0xad, 0x88, 0xad, 0x88, 0xad, 0x88, 0xad, 0x88, 0xad, 0x88, 0xad, 0x88,
+	0xad, 0x88, 0xad, 0x88, 0xad, 0x88, 0xad, 0x88, 0xad, 0x88, 0xad, 0x88, 0xad, 0x88, 0xad, 0x88,
+	0xad, 0x88, 0xad, 0x88, 0xad, 0x88, 0xad, 0x88, 0xff, 0xdf, 0xaf, 0x4a, 0x44, 0xff, 0x15, 0xbc,
+	0xa4, 0x83, 0xff, 0x4b, 0xc9, 0xfe, 0xc2, 0xff, 0x81, 0xd7, 0x59, 0x01, 0xff, 0xb7, 0xe4, 0xb3,
+	0x40, 0xff, 0xed, 0xf2, 0x0d, 0x7f, 0xff, 0x23, 0xff, 0x67, 0xbe, 0xff, 0x5a, 0x0c, 0xc1, 0xfd,
+	0xff, 0x90, 0x1a, 0x1c, 0x3c, 0xff, 0xc6, 0x27, 0x76, 0x7b, 0xff, 0xfc, 0x34, 0xd0, 0xba, 0xff,
+	0x32, 0x42, 0x2a, 0xf9, 0xff, 0x68, 0x4f, 0x85, 0x38, 0xff, 0x9e, 0x5c, 0xdf, 0x77, 0xff, 0xd4,
+	0x6a, 0x39, 0xb6, 0xff, 0x0a, 0x77, 0x93, 0xf5, 0xff, 0x40, 0x84, 0xee, 0x34, 0xff, 0x76, 0x92,
+	0x48, 0x73, 0xff, 0xac, 0x9f, 0xa2, 0xb2, 0xff, 0xe2, 0xac, 0xfc, 0xf1, 0xff, 0x18, 0xba, 0x57,
+	0x30, 0xff, 0x4e, 0xc7, 0xb1, 0x6f, 0xff, 0x84, 0xd5, 0x0b, 0xae, 0x05, 0xc8, 0xfe, 0x32, 0x5a,
+	0x6e, 0x7d, 0x7d, 0x7d, 0x7d, 0x14, 0x15, 0x7d, 0x17, 0x7d, 0x7d, 0x1a, 0x7d, 0xff, 0x00, 0x00,
+	0xff, 0x80, 0x32, 0x76, 0x6d, 0x32, 0x3b, 0x2e, 0x32, 0x30, 0x2e, 0xff, 0xff, 0x00, 0x00, 0x80,
+	0x30, 0x2e, 0x32, 0x30, 0x39, 0x32, 0x30, 0x2e, 0x32, 0x3b, 0x2e, 0x32, 0x09, 0x0c, 0xad, 0x88,
+	0xad, 0x88, 0xad, 0x88, 0xad, 0x88, 0xad, 0x88, 0xad, 0x88, 0xad, 0x88, 0xad, 0x88, 0xad, 0x88,
+	0xad, 0x88, 0xad, 0x88, 0xad, 0x88, 0xad, 0x88, 0xad, 0x88, 0xad, 0x88, 0xad, 0x88, 0xad, 0x88,
+	0xad, 0x88, 0xad, 0x88, 0xad, 0x88, 0xad, 0x88, 0xff, 0x33, 0x09, 0xf7, 0x68, 0xff, 0x69, 0x17,
+	0x51, 0xa7, 0xff, 0x9f, 0x24, 0xab, 0xe6, 0xff, 0xd5, 0x32, 0x06, 0x25, 0xff, 0x0b, 0x3f, 0x60,
+	0x64, 0xff, 0x41, 0x4c, 0xba, 0xa3, 0xff, 0x77, 0x5a, 0x14, 0xe2, 0xff, 0xad, 0x67, 0x6f, 0x21,
+	0xff, 0xe3, 0x74, 0xc9, 0x60, 0xff, 0x19, 0x82, 0x23, 0x9f, 0xff, 0x4f, 0x8f, 0x7d, 0xde, 0xff,
+	0x85, 0x9c, 0xd8, 0x1d, 0xff, 0xbb, 0xaa, 0x32, 0x5c, 0xff, 0xf1, 0xb7, 0x8c, 0x9b, 0xff, 0x27,
+	0xc4, 0xe6, 0xda, 0xff, 0x5d, 0xd2, 0x41, 0x19, 0xff, 0x93, 0xdf, 0x9b, 0x58, 0xff, 0xc9, 0xec,
+	0xf5, 0x97, 0xff, 0xff, 0xfa, 0x4f, 0xd6, 0xff, 0x36, 0x07, 0xaa, 0x15, 0xff, 0x6c, 0x15, 0x04,
+	0x54, 0xff, 0xa2, 0x22, 0x5e, 0x93, 0xff, 0xd8, 0x2f, 0xb8, 0xd2, 0xff, 0x28, 0x50, 0x78, 0xff,
+	0xc8, 0xfe, 0x32, 0x5a, 0x6e, 0x10, 0x11, 0x7d, 0x13, 0x14, 0x7d, 0x7d, 0x17, 0x7d, 0x7d, 0x1a,
+	0x7d, 0x3d, 0xff, 0x00, 0xff, 0x00, 0xff, 0x2e, 0x32, 0x30, 0xff, 0x00, 0x00, 0xff, 0x80, 0x32,
+	0x30, 0x2e, 0x32, 0x3b, 0x2e, 0x32, 0x30, 0x2e, 0x3d, 0x30, 0x2e, 0x32, 0x30, 0x39, 0x32, 0x30,
+	0xab, 0xc4, 0xad, 0x88, 0xad, 0x88, 0xad, 0x88, 0xad, 0x88, 0xad, 0x88, 0xad, 0x88, 0xad, 0x88,
+	0xad, 0x88, 0xad, 0x88, 0xad, 0x88, 0xad, 0x88, 0xad, 0x88, 0xad, 0x88, 0xad, 0x88, 0xad, 0x88,
+	0xad, 0x88, 0xad, 0x88, 0xad, 0x88, 0xad, 0x88, 0xad, 0x88, 0xad, 0x88, 0xad, 0x88, 0xff, 0x86,
+	0x64, 0xa4, 0x8c, 0xff, 0xbc, 0x71, 0xfe, 0xcb, 0xff, 0xf2, 0x7f, 0x59, 0x0a, 0xff, 0x28, 0x8c,
+	0xb3, 0x49, 0xff, 0x5e, 0x9a, 0x0d, 0x88, 0xff, 0x94, 0xa7, 0x67, 0xc7, 0xff, 0xca, 0xb4, 0xc2,
+	0x06, 0xff, 0x00, 0xc2, 0x1c, 0x45, 0xff, 0x36, 0xcf, 0x76, 0x84, 0xff, 0x6c, 0xdc, 0xd0, 0xc3,
+	0xff, 0xa2, 0xea, 0x2b, 0x02, 0xff, 0xd8, 0xf7, 0x85, 0x41, 0xff, 0x0f, 0x04, 0xdf, 0x80, 0xff,
+	0x45, 0x12, 0x39, 0xbf, 0xff, 0x7b, 0x1f, 0x93, 0xfe, 0xff, 0xb1, 0x2c, 0xee, 0x3d, 0xff, 0xe7,
+	0x3a, 0x48, 0x7c, 0xff, 0x1d, 0x47, 0xa2, 0xbb, 0xff, 0x53, 0x54, 0xfc, 0xfa, 0xff, 0x89, 0x62,
+	0x57, 0x39, 0xff, 0xbf, 0x6f, 0xb1, 0x78, 0xff, 0xf5, 0x7d, 0x0b, 0xb7, 0xff, 0x2b, 0x8a, 0x65,
+	0xf6, 0xff, 0x28, 0x50, 0x78, 0xff, 0xc8, 0xfe, 0x32, 0x5a, 0x6e, 0x7d, 0x7d, 0x12, 0x7d, 0x7d,
+	0x15, 0x16, 0x7d, 0x18, 0x7d, 0x7d, 0x1b, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01,
+};
+static const uint8_t ref_runs[] = {
+	0x71, 0x6f, 0x69, 0x66, 0x00, 0x00, 0x00, 0x46, 0x00, 0x00, 0x00, 0x02, 0x03, 0x00, 0xa2, 0x79,
+	0xfe, 0xc8, 0x64, 0x32, 0xfd, 0xfd, 0xcd, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01,
+};
+
+static const struct {
+	const uint8_t *data;
+	size_t len;
+	uint32_t width;
+	uint32_t height;
+	uint8_t channels;
+} images[3] = {
+	{ ref_rgb, sizeof(ref_rgb), 24, 12, 3 },
+	{ ref_rgba, sizeof(ref_rgba), 23, 13, 4 },
+	{ ref_runs, sizeof(ref_runs), 70, 2, 3 },
+};
+
+static uint32_t
+test_pixel(int kind, uint32_t x, uint32_t y)
+{ // as 0xAARRGGBB: a run, small steps, index hits, larger steps and random colors, every fourth row
+	uint32_t h = (x * 7919 + y * 104729 + 12345) * 2654435761u;
+	uint32_t r, g, b, a = 255;
+	if (kind == 2)
+		return (x + y > 0) ? 0xFFC86432 : 0xFF010203;
+	switch (y % 4)
+	{
+		case 0:
+			r = x < 10 ? 40 : 40 + x;
+			g = x < 10 ? 80 : 80 + x;
+			b = x < 10 ? 120 : 120 - x;
+			break;
+		case 1:
+			r = (x + y) % 3 == 0 ? 255 : 0;
+			g = (x + y) % 3 == 1 ? 255 : 0;
+			b = (x + y) % 3 == 2 ? 255 : 0;
+			if (kind == 1 && x % 5 == 0)
+				a = 128;
+			break;
+		case 2:
+			r = (x * 13 + y + 5) & 0xFF;
+			g = (x * 13 + y) & 0xFF;
+			b = (x * 13 + y - 3) & 0xFF;
+			break;
+		default:
+			r = (h >> 24) & 0xFF;
+			g = (h >> 16) & 0xFF;
+			b = (h >> 8) & 0xFF;
+			if (kind == 1)
+				a = h & 0xFF;
+			break;
+	}
+	return (a << 24) | (r << 16) | (g << 8) | b;
+}
+
+// the input is handed out a random number of bytes at a time, except for the header that is read at once.
+struct test_reader {
+	const uint8_t *data;
+	size_t len;
+	size_t pos;
+	size_t max_read;
+};
+
+static ssize_t
+test_read(void *p, void *buf, size_t buf_len)
+{
+	struct test_reader *tr = (struct test_reader *) p;
+	size_t len = tr->pos < QOI_HEADER_SIZE ? buf_len : 1 + rand() % tr->max_read;
+	if (len > buf_len)
+		len = buf_len;
+	if (len > tr->len - tr->pos)
+		len = tr->len - tr->pos;
+	memcpy(buf, &tr->data[tr->pos], len);
+	tr->pos += len;
+	return len;
+}
+
+static int
+test_decode(Window *window, const uint8_t *data, size_t len, uint32_t min_x, uint32_t min_y, uint32_t end_x, uint32_t end_y, size_t *consumed)
+{
+	struct test_reader tr = { data, len, 0, 1 + rand() % 300 };
+	struct lib_qoi_reader *qr = lib_qoi_new(test_read, &tr);
+	assert(qr != NULL);
+	int res = lib_qoi_load_image(window, qr, 0, 0, min_x, min_y, end_x, end_y);
+	lib_qoi_destroy(qr);
+	if (consumed != NULL)
+		*consumed = tr.pos;
+	return res;
+}
+
+static void
+check_image(Window *window, int kind, uint32_t min_x, uint32_t min_y, uint32_t end_x, uint32_t end_y, uint32_t background)
+{ // the visible part holds the image over the background, the rest only the background
+	uint32_t x, y;
+	for (y=0; y<images[kind].height; y++)
+	{
+		for (x=0; x<images[kind].width; x++)
+		{
+			uint32_t pixel = driver_framebuffer_getPixel(window, x, y);
+			bool visible = x >= min_x && x < end_x && y >= min_y && y < end_y;
+			uint32_t color = test_pixel(kind, x, y);
+			uint32_t a = visible ? color >> 24 : 0;
+			int shift;
+			for (shift=0; shift<24; shift+=8)
+			{
+				int expected = (((color >> shift) & 0xFF) * a + ((background >> shift) & 0xFF) * (255 - a) + 127) / 255;
+				int error = abs((int) ((pixel >> shift) & 0xFF) - expected);
+				if (error > ((a == 0 || a == 255) ? 0 : 2))
+					fprintf(stderr, "image %d: pixel %u,%u is %06x, expected %08x over %06x\n", kind, x, y, pixel, color, background);
+				assert(error <= ((a == 0 || a == 255) ? 0 : 2));
+			}
+		}
+	}
+}
+
+static void
+do_test_images(Window *windows[])
+{ // whole images, also with more data following them, and visible parts of them
+	static uint8_t padded[1024];
+	int kind, i;
+	for (kind=0; kind<3; kind++)
+	{
+		Window *window = windows[kind];
+		uint32_t width = images[kind].width, height = images[kind].height;
+		struct test_reader tr = { images[kind].data, images[kind].len, 0, 1 };
+		struct lib_qoi_reader *qr = lib_qoi_new(test_read, &tr);
+		assert(qr != NULL);
+		assert(lib_qoi_read_header(qr) == 0);
+		assert(qr->header.width == width && qr->header.height == height && qr->header.channels == images[kind].channels);
+		lib_qoi_destroy(qr);
+
+		for (i=0; i<N_RAND_TESTS; i++)
+		{
+			uint32_t background = rand() & 0xFFFFFF;
+			driver_framebuffer_fill(window, background);
+			size_t consumed;
+			assert(test_decode(window, images[kind].data, images[kind].len, 0, 0, width, height, &consumed) == 0);
+			assert(consumed == images[kind].len);
+			check_image(window, kind, 0, 0, width, height, background);
+
+			// nothing past the end marker is read
+			memcpy(padded, images[kind].data, images[kind].len);
+			memset(&padded[images[kind].len], 0xC0, 64);
+			assert(test_decode(window, padded, images[kind].len + 64, 0, 0, width, height, &consumed) == 0);
+			assert(consumed == images[kind].len);
+
+			uint32_t min_x = rand() % width, min_y = rand() % height;
+			uint32_t end_x = min_x + rand() % (width + 2 - min_x), end_y = min_y + rand() % (height + 2 - min_y);
+			driver_framebuffer_fill(window, background);
+			assert(test_decode(window, images[kind].data, images[kind].len, min_x, min_y, end_x, end_y, NULL) == 0);
+			check_image(window, kind, min_x, min_y, end_x, end_y, background);
+		}
+	}
+}
+
+static void
+do_test_broken(Window *windows[])
+{ // cut short anywhere, a broken end marker or a header that is not allowed
+	static uint8_t broken[1024];
+	int kind;
+	for (kind=0; kind<3; kind++)
+	{
+		uint32_t width = images[kind].width, height = images[kind].height;
+		size_t len;
+		for (len=0; len<images[kind].len; len++)
+			assert(test_decode(windows[kind], images[kind].data, len, 0, 0, width, height, NULL) == -LIB_QOI_ERROR_UNEXPECTED_END_OF_FILE);
+
+		size_t i;
+		for (i=images[kind].len - QOI_END_SIZE; i<images[kind].len; i++)
+		{
+			memcpy(broken, images[kind].data, images[kind].len);
+			broken[i] ^= 0x01;
+			assert(test_decode(windows[kind], broken, images[kind].len, 0, 0, width, height, NULL) == -LIB_QOI_ERROR_MISSING_END_MARKER);
+		}
+	}
+
+	// two pixels: a color and a run of one, then the same with a run of three that goes on past the last pixel
+	uint8_t pair[] = { 'q', 'o', 'i', 'f', 0, 0, 0, 2, 0, 0, 0, 1, 3, 0, QOI_OP_RGB, 1, 2, 3, QOI_OP_RUN, 0, 0, 0, 0, 0, 0, 0, 1 };
+	assert(test_decode(windows[0], pair, sizeof(pair), 0, 0, 2, 1, NULL) == 0);
+	pair[18] = QOI_OP_RUN | 2;
+	assert(test_decode(windows[0], pair, sizeof(pair), 0, 0, 2, 1, NULL) == -LIB_QOI_ERROR_MISSING_END_MARKER);
+
+	static const struct {
+		int offset;
+		uint8_t value;
+		int error;
+	} headers[] = {
+		{ 0, 'Q', -LIB_QOI_ERROR_MISSING_SIGNATURE },
+		{ 7, 0, -LIB_QOI_ERROR_INVALID_QOI_TYPE }, // no pixels
+		{ 8, 0x7F, -LIB_QOI_ERROR_INVALID_QOI_TYPE }, // more pixels than allowed
+		{ 12, 5, -LIB_QOI_ERROR_INVALID_QOI_TYPE },
+		{ 13, 2, -LIB_QOI_ERROR_INVALID_QOI_TYPE },
+	};
+	for (kind=0; kind<sizeof(headers) / sizeof(headers[0]); kind++)
+	{
+		pair[18] = QOI_OP_RUN;
+		pair[headers[kind].offset] = headers[kind].value;
+		assert(test_decode(windows[0], pair, sizeof(pair), 0, 0, 2, 1, NULL) == headers[kind].error);
+		memcpy(pair, "qoif\0\0\0\2\0\0\0\1\3\0", QOI_HEADER_SIZE);
+	}
+}
+
+int
+main(void)
+{
+	srand(42);
+	Window *windows[3];
+	int kind;
+	for (kind=0; kind<3; kind++)
+	{
+		windows[kind] = driver_framebuffer_window_create_format(kind == 0 ? "rgb" : kind == 1 ? "rgba" : "runs", images[kind].width, images[kind].height, FB_FORMAT_24BPP);
+		assert(windows[kind] != NULL);
+	}
+
+	do_test_images(windows);
+	do_test_broken(windows);
+
+	for (kind=0; kind<3; kind++)
+		driver_framebuffer_window_remove(windows[kind]);
+	printf("OK\n");
+	return 0;
+}
+
+#endif // LIB_QOI_READER_TEST
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "../include/driver_framebuffer_compositor.h"
+#include "../include/driver_framebuffer.h"
+#include "../include/driver_framebuffer_dither.h"
+
+#include "reader.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum lib_qoi_error_t {
+	LIB_QOI_ERROR_BASE = 0x1200,
+	LIB_QOI_ERROR_OUT_OF_MEMORY,
+	LIB_QOI_ERROR_MISSING_SIGNATURE,
+	LIB_QOI_ERROR_UNEXPECTED_END_OF_FILE,
+	LIB_QOI_ERROR_INVALID_QOI_TYPE,
+	LIB_QOI_ERROR_MISSING_END_MARKER,
+	LIB_QOI_ERROR_TOP,
+};
+
+struct lib_qoi_header {
+	uint32_t width;
+	uint32_t height;
+	uint8_t channels; // 3 (rgb) or 4 (rgba)
+	uint8_t colorspace; // 0 (srgb with linear alpha) or 1 (all channels linear), only informative
+};
+
+struct lib_qoi_reader {
+	lib_reader_read_t read;
+	void *read_p;
+
+	struct lib_qoi_header header;
+	bool header_read;
+
+	uint8_t buf[256]; // input is read in blocks, never past the end marker of a valid image
+	uint16_t buf_pos;
+	uint16_t buf_len;
+	uint32_t pixels_left; // pixels that still have to be decoded, bounds how much input is left
+
+	uint32_t index[64]; // previously seen pixels, as 0xAARRGGBB
+	uint32_t *row; // visible part of the current row as pixel values of the target
+	uint8_t *row_alpha; // alpha of the visible part of the current row, for images with an alpha channel
+	dither_row_t *dither; // error carried to the next row, for targets that are dithered
+};
+
+extern struct lib_qoi_reader * lib_qoi_new(lib_reader_read_t read, void *read_p);
+extern int lib_qoi_read_header(struct lib_qoi_reader *qr);
+extern int lib_qoi_load_image(Window *window, struct lib_qoi_reader *qr, uint16_t offset_x, uint16_t offset_y, uint32_t dst_min_x, uint32_t dst_min_y, uint32_t dst_width, uint32_t dst_height);
+extern void lib_qoi_destroy(struct lib_qoi_reader *qr);
+
+#ifdef __cplusplus
+}
+#endif
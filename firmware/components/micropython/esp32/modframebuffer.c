@@ -60,6 +60,12 @@ static mp_obj_t framebuffer_flush(mp_uint_t n_args, const mp_obj_t *args)
 	return mp_const_none;
 }
 
+static mp_obj_t framebuffer_flush_wait(mp_uint_t n_args, const mp_obj_t *args)
+{
+	driver_framebuffer_flush_wait();
+	return mp_const_none;
+}
+
 static mp_obj_t framebuffer_size(mp_uint_t n_args, const mp_obj_t *args)
 {
 	Window* window = NULL;
@@ -188,7 +194,12 @@ static mp_obj_t framebuffer_window_create(mp_uint_t n_args, const mp_obj_t *args
 	const char* name   = mp_obj_str_get_str(args[0]);
 	int16_t     width  = mp_obj_get_int(args[1]);
 	int16_t     height = mp_obj_get_int(args[2]);
-	if (!driver_framebuffer_window_create(name, width, height)) {
+	pixel_format_t format = FB_FORMAT_NATIVE;
+	if (n_args > 3) format = mp_obj_get_int(args[3]);
+	if (!driver_framebuffer_format_ops(format)) {
+		mp_raise_ValueError("Unknown pixel format!");
+	}
+	if (!driver_framebuffer_window_create_format(name, width, height, format)) {
 		mp_raise_ValueError("A window with the provided name exists already!");
 	}
 	return mp_const_none;
@@ -215,8 +226,7 @@ static mp_obj_t framebuffer_window_move(mp_uint_t n_args, const mp_obj_t *args)
 		return mp_const_none;
 	}
 	
-	window->x = mp_obj_get_int(args[1]);
-	window->y = mp_obj_get_int(args[2]);
+	driver_framebuffer_window_move(window, mp_obj_get_int(args[1]), mp_obj_get_int(args[2]));
 	
 	return mp_const_none;
 }
@@ -229,7 +239,7 @@ static mp_obj_t framebuffer_window_hide(mp_uint_t n_args, const mp_obj_t *args)
 		mp_raise_ValueError("Window not found");
 		return mp_const_none;
 	}
-	window->visible = false;
+	driver_framebuffer_window_set_visible(window, false);
 	return mp_const_none;
 }
 
@@ -241,7 +251,7 @@ static mp_obj_t framebuffer_window_show(mp_uint_t n_args, const mp_obj_t *args)
 		mp_raise_ValueError("Window not found");
 		return mp_const_none;
 	}
-	window->visible = true;
+	driver_framebuffer_window_set_visible(window, true);
 	return mp_const_none;
 }
 
@@ -253,7 +263,7 @@ static mp_obj_t framebuffer_window_visiblity(mp_uint_t n_args, const mp_obj_t *a
 		mp_raise_ValueError("Window not found");
 		return mp_const_none;
 	}
-	window->visible = mp_obj_get_int(args[1]);
+	driver_framebuffer_window_set_visible(window, mp_obj_get_int(args[1]));
 	return mp_const_none;
 }
 
@@ -312,10 +322,9 @@ static mp_obj_t framebuffer_window_transparency(mp_uint_t n_args, const mp_obj_t
 		return mp_const_none;
 	}
 	if (n_args > 1) {
-		window->enableTransparentColor = mp_obj_get_int(args[1]);
-		if (n_args > 2) {
-			window->transparentColor = mp_obj_get_int(args[2]);
-		}
+		bool enable = mp_obj_get_int(args[1]);
+		uint32_t color = (n_args > 2) ? mp_obj_get_int(args[2]) : window->transparentColor;
+		driver_framebuffer_window_set_transparency(window, enable, color);
 		return mp_const_none;
 	}
 	return mp_obj_new_int(window->transparentColor); //Fixme!
@@ -352,7 +361,7 @@ static mp_obj_t framebuffer_get_pixel(mp_uint_t n_args, const mp_obj_t *args) {
 	float y = mp_obj_get_float(args[paramOffset + 1]);
 	#ifdef CONFIG_G_MATRIX_ENABLE
 	if (!raw) {
-		matrix_2d_transform_point(stack->current, &x, &y);
+		matrix_2d_transform_point(&stack->current, &x, &y);
 	}
 	#endif
 	
@@ -390,7 +399,7 @@ static mp_obj_t framebuffer_draw_pixel(mp_uint_t n_args, const mp_obj_t *args) {
 	float y = mp_obj_get_float(args[paramOffset + 1]);
 	#ifdef CONFIG_G_MATRIX_ENABLE
 	if (!raw) {
-		matrix_2d_transform_point(stack->current, &x, &y);
+		matrix_2d_transform_point(&stack->current, &x, &y);
 	}
 	#endif
 	uint32_t color = mp_obj_get_int(args[paramOffset + 2]);
@@ -462,8 +471,8 @@ static mp_obj_t framebuffer_draw_line(mp_uint_t n_args, const mp_obj_t *args)
 
 	#ifdef CONFIG_G_MATRIX_ENABLE
 	//transform point according to the transformation
-	matrix_2d_transform_point(stack->current, &x0, &y0);
-	matrix_2d_transform_point(stack->current, &x1, &y1);
+	matrix_2d_transform_point(&stack->current, &x0, &y0);
+	matrix_2d_transform_point(&stack->current, &x1, &y1);
 	#endif
 	//convert back to int so the line drawer will accept it
 	int16_t x0i = (int16_t) (x0 + 0.5);
@@ -554,17 +563,13 @@ static mp_obj_t framebuffer_draw_triangle(mp_uint_t n_args, const mp_obj_t *args
 	else
 	#endif
 	{
-		float x0 = mp_obj_get_float(args[paramOffset]);
-		float y0 = mp_obj_get_float(args[paramOffset + 1]);
-		float x1 = mp_obj_get_float(args[paramOffset + 2]);
-		float y1 = mp_obj_get_float(args[paramOffset + 3]);
-		float x2 = mp_obj_get_float(args[paramOffset + 4]);
-		float y2 = mp_obj_get_float(args[paramOffset + 5]);
+		float points[6];
+		for (int i = 0; i < 6; i++) {
+			points[i] = mp_obj_get_float(args[paramOffset + i]);
+		}
 		uint32_t color = mp_obj_get_int(args[paramOffset + 6]);
-		matrix_2d_transform_point(stack_2d->current, &x0, &y0);
-		matrix_2d_transform_point(stack_2d->current, &x1, &y1);
-		matrix_2d_transform_point(stack_2d->current, &x2, &y2);
-		driver_framebuffer_triangle(window, x0, y0, x1, y1, x2, y2, color);
+		matrix_stack_2d_transform_points(stack_2d, points, 3);
+		driver_framebuffer_triangle(window, points[0], points[1], points[2], points[3], points[4], points[5], color);
 	}
 	return mp_const_none;
 }
@@ -634,20 +639,9 @@ static mp_obj_t framebuffer_draw_quad(mp_uint_t n_args, const mp_obj_t *args)
 		float y3 = mp_obj_get_float(args[paramOffset + 10]);
 		float z3 = mp_obj_get_float(args[paramOffset + 11]);
 		uint32_t color = mp_obj_get_int(args[paramOffset + 12]);
-		//matrix_3d_transform_point(stack_3d->current, &x0, &y0, &z0);
-		//matrix_3d_transform_point(stack_3d->current, &x1, &y1, &z1);
-		//matrix_3d_transform_point(stack_3d->current, &x2, &y2, &z2);
-		//matrix_3d_transform_point(stack_3d->current, &x3, &y3, &z3);
-		int res = driver_framebuffer_tri3d((triangle_3d) {
-			.x0 = x0, .y0 = y0, .z0 = z0,
-			.x1 = x1, .y1 = y1, .z1 = z1,
-			.x2 = x2, .y2 = y2, .z2 = z2
-		}, color, RENDERMODE_SOLID);
-		res |= driver_framebuffer_tri3d((triangle_3d) {
-			.x0 = x0, .y0 = y0, .z0 = z0,
-			.x1 = x2, .y1 = y2, .z1 = z2,
-			.x2 = x3, .y2 = y3, .z2 = z3
-		}, color, RENDERMODE_SOLID);
+		float vertices[] = {x0, y0, z0, x1, y1, z1, x2, y2, z2, x3, y3, z3};
+		const uint16_t indices[] = {0, 1, 2, 0, 2, 3};
+		int res = driver_framebuffer_mesh3d(vertices, 4, indices, 2, NULL, color, false);
 		if (res) {
 			mp_raise_msg(&mp_type_Exception, "Error rendering quad: Had to wait too long for space in triangle buffer.");
 			return mp_const_none;
@@ -656,20 +650,13 @@ static mp_obj_t framebuffer_draw_quad(mp_uint_t n_args, const mp_obj_t *args)
 	else
 	#endif
 	{
-		float x0 = mp_obj_get_float(args[paramOffset]);
-		float y0 = mp_obj_get_float(args[paramOffset + 1]);
-		float x1 = mp_obj_get_float(args[paramOffset + 2]);
-		float y1 = mp_obj_get_float(args[paramOffset + 3]);
-		float x2 = mp_obj_get_float(args[paramOffset + 4]);
-		float y2 = mp_obj_get_float(args[paramOffset + 5]);
-		float x3 = mp_obj_get_float(args[paramOffset + 6]);
-		float y3 = mp_obj_get_float(args[paramOffset + 7]);
+		float points[8];
+		for (int i = 0; i < 8; i++) {
+			points[i] = mp_obj_get_float(args[paramOffset + i]);
+		}
 		uint32_t color = mp_obj_get_int(args[paramOffset + 8]);
-		matrix_2d_transform_point(stack_2d->current, &x0, &y0);
-		matrix_2d_transform_point(stack_2d->current, &x1, &y1);
-		matrix_2d_transform_point(stack_2d->current, &x2, &y2);
-		matrix_2d_transform_point(stack_2d->current, &x3, &y3);
-		driver_framebuffer_quad(window, x0, y0, x1, y1, x2, y2, x3, y3, color);
+		matrix_stack_2d_transform_points(stack_2d, points, 4);
+		driver_framebuffer_quad(window, points[0], points[1], points[2], points[3], points[4], points[5], points[6], points[7], color);
 	}
 	return mp_const_none;
 }
@@ -701,16 +688,17 @@ static mp_obj_t framebuffer_draw_rect(mp_uint_t n_args, const mp_obj_t *args)
 	float y0 = mp_obj_get_float(args[n_args-5]);
 	float w = mp_obj_get_float(args[n_args-4]);
 	float h = mp_obj_get_float(args[n_args-3]);
-	float x1 = x0 + w;
-	float y1 = y0;
-	float x2 = x1;
-	float y2 = y0 + h;
-	float x3 = x0;
-	float y3 = y2;
-	matrix_2d_transform_point(stack->current, &x0, &y0);
-	matrix_2d_transform_point(stack->current, &x1, &y1);
-	matrix_2d_transform_point(stack->current, &x2, &y2);
-	matrix_2d_transform_point(stack->current, &x3, &y3);
+	float corners[8] = {
+		x0,     y0,
+		x0 + w, y0,
+		x0 + w, y0 + h,
+		x0,     y0 + h
+	};
+	matrix_stack_2d_transform_points(stack, corners, 4);
+	x0 = corners[0]; y0 = corners[1];
+	float x1 = corners[2], y1 = corners[3];
+	float x2 = corners[4], y2 = corners[5];
+	float x3 = corners[6], y3 = corners[7];
 	int fill = mp_obj_get_int(args[n_args-2]);
 	uint32_t color = mp_obj_get_int(args[n_args-1]);
 	//driver_framebuffer_rect(window, x, y, w, h, fill, color);
@@ -779,6 +767,67 @@ static mp_obj_t framebuffer_draw_circle(mp_uint_t n_args, const mp_obj_t *args)
 	return mp_const_none;
 }
 
+static mp_obj_t framebuffer_draw_line_aa(mp_uint_t n_args, const mp_obj_t *args)
+{
+	Window* window = NULL;
+	matrix_stack_2d* stack = NULL;
+	if (MP_OBJ_IS_STR(args[0])) {
+		if (n_args != 6) {
+			mp_raise_ValueError("Expected 5 or 6 arguments: (window), x0, y0, x1, y1 and color");
+			return mp_const_none;
+		}
+		window = driver_framebuffer_window_find(mp_obj_str_get_str(args[0]));
+		if (!window) {
+			mp_raise_ValueError("Window not found");
+			return mp_const_none;
+		}
+		stack = window->stack_2d;
+	}
+	else
+	{
+		stack = &stack_2d_global;
+	}
+	
+	float x0 = mp_obj_get_float(args[n_args-5]);
+	float y0 = mp_obj_get_float(args[n_args-4]);
+	float x1 = mp_obj_get_float(args[n_args-3]);
+	float y1 = mp_obj_get_float(args[n_args-2]);
+	uint32_t color = mp_obj_get_int(args[n_args-1]);
+
+	#ifdef CONFIG_G_MATRIX_ENABLE
+	//transform point according to the transformation
+	matrix_2d_transform_point(&stack->current, &x0, &y0);
+	matrix_2d_transform_point(&stack->current, &x1, &y1);
+	#endif
+
+	driver_framebuffer_line_aa(window, x0, y0, x1, y1, color);
+	return mp_const_none;
+}
+
+static mp_obj_t framebuffer_draw_circle_aa(mp_uint_t n_args, const mp_obj_t *args)
+{
+	Window* window = NULL;
+	if (MP_OBJ_IS_STR(args[0])) {
+		if (n_args != 6) {
+			mp_raise_ValueError("Expected 5 or 6 arguments: (window), x, y, radius, fill and color");
+			return mp_const_none;
+		}
+		window = driver_framebuffer_window_find(mp_obj_str_get_str(args[0]));
+		if (!window) {
+			mp_raise_ValueError("Window not found");
+			return mp_const_none;
+		}
+	}
+	
+	int x   = mp_obj_get_int(args[n_args-5]);
+	int y   = mp_obj_get_int(args[n_args-4]);
+	int r   = mp_obj_get_int(args[n_args-3]);
+	int fill  = mp_obj_get_int(args[n_args-2]);
+	uint32_t color = mp_obj_get_int(args[n_args-1]);
+	driver_framebuffer_circle_aa(window, x, y, r, fill, color);
+	return mp_const_none;
+}
+
 static mp_obj_t framebuffer_draw_text(mp_uint_t n_args, const mp_obj_t *args) {
 	uint8_t argOffset = 0;
 	Window* window = NULL;
@@ -814,15 +863,20 @@ static mp_obj_t framebuffer_draw_text(mp_uint_t n_args, const mp_obj_t *args) {
 	if (n_args>argOffset) xScale = mp_obj_get_int(args[argOffset++]);
 	if (n_args>argOffset) yScale = mp_obj_get_int(args[argOffset++]);
 	
+	int alpha = 255; //Text is mixed over what is below it when alpha is below 255
+	if (n_args>argOffset) alpha = mp_obj_get_int(args[argOffset++]);
+	if (alpha < 0) alpha = 0;
+	if (alpha > 255) alpha = 255;
+	
 	if (MP_OBJ_IS_STR(args[textArg])) {
 		const char *text = mp_obj_str_get_str(args[textArg]);
-		driver_framebuffer_print(window, text, x, y, xScale, yScale, color, font);
+		driver_framebuffer_print_blend(window, text, x, y, xScale, yScale, color, alpha, font);
 	} else {
 		int chr = mp_obj_get_int(args[textArg]);
 		char *text = malloc(2);
 		text[0] = chr;
 		text[1] = 0;
-		driver_framebuffer_print(window, text, x, y, xScale, yScale, color, font);
+		driver_framebuffer_print_blend(window, text, x, y, xScale, yScale, color, alpha, font);
 		free(text);
 	}
 	return mp_const_none;
@@ -967,23 +1021,348 @@ static mp_obj_t framebuffer_draw_png(mp_uint_t n_args, const mp_obj_t *args)
 			mp_raise_ValueError("File not found");
 			return mp_const_none;
 		}
+		renderRes = driver_framebuffer_png_file(window, x, y, fullname);
+		if (renderRes == ESP_ERR_NOT_FOUND) {
+			nlr_raise(mp_obj_new_exception_msg_varg(&mp_type_ValueError, "Could not open file '%s'!",filename));
+			return mp_const_none;
+		}
+	}
+	
+	if (renderRes != ESP_OK) {
+		mp_raise_ValueError("Rendering error");
+	}
+	
+	return mp_const_none;
+}
+
+static mp_obj_t framebuffer_qoi_info(mp_uint_t n_args, const mp_obj_t *args)
+{
+	lib_reader_read_t reader;
+	void * reader_p;
+	bool is_bytes = MP_OBJ_IS_TYPE(args[0], &mp_type_bytes);
+	if (is_bytes) {
+		size_t len;
+		const uint8_t* qoi_data = (const uint8_t *) mp_obj_str_get_data(args[0], &len);
+		struct lib_mem_reader *mr = lib_mem_new(qoi_data, len);
+		if (mr == NULL) {
+			nlr_raise(mp_obj_new_exception_msg_varg(&mp_type_ValueError, "out of memory!"));
+			return mp_const_none;
+		}
+		reader = (lib_reader_read_t) &lib_mem_read;
+		reader_p = mr;
+	} else {
+		const char* filename = mp_obj_str_get_str(args[0]);
+		char fullname[128] = {'\0'};
+		int res = physicalPathN(filename, fullname, sizeof(fullname));
+		if ((res != 0) || (strlen(fullname) == 0)) {
+			mp_raise_ValueError("Error resolving file name");
+			return mp_const_none;
+		}
+
 		struct lib_file_reader *fr = lib_file_new(fullname, 1024);
 		if (fr == NULL) {
 			nlr_raise(mp_obj_new_exception_msg_varg(&mp_type_ValueError, "Could not open file '%s'!",filename));
 			return mp_const_none;
 		}
+
 		reader = (lib_reader_read_t) &lib_file_read;
-		renderRes = driver_framebuffer_png(window, x, y, reader, fr);
+		reader_p = fr;
+	}
+
+	struct lib_qoi_reader *qr = lib_qoi_new(reader, reader_p);
+	if (qr == NULL) {
+		if (is_bytes) {
+			lib_mem_destroy(reader_p);
+		} else {
+			lib_file_destroy(reader_p);
+		}
+
+		nlr_raise(mp_obj_new_exception_msg_varg(&mp_type_ValueError, "out of memory."));
+		return mp_const_none;
+	}
+
+	int res = lib_qoi_read_header(qr);
+	mp_obj_t tuple[4];
+	if (res >= 0) {
+		tuple[0] = mp_obj_new_int(qr->header.width);
+		tuple[1] = mp_obj_new_int(qr->header.height);
+		tuple[2] = mp_obj_new_int(qr->header.channels);
+		tuple[3] = mp_obj_new_int(qr->header.colorspace);
+	}
+
+	lib_qoi_destroy(qr);
+	if (is_bytes) {
+		lib_mem_destroy(reader_p);
+	} else {
+		lib_file_destroy(reader_p);
+	}
+
+	if (res < 0) {
+		nlr_raise(mp_obj_new_exception_msg_varg(&mp_type_ValueError, "failed to load image: res = %d", res));
+	}
+	return mp_obj_new_tuple(4, tuple);
+}
+
+static mp_obj_t framebuffer_draw_qoi(mp_uint_t n_args, const mp_obj_t *args)
+{
+	Window* window = NULL;
+	int paramOffset = 0;
+
+	if (MP_OBJ_IS_STR(args[0])) {
+		if (n_args < 4) {
+			mp_raise_ValueError("Expected: window, x, y, file");
+			return mp_const_none;
+		}
+		window = driver_framebuffer_window_find(mp_obj_str_get_str(args[0]));
+		if (!window) {
+			mp_raise_ValueError("Window not found");
+			return mp_const_none;
+		}
+		paramOffset++;
+	}
+
+	int16_t x = mp_obj_get_int(args[paramOffset++]);
+	int16_t y = mp_obj_get_int(args[paramOffset++]);
+
+	esp_err_t renderRes = ESP_FAIL;
+
+	if (MP_OBJ_IS_TYPE(args[paramOffset], &mp_type_bytes)) {
+		mp_uint_t len;
+		uint8_t *data = (uint8_t *)mp_obj_str_get_data(args[paramOffset], &len);
+		struct lib_mem_reader *mr = lib_mem_new(data, len);
+		if (mr == NULL) {
+			mp_raise_ValueError("Out of memory");
+			return mp_const_none;
+		}
+		renderRes = driver_framebuffer_qoi(window, x, y, (lib_reader_read_t) &lib_mem_read, mr);
+		lib_mem_destroy(mr);
+	} else {
+		const char* filename = mp_obj_str_get_str(args[paramOffset]);
+		char fullname[128] = {'\0'};
+		int res = physicalPathN(filename, fullname, sizeof(fullname));
+		if ((res != 0) || (strlen(fullname) == 0)) {
+			mp_raise_ValueError("File not found");
+			return mp_const_none;
+		}
+		struct lib_file_reader *fr = lib_file_new(fullname, 1024);
+		if (fr == NULL) {
+			nlr_raise(mp_obj_new_exception_msg_varg(&mp_type_ValueError, "Could not open file '%s'!",filename));
+			return mp_const_none;
+		}
+		renderRes = driver_framebuffer_qoi(window, x, y, (lib_reader_read_t) &lib_file_read, fr);
 		lib_file_destroy(fr);
 	}
-	
+
 	if (renderRes != ESP_OK) {
 		mp_raise_ValueError("Rendering error");
 	}
+
+	return mp_const_none;
+}
+
+static mp_obj_t framebuffer_draw_sprite(mp_uint_t n_args, const mp_obj_t *args)
+{
+	Window* window = NULL;
+	int paramOffset = 0;
+	
+	if (MP_OBJ_IS_STR(args[0])) {
+		if (n_args < 4) {
+			mp_raise_ValueError("Expected: window, x, y, sprite");
+			return mp_const_none;
+		}
+		window = driver_framebuffer_window_find(mp_obj_str_get_str(args[0]));
+		if (!window) {
+			mp_raise_ValueError("Window not found");
+			return mp_const_none;
+		}
+		paramOffset++;
+	}
+	
+	int16_t x = mp_obj_get_int(args[paramOffset++]);
+	int16_t y = mp_obj_get_int(args[paramOffset++]);
+	
+	size_t length;
+	uint8_t* data = mp_obj_to_u8_ptr(args[paramOffset++], &length);
+	if (data == NULL) {
+		mp_raise_ValueError("Expected a bytes or bytearray object");
+		return mp_const_none;
+	}
+	
+	uint16_t frame = 0;
+	if (n_args > paramOffset) frame = mp_obj_get_int(args[paramOffset]);
+	
+	sprite_t sprite;
+	if (driver_framebuffer_sprite_open(&sprite, data, length) != ESP_OK) {
+		mp_raise_ValueError("Invalid sprite");
+		return mp_const_none;
+	}
+	if (frame >= sprite.frames) {
+		mp_raise_ValueError("Frame out of range");
+		return mp_const_none;
+	}
+	if (driver_framebuffer_sprite_draw(window, x, y, &sprite, frame) != ESP_OK) {
+		mp_raise_ValueError("Rendering error");
+	}
+	return mp_const_none;
+}
+
+static mp_obj_t framebuffer_sprite_info(mp_uint_t n_args, const mp_obj_t *args)
+{
+	size_t length;
+	uint8_t* data = mp_obj_to_u8_ptr(args[0], &length);
+	if (data == NULL) {
+		mp_raise_ValueError("Expected a bytes or bytearray object");
+		return mp_const_none;
+	}
+	sprite_t sprite;
+	if (driver_framebuffer_sprite_open(&sprite, data, length) != ESP_OK) {
+		mp_raise_ValueError("Invalid sprite");
+		return mp_const_none;
+	}
+	mp_obj_t tuple[4];
+	tuple[0] = mp_obj_new_int(sprite.width);
+	tuple[1] = mp_obj_new_int(sprite.height);
+	tuple[2] = mp_obj_new_int(sprite.frames);
+	tuple[3] = mp_obj_new_int(sprite.pixelOps->format);
+	return mp_obj_new_tuple(4, tuple);
+}
+
+static mp_obj_t framebuffer_play_animation(mp_uint_t n_args, const mp_obj_t *args)
+{
+	Window* window = NULL;
+	int paramOffset = 0;
+	
+	if (MP_OBJ_IS_STR(args[0])) {
+		if (n_args < 4) {
+			mp_raise_ValueError("Expected: window, x, y, file");
+			return mp_const_none;
+		}
+		window = driver_framebuffer_window_find(mp_obj_str_get_str(args[0]));
+		if (!window) {
+			mp_raise_ValueError("Window not found");
+			return mp_const_none;
+		}
+		paramOffset++;
+	}
+	
+	int16_t x = mp_obj_get_int(args[paramOffset++]);
+	int16_t y = mp_obj_get_int(args[paramOffset++]);
+	
+	const char* filename = mp_obj_str_get_str(args[paramOffset++]);
+	char fullname[128] = {'\0'};
+	int res = physicalPathN(filename, fullname, sizeof(fullname));
+	if ((res != 0) || (strlen(fullname) == 0)) {
+		mp_raise_ValueError("File not found");
+		return mp_const_none;
+	}
 	
+	uint16_t fps = 0;
+	uint8_t flags = ANIMATION_FLAG_FLUSH;
+	if (n_args > paramOffset) fps = mp_obj_get_int(args[paramOffset++]);
+	if ((n_args > paramOffset) && mp_obj_is_true(args[paramOffset++])) flags |= ANIMATION_FLAG_LOOP;
+	if ((n_args > paramOffset) && !mp_obj_is_true(args[paramOffset++])) flags &= ~ANIMATION_FLAG_FLUSH;
+	
+	esp_err_t playRes = driver_framebuffer_animation_play_file(window, x, y, fullname, fps, flags);
+	if (playRes == ESP_ERR_NOT_FOUND) {
+		nlr_raise(mp_obj_new_exception_msg_varg(&mp_type_ValueError, "Could not open file '%s'!",filename));
+		return mp_const_none;
+	}
+	if (playRes != ESP_OK) {
+		mp_raise_ValueError("Invalid animation");
+	}
+	return mp_const_none;
+}
+
+static mp_obj_t framebuffer_stop_animation(mp_uint_t n_args, const mp_obj_t *args)
+{
+	driver_framebuffer_animation_stop();
+	return mp_const_none;
+}
+
+static mp_obj_t framebuffer_animation_info(mp_uint_t n_args, const mp_obj_t *args)
+{
+	if (n_args == 0) {
+		animation_status_t status;
+		driver_framebuffer_animation_status(&status);
+		mp_obj_t tuple[4];
+		tuple[0] = mp_obj_new_bool(status.playing);
+		tuple[1] = mp_obj_new_int(status.frame);
+		tuple[2] = mp_obj_new_int(status.shown);
+		tuple[3] = mp_obj_new_int(status.dropped);
+		return mp_obj_new_tuple(4, tuple);
+	}
+	
+	const char* filename = mp_obj_str_get_str(args[0]);
+	char fullname[128] = {'\0'};
+	int res = physicalPathN(filename, fullname, sizeof(fullname));
+	if ((res != 0) || (strlen(fullname) == 0)) {
+		mp_raise_ValueError("Error resolving file name");
+		return mp_const_none;
+	}
+	struct lib_file_reader *fr = lib_file_new(fullname, 16);
+	if (fr == NULL) {
+		nlr_raise(mp_obj_new_exception_msg_varg(&mp_type_ValueError, "Could not open file '%s'!",filename));
+		return mp_const_none;
+	}
+	animation_info_t info;
+	esp_err_t infoRes = driver_framebuffer_animation_info((lib_reader_read_t) &lib_file_read, fr, &info);
+	lib_file_destroy(fr);
+	if (infoRes != ESP_OK) {
+		mp_raise_ValueError("Invalid animation");
+		return mp_const_none;
+	}
+	mp_obj_t tuple[3];
+	tuple[0] = mp_obj_new_int(info.width);
+	tuple[1] = mp_obj_new_int(info.height);
+	tuple[2] = mp_obj_new_int(info.frames);
+	return mp_obj_new_tuple(3, tuple);
+}
+
+static mp_obj_t framebuffer_image_cache_pin(mp_uint_t n_args, const mp_obj_t *args)
+{
+	const char* filename = mp_obj_str_get_str(args[0]);
+	char fullname[128] = {'\0'};
+	int res = physicalPathN(filename, fullname, sizeof(fullname));
+	if ((res != 0) || (strlen(fullname) == 0)) {
+		mp_raise_ValueError("File not found");
+		return mp_const_none;
+	}
+	bool pin = true;
+	if (n_args > 1) pin = mp_obj_is_true(args[1]);
+	return mp_obj_new_bool(driver_framebuffer_image_cache_pin(fullname, pin));
+}
+
+static mp_obj_t framebuffer_image_cache_evict(mp_uint_t n_args, const mp_obj_t *args)
+{
+	if (n_args < 1) {
+		driver_framebuffer_image_cache_evict(NULL);
+		return mp_const_none;
+	}
+	const char* filename = mp_obj_str_get_str(args[0]);
+	char fullname[128] = {'\0'};
+	int res = physicalPathN(filename, fullname, sizeof(fullname));
+	if ((res != 0) || (strlen(fullname) == 0)) {
+		mp_raise_ValueError("File not found");
+		return mp_const_none;
+	}
+	driver_framebuffer_image_cache_evict(fullname);
 	return mp_const_none;
 }
 
+static mp_obj_t framebuffer_image_cache_info(mp_uint_t n_args, const mp_obj_t *args)
+{
+	image_cache_stats_t stats;
+	driver_framebuffer_image_cache_stats(&stats);
+	mp_obj_t tuple[6];
+	tuple[0] = mp_obj_new_int(stats.hits);
+	tuple[1] = mp_obj_new_int(stats.misses);
+	tuple[2] = mp_obj_new_int(stats.entries);
+	tuple[3] = mp_obj_new_int(stats.pinned);
+	tuple[4] = mp_obj_new_int(stats.used);
+	tuple[5] = mp_obj_new_int(stats.size);
+	return mp_obj_new_tuple(6, tuple);
+}
+
 static mp_obj_t framebuffer_backlight(mp_uint_t n_args, const mp_obj_t *args)
 {
 	if (n_args > 0) {
@@ -1224,7 +1603,8 @@ static mp_obj_t framebuffer_clearMatrix(mp_uint_t n_args, const mp_obj_t *args)
 	}
 	else
 	{
-		stack_2d->current = matrix_2d_identity();
+		matrix_2d identity = matrix_2d_identity();
+		matrix_stack_2d_set(stack_2d, &identity);
 	}
 	return mp_const_none;
 }
@@ -1378,7 +1758,7 @@ static mp_obj_t framebuffer_setMatrix(mp_uint_t n_args, const mp_obj_t *args)
 		matrix.arr[i] = mp_obj_get_float(list[i]);
 	}
 
-	stack->current = matrix;
+	matrix_stack_2d_set(stack, &matrix);
 
 	return mp_const_none;
 }
@@ -1445,7 +1825,7 @@ static mp_obj_t framebuffer_transformPoint(mp_uint_t n_args, const mp_obj_t *arg
 		float y = mp_obj_get_float(args[paramOffset + 1]);
 		float z = mp_obj_get_float(args[paramOffset + 2]);
 		
-		matrix_3d_transform_point(stack_3d->current, &x, &y, &z);
+		matrix_3d_transform_point(&stack_3d->current, &x, &y, &z);
 		
 		mp_obj_t out[2] = {
 			mp_obj_new_float(x),
@@ -1460,7 +1840,7 @@ static mp_obj_t framebuffer_transformPoint(mp_uint_t n_args, const mp_obj_t *arg
 		float x = mp_obj_get_float(args[paramOffset]);
 		float y = mp_obj_get_float(args[paramOffset + 1]);
 		
-		matrix_2d_transform_point(stack_2d->current, &x, &y);
+		matrix_2d_transform_point(&stack_2d->current, &x, &y);
 		
 		mp_obj_t out[2] = {
 			mp_obj_new_float(x),
@@ -1543,7 +1923,7 @@ static mp_obj_t framebuffer_translate(mp_uint_t n_args, const mp_obj_t *args)
 	else
 	#endif
 	{
-		stack_2d->current = matrix_2d_multiply(stack_2d->current, matrix_2d_translate(mp_obj_get_float(args[paramOffset]), mp_obj_get_float(args[paramOffset + 1])));
+		matrix_stack_2d_translate(stack_2d, mp_obj_get_float(args[paramOffset]), mp_obj_get_float(args[paramOffset + 1]));
 	}
 	return mp_const_none;
 }
@@ -1621,7 +2001,8 @@ static mp_obj_t framebuffer_rotate(mp_uint_t n_args, const mp_obj_t *args)
 	else
 	#endif
 	{
-		stack_2d->current = matrix_2d_multiply(stack_2d->current, matrix_2d_rotate(mp_obj_get_float(args[paramOffset])));
+		matrix_2d rotation = matrix_2d_rotate(mp_obj_get_float(args[paramOffset]));
+		matrix_stack_2d_multiply(stack_2d, &rotation);
 	}
 
 	return mp_const_none;
@@ -1691,7 +2072,8 @@ static mp_obj_t framebuffer_scale(mp_uint_t n_args, const mp_obj_t *args)
 	else
 	#endif
 	{
-		stack_2d->current = matrix_2d_multiply(stack_2d->current, matrix_2d_scale(mp_obj_get_float(args[paramOffset]), mp_obj_get_float(args[paramOffset + 1])));
+		matrix_2d scale = matrix_2d_scale(mp_obj_get_float(args[paramOffset]), mp_obj_get_float(args[paramOffset + 1]));
+		matrix_stack_2d_multiply(stack_2d, &scale);
 	}
 	return mp_const_none;
 }
@@ -1756,7 +2138,8 @@ static mp_obj_t framebuffer_set3D(mp_uint_t n_args, const mp_obj_t *args)
 		}
 		bool new_3d = mp_obj_is_true(args[0]);
 		if (is_3d_global && !new_3d) { // Go from 3D to 2D.
-			// Mark as 2D. TODO: prevent race conditions that may arise.
+			// Mark as 2D, after the queued triangles are done with the depth buffer.
+			driver_framebuffer_tri3d_wait();
 			is_3d_global = 0;
 			// Free depth buffer.
 			free(depth_buffer_global.buffer);
@@ -1822,6 +2205,87 @@ static mp_obj_t framebuffer_clearDepth(mp_uint_t n_args, const mp_obj_t *args)
 	
 	return mp_const_none;
 }
+
+static mp_obj_t framebuffer_draw_mesh(mp_uint_t n_args, const mp_obj_t *args)
+{
+	if (!is_3d_global) {
+		mp_raise_msg(&mp_type_Exception, "3D is not enabled, there is no depth buffer!");
+		return mp_const_none;
+	}
+	
+	// Arrays of the right type are used as they are, lists and tuples are converted first.
+	mp_buffer_info_t bufinfo;
+	const float *vertices = NULL;
+	float *vertexCopy = NULL;
+	size_t vertexLen = 0;
+	if (mp_get_buffer(args[0], &bufinfo, MP_BUFFER_READ) && (bufinfo.typecode == 'f')) {
+		vertices = (const float *) bufinfo.buf;
+		vertexLen = bufinfo.len / sizeof(float);
+	} else {
+		mp_obj_t *items;
+		mp_obj_get_array(args[0], &vertexLen, &items);
+		vertexCopy = m_new(float, vertexLen);
+		for (size_t i = 0; i < vertexLen; i++) vertexCopy[i] = mp_obj_get_float(items[i]);
+		vertices = vertexCopy;
+	}
+	
+	const uint16_t *indices = NULL;
+	uint16_t *indexCopy = NULL;
+	size_t indexLen = 0;
+	if (mp_get_buffer(args[1], &bufinfo, MP_BUFFER_READ) && (bufinfo.typecode == 'H')) {
+		indices = (const uint16_t *) bufinfo.buf;
+		indexLen = bufinfo.len / sizeof(uint16_t);
+	} else {
+		mp_obj_t *items;
+		mp_obj_get_array(args[1], &indexLen, &items);
+		indexCopy = m_new(uint16_t, indexLen);
+		for (size_t i = 0; i < indexLen; i++) indexCopy[i] = mp_obj_get_int(items[i]);
+		indices = indexCopy;
+	}
+	
+	if ((vertexLen % 3) || (indexLen % 3) || (vertexLen / 3 > UINT16_MAX) || (indexLen / 3 > UINT16_MAX)) {
+		mp_raise_ValueError("Expected x, y, z for every vertex and three indices for every triangle");
+		return mp_const_none;
+	}
+	uint16_t vertexCount = vertexLen / 3;
+	uint16_t triangleCount = indexLen / 3;
+	for (size_t i = 0; i < indexLen; i++) {
+		if (indices[i] >= vertexCount) {
+			mp_raise_ValueError("Vertex index out of range");
+			return mp_const_none;
+		}
+	}
+	
+	// Either a single color or a color for every triangle.
+	uint32_t color = 0;
+	uint32_t *colors = NULL;
+	if (MP_OBJ_IS_INT(args[2])) {
+		color = mp_obj_get_int(args[2]);
+	} else {
+		size_t colorLen;
+		mp_obj_t *items;
+		mp_obj_get_array(args[2], &colorLen, &items);
+		if (colorLen != triangleCount) {
+			mp_raise_ValueError("Expected a color for every triangle");
+			return mp_const_none;
+		}
+		colors = m_new(uint32_t, colorLen);
+		for (size_t i = 0; i < colorLen; i++) colors[i] = mp_obj_get_int(items[i]);
+	}
+	
+	bool cull = (n_args > 3) ? mp_obj_is_true(args[3]) : true;
+	int res = driver_framebuffer_mesh3d(vertices, vertexCount, indices, triangleCount, colors, color, cull);
+	
+	if (vertexCopy) m_del(float, vertexCopy, vertexLen);
+	if (indexCopy) m_del(uint16_t, indexCopy, indexLen);
+	if (colors) m_del(uint32_t, colors, triangleCount);
+	
+	if (res) {
+		mp_raise_msg(&mp_type_Exception, "Error rendering mesh: Had to wait too long for space in triangle buffer.");
+		return mp_const_none;
+	}
+	return mp_const_none;
+}
 #endif //CONFIG_LIB3D_ENABLE
 
 static MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN( framebuffer_pushMatrix_obj,           0, 1, framebuffer_pushMatrix);
@@ -1862,6 +2326,9 @@ static MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN( framebuffer_get3D_obj,
 /* Arguments: window (optional) */
 
 static MP_DEFINE_CONST_FUN_OBJ_0          ( framebuffer_clearDepth_obj,                 framebuffer_clearDepth);
+
+static MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN( framebuffer_draw_mesh_obj,            3, 4, framebuffer_draw_mesh);
+/* Arguments: vertices (x, y, z, ... as list or array('f')), indices (three per triangle, as list or array('H')), color (or a list with a color per triangle), cull back faces (optional, default True) */
 #endif //CONFIG_LIB3D_ENABLE
 
 #endif //CONFIG_G_MATRIX_ENABLE
@@ -1869,6 +2336,9 @@ static MP_DEFINE_CONST_FUN_OBJ_0          ( framebuffer_clearDepth_obj,
 static MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN( framebuffer_flush_obj,                0, 1, framebuffer_flush      );
 /* Flush the framebuffer to the display. Arguments: flags (optional) */
 
+static MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN( framebuffer_flush_wait_obj,           0, 0, framebuffer_flush_wait );
+/* Wait until the display has received the last flushed frame. Arguments: none */
+
 static MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN( framebuffer_size_obj,                 0, 1, framebuffer_size   );
 /* Get the size (width, height) of the framebuffer or a window. Arguments: window (optional) */
 
@@ -1884,8 +2354,8 @@ static MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN( framebuffer_orientation_obj,
 static MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN( framebuffer_draw_raw_obj,             5, 6, framebuffer_draw_raw);
 /* Copy a raw bytes buffer directly to the framebuffer or a window. Arguments: window (optional), x, y, width, height, data */
 
-static MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN( framebuffer_window_create_obj,        3, 3, framebuffer_window_create);
-/* Create a new window. Arguments: window name, width, height */
+static MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN( framebuffer_window_create_obj,        3, 4, framebuffer_window_create);
+/* Create a new window. Arguments: window name, width, height, pixel format (optional) */
 
 static MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN( framebuffer_window_remove_obj,        1, 1, framebuffer_window_remove);
 /* Delete a window. Arguments: window name */
@@ -1942,7 +2412,13 @@ static MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN( framebuffer_draw_triangle_obj,
 static MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN( framebuffer_draw_circle_obj,          7, 8, framebuffer_draw_circle);
 /* Draw a circle in the framebuffer or a window. Arguments: window (optional), x, y, radius, starting-angle, ending-angle, fill, color */
 
-static MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN( framebuffer_draw_text_obj,            3, 8, framebuffer_draw_text);
+static MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN( framebuffer_draw_line_aa_obj,         5, 6, framebuffer_draw_line_aa);
+/* Draw an anti-aliased line from point (x0,y0) to point (x1,y1) in the framebuffer or a window. Arguments: window (optional), x0, y0, x1, y1, color */
+
+static MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN( framebuffer_draw_circle_aa_obj,       5, 6, framebuffer_draw_circle_aa);
+/* Draw an anti-aliased circle in the framebuffer or a window. Arguments: window (optional), x, y, radius, fill, color */
+
+static MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN( framebuffer_draw_text_obj,            3, 9, framebuffer_draw_text);
 /* Draw text in the framebuffer or a window. Arguments: window (optional), x, y, text, color (optional), font (optional), x-scale (optional), y-scale (optional) */
 
 static MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN( framebuffer_get_text_width_obj,       1, 2, framebuffer_get_text_width);
@@ -1957,6 +2433,36 @@ static MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(framebuffer_png_info_obj,
 static MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(framebuffer_draw_png_obj,              3, 4, framebuffer_draw_png);
 /* Draw a PNG image. Arguments: x, y, buffer with PNG data or filename of PNG image */
 
+static MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(framebuffer_qoi_info_obj,              1, 1, framebuffer_qoi_info);
+/* Get the width, height, channels and colorspace of a QOI image. Arguments: buffer with QOI data or filename of QOI image */
+
+static MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(framebuffer_draw_qoi_obj,              3, 4, framebuffer_draw_qoi);
+/* Draw a QOI image. Arguments: window (optional), x, y, buffer with QOI data or filename of QOI image */
+
+static MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(framebuffer_draw_sprite_obj,           3, 5, framebuffer_draw_sprite);
+/* Draw a frame of a sprite converted with spriteconvert.py. Arguments: window (optional), x, y, bytes or bytearray with the sprite, frame (optional) */
+
+static MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(framebuffer_sprite_info_obj,           1, 1, framebuffer_sprite_info);
+/* Get the frame width, frame height, number of frames and pixel format of a sprite. Arguments: bytes or bytearray with the sprite */
+
+static MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(framebuffer_play_animation_obj,        3, 7, framebuffer_play_animation);
+/* Play an animation converted with animconvert.py in the background. Arguments: window (optional), x, y, filename, frames per second (optional, 0 follows the file), loop (optional), flush (optional, default True) */
+
+static MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(framebuffer_stop_animation_obj,        0, 0, framebuffer_stop_animation);
+/* Stop the animation that is playing, the last frame that was drawn stays */
+
+static MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(framebuffer_animation_info_obj,        0, 1, framebuffer_animation_info);
+/* Get the width, height and number of frames of an animation file, or without filename the status of the player as (playing, frame, frames shown, frames dropped). Arguments: filename (optional) */
+
+static MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(framebuffer_image_cache_pin_obj,       1, 2, framebuffer_image_cache_pin);
+/* Keep a decoded PNG file in the image cache. Arguments: filename, pin (optional, False allows evicting it again) */
+
+static MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(framebuffer_image_cache_evict_obj,     0, 1, framebuffer_image_cache_evict);
+/* Remove a PNG file from the image cache. Arguments: filename (optional, empties the whole cache when omitted) */
+
+static MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(framebuffer_image_cache_info_obj,      0, 0, framebuffer_image_cache_info);
+/* Get the image cache counters as (hits, misses, entries, pinned entries, bytes used, bytes available) */
+
 static MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(framebuffer_backlight_obj,             0, 1, framebuffer_backlight);
 /* Set or get the backlight brightness level. Arguments: level (0-255) (optional) */
 
@@ -1989,6 +2495,14 @@ static const mp_rom_map_elem_t framebuffer_module_globals_table[] = {
 	{MP_ROM_QSTR( MP_QSTR_ORIENTATION_REVERSE_LANDSCAPE ), MP_ROM_INT( 180                                   )}, //Orientation: reverse landscape
 	{MP_ROM_QSTR( MP_QSTR_ORIENTATION_REVERSE_PORTRAIT  ), MP_ROM_INT( 270                                   )}, //Orientation: reverse portrait
 	
+	{MP_ROM_QSTR( MP_QSTR_FORMAT_NATIVE                 ), MP_ROM_INT( FB_FORMAT_NATIVE                      )}, //Pixel format: same as the display
+	{MP_ROM_QSTR( MP_QSTR_FORMAT_1BPP                   ), MP_ROM_INT( FB_FORMAT_1BPP                        )}, //Pixel format: black and white
+	{MP_ROM_QSTR( MP_QSTR_FORMAT_8BPP                   ), MP_ROM_INT( FB_FORMAT_8BPP                        )}, //Pixel format: 8-bit greyscale
+	{MP_ROM_QSTR( MP_QSTR_FORMAT_8BPP_COLOR             ), MP_ROM_INT( FB_FORMAT_8CBPP                       )}, //Pixel format: 8-bit color
+	{MP_ROM_QSTR( MP_QSTR_FORMAT_16BPP                  ), MP_ROM_INT( FB_FORMAT_16BPP                       )}, //Pixel format: 16-bit color
+	{MP_ROM_QSTR( MP_QSTR_FORMAT_24BPP                  ), MP_ROM_INT( FB_FORMAT_24BPP                       )}, //Pixel format: 24-bit color
+	{MP_ROM_QSTR( MP_QSTR_FORMAT_32BPP                  ), MP_ROM_INT( FB_FORMAT_32BPP                       )}, //Pixel format: 32-bit color with alpha
+	
 	{MP_ROM_QSTR( MP_QSTR_WHITE                         ), MP_ROM_INT( 0xFFFFFF                              )}, //Color: white
 	{MP_ROM_QSTR( MP_QSTR_BLACK                         ), MP_ROM_INT( 0x000000                              )}, //Color: black
 	
@@ -2006,6 +2520,7 @@ static const mp_rom_map_elem_t framebuffer_module_globals_table[] = {
 	
 	/* Functions: hardware */
 	{MP_ROM_QSTR( MP_QSTR_flush                         ), MP_ROM_PTR( &framebuffer_flush_obj                )}, //Flush the buffer to the display
+	{MP_ROM_QSTR( MP_QSTR_flushWait                     ), MP_ROM_PTR( &framebuffer_flush_wait_obj           )}, //Wait for an asynchronous flush to finish
 	{MP_ROM_QSTR( MP_QSTR_size                          ), MP_ROM_PTR( &framebuffer_size_obj                 )}, //Get the size (width and height) of the framebuffer or a window
 	{MP_ROM_QSTR( MP_QSTR_width                         ), MP_ROM_PTR( &framebuffer_width_obj                )}, //Get the width of the framebuffer or a window
 	{MP_ROM_QSTR( MP_QSTR_height                        ), MP_ROM_PTR( &framebuffer_height_obj               )}, //Get the height of the framebuffer or a window
@@ -2024,6 +2539,22 @@ static const mp_rom_map_elem_t framebuffer_module_globals_table[] = {
 	/* Functions: PNG images */
 	{MP_ROM_QSTR( MP_QSTR_pngInfo                       ), MP_ROM_PTR( &framebuffer_png_info_obj             )}, //Get information about a PNG image
 	{MP_ROM_QSTR( MP_QSTR_drawPng                       ), MP_ROM_PTR( &framebuffer_draw_png_obj             )}, //Display a PNG image
+	{MP_ROM_QSTR( MP_QSTR_imageCachePin                 ), MP_ROM_PTR( &framebuffer_image_cache_pin_obj      )}, //Keep a decoded PNG file in the image cache
+	{MP_ROM_QSTR( MP_QSTR_imageCacheEvict               ), MP_ROM_PTR( &framebuffer_image_cache_evict_obj    )}, //Remove PNG files from the image cache
+	{MP_ROM_QSTR( MP_QSTR_imageCacheInfo                ), MP_ROM_PTR( &framebuffer_image_cache_info_obj     )}, //Get the hit rate and usage of the image cache
+	
+	/* Functions: QOI images */
+	{MP_ROM_QSTR( MP_QSTR_qoiInfo                       ), MP_ROM_PTR( &framebuffer_qoi_info_obj             )}, //Get information about a QOI image
+	{MP_ROM_QSTR( MP_QSTR_drawQoi                       ), MP_ROM_PTR( &framebuffer_draw_qoi_obj             )}, //Display a QOI image
+	
+	/* Functions: sprites */
+	{MP_ROM_QSTR( MP_QSTR_drawSprite                    ), MP_ROM_PTR( &framebuffer_draw_sprite_obj          )}, //Draw a frame of a sprite
+	{MP_ROM_QSTR( MP_QSTR_spriteInfo                    ), MP_ROM_PTR( &framebuffer_sprite_info_obj          )}, //Get information about a sprite
+	
+	/* Functions: animations */
+	{MP_ROM_QSTR( MP_QSTR_playAnimation                 ), MP_ROM_PTR( &framebuffer_play_animation_obj       )}, //Play an animation in the background
+	{MP_ROM_QSTR( MP_QSTR_stopAnimation                 ), MP_ROM_PTR( &framebuffer_stop_animation_obj       )}, //Stop the animation that is playing
+	{MP_ROM_QSTR( MP_QSTR_animationInfo                 ), MP_ROM_PTR( &framebuffer_animation_info_obj       )}, //Get information about an animation or the player
 	
 	/* Functions: drawing */
 	{MP_ROM_QSTR( MP_QSTR_getPixel                      ), MP_ROM_PTR( &framebuffer_get_pixel_obj            )}, //Get the color of a pixel
@@ -2039,6 +2570,8 @@ static const mp_rom_map_elem_t framebuffer_module_globals_table[] = {
 	{MP_ROM_QSTR( MP_QSTR_drawTri                       ), MP_ROM_PTR( &framebuffer_draw_triangle_obj        )}, //Draw a triangle
 #endif
 	{MP_ROM_QSTR( MP_QSTR_drawCircle                    ), MP_ROM_PTR( &framebuffer_draw_circle_obj          )}, //Draw a circle
+	{MP_ROM_QSTR( MP_QSTR_drawLineAA                    ), MP_ROM_PTR( &framebuffer_draw_line_aa_obj         )}, //Draw an anti-aliased line
+	{MP_ROM_QSTR( MP_QSTR_drawCircleAA                  ), MP_ROM_PTR( &framebuffer_draw_circle_aa_obj       )}, //Draw an anti-aliased circle
 	{MP_ROM_QSTR( MP_QSTR_drawRaw                       ), MP_ROM_PTR( &framebuffer_draw_raw_obj             )}, //Write raw data to the buffer
 	
 	/* Functions: compositor windows */
@@ -2069,6 +2602,7 @@ static const mp_rom_map_elem_t framebuffer_module_globals_table[] = {
 	{MP_ROM_QSTR( MP_QSTR_set3D                         ), MP_ROM_PTR( &framebuffer_set3D_obj                )}, //Enable / disable 3D for the given context
 	{MP_ROM_QSTR( MP_QSTR_get3D                         ), MP_ROM_PTR( &framebuffer_get3D_obj                )}, //Check if 3D is enabled for the given context
 	{MP_ROM_QSTR( MP_QSTR_clearDepth                    ), MP_ROM_PTR( &framebuffer_clearDepth_obj           )}, //Clear the depth buffer to prepare for drawing
+	{MP_ROM_QSTR( MP_QSTR_drawMesh                      ), MP_ROM_PTR( &framebuffer_draw_mesh_obj            )}, //Draw a mesh of indexed triangles
 #endif
 
 };
@@ -66,6 +66,14 @@ STATIC mp_obj_t hub75_brightness16(mp_obj_t bright_obj) {
 }
 STATIC MP_DEFINE_CONST_FUN_OBJ_1(hub75_brightness16_obj, hub75_brightness16);
 
+// Dithers at and below this 16-bit brightness, -1 turns it off
+STATIC mp_obj_t hub75_dither16(mp_obj_t bright_obj) {
+    driver_hub75_set_dither(mp_obj_get_int(bright_obj));
+
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(hub75_dither16_obj, hub75_dither16);
+
 STATIC mp_obj_t hub75_framerate(mp_obj_t bright_obj) {
     int framerate = mp_obj_get_int(bright_obj);
 
@@ -261,6 +269,7 @@ STATIC const mp_rom_map_elem_t hub75_module_globals_table[] = {
     {MP_ROM_QSTR(MP_QSTR_clear), MP_ROM_PTR(&hub75_clear_obj)},
     {MP_ROM_QSTR(MP_QSTR_brightness), MP_ROM_PTR(&hub75_brightness_obj)},
     {MP_ROM_QSTR(MP_QSTR_brightness16), MP_ROM_PTR(&hub75_brightness16_obj)},
+    {MP_ROM_QSTR(MP_QSTR_dither16), MP_ROM_PTR(&hub75_dither16_obj)},
     {MP_ROM_QSTR(MP_QSTR_framerate), MP_ROM_PTR(&hub75_framerate_obj)},
     {MP_ROM_QSTR(MP_QSTR_disablecomp), MP_ROM_PTR(&hub75_disablecomp_obj)},
     {MP_ROM_QSTR(MP_QSTR_enablecomp), MP_ROM_PTR(&hub75_enablecomp_obj)},
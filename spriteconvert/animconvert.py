@@ -0,0 +1,120 @@
+#!/usr/bin/env python3
+
+# Converts PNG frames into animation files for the framebuffer driver, see
+# firmware/components/driver_framebuffer/include/driver_framebuffer_animation.h
+# for a description of the file format.
+#
+# Every frame only stores the area that changed since the frame before, as a
+# QOI image, so the player decodes and sends no more than that area. Frames are
+# opaque: transparent pixels are mixed with the background color.
+#
+# Examples:
+#   animconvert.py -d 80 -o mascot.anim mascot0.png mascot1.png mascot2.png
+#   animconvert.py -s 64x64 -d 40 -b ffffff -o splash.anim splash_sheet.png
+
+import argparse, struct
+
+from spriteconvert import read_png
+
+VERSION = 1
+
+# QOI images
+
+def qoi_encode(width, height, pixels):
+	# Encodes a list of (r, g, b) tuples, see https://qoiformat.org/qoi-specification.pdf
+	out = bytearray(b'qoif' + struct.pack('>IIBB', width, height, 3, 0))
+	index = [None] * 64 # The decoder starts with transparent black, which opaque images never match
+	previous, run = (0, 0, 0), 0
+	for i, p in enumerate(pixels):
+		if p == previous:
+			run += 1
+			if run == 62 or i == len(pixels) - 1:
+				out.append(0xC0 | (run - 1))
+				run = 0
+			continue
+		if run:
+			out.append(0xC0 | (run - 1))
+			run = 0
+		slot = (p[0] * 3 + p[1] * 5 + p[2] * 7 + 255 * 11) & 63
+		if index[slot] == p:
+			out.append(slot)
+		else:
+			index[slot] = p
+			dr, dg, db = [(p[c] - previous[c] + 128) % 256 - 128 for c in range(3)]
+			if -2 <= dr < 2 and -2 <= dg < 2 and -2 <= db < 2:
+				out.append(0x40 | ((dr + 2) << 4) | ((dg + 2) << 2) | (db + 2))
+			elif -32 <= dg < 32 and -8 <= dr - dg < 8 and -8 <= db - dg < 8:
+				out += bytes([0x80 | (dg + 32), ((dr - dg + 8) << 4) | (db - dg + 8)])
+			else:
+				out += bytes([0xFE, p[0], p[1], p[2]])
+		previous = p
+	return bytes(out) + b'\0' * 7 + b'\1'
+
+# Animation files
+
+def changed_area(before, after):
+	# Returns (x, y, width, height) of the pixels that differ, None when nothing changed
+	rows = [y for y in range(len(after)) if before[y] != after[y]]
+	if not rows:
+		return None
+	columns = [x for x in range(len(after[0])) if any(before[y][x] != after[y][x] for y in rows)]
+	return columns[0], rows[0], columns[-1] - columns[0] + 1, rows[-1] - rows[0] + 1
+
+def build(frames, width, height, delay):
+	out = b'FBAN' + struct.pack('<BBHHH', VERSION, 0, len(frames), width, height)
+	before = None
+	for frame in frames:
+		area = (0, 0, width, height) if before is None else changed_area(before, frame)
+		data = b''
+		if area:
+			x, y, w, h = area
+			data = qoi_encode(w, h, [p for row in frame[y:y + h] for p in row[x:x + w]])
+		else:
+			x, y = 0, 0
+		out += struct.pack('<HHHHI', x, y, delay, 0, len(data)) + data
+		before = frame
+	return out
+
+def main():
+	parser = argparse.ArgumentParser(description='Convert PNG frames into an animation file for the framebuffer driver')
+	parser.add_argument('images', nargs='+', help='PNG images, every image is a frame unless --size cuts a single image into frames')
+	parser.add_argument('-o', '--output', required=True, help='animation file to write')
+	parser.add_argument('-s', '--size', help='frame size as WIDTHxHEIGHT, cuts a sprite sheet into frames from left to right and top to bottom')
+	parser.add_argument('-n', '--frames', type=int, help='number of frames in the sprite sheet (default all of them)')
+	parser.add_argument('-d', '--delay', type=int, default=100, help='time between frames in milliseconds (default 100)')
+	parser.add_argument('-b', '--background', default='000000', help='color as RRGGBB that transparent pixels are mixed with (default 000000)')
+	args = parser.parse_args()
+
+	if not 0 <= args.delay <= 65535:
+		parser.error('the delay has to fit in 16 bits')
+	value = int(args.background, 16)
+	background = ((value >> 16) & 0xFF, (value >> 8) & 0xFF, value & 0xFF)
+	mix = lambda p: tuple((p[c] * p[3] + background[c] * (255 - p[3]) + 127) // 255 for c in range(3))
+
+	frames = []
+	for path in args.images:
+		imageWidth, imageHeight, pixels = read_png(path)
+		pixels = [[mix(p) for p in row] for row in pixels]
+		if args.size:
+			width, height = [int(v) for v in args.size.lower().split('x')]
+			for y in range(0, imageHeight - height + 1, height):
+				for x in range(0, imageWidth - width + 1, width):
+					frames.append([row[x:x + width] for row in pixels[y:y + height]])
+		else:
+			frames.append(pixels)
+	if args.frames:
+		frames = frames[:args.frames]
+	if not frames:
+		parser.error('no frames')
+	width, height = len(frames[0][0]), len(frames[0])
+	if any(len(f) != height or len(f[0]) != width for f in frames):
+		parser.error('all frames need to be the same size')
+	if len(frames) > 65535 or width > 65535 or height > 65535:
+		parser.error('too many frames or frames too large')
+
+	animation = build(frames, width, height, args.delay)
+	open(args.output, 'wb').write(animation)
+	print('%s: %d frame(s) of %dx%d, %d bytes' % (args.output, len(frames), width, height, len(animation)))
+
+if __name__ == '__main__':
+	main()
@@ -0,0 +1,344 @@
+#!/usr/bin/env python3
+
+# Converts PNG images into sprite files for the framebuffer driver, see
+# firmware/components/driver_framebuffer/include/driver_framebuffer_sprite.h
+# for a description of the file format.
+#
+# The pixels are stored exactly like the framebuffer stores them, so drawing
+# a sprite only copies memory. Pick the pixel format of the display (or of the
+# window the sprite is drawn to) and pass --swap when the firmware is built with
+# CONFIG_DRIVER_FRAMEBUFFER_SWAP_R_AND_B. Drawing a sprite does not dither it,
+# pass --dither to dither images for black and white and 8cbpp displays here.
+#
+# Examples:
+#   spriteconvert.py -f 16bpp -o icon.spr icon.png
+#   spriteconvert.py -f 16bpp -s 32x32 -k ff00ff -o walk.spr walk_sheet.png
+#   spriteconvert.py -f 24bpp --rle -o intro.spr frame0.png frame1.png frame2.png
+#   spriteconvert.py -f 1bpp_vert --dither -o photo.spr photo.png
+
+import argparse, struct, zlib
+
+FORMATS = {
+	'1bpp':       (1,   1),
+	'1bpp_vert':  (2,   1),
+	'1bpp_vert2': (3,   1),
+	'1bpp_ohs':   (4,   1),
+	'8bpp':       (5,   8),
+	'8cbpp':      (6,   8),
+	'12bpp':      (7,  12),
+	'16bpp':      (8,  16),
+	'24bpp':      (9,  24),
+	'32bpp':      (10, 32),
+}
+
+HEADER_SIZE = 24
+VERSION     = 1
+FLAG_RLE    = 1
+FLAG_KEYED  = 2
+
+# PNG files
+
+def read_png(path):
+	# Returns (width, height, pixels) with pixels a list of rows of (r, g, b, a) tuples
+	data = open(path, 'rb').read()
+	if data[:8] != b'\x89PNG\r\n\x1a\n':
+		raise ValueError('%s is not a PNG file' % path)
+	pos, idat, palette, trns = 8, b'', [], b''
+	while pos < len(data):
+		length, kind = struct.unpack('>I4s', data[pos:pos + 8])
+		chunk = data[pos + 8:pos + 8 + length]
+		pos += 12 + length
+		if kind == b'IHDR':
+			width, height, depth, color, _, _, interlace = struct.unpack('>IIBBBBB', chunk)
+		elif kind == b'PLTE':
+			palette = [tuple(chunk[i:i + 3]) for i in range(0, len(chunk), 3)]
+		elif kind == b'tRNS':
+			trns = chunk
+		elif kind == b'IDAT':
+			idat += chunk
+		elif kind == b'IEND':
+			break
+	if interlace:
+		raise ValueError('%s: interlaced PNG files are not supported' % path)
+
+	channels = {0: 1, 2: 3, 3: 1, 4: 2, 6: 4}[color]
+	bits = channels * depth
+	stride = (width * bits + 7) // 8
+	step = max(1, bits // 8)
+	raw = zlib.decompress(idat)
+	rows, previous = [], bytearray(stride)
+	for y in range(height):
+		kind = raw[y * (stride + 1)]
+		line = bytearray(raw[y * (stride + 1) + 1:(y + 1) * (stride + 1)])
+		for i in range(stride):
+			a = line[i - step] if i >= step else 0
+			b = previous[i]
+			c = previous[i - step] if i >= step else 0
+			if kind == 1:
+				line[i] = (line[i] + a) & 0xFF
+			elif kind == 2:
+				line[i] = (line[i] + b) & 0xFF
+			elif kind == 3:
+				line[i] = (line[i] + ((a + b) >> 1)) & 0xFF
+			elif kind == 4:
+				p = a + b - c
+				pa, pb, pc = abs(p - a), abs(p - b), abs(p - c)
+				line[i] = (line[i] + (a if (pa <= pb and pa <= pc) else (b if pb <= pc else c))) & 0xFF
+		previous = line
+
+		samples = []
+		if depth < 8:
+			for x in range(width * channels):
+				samples.append((line[x * depth // 8] >> (8 - depth - (x * depth) % 8)) & ((1 << depth) - 1))
+		elif depth == 8:
+			samples = list(line)
+		else:
+			samples = [(line[i] << 8) | line[i + 1] for i in range(0, len(line), 2)]
+
+		row = []
+		for x in range(width):
+			s = samples[x * channels:(x + 1) * channels]
+			if color == 3:
+				r, g, b = palette[s[0]] if s[0] < len(palette) else (0, 0, 0)
+				row.append((r, g, b, trns[s[0]] if s[0] < len(trns) else 255))
+				continue
+			scale = lambda v: (v >> 8) if depth == 16 else (v * 255) // ((1 << depth) - 1)
+			if color in (0, 4):
+				v = scale(s[0])
+				alpha = scale(s[1]) if color == 4 else 255
+				if color == 0 and len(trns) == 2 and s[0] == struct.unpack('>H', trns)[0]:
+					alpha = 0
+				row.append((v, v, v, alpha))
+			else:
+				r, g, b = scale(s[0]), scale(s[1]), scale(s[2])
+				alpha = scale(s[3]) if color == 6 else 255
+				if color == 2 and len(trns) == 6 and tuple(s) == struct.unpack('>HHH', trns):
+					alpha = 0
+				row.append((r, g, b, alpha))
+		rows.append(row)
+	return width, height, rows
+
+# Pixel formats, these follow driver_framebuffer_format.cpp
+
+def encode(fmt, pixel, swap):
+	r, g, b, a = pixel
+	if fmt in ('1bpp', '1bpp_vert', '1bpp_vert2', '1bpp_ohs'):
+		return 1 if (r + g + b + 1) // 3 >= 128 else 0
+	if fmt == '8bpp':
+		return (r + g + b + 1) // 3
+	if fmt == '8cbpp':
+		if swap:
+			r, b = b, r
+		return (r >> 5) | ((g >> 5) << 3) | ((b >> 6) << 6)
+	if fmt == '12bpp':
+		return ((r >> 4) << 8) | ((g >> 4) << 4) | (b >> 4)
+	if fmt == '16bpp':
+		if swap:
+			r, b = b, r
+		return ((b & 0xF8) << 8) | ((g & 0xFC) << 3) | (r >> 3)
+	if fmt == '24bpp':
+		return (r << 16) | (g << 8) | b
+	return (a << 24) | (r << 16) | (g << 8) | b
+
+def buffer_size(fmt, width, height):
+	return {
+		'1bpp':       ((width + 7) // 8) * height,
+		'1bpp_vert':  width * ((height + 7) // 8),
+		'1bpp_vert2': width * ((height + 7) // 8),
+		'1bpp_ohs':   (width * height + 7) // 8,
+		'8bpp':       width * height,
+		'8cbpp':      width * height,
+		'12bpp':      ((width * height * 12) // 8) + 1,
+		'16bpp':      width * height * 2,
+		'24bpp':      width * height * 3,
+		'32bpp':      width * height * 4,
+	}[fmt]
+
+def store(fmt, buf, width, height, x, y, value):
+	def bit(position, mask):
+		if value:
+			buf[position] |= mask
+		else:
+			buf[position] &= ~mask & 0xFF
+	if fmt == '1bpp':
+		bit(y * ((width + 7) // 8) + x // 8, 1 << (x % 8))
+	elif fmt == '1bpp_vert':
+		bit((y // 8) * width + x, 1 << (y % 8))
+	elif fmt == '1bpp_vert2':
+		bit(y // 8 + x * ((height + 7) // 8), 1 << (y % 8))
+	elif fmt == '1bpp_ohs':
+		bit(((width - x - 1) + y * width) // 8, 1 << (x % 8))
+	elif fmt in ('8bpp', '8cbpp'):
+		buf[y * width + x] = value
+	elif fmt == '12bpp':
+		bits = (x + y * width) * 12
+		p = bits // 8
+		r, g, b = (value >> 8) & 0x0F, (value >> 4) & 0x0F, value & 0x0F
+		if bits % 8 == 0:
+			buf[p], buf[p + 1] = (r << 4) | g, (b << 4) | (buf[p + 1] & 0x0F)
+		else:
+			buf[p], buf[p + 1] = (buf[p] & 0xF0) | r, (g << 4) | b
+	elif fmt == '16bpp':
+		p = (y * width + x) * 2
+		buf[p:p + 2] = bytes(((value >> 8) & 0xFF, value & 0xFF))
+	elif fmt == '24bpp':
+		p = (y * width + x) * 3
+		buf[p:p + 3] = bytes(((value >> 16) & 0xFF, (value >> 8) & 0xFF, value & 0xFF))
+	else:
+		p = (y * width + x) * 4
+		buf[p:p + 4] = bytes(((value >> 24) & 0xFF, value & 0xFF, (value >> 8) & 0xFF, (value >> 16) & 0xFF))
+
+def stored_pixel(fmt, value):
+	# A single pixel stored in a 1x1 buffer, used for the transparent pixel and for run-length encoding
+	buf = bytearray(buffer_size(fmt, 1, 1))
+	store(fmt, buf, 1, 1, 0, 0, value)
+	return bytes(buf)
+
+def dither_frame(fmt, frame, key, swap):
+	# Floyd-Steinberg in alternating directions, like driver_framebuffer_dither.cpp does for decoded images.
+	# Returns the frame with every pixel moved to a color the format stores exactly
+	if fmt in ('1bpp', '1bpp_vert', '1bpp_vert2', '1bpp_ohs'):
+		levels = (1,)
+	elif fmt == '8cbpp':
+		levels = (3, 7, 7) if swap else (7, 7, 3)
+	else:
+		return frame
+	channels = len(levels)
+	split = (lambda p: ((p[0] + p[1] + p[2] + 1) // 3,)) if channels == 1 else (lambda p: p[:3])
+	error = [[0] * channels for x in range(len(frame[0]))]
+	result = []
+	for y, row in enumerate(frame):
+		out = list(row)
+		order = range(len(row)) if y % 2 == 0 else range(len(row) - 1, -1, -1)
+		carry, below, last, previous = [0] * channels, [0] * channels, [0] * channels, None
+		for x in order:
+			keyed = key is not None and row[x][:3] == key
+			value = list(split(row[x]))
+			for c in range(channels):
+				e = 0
+				if not keyed:
+					wanted = min(255, max(0, ((value[c] << 4) + error[x][c] + carry[c] + 8) >> 4))
+					value[c] = (wanted * levels[c] + 127) // 255 * 255 // levels[c]
+					e = wanted - value[c]
+				carry[c] = 7 * e
+				if previous is not None:
+					error[previous][c] = below[c] + 3 * e
+				below[c] = last[c] + 5 * e
+				last[c] = e
+			if not keyed:
+				out[x] = (tuple(value) * 3 if channels == 1 else tuple(value)) + (row[x][3],)
+			previous = x
+		for c in range(channels):
+			error[previous][c] = below[c]
+		result.append(out)
+	return result
+
+# Sprite files
+
+def rle_frame(fmt, frame, swap):
+	out = bytearray()
+	for row in frame:
+		pixels = [stored_pixel(fmt, encode(fmt, p, swap)) for p in row]
+		literal, i = [], 0
+		def flush():
+			if literal:
+				out.append(len(literal) - 1)
+				out.extend(b''.join(literal))
+				del literal[:]
+		while i < len(pixels):
+			run = 1
+			while i + run < len(pixels) and run < 128 and pixels[i + run] == pixels[i]:
+				run += 1
+			if run > 1:
+				flush()
+				out.append(0x80 | (run - 1))
+				out.extend(pixels[i])
+				i += run
+			else:
+				literal.append(pixels[i])
+				if len(literal) == 128:
+					flush()
+				i += 1
+		flush()
+	return bytes(out)
+
+def build(fmt, frames, width, height, columns, key, rle, swap):
+	flags = (FLAG_RLE if rle else 0) | (FLAG_KEYED if key is not None else 0)
+	keyBytes = stored_pixel(fmt, encode(fmt, key + (255,), swap)) if key is not None else b''
+	if rle:
+		table, data = b'', b''
+		first = HEADER_SIZE + 4 * len(frames)
+		for frame in frames:
+			table += struct.pack('<I', first + len(data))
+			data += rle_frame(fmt, frame, swap)
+		body = table + data
+	else:
+		rows = (len(frames) + columns - 1) // columns
+		atlasWidth, atlasHeight = columns * width, rows * height
+		if atlasWidth > 32767 or atlasHeight > 32767:
+			raise ValueError('the atlas is larger than 32767 pixels, use fewer columns')
+		if fmt == '1bpp_ohs' and atlasWidth % 8:
+			raise ValueError('1bpp_ohs needs an atlas width that is a multiple of 8 pixels')
+		buf = bytearray(buffer_size(fmt, atlasWidth, atlasHeight))
+		for index, frame in enumerate(frames):
+			frameX, frameY = (index % columns) * width, (index // columns) * height
+			for y in range(height):
+				for x in range(width):
+					store(fmt, buf, atlasWidth, atlasHeight, frameX + x, frameY + y, encode(fmt, frame[y][x], swap))
+		body = bytes(buf)
+	header = b'FBSP' + struct.pack('<BBBBHHHH4sI', VERSION, FORMATS[fmt][0], flags, 0, width, height, len(frames), columns, keyBytes.ljust(4, b'\0'), HEADER_SIZE + len(body))
+	return header + body
+
+def main():
+	parser = argparse.ArgumentParser(description='Convert PNG images into a sprite file for the framebuffer driver')
+	parser.add_argument('images', nargs='+', help='PNG images, every image is a frame unless --size cuts a single image into frames')
+	parser.add_argument('-o', '--output', required=True, help='sprite file to write')
+	parser.add_argument('-f', '--format', default='16bpp', choices=sorted(FORMATS), help='pixel format of the display or window (default 16bpp)')
+	parser.add_argument('-s', '--size', help='frame size as WIDTHxHEIGHT, cuts a sprite sheet into frames from left to right and top to bottom')
+	parser.add_argument('-n', '--frames', type=int, help='number of frames in the sprite sheet (default all of them)')
+	parser.add_argument('-c', '--columns', type=int, help='frames per row of the atlas (default as many as fit)')
+	parser.add_argument('-k', '--key', help='transparent color as RRGGBB, pixels with less than 50%% alpha are made transparent too')
+	parser.add_argument('--rle', action='store_true', help='run-length encode the frames (byte aligned formats only)')
+	parser.add_argument('--swap', action='store_true', help='the firmware is built with CONFIG_DRIVER_FRAMEBUFFER_SWAP_R_AND_B')
+	parser.add_argument('--dither', action='store_true', help='dither the colors black and white and 8-bit color (8cbpp) formats can not show')
+	args = parser.parse_args()
+
+	if args.rle and FORMATS[args.format][1] % 8:
+		parser.error('run-length encoding needs a byte aligned format')
+	key = None
+	if args.key:
+		value = int(args.key, 16)
+		key = ((value >> 16) & 0xFF, (value >> 8) & 0xFF, value & 0xFF)
+
+	frames = []
+	for path in args.images:
+		imageWidth, imageHeight, pixels = read_png(path)
+		if key is not None:
+			pixels = [[key + (255,) if p[3] < 128 else p for p in row] for row in pixels]
+		if args.size:
+			width, height = [int(v) for v in args.size.lower().split('x')]
+			for y in range(0, imageHeight - height + 1, height):
+				for x in range(0, imageWidth - width + 1, width):
+					frames.append([row[x:x + width] for row in pixels[y:y + height]])
+		else:
+			frames.append(pixels)
+	if args.frames:
+		frames = frames[:args.frames]
+	if not frames:
+		parser.error('no frames')
+	width, height = len(frames[0][0]), len(frames[0])
+	if any(len(f) != height or len(f[0]) != width for f in frames):
+		parser.error('all frames need to be the same size')
+	if args.dither:
+		frames = [dither_frame(args.format, f, key, args.swap) for f in frames]
+
+	columns = args.columns or min(len(frames), max(1, 32767 // width))
+	try:
+		sprite = build(args.format, frames, width, height, columns, key, args.rle, args.swap)
+	except ValueError as e:
+		parser.error(str(e))
+	open(args.output, 'wb').write(sprite)
+	print('%s: %d frame(s) of %dx%d, %s%s, %d bytes' % (args.output, len(frames), width, height, args.format, ' rle' if args.rle else '', len(sprite)))
+
+if __name__ == '__main__':
+	main()